@@ -26,6 +26,7 @@
 
 #include "common.h"
 #include "aes.h"
+#include "perf_counters.h"
 
 /** Forward S-box for Rijndael. */
 static const uint8_t sbox[256] PROGMEM = {
@@ -305,7 +306,9 @@ void aesExpandKey(uint8_t *expanded_key, uint8_t *key)
 void aesEncrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key)
 {
 	uint8_t round;
+	PERF_DECLARE_START;
 
+	PERF_START();
 	memcpy(out, in, 16);
 
 	xor16Bytes(out, expanded_key);
@@ -323,6 +326,7 @@ void aesEncrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key)
 
 		xor16Bytes(out, &(expanded_key[round * 16]));
 	}
+	PERF_STOP(PERF_AES_ENCRYPT, 1);
 }
 
 /** Decrypt one 128 bit block.
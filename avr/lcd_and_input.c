@@ -26,6 +26,7 @@
 
 #include "../common.h"
 #include "../hwinterface.h"
+#include "../background.h"
 #include "../baseconv.h"
 #include "../prandom.h"
 
@@ -230,6 +231,9 @@ static bool transaction_fee_set;
 /** Storage for transaction fee amount. This is only valid
   * if #transaction_fee_set is true. */
 static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
+/** Storage for the number of addresses in an #ASKUSER_NEW_ADDRESSES
+  * request. */
+static char new_addresses_count[TEXT_COUNT_LENGTH];
 
 /** This does the scrolling and checks the state of the buttons. */
 ISR(TIMER0_COMPA_vect)
@@ -471,6 +475,17 @@ void clearOutputsSeen(void)
 	transaction_fee_set = false;
 }
 
+/** Notify the user interface of how many addresses
+  * an #ASKUSER_NEW_ADDRESSES request is for.
+  * \param text_count The number of addresses, as a null-terminated text
+  *                   string such as "64".
+  */
+void setNewAddressesCount(char *text_count)
+{
+	strncpy(new_addresses_count, text_count, TEXT_COUNT_LENGTH);
+	new_addresses_count[TEXT_COUNT_LENGTH - 1] = '\0';
+}
+
 /** Wait until neither accept nor cancel buttons are being pressed. */
 static void waitForNoButtonPress(void)
 {
@@ -480,7 +495,10 @@ static void waitForNoButtonPress(void)
 	} while (accept_button || cancel_button);
 }
 
-/** Wait until accept or cancel button is pressed.
+/** Wait until accept or cancel button is pressed. Background tasks (see
+  * background.c) are run while waiting. The buttons are debounced by the
+  * timer interrupt, so running a slice of background work only delays
+  * noticing a press; it doesn't affect debouncing.
   * \return false if the accept button was pressed, true if the cancel
   *         button was pressed.
   */
@@ -491,6 +509,7 @@ static bool waitForButtonPress(void)
 
 	do
 	{
+		runBackgroundTask();
 		// Copy to avoid race condition.
 		current_accept_button = accept_button;
 		current_cancel_button = cancel_button;
@@ -523,6 +542,11 @@ static char str_delete_line1[] PROGMEM = "and start a new one?";
 static char str_new_line0[] PROGMEM = "Create new";
 /** Second line of #ASKUSER_NEW_ADDRESS prompt. */
 static char str_new_line1[] PROGMEM = "address?";
+/** What will be prepended to the number of addresses
+  * for #ASKUSER_NEW_ADDRESSES prompt. */
+static char str_new_many_part0[] PROGMEM = "Create ";
+/** Second line of #ASKUSER_NEW_ADDRESSES prompt. */
+static char str_new_many_line1[] PROGMEM = "new addresses?";
 /** What will be prepended to output amounts for #ASKUSER_SIGN_TRANSACTION
   * prompt. */
 static char str_sign_part0[] PROGMEM = "Sending ";
@@ -597,6 +621,16 @@ bool userDenied(AskUserCommand command)
 		writeString(str_new_line1, true);
 		r = waitForButtonPress();
 	}
+	else if (command == ASKUSER_NEW_ADDRESSES)
+	{
+		waitForNoButtonPress();
+		gotoStartOfLine(0);
+		writeString(str_new_many_part0, true);
+		writeString(new_addresses_count, false);
+		gotoStartOfLine(1);
+		writeString(str_new_many_line1, true);
+		r = waitForButtonPress();
+	}
 	else if (command == ASKUSER_SIGN_TRANSACTION)
 	{
 		for (i = 0; i < list_index; i++)
@@ -0,0 +1,445 @@
+/** \file background.c
+  *
+  * \brief Runs long-running work in slices while waiting for the user.
+  *
+  * userDenied() spends most of its time (often several seconds) waiting for
+  * the user to read the display and press a button. Rather than spinning,
+  * the platform-specific button-wait loops call runBackgroundTask() while no
+  * button press is in progress. This runs one slice of a registered
+  * background task (for example, refilling a pool of random bytes or
+  * precomputing something which will be needed soon). Tasks are run in
+  * round-robin order, so that no task is starved.
+  *
+  * Once a button press starts to register, background work stops and the
+  * buttons are sampled at the normal rate, so the debounce time is
+  * unaffected. The worst-case extra latency for a press is the length of
+  * one slice.
+  *
+  * The debouncing logic which decides whether a press is in progress is
+  * here too, so that every platform gets the same behaviour, and so that it
+  * can be tested on the host with a simulated button source. A platform's
+  * button-wait loop looks like:
+  * \code
+  * initButtonDebouncer(&debouncer, DEBOUNCE_COUNT);
+  * do
+  * {
+  *     if (isButtonPressInProgress(&debouncer) || !runBackgroundTask())
+  *     {
+  *         wait1ms();
+  *     }
+  * } while (!sampleButtonDebouncer(&debouncer, isAcceptPressed(), isCancelPressed()));
+  * return wasCancelPressed(&debouncer);
+  * \endcode
+  *
+  * Background tasks are run from within userDenied(), which may be called
+  * in the middle of processing a packet. Therefore tasks must not modify
+  * anything which the code that called userDenied() relies on (for example,
+  * the currently loaded wallet), and must not send anything to the host.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_BACKGROUND
+#include <stdlib.h>
+#include <stdio.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_BACKGROUND
+
+#include "common.h"
+#include "background.h"
+
+/** Registered background tasks. Only the first #num_tasks entries are
+  * valid. */
+static BackgroundTask tasks[MAX_BACKGROUND_TASKS];
+/** Number of valid entries in #tasks. */
+static uint32_t num_tasks;
+/** Index into #tasks of the task which will be tried first in the next call
+  * to runBackgroundTask(). */
+static uint32_t next_task;
+
+/** Unregister all background tasks. */
+void clearBackgroundTasks(void)
+{
+	num_tasks = 0;
+	next_task = 0;
+}
+
+/** Register a background task, so that runBackgroundTask() will run it.
+  * \param task The task to register.
+  * \return false on success, true if there are already
+  *         #MAX_BACKGROUND_TASKS tasks registered.
+  */
+bool addBackgroundTask(BackgroundTask task)
+{
+	if (num_tasks >= MAX_BACKGROUND_TASKS)
+	{
+		return true; // no space
+	}
+	tasks[num_tasks] = task;
+	num_tasks++;
+	return false;
+}
+
+/** Run one slice of the next background task which has work to do. Tasks
+  * are tried in round-robin order, starting after the task which last did
+  * some work.
+  * \return true if a task did some work, false if no task had anything to
+  *         do. If this returns false, the caller should idle for a while
+  *         instead of calling this again straight away.
+  */
+bool runBackgroundTask(void)
+{
+	uint32_t i;
+	uint32_t index;
+
+	for (i = 0; i < num_tasks; i++)
+	{
+		index = (next_task + i) % num_tasks;
+		if (tasks[index]())
+		{
+			next_task = (index + 1) % num_tasks;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Reset a button debouncer, ready for a new button-wait loop.
+  * \param debouncer The debouncer to reset.
+  * \param debounce_count Number of consistent samples required to register
+  *                       a button press.
+  */
+void initButtonDebouncer(ButtonDebouncer *debouncer, uint32_t debounce_count)
+{
+	debouncer->debounce_count = debounce_count;
+	debouncer->remaining = debounce_count;
+	debouncer->cancel_pressed = false;
+}
+
+/** Feed one sample of the state of the buttons into a debouncer.
+  * \param debouncer The debouncer to update.
+  * \param accept_pressed Whether the accept button is currently pressed.
+  * \param cancel_pressed Whether the cancel button is currently pressed.
+  * \return true if a button press has now been registered, false if the
+  *         button-wait loop should keep going.
+  */
+bool sampleButtonDebouncer(ButtonDebouncer *debouncer, bool accept_pressed, bool cancel_pressed)
+{
+	debouncer->cancel_pressed = cancel_pressed;
+	if (!accept_pressed && !cancel_pressed)
+	{
+		debouncer->remaining = debouncer->debounce_count; // reset debounce counter
+	}
+	else if (debouncer->remaining > 0)
+	{
+		debouncer->remaining--;
+	}
+	if (debouncer->remaining == 0)
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+/** Check whether a button press has started to register. While this is
+  * true, the buttons should be sampled at the normal rate, so background
+  * work shouldn't be done.
+  * \param debouncer The debouncer to check.
+  * \return true if a press is in progress, false if no button has been
+  *         pressed since the last sample with both buttons released.
+  */
+bool isButtonPressInProgress(ButtonDebouncer *debouncer)
+{
+	if (debouncer->remaining != debouncer->debounce_count)
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+/** Find out which button press was registered, once
+  * sampleButtonDebouncer() has returned true.
+  * \param debouncer The debouncer to check.
+  * \return false if the accept button was pressed, true if the cancel
+  *         button was pressed. If both buttons were pressed simultaneously,
+  *         true will be returned.
+  */
+bool wasCancelPressed(ButtonDebouncer *debouncer)
+{
+	return debouncer->cancel_pressed;
+}
+
+#ifdef TEST_BACKGROUND
+
+/** Debounce count used in tests. This is the same as the PIC32 and
+  * LPC11Uxx firmware. */
+#define TEST_DEBOUNCE_COUNT		50
+/** Number of mock background tasks. */
+#define NUM_MOCKS				(MAX_BACKGROUND_TASKS)
+
+/** Simulated time, in milliseconds. */
+static uint32_t sim_time;
+/** Time at which the simulated button is pressed. */
+static uint32_t press_time;
+/** Time at which the simulated button stops bouncing. Before this, the
+  * button alternates between pressed and released every millisecond. */
+static uint32_t bounce_end_time;
+/** Whether the simulated accept button is the one being pressed. */
+static bool press_accept;
+/** Whether the simulated cancel button is the one being pressed. */
+static bool press_cancel;
+/** Number of calls to simulatedWait1ms(). */
+static uint32_t wait_count;
+/** Length of one slice of each mock task, in milliseconds. */
+static uint32_t mock_slice_length[NUM_MOCKS];
+/** Number of slices of work left for each mock task. */
+static uint32_t mock_work_left[NUM_MOCKS];
+/** Number of slices each mock task has done. */
+static uint32_t mock_slices_done[NUM_MOCKS];
+/** Simulated time at which the most recent slice of work started. */
+static uint32_t last_slice_start;
+/** Number of slices which started while the simulated button was pressed. */
+static uint32_t slices_while_pressed;
+
+/** Simulated version of each platform's wait1ms(). */
+static void simulatedWait1ms(void)
+{
+	sim_time++;
+	wait_count++;
+}
+
+/** Find out whether the simulated button is pressed at the current
+  * simulated time.
+  * \return true if it is pressed, false if it is released.
+  */
+static bool isSimulatedButtonDown(void)
+{
+	if (sim_time < press_time)
+	{
+		return false;
+	}
+	if (sim_time < bounce_end_time)
+	{
+		return ((sim_time - press_time) & 1) == 0;
+	}
+	return true;
+}
+
+/** Common implementation of the mock background tasks.
+  * \param which Index of the mock task.
+  * \return See #BackgroundTask.
+  */
+static bool mockTask(int which)
+{
+	if (mock_work_left[which] == 0)
+	{
+		return false;
+	}
+	if (isSimulatedButtonDown())
+	{
+		slices_while_pressed++;
+	}
+	last_slice_start = sim_time;
+	mock_work_left[which]--;
+	mock_slices_done[which]++;
+	sim_time += mock_slice_length[which];
+	return true;
+}
+
+static bool mockTask0(void)
+{
+	return mockTask(0);
+}
+
+static bool mockTask1(void)
+{
+	return mockTask(1);
+}
+
+static bool mockTask2(void)
+{
+	return mockTask(2);
+}
+
+static bool mockTask3(void)
+{
+	return mockTask(3);
+}
+
+/** The mock background tasks, in the same order as the mock_* arrays. */
+static const BackgroundTask mock_tasks[NUM_MOCKS] = {mockTask0, mockTask1, mockTask2, mockTask3};
+
+/** Reset the simulated clock, button and mock tasks, and unregister all
+  * background tasks. The simulated button will be pressed at time 1000, and
+  * won't bounce.
+  */
+static void resetSimulation(void)
+{
+	int i;
+
+	clearBackgroundTasks();
+	sim_time = 0;
+	press_time = 1000;
+	bounce_end_time = 1000;
+	press_accept = true;
+	press_cancel = false;
+	wait_count = 0;
+	last_slice_start = 0;
+	slices_while_pressed = 0;
+	for (i = 0; i < NUM_MOCKS; i++)
+	{
+		mock_slice_length[i] = 5;
+		mock_work_left[i] = 0xffffffff;
+		mock_slices_done[i] = 0;
+	}
+}
+
+/** The button-wait loop which each platform uses (see the example in the
+  * comments at the start of this file), except with the simulated clock and
+  * button source.
+  * \return false if accept was registered, true if cancel was registered.
+  */
+static bool simulatedWaitForButtonPress(void)
+{
+	ButtonDebouncer debouncer;
+	bool down;
+
+	initButtonDebouncer(&debouncer, TEST_DEBOUNCE_COUNT);
+	do
+	{
+		if (isButtonPressInProgress(&debouncer) || !runBackgroundTask())
+		{
+			simulatedWait1ms();
+		}
+		down = isSimulatedButtonDown();
+	} while (!sampleButtonDebouncer(&debouncer, down && press_accept, down && press_cancel));
+	return wasCancelPressed(&debouncer);
+}
+
+/** Check that a count is what it should be.
+  * \param count The actual count.
+  * \param expected What the count should be.
+  * \param test_name Name of test, for reporting.
+  */
+static void checkCount(uint32_t count, uint32_t expected, const char *test_name)
+{
+	if (count != expected)
+	{
+		printf("%s: got %u, expected %u\n", test_name, count, expected);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Check that a condition holds.
+  * \param condition The condition.
+  * \param test_name Name of test, for reporting.
+  */
+static void checkCondition(bool condition, const char *test_name)
+{
+	if (!condition)
+	{
+		printf("%s failed\n", test_name);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+int main(void)
+{
+	int i;
+	uint32_t latency;
+	uint32_t total_slices;
+
+	initTests(__FILE__);
+
+	// With no background tasks, a clean press should be registered exactly
+	// TEST_DEBOUNCE_COUNT samples after it started.
+	resetSimulation();
+	checkCondition(!simulatedWaitForButtonPress(), "Accept with no tasks");
+	checkCount(sim_time, press_time + TEST_DEBOUNCE_COUNT - 1, "Registration time with no tasks");
+	checkCount(wait_count, sim_time, "Idle waits with no tasks");
+
+	// Same for cancel, and for both buttons together.
+	resetSimulation();
+	press_accept = false;
+	press_cancel = true;
+	checkCondition(simulatedWaitForButtonPress(), "Cancel with no tasks");
+	resetSimulation();
+	press_cancel = true;
+	checkCondition(simulatedWaitForButtonPress(), "Both buttons with no tasks");
+
+	// Registration limit.
+	resetSimulation();
+	for (i = 0; i < MAX_BACKGROUND_TASKS; i++)
+	{
+		checkCondition(!addBackgroundTask(mock_tasks[i]), "Register task");
+	}
+	checkCondition(addBackgroundTask(mock_tasks[0]), "Register too many tasks");
+
+	// Tasks with unlimited work should share the wait fairly, and stop once
+	// the press is in progress.
+	resetSimulation();
+	addBackgroundTask(mock_tasks[0]);
+	addBackgroundTask(mock_tasks[1]);
+	addBackgroundTask(mock_tasks[2]);
+	checkCondition(!simulatedWaitForButtonPress(), "Accept with tasks");
+	total_slices = mock_slices_done[0] + mock_slices_done[1] + mock_slices_done[2];
+	checkCondition(total_slices >= (press_time / 5) - 1, "Tasks used the wait");
+	checkCondition((mock_slices_done[0] - mock_slices_done[2]) <= 1, "Round robin");
+	checkCount(slices_while_pressed, 0, "Slices while pressed");
+	checkCondition(last_slice_start < press_time, "No slices after press");
+	latency = sim_time - press_time;
+	checkCondition(latency <= TEST_DEBOUNCE_COUNT - 1 + 5, "Latency with tasks");
+
+	// A bouncing button should reset the debouncer, and background work
+	// may resume in between bounces, but the press must still register.
+	resetSimulation();
+	addBackgroundTask(mock_tasks[0]);
+	mock_slice_length[0] = 3;
+	press_accept = false;
+	press_cancel = true;
+	bounce_end_time = press_time + 20;
+	checkCondition(simulatedWaitForButtonPress(), "Cancel with bounce");
+	checkCondition(sim_time >= bounce_end_time + TEST_DEBOUNCE_COUNT - 1, "Bounce resets debouncer");
+	checkCondition(sim_time <= bounce_end_time + TEST_DEBOUNCE_COUNT - 1 + 3, "Latency with bounce");
+
+	// A task which runs out of work should stop being run, and the loop
+	// should then idle.
+	resetSimulation();
+	addBackgroundTask(mock_tasks[0]);
+	addBackgroundTask(mock_tasks[1]);
+	mock_work_left[0] = 7;
+	mock_work_left[1] = 3;
+	checkCondition(!simulatedWaitForButtonPress(), "Accept with finite work");
+	checkCount(mock_slices_done[0], 7, "Finite work task 0");
+	checkCount(mock_slices_done[1], 3, "Finite work task 1");
+	checkCount(wait_count, sim_time - 10 * 5, "Idle once work is done");
+
+	// A long slice delays registration by at most its own length.
+	resetSimulation();
+	addBackgroundTask(mock_tasks[0]);
+	mock_slice_length[0] = 30;
+	press_time = 1010; // in the middle of a slice
+	bounce_end_time = press_time;
+	checkCondition(!simulatedWaitForButtonPress(), "Accept with long slices");
+	latency = sim_time - press_time;
+	checkCondition(latency <= TEST_DEBOUNCE_COUNT - 1 + 30, "Latency with long slices");
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_BACKGROUND
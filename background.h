@@ -0,0 +1,46 @@
+/** \file background.h
+  *
+  * \brief Describes types and functions exported by background.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef BACKGROUND_H_INCLUDED
+#define BACKGROUND_H_INCLUDED
+
+#include "common.h"
+
+/** Maximum number of background tasks which can be registered using
+  * addBackgroundTask(). */
+#define MAX_BACKGROUND_TASKS		4
+
+/** A piece of long-running work which can be done in slices, whenever the
+  * device would otherwise be idle (see runBackgroundTask()). Each call should
+  * do one short slice of work; "short" means a few tens of milliseconds at
+  * most, because a button press isn't sampled while a slice is running.
+  * This should return true if it did some work, or false if it had nothing
+  * to do. A task which has nothing to do should return quickly. */
+typedef bool (*BackgroundTask)(void);
+
+/** State of the debouncer used by button-wait loops. The fields are private
+  * to background.c; use initButtonDebouncer(),
+  * sampleButtonDebouncer() and isButtonPressInProgress() instead. */
+typedef struct ButtonDebouncerStruct
+{
+	/** Number of consistent samples required to register a press. */
+	uint32_t debounce_count;
+	/** Number of consistent samples still required to register a press. */
+	uint32_t remaining;
+	/** Whether the cancel button was pressed in the most recent sample. */
+	bool cancel_pressed;
+} ButtonDebouncer;
+
+extern void clearBackgroundTasks(void);
+extern bool addBackgroundTask(BackgroundTask task);
+extern bool runBackgroundTask(void);
+extern void initButtonDebouncer(ButtonDebouncer *debouncer, uint32_t debounce_count);
+extern bool sampleButtonDebouncer(ButtonDebouncer *debouncer, bool accept_pressed, bool cancel_pressed);
+extern bool isButtonPressInProgress(ButtonDebouncer *debouncer);
+extern bool wasCancelPressed(ButtonDebouncer *debouncer);
+
+#endif // #ifndef BACKGROUND_H_INCLUDED
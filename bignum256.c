@@ -46,6 +46,7 @@
 
 #include "common.h"
 #include "bignum256.h"
+#include "perf_counters.h"
 
 /** The prime modulus to operate under.
   * \warning This must be greater than 2 ^ 255.
@@ -418,7 +419,9 @@ void bigMultiply(BigNum256 r, BigNum256 op1, BigNum256 op2)
 	uint8_t temp[64];
 	uint8_t full_r[64];
 	uint8_t remaining;
+	PERF_DECLARE_START;
 
+	PERF_START();
 	bigMultiplyVariableSizeNoModulo(full_r, op1, 32, op2, 32);
 	// The modular reduction is done by subtracting off some multiple of
 	// n. The upper 256 bits of r are used as an estimate for that multiple.
@@ -450,6 +453,7 @@ void bigMultiply(BigNum256 r, BigNum256 op1, BigNum256 op2)
 	// required to ensure that r < n.
 	bigModulo(full_r, full_r);
 	bigAssign(r, full_r);
+	PERF_STOP(PERF_BIG_MULTIPLY, 1);
 }
 
 
@@ -0,0 +1,752 @@
+/** \file device_sim.c
+  *
+  * \brief Simulate many hardware wallets on a Linux host.
+  *
+  * Each simulated device runs the real packet handler (processPacket() in
+  * stream_comm.c) and wallet code against its own non-volatile storage image
+  * file, and talks to the host through its own endpoint: either a UNIX
+  * domain socket or a pseudo-terminal. This allows host software to be
+  * tested against hundreds of wallets without any hardware.
+  *
+  * stream_comm.c, wallet.c, prandom.c, xex.c and bignum256.c all keep their
+  * state in global variables, so every device is a separate process, forked
+  * from a supervisor process. The supervisor owns each device's endpoint,
+  * so it survives the device process. When the host closes a socket
+  * connection, the device process exits and the supervisor starts a new
+  * one, in the same way that unplugging a device resets it. Non-volatile
+  * storage is a shared memory mapping of the image file, so its contents
+  * survive resets (and crashes) too.
+  *
+  * All user prompts are automatically accepted (or, with -r, denied).
+  * One-time passwords are written to a file next to the endpoint, so that
+  * test scripts can read them.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+// For posix_openpt() and friends.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../prandom.h"
+#include "../stream_comm.h"
+#include "../wallet.h"
+
+/** Size, in bytes, of the global partition. This is the same as the PIC32
+  * port (see pic32/sst25x.h), so images can be used with other tools. */
+#define GLOBAL_PARTITION_SIZE	1024
+/** Size, in bytes, of the accounts partition. */
+#define ACCOUNTS_PARTITION_SIZE	3072
+/** Total size, in bytes, of each device's image file. The global partition
+  * comes first. */
+#define IMAGE_SIZE				(GLOBAL_PARTITION_SIZE + ACCOUNTS_PARTITION_SIZE)
+/** Size of the input and output buffers of each device, in bytes. */
+#define STREAM_BUFFER_SIZE		4096
+/** Maximum length of any file name created by this program. */
+#define MAX_FILENAME_LENGTH		256
+/** Default number of PBKDF2 iterations. This is what every port uses. */
+#define DEFAULT_ITERATIONS		128
+
+/** What the supervisor keeps track of for each simulated device. */
+typedef struct SimDeviceStruct
+{
+	/** Listening socket, or pseudo-terminal master. This is inherited by
+	  * each device process. */
+	int endpoint_fd;
+	/** For pseudo-terminals, the slave side. The supervisor keeps this open
+	  * so that reads from the master block (instead of failing) while the
+	  * host doesn't have the pseudo-terminal open. */
+	int slave_fd;
+	/** Process ID of the current device process, or 0 if there isn't one. */
+	pid_t pid;
+	/** Name of the socket or pseudo-terminal symbolic link. */
+	char endpoint_filename[MAX_FILENAME_LENGTH];
+} SimDevice;
+
+/** Directory where every device's files go. */
+static const char *directory;
+/** Whether pseudo-terminals are used instead of UNIX domain sockets. */
+static bool use_pty;
+/** Whether every user prompt is denied (instead of accepted). */
+static bool deny_all;
+/** What getPBKDF2Iterations() returns. */
+static uint32_t pbkdf2_iterations;
+/** Set by the signal handler when the supervisor should stop. */
+static volatile sig_atomic_t stop_requested;
+
+/** Index of the device which this process is simulating. */
+static uint32_t device_index;
+/** File descriptor used for the stream. */
+static int stream_fd;
+/** Contents of the device's non-volatile storage (a mapping of the
+  * image file). */
+static uint8_t *image;
+/** Bytes received from the host but not yet read by streamGetOneByte(). */
+static uint8_t in_buffer[STREAM_BUFFER_SIZE];
+/** Number of valid bytes in #in_buffer. */
+static uint32_t in_length;
+/** Index into #in_buffer of the next byte to read. */
+static uint32_t in_ptr;
+/** Bytes written by streamPutOneByte() but not yet sent to the host. */
+static uint8_t out_buffer[STREAM_BUFFER_SIZE];
+/** Number of valid bytes in #out_buffer. */
+static uint32_t out_length;
+
+/** Construct the name of one of a device's files.
+  * \param out_filename Character array (of length #MAX_FILENAME_LENGTH) where
+  *                     the file name will be written to.
+  * \param index The index of the device.
+  * \param extension The file name extension, without the dot.
+  */
+static void deviceFilename(char *out_filename, uint32_t index, const char *extension)
+{
+	snprintf(out_filename, MAX_FILENAME_LENGTH, "%s/device%u.%s", directory, index, extension);
+}
+
+/** The host has gone away, so reset the device by exiting. The supervisor
+  * will start a new device process. */
+static void hostDisconnected(void)
+{
+	_exit(0);
+}
+
+/** Send everything in #out_buffer to the host. */
+static void flushOutput(void)
+{
+	uint32_t sent;
+	ssize_t r;
+
+	sent = 0;
+	while (sent < out_length)
+	{
+		r = write(stream_fd, &(out_buffer[sent]), out_length - sent);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			hostDisconnected();
+		}
+		sent += (uint32_t)r;
+	}
+	out_length = 0;
+}
+
+/** Get one byte from the host. If there are no bytes waiting, this
+  * will block until there are. Anything written by streamPutOneByte() is
+  * sent first, since the host may be waiting for it.
+  * \return The received byte.
+  */
+uint8_t streamGetOneByte(void)
+{
+	ssize_t r;
+
+	while (in_ptr >= in_length)
+	{
+		flushOutput();
+		r = read(stream_fd, in_buffer, sizeof(in_buffer));
+		if (r > 0)
+		{
+			in_length = (uint32_t)r;
+			in_ptr = 0;
+		}
+		else if ((r == 0) || (errno != EINTR))
+		{
+			hostDisconnected();
+		}
+	}
+	return in_buffer[in_ptr++];
+}
+
+/** Send one byte to the host. Bytes are buffered until the device next
+  * waits for input, or until the buffer is full.
+  * \param one_byte The byte to send.
+  */
+void streamPutOneByte(uint8_t one_byte)
+{
+	if (out_length >= sizeof(out_buffer))
+	{
+		flushOutput();
+	}
+	out_buffer[out_length++] = one_byte;
+}
+
+/** Notify the user interface that the transaction parser has seen a new
+  * Bitcoin amount/address pair. There is no user interface, so this does
+  * nothing.
+  * \param text_amount Ignored.
+  * \param text_address Ignored.
+  * \return Always false (success).
+  */
+bool newOutputSeen(char *text_amount, char *text_address)
+{
+	(void)text_amount;
+	(void)text_address;
+	return false;
+}
+
+/** Notify the user interface of the transaction fee. There is no user
+  * interface, so this does nothing.
+  * \param text_amount Ignored.
+  */
+void setTransactionFee(char *text_amount)
+{
+	(void)text_amount;
+}
+
+/** Notify the user interface that the list of Bitcoin amount/address pairs
+  * should be cleared. There is no user interface, so this does nothing. */
+void clearOutputsSeen(void)
+{
+}
+
+/** Notify the user interface of how many addresses are being asked for.
+  * There is no user interface, so this does nothing.
+  * \param text_count Ignored.
+  */
+void setNewAddressesCount(char *text_count)
+{
+	(void)text_count;
+}
+
+/** Ask user if they want to allow some action. The answer is set by the
+  * -r command-line option.
+  * \param command Ignored.
+  * \return false if the user accepted, true if the user denied.
+  */
+bool userDenied(AskUserCommand command)
+{
+	(void)command;
+	return deny_all;
+}
+
+/** Write a one-time password to the device's OTP file, so that the host
+  * test can read it.
+  * \param command Ignored.
+  * \param otp The one-time password to display.
+  */
+void displayOTP(AskUserCommand command, char *otp)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	FILE *f;
+
+	(void)command;
+	deviceFilename(filename, device_index, "otp");
+	f = fopen(filename, "w");
+	if (f != NULL)
+	{
+		fprintf(f, "%s\n", otp);
+		fclose(f);
+	}
+}
+
+/** Remove the device's OTP file. */
+void clearOTP(void)
+{
+	char filename[MAX_FILENAME_LENGTH];
+
+	deviceFilename(filename, device_index, "otp");
+	unlink(filename);
+}
+
+/** Fill buffer with 32 random bytes from the operating system.
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return 256 (the number of bits of entropy) on success, or -1 on failure.
+  */
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	if (getrandom(buffer, 32, 0) != 32)
+	{
+		return -1;
+	}
+	return 256;
+}
+
+/** Get size of a partition.
+  * \param out_size On success, the size of the partition (in number of bytes)
+  *                 will be written here.
+  * \param partition Partition to query. Must be one of #NVPartitions.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
+{
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_size = GLOBAL_PARTITION_SIZE;
+	}
+	else if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_size = ACCOUNTS_PARTITION_SIZE;
+	}
+	else
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	return NV_NO_ERROR;
+}
+
+/** Convert a partition and address into an offset into #image, checking
+  * that the whole range is within the partition.
+  * \param out_offset On success, the offset will be written here.
+  * \param partition The partition. Must be one of #NVPartitions.
+  * \param address Byte offset within the partition.
+  * \param length Number of bytes which will be accessed.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn imageOffset(uint32_t *out_offset, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t size;
+
+	if (nonVolatileGetSize(&size, partition) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	if ((address > size) || (length > (size - address)))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	*out_offset = address;
+	if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_offset += GLOBAL_PARTITION_SIZE;
+	}
+	return NV_NO_ERROR;
+}
+
+/** Write to the device's non-volatile storage image.
+  * \param data A pointer to the data to be written.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+
+	if (imageOffset(&offset, partition, address, length) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(&(image[offset]), data, length);
+	return NV_NO_ERROR;
+}
+
+/** Read from the device's non-volatile storage image.
+  * \param data A pointer to the buffer which will receive the data.
+  * \param partition The partition to read from. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start reading from.
+  * \param length The number of bytes to read.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+
+	if (imageOffset(&offset, partition, address, length) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(data, &(image[offset]), length);
+	return NV_NO_ERROR;
+}
+
+/** The image is a shared mapping, so writes reach the image file even if
+  * the device process crashes. So there is nothing to flush.
+  * \return Always #NV_NO_ERROR.
+  */
+NonVolatileReturn nonVolatileFlush(void)
+{
+	return NV_NO_ERROR;
+}
+
+/** Number of PBKDF2 iterations to use when deriving wallet encryption keys.
+  * This is set by the -i command-line option.
+  * \return Number of iterations.
+  */
+uint32_t getPBKDF2Iterations(void)
+{
+	return pbkdf2_iterations;
+}
+
+/** Append a backup seed, in hexadecimal, to the device's backup file.
+  * \param seed A byte array of length #SEED_LENGTH bytes which contains the
+  *             backup seed.
+  * \param is_encrypted Specifies whether the seed has been encrypted.
+  * \param destination_device Must be 0; there is only one backup file.
+  * \return false on success, true if the backup seed could not be written.
+  */
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	FILE *f;
+	int i;
+
+	if (destination_device != 0)
+	{
+		return true;
+	}
+	deviceFilename(filename, device_index, "backup");
+	f = fopen(filename, "a");
+	if (f == NULL)
+	{
+		return true;
+	}
+	fprintf(f, "%s ", is_encrypted ? "encrypted" : "unencrypted");
+	for (i = 0; i < SEED_LENGTH; i++)
+	{
+		fprintf(f, "%02x", seed[i]);
+	}
+	fprintf(f, "\n");
+	fclose(f);
+	return false;
+}
+
+/** This will be called whenever something very unexpected occurs. This
+  * function must not return. The supervisor will start a new device
+  * process. */
+void fatalError(void)
+{
+	fprintf(stderr, "device %u: fatal error\n", device_index);
+	_exit(1);
+}
+
+/** Open (and create, if necessary) a device's image file and map it.
+  * New images are filled with 0xff, like erased flash memory.
+  * \param index The index of the device.
+  * \return The mapping, or NULL on failure.
+  */
+static uint8_t *mapImage(uint32_t index)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	uint8_t blank[IMAGE_SIZE];
+	struct stat st;
+	void *mapping;
+	int fd;
+
+	deviceFilename(filename, index, "nv");
+	fd = open(filename, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < IMAGE_SIZE)
+	{
+		memset(blank, 0xff, sizeof(blank));
+		if ((ftruncate(fd, 0) != 0) || (write(fd, blank, sizeof(blank)) != (ssize_t)sizeof(blank)))
+		{
+			close(fd);
+			return NULL;
+		}
+	}
+	mapping = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		return NULL;
+	}
+	return (uint8_t *)mapping;
+}
+
+/** Run one device process. This never returns.
+  * \param device The device to simulate.
+  * \param index The index of the device.
+  */
+static void runDevice(SimDevice *device, uint32_t index)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	device_index = index;
+	image = mapImage(index);
+	if (image == NULL)
+	{
+		fprintf(stderr, "device %u: could not open image\n", index);
+		_exit(1);
+	}
+	if (use_pty)
+	{
+		stream_fd = device->endpoint_fd;
+	}
+	else
+	{
+		do
+		{
+			stream_fd = accept(device->endpoint_fd, NULL, NULL);
+		} while ((stream_fd < 0) && (errno == EINTR));
+		if (stream_fd < 0)
+		{
+			_exit(1);
+		}
+	}
+	while (true)
+	{
+		processPacket();
+	}
+}
+
+/** Start (or restart) a device process.
+  * \param device The device to start.
+  * \param index The index of the device.
+  * \return false on success, true on failure.
+  */
+static bool startDevice(SimDevice *device, uint32_t index)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+	{
+		return true;
+	}
+	if (pid == 0)
+	{
+		runDevice(device, index);
+	}
+	device->pid = pid;
+	return false;
+}
+
+/** Create a device's endpoint (a listening UNIX domain socket or a
+  * pseudo-terminal).
+  * \param device The device whose endpoint will be created.
+  * \param index The index of the device.
+  * \return false on success, true on failure.
+  */
+static bool createEndpoint(SimDevice *device, uint32_t index)
+{
+	struct sockaddr_un addr;
+	struct termios tio;
+	char *slave_name;
+
+	device->slave_fd = -1;
+	if (use_pty)
+	{
+		deviceFilename(device->endpoint_filename, index, "tty");
+		device->endpoint_fd = posix_openpt(O_RDWR | O_NOCTTY);
+		if ((device->endpoint_fd < 0) || (grantpt(device->endpoint_fd) != 0)
+			|| (unlockpt(device->endpoint_fd) != 0))
+		{
+			return true;
+		}
+		slave_name = ptsname(device->endpoint_fd);
+		if (slave_name == NULL)
+		{
+			return true;
+		}
+		device->slave_fd = open(slave_name, O_RDWR | O_NOCTTY);
+		if ((device->slave_fd < 0) || (tcgetattr(device->slave_fd, &tio) != 0))
+		{
+			return true;
+		}
+		cfmakeraw(&tio);
+		if (tcsetattr(device->slave_fd, TCSANOW, &tio) != 0)
+		{
+			return true;
+		}
+		unlink(device->endpoint_filename);
+		if (symlink(slave_name, device->endpoint_filename) != 0)
+		{
+			return true;
+		}
+	}
+	else
+	{
+		deviceFilename(device->endpoint_filename, index, "sock");
+		if (strlen(device->endpoint_filename) >= sizeof(addr.sun_path))
+		{
+			return true;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, device->endpoint_filename);
+		unlink(device->endpoint_filename);
+		device->endpoint_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((device->endpoint_fd < 0)
+			|| (bind(device->endpoint_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			|| (listen(device->endpoint_fd, 1) != 0))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Signal handler which asks the supervisor to stop.
+  * \param sig Ignored.
+  */
+static void requestStop(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+/** Print command-line usage information.
+  * \param program_name The name of this program.
+  */
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-n <devices>] [-d <directory>] [-t] [-r] [-i <iterations>]\n", program_name);
+	printf("  -n   Number of devices to simulate (default: 1).\n");
+	printf("  -d   Directory for each device's files (default: current directory).\n");
+	printf("  -t   Use pseudo-terminals instead of UNIX domain sockets.\n");
+	printf("  -r   Deny every user prompt (default: accept).\n");
+	printf("  -i   Number of PBKDF2 iterations (default: %d).\n", DEFAULT_ITERATIONS);
+	printf("Device <i> uses <directory>/device<i>.nv as its non-volatile storage, and\n");
+	printf("<directory>/device<i>.sock (or .tty, with -t) as its endpoint.\n");
+}
+
+int main(int argc, char **argv)
+{
+	SimDevice *devices;
+	struct sigaction stop_action;
+	uint32_t num_devices;
+	uint32_t i;
+	int arg;
+	int status;
+	pid_t pid;
+
+	num_devices = 1;
+	directory = ".";
+	use_pty = false;
+	deny_all = false;
+	pbkdf2_iterations = DEFAULT_ITERATIONS;
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (!strcmp(argv[arg], "-t"))
+		{
+			use_pty = true;
+		}
+		else if (!strcmp(argv[arg], "-r"))
+		{
+			deny_all = true;
+		}
+		else if ((arg + 1) >= argc)
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+		else if (!strcmp(argv[arg], "-n"))
+		{
+			num_devices = (uint32_t)strtoul(argv[++arg], NULL, 0);
+		}
+		else if (!strcmp(argv[arg], "-d"))
+		{
+			directory = argv[++arg];
+		}
+		else if (!strcmp(argv[arg], "-i"))
+		{
+			pbkdf2_iterations = (uint32_t)strtoul(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	if ((num_devices == 0) || (num_devices > 100000))
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+
+	devices = calloc(num_devices, sizeof(SimDevice));
+	if (devices == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	// sigaction() is used (without SA_RESTART) so that wait() is interrupted
+	// when the supervisor is asked to stop.
+	memset(&stop_action, 0, sizeof(stop_action));
+	stop_action.sa_handler = requestStop;
+	sigemptyset(&stop_action.sa_mask);
+	sigaction(SIGINT, &stop_action, NULL);
+	sigaction(SIGTERM, &stop_action, NULL);
+	for (i = 0; i < num_devices; i++)
+	{
+		if (createEndpoint(&(devices[i]), i))
+		{
+			fprintf(stderr, "Could not create endpoint \"%s\"\n", devices[i].endpoint_filename);
+			exit(1);
+		}
+		if (startDevice(&(devices[i]), i))
+		{
+			fprintf(stderr, "Could not start device %u\n", i);
+			exit(1);
+		}
+	}
+	printf("Simulating %u devices in \"%s\"\n", num_devices, directory);
+	fflush(stdout);
+
+	// Restart devices as their processes exit, until asked to stop.
+	while (!stop_requested)
+	{
+		pid = wait(&status);
+		if (pid < 0)
+		{
+			continue;
+		}
+		for (i = 0; i < num_devices; i++)
+		{
+			if (devices[i].pid == pid)
+			{
+				devices[i].pid = 0;
+				if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+				{
+					// Don't spin if the device keeps failing.
+					fprintf(stderr, "device %u: process failed, restarting\n", i);
+					sleep(1);
+				}
+				if (!stop_requested && startDevice(&(devices[i]), i))
+				{
+					fprintf(stderr, "Could not restart device %u\n", i);
+				}
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < num_devices; i++)
+	{
+		if (devices[i].pid != 0)
+		{
+			kill(devices[i].pid, SIGTERM);
+		}
+	}
+	while (wait(NULL) > 0)
+	{
+		// Wait for every device process.
+	}
+	for (i = 0; i < num_devices; i++)
+	{
+		unlink(devices[i].endpoint_filename);
+	}
+	free(devices);
+	exit(0);
+}
@@ -37,28 +37,7 @@
 #include "ecdsa.h"
 #include "endian.h"
 #include "hmac_drbg.h"
-
-/** A point on the elliptic curve, in Jacobian coordinates. The
-  * Jacobian coordinates (x, y, z) are related to affine coordinates
-  * (x_affine, y_affine) by:
-  * (x_affine, y_affine) = (x / (z ^ 2), y / (z ^ 3)).
-  *
-  * Why use Jacobian coordinates? Because then point addition and
-  * point doubling don't have to use inversion (division), which is very slow.
-  */
-typedef struct PointJacobianStruct
-{
-	/** x component of a point in Jacobian coordinates. */
-	uint8_t x[32];
-	/** y component of a point in Jacobian coordinates. */
-	uint8_t y[32];
-	/** z component of a point in Jacobian coordinates. */
-	uint8_t z[32];
-	/** If is_point_at_infinity is non-zero, then this point represents the
-	  * point at infinity and all other structure members are considered
-	  * invalid. */
-	uint8_t is_point_at_infinity;
-} PointJacobian;
+#include "perf_counters.h"
 
 /** The prime number used to define the prime finite field for secp256k1. */
 static const uint8_t secp256k1_p[32] = {
@@ -286,29 +265,26 @@ void setFieldToN(void)
 	bigSetField(secp256k1_n, secp256k1_complement_n, sizeof(secp256k1_complement_n));
 }
 
-/** Perform scalar multiplication (p = k x p) of the point p by the scalar k.
-  * The result will be stored back into p. The multiplication is
-  * accomplished by repeated point doubling and adding of the
-  * original point. All multi-precision integer operations are done under
-  * the prime finite field specified by #secp256k1_p.
-  * \param p The point (in affine coordinates) to multiply.
-  * \param k The 32 byte multi-precision scalar to multiply p by.
+/** Process some bits of the scalar in a point multiplication, from the most
+  * significant bit down. For each bit, the accumulator is doubled, then the
+  * point is added to it if the bit is set. All multi-precision integer
+  * operations are done under the prime finite field specified by
+  * #secp256k1_p, which must already be set.
+  * \param accumulator The running result of the multiplication.
+  * \param junk Destination for dummy operations.
+  * \param p The point (in affine coordinates) being multiplied.
+  * \param k The 32 byte multi-precision scalar p is being multiplied by.
+  * \param first_bit Index of the most significant bit to process, where 0
+  *                  means the least significant bit of k.
+  * \param num_bits Number of bits to process.
   */
-void pointMultiply(PointAffine *p, BigNum256 k)
+static void pointMultiplyBits(PointJacobian *accumulator, PointJacobian *junk, PointAffine *p, BigNum256 k, uint16_t first_bit, uint16_t num_bits)
 {
-	PointJacobian accumulator;
-	PointJacobian junk;
 	PointAffine always_point_at_infinity; // for dummy operations
-	uint8_t i;
-	uint8_t j;
-	uint8_t one_byte;
+	uint16_t i;
 	uint8_t one_bit;
 	PointAffine *lookup_affine[2];
 
-	memset(&accumulator, 0, sizeof(PointJacobian));
-	memset(&junk, 0, sizeof(PointJacobian));
-	memset(&always_point_at_infinity, 0, sizeof(PointAffine));
-	setFieldToP();
 	// The Montgomery ladder method can't be used here because it requires
 	// point addition to be done in pure Jacobian coordinates. Point addition
 	// in pure Jacobian coordinates would make point multiplication about
@@ -319,22 +295,215 @@ void pointMultiply(PointAffine *p, BigNum256 k)
 	// can determine whether bits in the private key are set or not.
 	// So the use of this code is not appropriate in situations where fault
 	// analysis can occur.
-	accumulator.is_point_at_infinity = 1;
+	memset(&always_point_at_infinity, 0, sizeof(PointAffine));
 	always_point_at_infinity.is_point_at_infinity = 1;
 	lookup_affine[1] = p;
 	lookup_affine[0] = &always_point_at_infinity;
-	for (i = 31; i < 32; i--)
+	for (i = 0; i < num_bits; i++)
+	{
+		pointDouble(accumulator);
+		one_bit = (uint8_t)((k[first_bit >> 3] >> (first_bit & 7)) & 1);
+		pointAdd(accumulator, junk, lookup_affine[one_bit]);
+		first_bit--;
+	}
+}
+
+/** Perform scalar multiplication (p = k x p) of the point p by the scalar k.
+  * The result will be stored back into p. The multiplication is
+  * accomplished by repeated point doubling and adding of the
+  * original point. All multi-precision integer operations are done under
+  * the prime finite field specified by #secp256k1_p.
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiply(PointAffine *p, BigNum256 k)
+{
+	PointJacobian accumulator;
+	PointJacobian junk;
+	PERF_DECLARE_START;
+
+	PERF_START();
+	memset(&accumulator, 0, sizeof(PointJacobian));
+	memset(&junk, 0, sizeof(PointJacobian));
+	setFieldToP();
+	accumulator.is_point_at_infinity = 1;
+	pointMultiplyBits(&accumulator, &junk, p, k, 255, 256);
+	jacobianToAffine(p, &accumulator);
+	PERF_STOP(PERF_POINT_MULTIPLY, 1);
+}
+
+/** Begin a scalar multiplication (k x p) which will be done in slices,
+  * using pointMultiplySlice() and pointMultiplyEnd(). This is for long
+  * point multiplications which would otherwise hold up something else,
+  * such as precomputing a public key while waiting for the user. The result
+  * is exactly the same as the result of pointMultiply(), and each bit
+  * takes the same amount of time.
+  * \param state The state of the multiplication, which will be initialised
+  *              by this function. This includes copies of p and k.
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiplyBegin(PointMultiplyState *state, PointAffine *p, BigNum256 k)
+{
+	PERF_DECLARE_START;
+
+	PERF_START();
+	memset(state, 0, sizeof(PointMultiplyState));
+	state->accumulator.is_point_at_infinity = 1;
+	memcpy(&(state->point), p, sizeof(PointAffine));
+	memcpy(state->k, k, sizeof(state->k));
+	state->bits_remaining = 256;
+	// The multiplication is counted once, by pointMultiplyEnd().
+	PERF_STOP(PERF_POINT_MULTIPLY, 0);
+}
+
+/** Do one slice of a point multiplication which was started by
+  * pointMultiplyBegin(). The field is set by this function, so other
+  * multi-precision arithmetic can be done in between slices.
+  * \param state The state of the multiplication.
+  * \param max_bits The maximum number of bits of the scalar to process. The
+  *                 time taken is proportional to this.
+  * \return The number of bits of the scalar which still have to be
+  *         processed. When this is 0, call pointMultiplyEnd() to get the
+  *         result.
+  */
+uint16_t pointMultiplySlice(PointMultiplyState *state, uint16_t max_bits)
+{
+	PERF_DECLARE_START;
+
+	PERF_START();
+	if (max_bits > state->bits_remaining)
+	{
+		max_bits = state->bits_remaining;
+	}
+	setFieldToP();
+	pointMultiplyBits(&(state->accumulator), &(state->junk), &(state->point), state->k, (uint16_t)(state->bits_remaining - 1), max_bits);
+	state->bits_remaining = (uint16_t)(state->bits_remaining - max_bits);
+	// The multiplication is counted once, by pointMultiplyEnd().
+	PERF_STOP(PERF_POINT_MULTIPLY, 0);
+	return state->bits_remaining;
+}
+
+/** Finish a point multiplication which was started by
+  * pointMultiplyBegin(). Any bits which haven't been processed yet are
+  * processed now. Afterwards, the state is cleared, since it contains a
+  * copy of the (possibly secret) scalar.
+  * \param out The result (in affine coordinates) will be written here.
+  * \param state The state of the multiplication.
+  */
+void pointMultiplyEnd(PointAffine *out, PointMultiplyState *state)
+{
+	PERF_DECLARE_START;
+
+	// The time for any remaining bits is added by pointMultiplySlice().
+	pointMultiplySlice(state, state->bits_remaining);
+	PERF_START();
+	jacobianToAffine(out, &(state->accumulator));
+	memset(state, 0, sizeof(PointMultiplyState));
+	PERF_STOP(PERF_POINT_MULTIPLY, 1);
+}
+
+/** Perform scalar multiplication on up to #POINT_MULTIPLY_BATCH_SIZE points.
+  * See pointMultiplyBatch() for details.
+  * \param points The points (in affine coordinates) to multiply.
+  * \param keys The scalars to multiply the points by.
+  * \param count The number of points. This must be between 1 and
+  *              #POINT_MULTIPLY_BATCH_SIZE inclusive.
+  */
+static void pointMultiplyChunk(PointAffine *points, uint8_t *keys, uint8_t count)
+{
+	PointJacobian accumulators[POINT_MULTIPLY_BATCH_SIZE];
+	PointJacobian junk;
+	uint8_t products[POINT_MULTIPLY_BATCH_SIZE][32];
+	uint8_t inverse[32];
+	uint8_t z_inverse[32];
+	uint8_t s[32];
+	uint8_t i;
+	PERF_DECLARE_START;
+
+	PERF_START();
+	memset(&junk, 0, sizeof(PointJacobian));
+	setFieldToP();
+	for (i = 0; i < count; i++)
 	{
-		one_byte = k[i];
-		for (j = 0; j < 8; j++)
+		memset(&(accumulators[i]), 0, sizeof(PointJacobian));
+		accumulators[i].is_point_at_infinity = 1;
+		pointMultiplyBits(&(accumulators[i]), &junk, &(points[i]), &(keys[i * 32]), 255, 256);
+		// The z component of the point at infinity is meaningless and may be
+		// 0, which would make the product of all z components 0.
+		if (accumulators[i].is_point_at_infinity)
+		{
+			bigSetZero(accumulators[i].z);
+			accumulators[i].z[0] = 1;
+		}
+		if (i == 0)
+		{
+			bigAssign(products[0], accumulators[0].z);
+		}
+		else
 		{
-			pointDouble(&accumulator);
-			one_bit = (uint8_t)((one_byte & 0x80) >> 7);
-			pointAdd(&accumulator, &junk, lookup_affine[one_bit]);
-			one_byte = (uint8_t)(one_byte << 1);
+			bigMultiply(products[i], products[i - 1], accumulators[i].z);
 		}
 	}
-	jacobianToAffine(p, &accumulator);
+	// Now products[i] = z_0 * z_1 * ... * z_i. Invert the product of all z
+	// components, then peel off one z component at a time, starting from the
+	// last point.
+	bigInvert(inverse, products[count - 1]);
+	for (i = (uint8_t)(count - 1); i < count; i--)
+	{
+		if (i == 0)
+		{
+			bigAssign(z_inverse, inverse);
+		}
+		else
+		{
+			bigMultiply(z_inverse, inverse, products[i - 1]);
+			bigMultiply(inverse, inverse, accumulators[i].z);
+		}
+		points[i].is_point_at_infinity = accumulators[i].is_point_at_infinity;
+		bigMultiply(s, z_inverse, z_inverse);
+		bigMultiply(points[i].x, accumulators[i].x, s);
+		bigMultiply(s, s, z_inverse);
+		bigMultiply(points[i].y, accumulators[i].y, s);
+	}
+	// Each point counts as one point multiplication.
+	PERF_STOP(PERF_POINT_MULTIPLY, count);
+}
+
+/** Perform scalar multiplication (points[i] = k_i x points[i]) on several
+  * points. The results are the same as the results of calling
+  * pointMultiply() on each point, but this is faster, because the
+  * conversion from Jacobian to affine coordinates is shared. That
+  * conversion requires inversion, which is very slow, so instead of two
+  * inversions per point, Montgomery's trick is used to do one inversion
+  * for every #POINT_MULTIPLY_BATCH_SIZE points. For the performance
+  * counters, each point counts as one pointMultiply() (see
+  * pointMultiplyChunk()).
+  * \param points The points (in affine coordinates) to multiply. The results
+  *               will be written back here.
+  * \param keys The 32 byte multi-precision scalars to multiply the points
+  *             by, one after another. k_i is at keys[i * 32].
+  * \param count The number of points.
+  */
+void pointMultiplyBatch(PointAffine *points, uint8_t *keys, uint32_t count)
+{
+	uint8_t chunk_size;
+
+	while (count > 0)
+	{
+		if (count > POINT_MULTIPLY_BATCH_SIZE)
+		{
+			chunk_size = POINT_MULTIPLY_BATCH_SIZE;
+		}
+		else
+		{
+			chunk_size = (uint8_t)count;
+		}
+		pointMultiplyChunk(points, keys, chunk_size);
+		points += chunk_size;
+		keys += chunk_size * 32;
+		count -= chunk_size;
+	}
 }
 
 /** Set a point to the base point of secp256k1.
@@ -998,6 +1167,9 @@ int main(void)
 	PointJacobian p2;
 	PointJacobian junk;
 	PointAffine compare;
+	PointMultiplyState multiply_state;
+	PointAffine batch_points[POINT_MULTIPLY_BATCH_SIZE * 2 + 3];
+	uint8_t batch_keys[(POINT_MULTIPLY_BATCH_SIZE * 2 + 3) * 32];
 	uint8_t temp[32];
 	uint8_t r[32];
 	uint8_t s[32];
@@ -1250,6 +1422,92 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Test that point multiplication in slices gives the same result as
+	// pointMultiply(), for various slice sizes, including ones which don't
+	// divide 256.
+	fail_count = 0;
+	for (i = 0; i < 20; i++)
+	{
+		fillWithRandom(temp, sizeof(temp));
+		setToG(&compare);
+		pointMultiply(&compare, temp);
+		setToG(&p);
+		pointMultiplyBegin(&multiply_state, &p, temp);
+		setFieldToN(); // slices must not depend on the field
+		while (pointMultiplySlice(&multiply_state, (uint16_t)(1 + i * 7)) > 0)
+		{
+			setFieldToN();
+		}
+		pointMultiplyEnd(&p, &multiply_state);
+		if (memcmp(&p, &compare, sizeof(PointAffine)))
+		{
+			fail_count++;
+		}
+	}
+	// pointMultiplyEnd() should finish off a multiplication which hasn't
+	// been sliced at all.
+	setToG(&compare);
+	pointMultiply(&compare, temp);
+	setToG(&p);
+	pointMultiplyBegin(&multiply_state, &p, temp);
+	pointMultiplyEnd(&p, &multiply_state);
+	if (memcmp(&p, &compare, sizeof(PointAffine)))
+	{
+		fail_count++;
+	}
+	if (fail_count != 0)
+	{
+		printf("Point multiplication in slices doesn't match pointMultiply()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Test that pointMultiplyBatch() gives the same results as
+	// pointMultiply(), for batches which are smaller than, equal to and
+	// larger than POINT_MULTIPLY_BATCH_SIZE. Some keys are 0 or n, so
+	// that the point at infinity gets tested too.
+	fail_count = 0;
+	for (j = 1; j < sizeof(batch_points) / sizeof(batch_points[0]); j += 5)
+	{
+		fillWithRandom(batch_keys, (unsigned int)(j * 32));
+		if (j > 3)
+		{
+			memset(&(batch_keys[2 * 32]), 0, 32);
+			memcpy(&(batch_keys[3 * 32]), secp256k1_n, 32);
+		}
+		for (i = 0; i < (int)j; i++)
+		{
+			setToG(&(batch_points[i]));
+		}
+		pointMultiplyBatch(batch_points, batch_keys, j);
+		for (i = 0; i < (int)j; i++)
+		{
+			setToG(&compare);
+			pointMultiply(&compare, &(batch_keys[i * 32]));
+			if (compare.is_point_at_infinity != batch_points[i].is_point_at_infinity)
+			{
+				fail_count++;
+			}
+			else if (!compare.is_point_at_infinity
+				&& (memcmp(compare.x, batch_points[i].x, 32) || memcmp(compare.y, batch_points[i].y, 32)))
+			{
+				fail_count++;
+			}
+		}
+	}
+	if (fail_count != 0)
+	{
+		printf("pointMultiplyBatch() doesn't match pointMultiply()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// Test that ecdsaPointDecompress() doesn't always succeed.
 	fail_count = 0;
 	for (i = 0; i < 100; i++)
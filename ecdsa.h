@@ -16,6 +16,18 @@
   * written by ecdsaSerialise(). */
 #define ECDSA_MAX_SERIALISE_SIZE	65
 
+/** Number of points which pointMultiplyBatch() converts to affine
+  * coordinates at once. Larger batches share the cost of inversion between
+  * more points, but each point in a batch needs about 130 bytes of stack
+  * space. The AVR only has 2 kilobytes of RAM, which a batch of 8 (along
+  * with the rest of the NewAddresses path in stream_comm.c) would overflow,
+  * so it converts one point at a time. */
+#ifdef AVR
+#define POINT_MULTIPLY_BATCH_SIZE	1
+#else
+#define POINT_MULTIPLY_BATCH_SIZE	8
+#endif // #ifdef AVR
+
 /** A point on the elliptic curve, in affine coordinates. Affine
   * coordinates are the (x, y) that satisfy the elliptic curve
   * equation y ^ 2 = x ^ 3 + a * x + b.
@@ -32,11 +44,53 @@ typedef struct PointAffineStruct
 	uint8_t is_point_at_infinity;
 } PointAffine;
 
+/** A point on the elliptic curve, in Jacobian coordinates. The
+  * Jacobian coordinates (x, y, z) are related to affine coordinates
+  * (x_affine, y_affine) by:
+  * (x_affine, y_affine) = (x / (z ^ 2), y / (z ^ 3)).
+  *
+  * Why use Jacobian coordinates? Because then point addition and
+  * point doubling don't have to use inversion (division), which is very slow.
+  */
+typedef struct PointJacobianStruct
+{
+	/** x component of a point in Jacobian coordinates. */
+	uint8_t x[32];
+	/** y component of a point in Jacobian coordinates. */
+	uint8_t y[32];
+	/** z component of a point in Jacobian coordinates. */
+	uint8_t z[32];
+	/** If is_point_at_infinity is non-zero, then this point represents the
+	  * point at infinity and all other structure members are considered
+	  * invalid. */
+	uint8_t is_point_at_infinity;
+} PointJacobian;
+
+/** State of a point multiplication which is being done in slices. See
+  * pointMultiplyBegin(), pointMultiplySlice() and pointMultiplyEnd(). */
+typedef struct PointMultiplyStateStruct
+{
+	/** The running result of the multiplication. */
+	PointJacobian accumulator;
+	/** Destination for dummy operations. */
+	PointJacobian junk;
+	/** Copy of the point being multiplied. */
+	PointAffine point;
+	/** Copy of the scalar (little-endian) the point is being multiplied by. */
+	uint8_t k[32];
+	/** Number of bits of #k which haven't been processed yet. */
+	uint16_t bits_remaining;
+} PointMultiplyState;
+
 extern const uint8_t secp256k1_n[];
 
 extern void setFieldToN(void);
 extern void setToG(PointAffine *p);
 extern void pointMultiply(PointAffine *p, BigNum256 k);
+extern void pointMultiplyBegin(PointMultiplyState *state, PointAffine *p, BigNum256 k);
+extern uint16_t pointMultiplySlice(PointMultiplyState *state, uint16_t max_bits);
+extern void pointMultiplyEnd(PointAffine *out, PointMultiplyState *state);
+extern void pointMultiplyBatch(PointAffine *points, uint8_t *keys, uint32_t count);
 extern void ecdsaSign(BigNum256 r, BigNum256 s, const BigNum256 hash, const BigNum256 privatekey);
 extern uint8_t ecdsaSerialise(uint8_t *out, const PointAffine *point, const bool do_compress);
 
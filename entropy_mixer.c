@@ -0,0 +1,553 @@
+/** \file entropy_mixer.c
+  *
+  * \brief Combines several entropy sources into one hardwareRandom32Bytes()
+  *        style interface.
+  *
+  * Some entropy sources spend most of their time waiting. For example, the
+  * ATSHA204 takes tens of millisecond to execute a "Random" command, while
+  * the ADC-based HWRNG spends a long time acquiring and testing each batch
+  * of samples. mixedRandom32Bytes() begins a request on every source before
+  * polling any of them, so that a source which is waiting on I/O makes
+  * progress while another source is busy. Sources are polled in round-robin
+  * order, starting after the source which last returned bytes, so that no
+  * source is starved.
+  *
+  * Supplementary sources (see EntropySource#supplementary) don't take turns.
+  * Their bytes are XORed into whichever buffer another source fills, so
+  * they add entropy to every call without adding calls.
+  *
+  * Each source's entropy estimate is capped (see EntropySource#max_credit),
+  * so that a source which cannot be tested is only credited conservatively.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_ENTROPY_MIXER
+#include <stdlib.h>
+#include <stdio.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_ENTROPY_MIXER
+
+#include "common.h"
+#include "entropy_mixer.h"
+
+/** Possible states for each registered entropy source. */
+typedef enum EntropySourceStateEnum
+{
+	/** No request is outstanding; begin needs to be called. */
+	SOURCE_IDLE			= 0,
+	/** A request has begun and the source needs to be polled. */
+	SOURCE_PENDING		= 1,
+	/** The source has failed and will not be used again. */
+	SOURCE_DISABLED		= 2
+} EntropySourceState;
+
+/** Registered entropy sources. Only the first #num_sources entries are
+  * valid. */
+static const EntropySource *sources[MAX_ENTROPY_SOURCES];
+/** State of each entry in #sources. */
+static EntropySourceState source_state[MAX_ENTROPY_SOURCES];
+/** Number of valid entries in #sources. */
+static uint32_t num_sources;
+/** Index into #sources of the source which will be polled first in the next
+  * call to mixedRandom32Bytes(). */
+static uint32_t next_source;
+
+/** Unregister all entropy sources. */
+void clearEntropySources(void)
+{
+	num_sources = 0;
+	next_source = 0;
+}
+
+/** Register an entropy source, so that mixedRandom32Bytes() will use it.
+  * \param source The source to register. This must remain valid for as long
+  *               as the source is registered.
+  * \return false on success, true if there are already
+  *         #MAX_ENTROPY_SOURCES sources registered.
+  */
+bool addEntropySource(const EntropySource *source)
+{
+	if (num_sources >= MAX_ENTROPY_SOURCES)
+	{
+		return true; // no space
+	}
+	sources[num_sources] = source;
+	source_state[num_sources] = SOURCE_IDLE;
+	num_sources++;
+	return false;
+}
+
+/** Handle the failure of an entropy source.
+  * \param index Index into #sources of the source which failed.
+  * \return false if the failure can be ignored, true if it is fatal.
+  */
+static bool sourceFailed(uint32_t index)
+{
+	if (sources[index]->required)
+	{
+		source_state[index] = SOURCE_IDLE;
+		return true;
+	}
+	source_state[index] = SOURCE_DISABLED;
+	return false;
+}
+
+/** XOR the bytes of every supplementary source which is ready into a buffer
+  * which another source has just filled. Supplementary sources which aren't
+  * ready are left pending, to be polled again next time.
+  * \param buffer The buffer which was just filled. This must have space for
+  *               32 bytes.
+  * \return The number of bits of entropy credited for the supplementary
+  *         bytes mixed into buffer, or a negative number if a required
+  *         supplementary source failed.
+  */
+static int mixSupplementarySources(uint8_t *buffer)
+{
+	uint32_t index;
+	uint8_t j;
+	int r;
+	int credit;
+	uint8_t supplementary_bytes[32];
+
+	credit = 0;
+	for (index = 0; index < num_sources; index++)
+	{
+		if (!sources[index]->supplementary || (source_state[index] != SOURCE_PENDING))
+		{
+			continue;
+		}
+		r = sources[index]->poll(supplementary_bytes);
+		if (r > 0)
+		{
+			for (j = 0; j < 32; j++)
+			{
+				buffer[j] ^= supplementary_bytes[j];
+			}
+			source_state[index] = SOURCE_IDLE;
+			credit += MIN(r, sources[index]->max_credit);
+		}
+		else if (r < 0)
+		{
+			if (sourceFailed(index))
+			{
+				return -1;
+			}
+		}
+	}
+	return credit;
+}
+
+/** Fill buffer with 32 random bytes from whichever registered entropy source
+  * is ready first, then mix in the bytes of any supplementary sources which
+  * are ready. This has the same interface as hardwareRandom32Bytes(),
+  * except that it never returns 0; it will keep polling until some
+  * non-supplementary source is ready.
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return The number of bits of entropy credited to the buffer on success,
+  *         or a negative number if a required source failed or if there are
+  *         no usable sources.
+  */
+int mixedRandom32Bytes(uint8_t *buffer)
+{
+	uint32_t i;
+	uint32_t index;
+	bool any_pending;
+	int r;
+	int supplementary_credit;
+
+	while (true)
+	{
+		// Begin requests on all idle sources before polling any of them,
+		// so that slow sources can work in the background.
+		for (i = 0; i < num_sources; i++)
+		{
+			index = (next_source + i) % num_sources;
+			if (source_state[index] == SOURCE_IDLE)
+			{
+				if ((sources[index]->begin == NULL) || !sources[index]->begin())
+				{
+					source_state[index] = SOURCE_PENDING;
+				}
+				else if (sourceFailed(index))
+				{
+					return -1;
+				}
+			}
+		}
+
+		any_pending = false;
+		for (i = 0; i < num_sources; i++)
+		{
+			index = (next_source + i) % num_sources;
+			if (sources[index]->supplementary || (source_state[index] != SOURCE_PENDING))
+			{
+				continue;
+			}
+			any_pending = true;
+			r = sources[index]->poll(buffer);
+			if (r > 0)
+			{
+				source_state[index] = SOURCE_IDLE;
+				next_source = (index + 1) % num_sources;
+				supplementary_credit = mixSupplementarySources(buffer);
+				if (supplementary_credit < 0)
+				{
+					return -1;
+				}
+				return MIN(r, sources[index]->max_credit) + supplementary_credit;
+			}
+			else if (r < 0)
+			{
+				if (sourceFailed(index))
+				{
+					return -1;
+				}
+			}
+		}
+		if (!any_pending)
+		{
+			return -1; // no usable sources
+		}
+	}
+}
+
+#ifdef TEST_ENTROPY_MIXER
+
+/** Number of mock sources. */
+#define NUM_MOCKS			3
+
+/** Number of times each mock source's begin function has been called. */
+static int mock_begin_count[NUM_MOCKS];
+/** Number of times each mock source's poll function has been called. */
+static int mock_poll_count[NUM_MOCKS];
+/** If true, the corresponding mock source's begin function will fail. */
+static bool mock_begin_fails[NUM_MOCKS];
+/** Number of polls that each mock source stays busy for, after begin. */
+static int mock_busy_polls[NUM_MOCKS];
+/** Value each mock source's poll function returns once it is no longer
+  * busy. */
+static int mock_result[NUM_MOCKS];
+/** Number of polls remaining until each mock source is ready. */
+static int mock_remaining[NUM_MOCKS];
+
+/** Common implementation of the mock sources' begin functions.
+  * \param which Index of the mock source.
+  * \return See EntropySource#begin.
+  */
+static bool mockBegin(int which)
+{
+	mock_begin_count[which]++;
+	mock_remaining[which] = mock_busy_polls[which];
+	return mock_begin_fails[which];
+}
+
+/** Common implementation of the mock sources' poll functions. When ready,
+  * this fills the buffer with (which + 1), so that tests can tell which
+  * source the bytes came from.
+  * \param which Index of the mock source.
+  * \param buffer See EntropySource#poll.
+  * \return See EntropySource#poll.
+  */
+static int mockPoll(int which, uint8_t *buffer)
+{
+	mock_poll_count[which]++;
+	if (mock_remaining[which] > 0)
+	{
+		mock_remaining[which]--;
+		memset(buffer, 0xff, 32);
+		return 0;
+	}
+	memset(buffer, which + 1, 32);
+	return mock_result[which];
+}
+
+static bool mockBegin0(void) { return mockBegin(0); }
+static bool mockBegin1(void) { return mockBegin(1); }
+static bool mockBegin2(void) { return mockBegin(2); }
+static int mockPoll0(uint8_t *buffer) { return mockPoll(0, buffer); }
+static int mockPoll1(uint8_t *buffer) { return mockPoll(1, buffer); }
+static int mockPoll2(uint8_t *buffer) { return mockPoll(2, buffer); }
+
+/** The mock sources. Their credit limits and required flags are set by
+  * resetMocks(). */
+static EntropySource mock_sources[NUM_MOCKS] = {
+	{mockBegin0, mockPoll0, 0, false, false},
+	{mockBegin1, mockPoll1, 0, false, false},
+	{mockBegin2, mockPoll2, 0, false, false}};
+
+/** Unregister all sources and reset all mock sources to a default state:
+  * never busy, reporting 16 bits of entropy, with 16 bits credited, not
+  * required and with begin functions that succeed. */
+static void resetMocks(void)
+{
+	int i;
+
+	clearEntropySources();
+	for (i = 0; i < NUM_MOCKS; i++)
+	{
+		mock_begin_count[i] = 0;
+		mock_poll_count[i] = 0;
+		mock_begin_fails[i] = false;
+		mock_busy_polls[i] = 0;
+		mock_result[i] = 16;
+		mock_remaining[i] = 0;
+		mock_sources[i].max_credit = 16;
+		mock_sources[i].required = false;
+		mock_sources[i].supplementary = false;
+	}
+}
+
+/** Call mixedRandom32Bytes() and check its return value and which source
+  * the bytes came from.
+  * \param expected_return Expected return value of mixedRandom32Bytes().
+  * \param expected_source Index of the mock source which is expected to have
+  *                        filled the buffer. This is ignored if
+  *                        expected_return is negative.
+  * \param description Name of the test case, printed on failure.
+  */
+static void checkMixer(int expected_return, int expected_source, const char *description)
+{
+	uint8_t buffer[32];
+	uint8_t expected_bytes[32];
+	int r;
+
+	r = mixedRandom32Bytes(buffer);
+	memset(expected_bytes, expected_source + 1, 32);
+	if ((r != expected_return)
+		|| ((expected_return >= 0) && (memcmp(buffer, expected_bytes, 32) != 0)))
+	{
+		printf("%s: got %d from source %d, expected %d from source %d\n", description, r, buffer[0] - 1, expected_return, expected_source);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Call mixedRandom32Bytes() repeatedly until it has credited at least 512
+  * bits (which is what getRandom256Internal() requires), and count how many
+  * calls that took.
+  * \return The number of calls, or -1 if mixedRandom32Bytes() failed.
+  */
+static int callsFor512Bits(void)
+{
+	uint8_t buffer[32];
+	int total;
+	int calls;
+	int r;
+
+	total = 0;
+	calls = 0;
+	while (total < 512)
+	{
+		r = mixedRandom32Bytes(buffer);
+		if (r < 0)
+		{
+			return -1;
+		}
+		total += r;
+		calls++;
+	}
+	return calls;
+}
+
+/** Check that a counter has the expected value.
+  * \param actual The counter.
+  * \param expected The expected value of the counter.
+  * \param description Name of the test case, printed on failure.
+  */
+static void checkCount(int actual, int expected, const char *description)
+{
+	if (actual != expected)
+	{
+		printf("%s: got %d, expected %d\n", description, actual, expected);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+int main(void)
+{
+	int i;
+
+	initTests(__FILE__);
+
+	// No sources at all.
+	resetMocks();
+	checkMixer(-1, 0, "No sources");
+
+	// Registering too many sources should fail.
+	resetMocks();
+	for (i = 0; i < MAX_ENTROPY_SOURCES; i++)
+	{
+		if (addEntropySource(&(mock_sources[0])))
+		{
+			printf("Couldn't add source %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	if (!addEntropySource(&(mock_sources[0])))
+	{
+		printf("Could add more than MAX_ENTROPY_SOURCES sources\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Credit should be capped, but not raised.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	mock_result[0] = 100;
+	checkMixer(16, 0, "Credit cap");
+	mock_result[0] = 5;
+	checkMixer(5, 0, "Credit below cap");
+
+	// A supplementary source's bytes are XORed into the other source's
+	// buffer (giving bytes of 1 ^ 2 = 3, as if from source 2), and its
+	// capped credit is added, without any extra polls of the other source.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].supplementary = true;
+	mock_sources[1].max_credit = 2;
+	checkMixer(18, 2, "Supplementary source 1");
+	checkMixer(18, 2, "Supplementary source 2");
+	checkCount(mock_poll_count[0], 2, "Poll count with supplementary source");
+
+	// A busy supplementary source doesn't delay the other source, and its
+	// request is left pending until it is ready.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].supplementary = true;
+	mock_sources[1].max_credit = 2;
+	mock_busy_polls[1] = 2;
+	checkMixer(16, 0, "Busy supplementary source 1");
+	checkMixer(16, 0, "Busy supplementary source 2");
+	checkMixer(18, 2, "Busy supplementary source 3");
+	checkCount(mock_begin_count[1], 1, "Busy supplementary source begin count");
+	checkCount(mock_poll_count[0], 3, "Poll count with busy supplementary source");
+
+	// With the ATSHA204's credit (1/8 of an ADC batch), fewer ADC batches
+	// are needed for 512 bits: 29 instead of 32.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	checkCount(callsFor512Bits(), 32, "Calls for 512 bits without supplementary source");
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].supplementary = true;
+	mock_sources[1].max_credit = 2;
+	checkCount(callsFor512Bits(), 29, "Calls for 512 bits with supplementary source");
+	checkCount(mock_poll_count[0], 29, "ADC-like polls for 512 bits");
+
+	// A failing supplementary source is dropped.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].supplementary = true;
+	mock_result[1] = -1;
+	checkMixer(16, 0, "Supplementary source fails");
+	checkMixer(16, 0, "Supplementary source stays disabled");
+	checkCount(mock_begin_count[1], 1, "Disabled supplementary source begin count");
+
+	// Supplementary sources can't fill a buffer on their own.
+	resetMocks();
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].supplementary = true;
+	checkMixer(-1, 0, "Only supplementary sources");
+
+	// Sources which are always ready should be used in turn.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	addEntropySource(&(mock_sources[2]));
+	for (i = 0; i < 9; i++)
+	{
+		checkMixer(16, i % NUM_MOCKS, "Round robin");
+	}
+
+	// A slow source should be begun once and left working while a fast
+	// source is used.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_busy_polls[0] = 3;
+	checkMixer(16, 1, "Slow and fast 1");
+	checkMixer(16, 1, "Slow and fast 2");
+	checkMixer(16, 1, "Slow and fast 3");
+	checkMixer(16, 0, "Slow and fast 4");
+	checkCount(mock_begin_count[0], 1, "Slow source begin count");
+	checkCount(mock_begin_count[1], 4, "Fast source begin count");
+	checkMixer(16, 1, "Slow and fast 5");
+	checkCount(mock_begin_count[0], 2, "Slow source begin count after completion");
+
+	// If every source is busy, the mixer should keep polling.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	mock_busy_polls[0] = 10;
+	checkMixer(16, 0, "Busy source");
+	checkCount(mock_poll_count[0], 11, "Busy source poll count");
+
+	// A failing optional source should be ignored from then on.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_result[0] = -1;
+	checkMixer(16, 1, "Optional source fails");
+	checkMixer(16, 1, "Optional source stays disabled");
+	checkCount(mock_begin_count[0], 1, "Disabled source begin count");
+
+	// So should an optional source which fails to begin.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_begin_fails[0] = true;
+	checkMixer(16, 1, "Optional source fails to begin");
+	checkCount(mock_poll_count[0], 0, "Optional source poll count");
+
+	// If all sources fail, the mixer fails.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_result[0] = -1;
+	mock_result[1] = -1;
+	checkMixer(-1, 0, "All optional sources fail");
+
+	// A failing required source is fatal, even if other sources are fine.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].required = true;
+	mock_result[1] = -1;
+	checkMixer(16, 0, "Required source fails 1");
+	checkMixer(-1, 0, "Required source fails 2");
+	mock_result[1] = 16;
+	checkMixer(16, 1, "Required source recovers 1");
+	checkMixer(16, 0, "Required source recovers 2");
+
+	// Same for a required source which fails to begin.
+	resetMocks();
+	addEntropySource(&(mock_sources[0]));
+	addEntropySource(&(mock_sources[1]));
+	mock_sources[1].required = true;
+	mock_begin_fails[1] = true;
+	checkMixer(-1, 0, "Required source fails to begin");
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_ENTROPY_MIXER
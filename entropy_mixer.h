@@ -0,0 +1,53 @@
+/** \file entropy_mixer.h
+  *
+  * \brief Describes types and functions exported by entropy_mixer.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef ENTROPY_MIXER_H_INCLUDED
+#define ENTROPY_MIXER_H_INCLUDED
+
+#include "common.h"
+
+/** Maximum number of entropy sources which can be registered using
+  * addEntropySource(). */
+#define MAX_ENTROPY_SOURCES			4
+
+/** A source of random bytes which can be polled by mixedRandom32Bytes().
+  * Requests are split into a begin and a poll stage, so that a source which
+  * spends most of its time waiting on I/O can make progress while other
+  * sources are being polled. */
+typedef struct EntropySourceStruct
+{
+	/** Begin a request for 32 random bytes. This may be NULL if the source
+	  * doesn't need to do anything to begin a request. This should return
+	  * false on success, true on failure. */
+	bool (*begin)(void);
+	/** Check whether the request started by begin has completed. This has
+	  * the same interface as hardwareRandom32Bytes(), except that a return
+	  * value of 0 means "not ready yet; poll again later", and any bytes
+	  * written to the buffer in that case are discarded. A source must not
+	  * return 0 forever; if it gets stuck, it should time out and return a
+	  * negative number. */
+	int (*poll)(uint8_t *buffer);
+	/** The maximum number of bits of entropy which will be credited for
+	  * every 32 bytes this source returns, regardless of what poll reports.
+	  * This should be conservative for sources which cannot be tested. */
+	int max_credit;
+	/** If this is true, failure of this source is a failure of the whole
+	  * mixer. If this is false, a failed source is ignored from then on. */
+	bool required;
+	/** If this is true, this source never fills a buffer by itself.
+	  * Instead, whenever another source fills a buffer, this source is
+	  * polled once; if it is ready, its bytes are XORed into that buffer
+	  * and its credit is added. A slow supplementary source therefore never
+	  * delays mixedRandom32Bytes(). */
+	bool supplementary;
+} EntropySource;
+
+extern void clearEntropySources(void);
+extern bool addEntropySource(const EntropySource *source);
+extern int mixedRandom32Bytes(uint8_t *buffer);
+
+#endif // #ifndef ENTROPY_MIXER_H_INCLUDED
@@ -13,8 +13,8 @@
   *   emulation).
   * - The FFT size is fixed by #FFT_SIZE. If the FFT size is changed, some
   *   parts of this file will also need to be modified.
-  * - The use of lookup tables is minimised, resulting in smaller code at
-  *   the expense of slightly slower speed.
+  * - Lookup tables are used for bit reversal and for twiddle factors, so
+  *   that the inner loops of fft() don't need to compute either.
   * - The aim was for the code to be fast enough so that the LPC11Uxx (running
   *   at 48 Mhz) microcontrollers be capable of performing size 512 real FFTs
   *   on a 22050 Hz bandwidth signal in real-time.
@@ -24,12 +24,27 @@
   * This file is licensed as described by the file LICENCE.
   */
 
+#ifdef TEST_FFT
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_FFT
+
 #include "common.h"
 #include "fix16.h"
 #include "fft.h"
 
+/** 7th level of #R_DEF0 definition. */
+#define R_DEF7(x)	x,			x + 128
+/** 6th level of #R_DEF0 definition. */
+#define R_DEF6(x)	R_DEF7(x),	R_DEF7(x + 64)
+/** 5th level of #R_DEF0 definition. */
+#define R_DEF5(x)	R_DEF6(x),	R_DEF6(x + 32)
+/** 4th level of #R_DEF0 definition. */
+#define R_DEF4(x)	R_DEF5(x),	R_DEF5(x + 16)
 /** 3rd level of #R_DEF0 definition. */
-#define R_DEF3(x)	x,			x + 8
+#define R_DEF3(x)	R_DEF4(x),	R_DEF4(x + 8)
 /** 2nd level of #R_DEF0 definition. */
 #define R_DEF2(x)	R_DEF3(x),	R_DEF3(x + 4)
 /** 1st level of #R_DEF0 definition. */
@@ -39,9 +54,13 @@
   * accessed 18-July-2012. */
 #define R_DEF0(x)	R_DEF1(x),	R_DEF1(x + 1)
 
+#if FFT_SIZE != 256
+#error "You may need to update bit_reverse_lookup."
+#endif
 /** Bit reverse lookup table. Its contents are defined by recursively using
-  * the C preprocessor. reverseBits() uses this to reverse groups of bits. */
-static const uint8_t bit_reverse_lookup[16] =
+  * the C preprocessor. Entry i is i with its 8 bits reversed, so fft() can
+  * reorder its input data without having to compute any bit reversals. */
+static const uint8_t bit_reverse_lookup[FFT_SIZE] =
 {R_DEF0(0)};
 
 #if FFT_SIZE != 256
@@ -80,6 +99,56 @@ const uint16_t twiddle_factor_lookup[128] = {
 0xfec4, 0xff0e, 0xff4e, 0xff85, 0xffb1, 0xffd4, 0xffec, 0xfffb
 };
 
+#if FFT_SIZE != 256
+#error "You may need to update radix4_twiddle_lookup using gen_twiddle."
+#endif
+/** Lookup table of twiddle factors (complex roots of unity) for fft(). This
+  * table is sin(phi), where phi is in [0, 2 * pi), sampled at multiples of
+  * 2 * pi / #FFT_SIZE. Since cos(phi) = sin(phi + pi / 2), both components
+  * of a twiddle factor can be read straight from this table without
+  * checking which quadrant phi is in (see getRadix4TwiddleFactor()).
+  *
+  * Entries are in Q16.16 fixed-point representation and agree with the
+  * corresponding entries of #twiddle_factor_lookup.
+  *
+  * Table generated using gen_twiddle.
+  * FFT size: 512.
+  */
+static const fix16_t radix4_twiddle_lookup[FFT_SIZE] = {
+0, 1608, 3216, 4821, 6424, 8022, 9616, 11204,
+12785, 14359, 15924, 17479, 19024, 20557, 22078, 23586,
+25080, 26558, 28020, 29466, 30893, 32303, 33692, 35062,
+36410, 37736, 39040, 40320, 41576, 42806, 44011, 45190,
+46341, 47464, 48559, 49624, 50660, 51665, 52639, 53581,
+54491, 55368, 56212, 57022, 57798, 58538, 59244, 59914,
+60547, 61145, 61705, 62228, 62714, 63162, 63572, 63944,
+64277, 64571, 64827, 65043, 65220, 65358, 65457, 65516,
+65536, 65516, 65457, 65358, 65220, 65043, 64827, 64571,
+64277, 63944, 63572, 63162, 62714, 62228, 61705, 61145,
+60547, 59914, 59244, 58538, 57798, 57022, 56212, 55368,
+54491, 53581, 52639, 51665, 50660, 49624, 48559, 47464,
+46341, 45190, 44011, 42806, 41576, 40320, 39040, 37736,
+36410, 35062, 33692, 32303, 30893, 29466, 28020, 26558,
+25080, 23586, 22078, 20557, 19024, 17479, 15924, 14359,
+12785, 11204, 9616, 8022, 6424, 4821, 3216, 1608,
+0, -1608, -3216, -4821, -6424, -8022, -9616, -11204,
+-12785, -14359, -15924, -17479, -19024, -20557, -22078, -23586,
+-25080, -26558, -28020, -29466, -30893, -32303, -33692, -35062,
+-36410, -37736, -39040, -40320, -41576, -42806, -44011, -45190,
+-46341, -47464, -48559, -49624, -50660, -51665, -52639, -53581,
+-54491, -55368, -56212, -57022, -57798, -58538, -59244, -59914,
+-60547, -61145, -61705, -62228, -62714, -63162, -63572, -63944,
+-64277, -64571, -64827, -65043, -65220, -65358, -65457, -65516,
+-65536, -65516, -65457, -65358, -65220, -65043, -64827, -64571,
+-64277, -63944, -63572, -63162, -62714, -62228, -61705, -61145,
+-60547, -59914, -59244, -58538, -57798, -57022, -56212, -55368,
+-54491, -53581, -52639, -51665, -50660, -49624, -48559, -47464,
+-46341, -45190, -44011, -42806, -41576, -40320, -39040, -37736,
+-36410, -35062, -33692, -32303, -30893, -29466, -28020, -26558,
+-25080, -23586, -22078, -20557, -19024, -17479, -15924, -14359,
+-12785, -11204, -9616, -8022, -6424, -4821, -3216, -1608
+};
+
 /** Add two complex numbers.
   * \param op1 The first operand.
   * \param op2 The second operand.
@@ -135,23 +204,6 @@ static ComplexFixed complexFixedConjugate(ComplexFixed op1)
 	return r;
 }
 
-/** Reverse the bits in an integer. For example, 0x59 (0b01011001) becomes
-  * 0x9A (0b10011010).
-  * \param op1 The integer to reverse.
-  * \return The integer, with bits reversed.
-  * \warning The implementation of this function depends on #FFT_SIZE.
-  *          If #FFT_SIZE is changed, the code for this function will also
-  *          need to be changed.
-  */
-static uint32_t reverseBits(uint32_t op1)
-{
-#if FFT_SIZE != 256
-#error "You may need to update reverseBits()."
-#endif
-	return ((bit_reverse_lookup[op1 & 15] << 4)
-		+ bit_reverse_lookup[(op1 >> 4) & 15]);
-}
-
 /** Get the complex twiddle factor (complex root of unity) for a given angle.
   * This function uses the lookup table #twiddle_factor_lookup and complements
   * it with trigonometric symmetries.
@@ -205,21 +257,53 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
 	return r;
 }
 
-/** Perform a complex, in-place Fast Fourier Transform using the radix-2
+/** Get the complex twiddle factor (complex root of unity) used by fft().
+  * Unlike getTwiddleFactor(), this doesn't need to exploit any trigonometric
+  * symmetries, since #radix4_twiddle_lookup covers a full period.
+  * \param tf_index The angle, in radian * FFT_SIZE / (2 * pi). This parameter
+  *                 is range-checked.
+  * \param is_inverse If this is false, the complex conjugate of the twiddle
+  *                   factor (which is what a forward FFT uses) is returned.
+  * \return The complex twiddle factor.
+  */
+static ComplexFixed getRadix4TwiddleFactor(uint32_t tf_index, bool is_inverse)
+{
+	ComplexFixed r;
+
+	if (tf_index >= ((FFT_SIZE * 3) / 4))
+	{
+		// tf_index too large.
+		r.real = fix16_zero;
+		r.imag = fix16_zero;
+		fix16_error_occurred = true;
+		return r;
+	}
+	r.real = radix4_twiddle_lookup[tf_index + (FFT_SIZE / 4)];
+	r.imag = radix4_twiddle_lookup[tf_index];
+	if (!is_inverse)
+	{
+		r.imag = -r.imag;
+	}
+	return r;
+}
+
+/** Perform a complex, in-place Fast Fourier Transform using the radix-4
   * Cooley-Tukey algorithm.
   * This does a complex FFT of size #FFT_SIZE. If the input data is purely
   * real, this can do a real FFT of size #FFT_SIZE * 2, but that requires
   * some post-processing. See fftRealPostProcess() for more details.
   *
-  * The code was heavily inspired by Sergey Chernenko's FFT code, available
-  * from http://www.librow.com/articles/article-10, accessed 18-July-2012.
-  * Like Sergey's code, no recursion is used. Some changes:
-  * - A lookup table for twiddle factors (see getTwiddleFactor()) is used
-  *   instead of a trigonometric recurrence relation. This gives better
-  *   numerical performance, at little space cost.
-  * - If the twiddle factor is 1, no multiplication is done. For a size
-  *   512 complex FFT, this removes 12.5% of the multiplications, at little
-  *   space cost.
+  * The code was originally based on Sergey Chernenko's radix-2 FFT code,
+  * available from http://www.librow.com/articles/article-10, accessed
+  * 18-July-2012. Like Sergey's code, no recursion is used. Some changes:
+  * - Input data is still reordered using bit reversal, but each pass
+  *   combines two radix-2 stages into one radix-4 butterfly. Each butterfly
+  *   needs 3 complex multiplications instead of 4, and there are half as
+  *   many passes over the data.
+  * - A lookup table for twiddle factors (see getRadix4TwiddleFactor()) is
+  *   used instead of a trigonometric recurrence relation. This gives better
+  *   numerical performance.
+  * - If the twiddle factors are all 1, no multiplication is done.
   *
   * \param data The input data array. The output of the FFT will also be
   *             written here. This must be an array of size #FFT_SIZE.
@@ -227,26 +311,42 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
   *                   FFT.
   * \return false for success, true if an arithmetic error (eg. overflow)
   *         occurred.
+  * \warning #FFT_SIZE must be a power of 4.
   */
 bool fft(ComplexFixed *data, bool is_inverse)
 {
 	uint32_t i;
 	uint32_t j;
-	uint32_t pair;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t d;
 	uint32_t jump;
-	uint32_t match;
 	uint32_t tf_index; // twiddle factor index
 	uint32_t tf_step; // twiddle factor index increment
-	ComplexFixed factor; // twiddle factor
-	ComplexFixed product;
+	ComplexFixed factor1; // twiddle factor for data[c]
+	ComplexFixed factor2; // twiddle factor for data[b]
+	ComplexFixed factor3; // twiddle factor for data[d]
+	ComplexFixed product_b;
+	ComplexFixed product_c;
+	ComplexFixed product_d;
+	ComplexFixed sum_ab;
+	ComplexFixed diff_ab;
+	ComplexFixed sum_cd;
+	ComplexFixed diff_cd;
+	ComplexFixed rotated;
 	ComplexFixed temp;
 
+#if (FFT_SIZE & 0x55555555) == 0
+#error "FFT_SIZE not a power of 4"
+#endif // #if (FFT_SIZE & 0x55555555) == 0
+
 	fix16_error_occurred = false;
 
 	// Do in-place input data reordering.
 	for (i = 0; i < FFT_SIZE; i++)
 	{
-		j = reverseBits(i);
+		j = bit_reverse_lookup[i];
 		if (j > i) // only swap if not already swapped
 		{
 			temp = data[i];
@@ -255,38 +355,69 @@ bool fft(ComplexFixed *data, bool is_inverse)
 		}
 	}
 
-	// Perform the actual FFT calculation.
-	tf_step = FFT_SIZE;
-	for (i = 1; i < FFT_SIZE; i <<= 1)
+	// Perform the actual FFT calculation. Each radix-4 butterfly does the
+	// same job as two consecutive radix-2 stages would do on data[a],
+	// data[b], data[c] and data[d].
+	factor1.real = fix16_one;
+	factor1.imag = fix16_zero;
+	factor2 = factor1;
+	factor3 = factor1;
+	tf_step = FFT_SIZE / 4;
+	for (i = 1; i < FFT_SIZE; i <<= 2)
 	{
-		jump = i << 1;
+		jump = i << 2;
 		tf_index = 0;
 		for (j = 0; j < i; j++)
 		{
-			factor = getTwiddleFactor(tf_index);
-			if (!is_inverse)
+			if (tf_index != 0)
 			{
-				factor = complexFixedConjugate(factor);
+				factor1 = getRadix4TwiddleFactor(tf_index, is_inverse);
+				factor2 = getRadix4TwiddleFactor(tf_index * 2, is_inverse);
+				factor3 = getRadix4TwiddleFactor(tf_index * 3, is_inverse);
 			}
-			for (pair = j; pair < FFT_SIZE; pair += jump)
+			for (a = j; a < FFT_SIZE; a += jump)
 			{
-				match = pair + i;
+				b = a + i;
+				c = b + i;
+				d = c + i;
 				if (tf_index == 0)
 				{
-					// Save multiplications since factor = 1.0.
-					product = data[match];
+					// Save multiplications since all factors = 1.0.
+					product_b = data[b];
+					product_c = data[c];
+					product_d = data[d];
+				}
+				else
+				{
+					product_b = complexFixedMultiply(factor2, data[b]);
+					product_c = complexFixedMultiply(factor1, data[c]);
+					product_d = complexFixedMultiply(factor3, data[d]);
+				}
+				sum_ab = complexFixedAdd(data[a], product_b);
+				diff_ab = complexFixedSubtract(data[a], product_b);
+				sum_cd = complexFixedAdd(product_c, product_d);
+				diff_cd = complexFixedSubtract(product_c, product_d);
+				// Multiply diff_cd by -i (forward) or i (inverse). This is
+				// the only twiddle factor which is shared by every butterfly.
+				if (is_inverse)
+				{
+					rotated.real = fix16_sub(fix16_zero, diff_cd.imag);
+					rotated.imag = diff_cd.real;
 				}
 				else
 				{
-					product = complexFixedMultiply(factor, data[match]);
+					rotated.real = diff_cd.imag;
+					rotated.imag = fix16_sub(fix16_zero, diff_cd.real);
 				}
-				data[match] = complexFixedSubtract(data[pair], product);
-				data[pair] = complexFixedAdd(data[pair], product);
+				data[a] = complexFixedAdd(sum_ab, sum_cd);
+				data[b] = complexFixedAdd(diff_ab, rotated);
+				data[c] = complexFixedSubtract(sum_ab, sum_cd);
+				data[d] = complexFixedSubtract(diff_ab, rotated);
 			}
 			tf_index += tf_step;
 		}
-		tf_step >>= 1;
-	} // end for (i = 1; i < FFT_SIZE; i <<= 1)
+		tf_step >>= 2;
+	} // end for (i = 1; i < FFT_SIZE; i <<= 2)
 
 	if (is_inverse)
 	{
@@ -301,6 +432,69 @@ bool fft(ComplexFixed *data, bool is_inverse)
 	return fix16_error_occurred;
 }
 
+/** Compute one pair of bins of a real FFT of size 2 * #FFT_SIZE from the
+  * output of fft(). Bins i and (#FFT_SIZE - i) depend only on data[i] and
+  * data[#FFT_SIZE - i], so they can be computed together, without
+  * modifying data. This allows callers which only need some function of
+  * each bin (eg. its squared magnitude) to consume the bins as they are
+  * produced, instead of having to write the whole real FFT result out
+  * first; see fftPostProcessReal() for how to prepare the input.
+  *
+  * When i is 0, out_low receives the DC bin and out_high receives the Nyquist
+  * bin. When i is #FFT_SIZE / 2, both outputs refer to the same bin, and
+  * out_high is the one that should be used.
+  *
+  * This does not clear #fix16_error_occurred, so that callers can check
+  * for arithmetic errors once, after computing all the bins they need.
+  * \param data The data array which fft() has operated on. This must be an
+  *             array of size #FFT_SIZE. It is not modified.
+  * \param i Index of the lower bin of the pair. This must be between 0
+  *          and #FFT_SIZE / 2 inclusive.
+  * \param is_inverse Whether to perform an inverse FFT instead of a forward
+  *                   FFT. This does not do the scaling (by 1/2) that
+  *                   fftPostProcessReal() does for inverse FFTs.
+  * \param out_low Bin i of the real FFT will be written here.
+  * \param out_high Bin (#FFT_SIZE - i) of the real FFT will be written here.
+  */
+void fftRealBinPair(const ComplexFixed *data, uint32_t i, bool is_inverse, ComplexFixed *out_low, ComplexFixed *out_high)
+{
+	uint32_t j;
+	fix16_t real_sum;
+	fix16_t imag_diff;
+	ComplexFixed twiddled;
+	ComplexFixed twiddle_factor;
+
+	if (i == 0)
+	{
+		// DC and Nyquist bins.
+		out_low->real = fix16_add(data[0].real, data[0].imag);
+		out_low->imag = fix16_zero;
+		out_high->real = fix16_sub(data[0].real, data[0].imag);
+		out_high->imag = fix16_zero;
+		return;
+	}
+
+	// Split the real and imaginary spectra.
+	j = FFT_SIZE - i;
+	real_sum = fix16_add(data[i].real, data[j].real);
+	twiddled.real = fix16_sub(data[i].real, data[j].real); // real_diff
+	twiddled.imag = fix16_add(data[i].imag, data[j].imag); // imag_sum
+	imag_diff = fix16_sub(data[i].imag, data[j].imag);
+	// Since the input is the result of a FFT of size FFT_SIZE and we want
+	// a FFT of size FFT_SIZE * 2, additional twiddling is necessary.
+	twiddle_factor = getTwiddleFactor(i);
+	if (!is_inverse)
+	{
+		twiddle_factor = complexFixedConjugate(twiddle_factor);
+	}
+	twiddled = complexFixedMultiply(twiddled, twiddle_factor);
+	out_low->real = fix16_mul(fix16_add(real_sum, twiddled.imag), FIX16_RECIPROCAL_OF(2));
+	out_low->imag = fix16_mul(fix16_sub(imag_diff, twiddled.real), FIX16_RECIPROCAL_OF(2));
+	out_high->real = fix16_mul(fix16_sub(real_sum, twiddled.imag), FIX16_RECIPROCAL_OF(2));
+	out_high->imag = fix16_mul(fix16_add(twiddled.real, imag_diff), FIX16_RECIPROCAL_OF(2));
+	*out_high = complexFixedConjugate(*out_high);
+}
+
 /** Post-process the results of a complex FFT to get the results of a real FFT
   * of twice the size. To do a real FFT:
   * - Place even entries of the real input data into the real components of
@@ -315,6 +509,9 @@ bool fft(ComplexFixed *data, bool is_inverse)
   * data in-place, the output will be truncated after the Nyquist bin. This
   * is no loss because the output of a real FFT has Hermitian symmetry.
   *
+  * If the real FFT result is only going to be consumed once, bin by bin,
+  * it is cheaper to call fftRealBinPair() directly.
+  *
   * The code for this function was heavily inspired by the "realbifftstage()"
   * function from http://www.katjaas.nl/realFFT/realFFT2.html, accessed 4
   * August 2012.
@@ -332,47 +529,19 @@ bool fft(ComplexFixed *data, bool is_inverse)
 bool fftPostProcessReal(ComplexFixed *data, bool is_inverse)
 {
 	uint32_t i;
-	uint32_t j;
-	fix16_t real_sum;
-	fix16_t imag_diff;
-	fix16_t temp;
-	ComplexFixed twiddled;
-	ComplexFixed twiddle_factor;
+	ComplexFixed bin_low;
+	ComplexFixed bin_high;
 
 	fix16_error_occurred = false;
 
-	// Split the real and imaginary spectra.
-	i = FFT_SIZE / 2;
-	j = FFT_SIZE / 2;
-	while (i != 0)
-	{
-		real_sum = fix16_add(data[i].real, data[j].real);
-		twiddled.real = fix16_sub(data[i].real, data[j].real); // real_diff
-		twiddled.imag = fix16_add(data[i].imag, data[j].imag); // imag_sum
-		imag_diff = fix16_sub(data[i].imag, data[j].imag);
-		// Since the input is the result of a FFT of size FFT_SIZE and we want
-		// a FFT of size FFT_SIZE * 2, additional twiddling is necessary.
-		twiddle_factor = getTwiddleFactor(i);
-		if (!is_inverse)
-		{
-			twiddle_factor = complexFixedConjugate(twiddle_factor);
-		}
-		twiddled = complexFixedMultiply(twiddled, twiddle_factor);
-		data[i].real = fix16_mul(fix16_add(real_sum, twiddled.imag), FIX16_RECIPROCAL_OF(2));
-		data[i].imag = fix16_mul(fix16_sub(imag_diff, twiddled.real), FIX16_RECIPROCAL_OF(2));
-		data[j].real = fix16_mul(fix16_sub(real_sum, twiddled.imag), FIX16_RECIPROCAL_OF(2));
-		data[j].imag = fix16_mul(fix16_add(twiddled.real, imag_diff), FIX16_RECIPROCAL_OF(2));
-		data[j] = complexFixedConjugate(data[j]);
-		i--;
-		j++;
-	}
-
-	// Fix up DC and Nyquist bins.
-	temp = data[0].real;
-	data[0].real = fix16_add(temp, data[0].imag);
-	data[FFT_SIZE].real = fix16_sub(temp, data[0].imag);
-	data[0].imag = fix16_zero;
-	data[FFT_SIZE].imag = fix16_zero;
+	// Each pair of bins only depends on the entries that it overwrites, so
+	// this can be done in-place.
+	for (i = 0; i <= (FFT_SIZE / 2); i++)
+	{
+		fftRealBinPair(data, i, is_inverse, &bin_low, &bin_high);
+		data[i] = bin_low;
+		data[FFT_SIZE - i] = bin_high;
+	}
 
 	if (is_inverse)
 	{
@@ -386,4 +555,255 @@ bool fftPostProcessReal(ComplexFixed *data, bool is_inverse)
 	return fix16_error_occurred;
 }
 
+#ifdef TEST_FFT
+
+/** Largest absolute error allowed in any real or imaginary component of an
+  * FFT output, compared to a floating-point reference. The inputs used
+  * below have magnitudes of at most 1.0, so outputs of a forward FFT can be
+  * as large as #FFT_SIZE. */
+#define FFT_TOLERANCE		0.005
+
+/** Compute a discrete Fourier transform directly from its definition, in
+  * floating-point. This is slow, but is obviously correct.
+  * \param out_real The real components of the result will be written here.
+  * \param out_imag The imaginary components of the result will be written
+  *                 here.
+  * \param in_real The real components of the input.
+  * \param in_imag The imaginary components of the input.
+  * \param size The number of points. All arrays must have this many
+  *             entries.
+  * \param is_inverse Whether to do an inverse DFT (which is scaled by
+  *                   1 / size, like fft()'s) instead of a forward DFT.
+  */
+static void referenceDft(double *out_real, double *out_imag, const double *in_real, const double *in_imag, uint32_t size, bool is_inverse)
+{
+	uint32_t k;
+	uint32_t n;
+	double angle;
+	double sign;
+
+	sign = is_inverse ? 1.0 : -1.0;
+	for (k = 0; k < size; k++)
+	{
+		out_real[k] = 0.0;
+		out_imag[k] = 0.0;
+		for (n = 0; n < size; n++)
+		{
+			// (k * n) is reduced mod size to keep the angle accurate.
+			angle = sign * 2.0 * M_PI * (double)((k * n) % size) / (double)size;
+			out_real[k] += in_real[n] * cos(angle) - in_imag[n] * sin(angle);
+			out_imag[k] += in_real[n] * sin(angle) + in_imag[n] * cos(angle);
+		}
+		if (is_inverse)
+		{
+			out_real[k] /= (double)size;
+			out_imag[k] /= (double)size;
+		}
+	}
+}
+
+/** Check that one fixed-point complex value is close to a floating-point
+  * reference.
+  * \param actual The fixed-point value.
+  * \param expected_real The real component of the reference.
+  * \param expected_imag The imaginary component of the reference.
+  * \return false if the value is close enough, true if it isn't.
+  */
+static bool isFarFrom(ComplexFixed actual, double expected_real, double expected_imag)
+{
+	return (fabs((double)actual.real / 65536.0 - expected_real) > FFT_TOLERANCE)
+		|| (fabs((double)actual.imag / 65536.0 - expected_imag) > FFT_TOLERANCE);
+}
+
+/** Run fft() on some input and compare its output to referenceDft().
+  * \param in_real The real components of the input. This must have
+  *                #FFT_SIZE entries.
+  * \param in_imag The imaginary components of the input. This must have
+  *                #FFT_SIZE entries.
+  * \param is_inverse Whether to do an inverse FFT.
+  * \param description Printed if the check fails.
+  */
+static void checkFft(const double *in_real, const double *in_imag, bool is_inverse, const char *description)
+{
+	uint32_t i;
+	uint32_t bad_bins;
+	ComplexFixed data[FFT_SIZE];
+	double expected_real[FFT_SIZE];
+	double expected_imag[FFT_SIZE];
+
+	for (i = 0; i < FFT_SIZE; i++)
+	{
+		data[i].real = (fix16_t)floor(in_real[i] * 65536.0 + 0.5);
+		data[i].imag = (fix16_t)floor(in_imag[i] * 65536.0 + 0.5);
+	}
+	referenceDft(expected_real, expected_imag, in_real, in_imag, FFT_SIZE, is_inverse);
+	if (fft(data, is_inverse))
+	{
+		printf("%s: arithmetic error\n", description);
+		reportFailure();
+		return;
+	}
+	bad_bins = 0;
+	for (i = 0; i < FFT_SIZE; i++)
+	{
+		if (isFarFrom(data[i], expected_real[i], expected_imag[i]))
+		{
+			if (bad_bins == 0)
+			{
+				printf("%s: bin %u is (%f, %f), expected (%f, %f)\n", description, i, (double)data[i].real / 65536.0, (double)data[i].imag / 65536.0, expected_real[i], expected_imag[i]);
+			}
+			bad_bins++;
+		}
+	}
+	if (bad_bins != 0)
+	{
+		printf("%s: %u bins differ from the reference DFT\n", description, bad_bins);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Do a real FFT of size 2 * #FFT_SIZE by packing the input into fft(),
+  * then splitting the result (with fftRealBinPair() and with
+  * fftPostProcessReal()). Compare both to a full complex DFT of size
+  * 2 * #FFT_SIZE.
+  * \param in The real input. This must have 2 * #FFT_SIZE entries.
+  * \param description Printed if the check fails.
+  */
+static void checkRealFft(const double *in, const char *description)
+{
+	uint32_t i;
+	uint32_t bad_bins;
+	ComplexFixed data[FFT_SIZE + 1];
+	ComplexFixed bin_low;
+	ComplexFixed bin_high;
+	double zeroes[FFT_SIZE * 2];
+	double expected_real[FFT_SIZE * 2];
+	double expected_imag[FFT_SIZE * 2];
+
+	memset(zeroes, 0, sizeof(zeroes));
+	referenceDft(expected_real, expected_imag, in, zeroes, FFT_SIZE * 2, false);
+	for (i = 0; i < FFT_SIZE; i++)
+	{
+		data[i].real = (fix16_t)floor(in[2 * i] * 65536.0 + 0.5);
+		data[i].imag = (fix16_t)floor(in[2 * i + 1] * 65536.0 + 0.5);
+	}
+	if (fft(data, false))
+	{
+		printf("%s: arithmetic error\n", description);
+		reportFailure();
+		return;
+	}
+
+	// Bin pairs, as consumed by accumulatePowerSpectralDensity().
+	bad_bins = 0;
+	for (i = 0; i <= (FFT_SIZE / 2); i++)
+	{
+		fftRealBinPair(data, i, false, &bin_low, &bin_high);
+		if ((i != (FFT_SIZE / 2)) && isFarFrom(bin_low, expected_real[i], expected_imag[i]))
+		{
+			bad_bins++;
+		}
+		if (isFarFrom(bin_high, expected_real[FFT_SIZE - i], expected_imag[FFT_SIZE - i]))
+		{
+			bad_bins++;
+		}
+	}
+	if (bad_bins != 0)
+	{
+		printf("%s: %u bin pairs differ from the full DFT\n", description, bad_bins);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Whole real FFT, written out in-place.
+	if (fftPostProcessReal(data, false))
+	{
+		printf("%s: arithmetic error in post-processing\n", description);
+		reportFailure();
+		return;
+	}
+	bad_bins = 0;
+	for (i = 0; i <= FFT_SIZE; i++)
+	{
+		if (isFarFrom(data[i], expected_real[i], expected_imag[i]))
+		{
+			bad_bins++;
+		}
+	}
+	if (bad_bins != 0)
+	{
+		printf("%s: %u post-processed bins differ from the full DFT\n", description, bad_bins);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+int main(void)
+{
+	uint32_t i;
+	double in_real[FFT_SIZE];
+	double in_imag[FFT_SIZE];
+	double real_input[FFT_SIZE * 2];
+
+	initTests(__FILE__);
+	srand(42);
+
+	// Impulse at the origin: every output bin is 1.
+	memset(in_real, 0, sizeof(in_real));
+	memset(in_imag, 0, sizeof(in_imag));
+	in_real[0] = 1.0;
+	checkFft(in_real, in_imag, false, "Impulse at 0");
+
+	// Impulses elsewhere exercise every twiddle factor.
+	in_real[0] = 0.0;
+	in_real[1] = 1.0;
+	checkFft(in_real, in_imag, false, "Impulse at 1");
+	in_real[1] = 0.0;
+	in_imag[FFT_SIZE - 3] = -1.0;
+	checkFft(in_real, in_imag, false, "Imaginary impulse");
+	checkFft(in_real, in_imag, true, "Imaginary impulse (inverse)");
+
+	// A pure tone which isn't centred on a bin.
+	for (i = 0; i < FFT_SIZE; i++)
+	{
+		in_real[i] = 0.9 * cos(2.0 * M_PI * 10.3 * (double)i / FFT_SIZE);
+		in_imag[i] = 0.9 * sin(2.0 * M_PI * 10.3 * (double)i / FFT_SIZE);
+	}
+	checkFft(in_real, in_imag, false, "Tone");
+
+	// Random data, forward and inverse.
+	for (i = 0; i < FFT_SIZE; i++)
+	{
+		in_real[i] = (double)(rand() % 2001 - 1000) / 1000.0;
+		in_imag[i] = (double)(rand() % 2001 - 1000) / 1000.0;
+	}
+	checkFft(in_real, in_imag, false, "Random");
+	checkFft(in_real, in_imag, true, "Random (inverse)");
+
+	// Real FFTs of twice the size.
+	for (i = 0; i < (FFT_SIZE * 2); i++)
+	{
+		real_input[i] = 0.5 * cos(2.0 * M_PI * 37.0 * (double)i / (FFT_SIZE * 2)) + 0.25;
+	}
+	checkRealFft(real_input, "Real tone");
+	for (i = 0; i < (FFT_SIZE * 2); i++)
+	{
+		real_input[i] = (double)(rand() % 2001 - 1000) / 1000.0;
+	}
+	checkRealFft(real_input, "Real random");
+
+	finishTests();
+	exit(0);
+}
 
+#endif // #ifdef TEST_FFT
@@ -19,9 +19,9 @@
   * FFT when the input is complex-valued. If the input is real-valued, then
   * fft() is capable of doing an FFT of twice this size. When doing a
   * real-valued FFT of twice this size, some post-processing is necessary;
-  * see fftPostProcessReal() for more information.
+  * see fftPostProcessReal() and fftRealBinPair() for more information.
   *
-  * \warning This must be a power of 2, since fft.c uses a radix-2 FFT
+  * \warning This must be a power of 4, since fft.c uses a radix-4 FFT
   *          algorithm.
   */
 #define FFT_SIZE	256
@@ -37,6 +37,7 @@ typedef struct ComplexFixed_struct
 } ComplexFixed;
 
 extern bool fft(ComplexFixed *data, bool is_inverse);
+extern void fftRealBinPair(const ComplexFixed *data, uint32_t i, bool is_inverse, ComplexFixed *out_low, ComplexFixed *out_high);
 extern bool fftPostProcessReal(ComplexFixed *data, bool is_inverse);
 
 #endif // #ifndef FFT_H_INCLUDED
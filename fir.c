@@ -0,0 +1,234 @@
+/** \file fir.c
+  *
+  * \brief Implements a decimating FIR filter for the HWRNG front end.
+  *
+  * The hardware random number generator signal can be oversampled and then
+  * low-pass filtered in the digital domain, to improve the robustness of
+  * the HWRNG to high-frequency interference. firDecimate() does the
+  * filtering and decimation in one pass, treating the input buffer as
+  * circular so that every sample in the buffer is treated fairly.
+  *
+  * Two properties of the filter are exploited to reduce the amount of work:
+  * - Only the outputs which survive decimation are computed. This is the
+  *   polyphase decomposition of a decimating filter: each kept output is the
+  *   sum of the ratio sub-filters applied to their own input phase, which is
+  *   the same as evaluating the full filter at that output only.
+  * - The coefficients are symmetric (linear phase), so the two samples which
+  *   share a coefficient can be added before multiplying. This roughly halves
+  *   the number of multiplies.
+  *
+  * Circular addressing is only needed for the few outputs whose window
+  * wraps around the end of the input buffer. Those outputs are computed from
+  * a small linear guard buffer which holds the samples on either side of the
+  * wrap point, so the inner loop never has to mask indices.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_FIR
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_FIR
+
+#include "common.h"
+#include "fir.h"
+
+/** Apply a symmetric FIR filter to a linear window of samples.
+  * \param window Pointer to the first sample in the window. The window
+  *               contains (2 * half_order + 1) samples.
+  * \param coefficients Array of FIR filter coefficients, in Q16.16
+  *                     fixed-point representation. Only the first
+  *                     (half_order + 1) coefficients are used.
+  * \param half_order See firDecimate().
+  * \return The output sample, rounded to the nearest integer.
+  */
+static int32_t firFoldedKernel(const volatile uint16_t *window, const int32_t *coefficients, const uint32_t half_order)
+{
+	int32_t sum; // Q16.16 fixed-point representation
+	uint32_t i;
+
+	sum = ((int32_t)window[half_order]) * coefficients[half_order];
+	for (i = 0; i < half_order; i++)
+	{
+		sum += ((int32_t)window[i] + (int32_t)window[2 * half_order - i]) * coefficients[i];
+	}
+	return (sum >> 16) + ((sum >> 15) & 1); // round result
+}
+
+/** Low-pass filter and decimate a circular buffer of samples.
+  *
+  * Output j is centred on input sample (j * ratio), so the
+  * (2 * half_order + 1) point filter does not introduce any delay. Input
+  * indices which fall outside [0, in_length) wrap around; that is, this
+  * does a circular convolution. The result is bit-identical to evaluating
+  * the full (unfolded) filter at every kept output.
+  * \param out Array which will receive (in_length / ratio) filtered samples.
+  * \param in Array of in_length input samples. This is read, but
+  *           not written.
+  * \param in_length Number of samples in the input array. This must be a
+  *                  multiple of ratio and must be at
+  *                  least (4 * half_order).
+  * \param ratio Decimation ratio. Every ratio-th filtered sample is kept.
+  * \param coefficients Array of (2 * half_order + 1) FIR filter coefficients,
+  *                     in Q16.16 fixed-point representation. The
+  *                     coefficients must be symmetric, i.e. coefficients[i]
+  *                     must equal coefficients[2 * half_order - i].
+  * \param half_order Half the order (number of coefficients, rounded down)
+  *                   of the filter. This must not be greater
+  *                   than #FIR_MAX_HALF_ORDER.
+  * \warning All filter coefficients should have a magnitude of less than one.
+  */
+void firDecimate(volatile uint16_t *out, const volatile uint16_t *in, const uint32_t in_length, const uint32_t ratio, const int32_t *coefficients, const uint32_t half_order)
+{
+	// The guard buffer holds in[in_length - 2 * half_order ... in_length - 1]
+	// followed by in[0 ... 2 * half_order - 1]. That covers the window of
+	// every output which wraps around either end of the input buffer.
+	uint16_t guard[4 * FIR_MAX_HALF_ORDER];
+	uint32_t guard_offset;
+	uint32_t i;
+	uint32_t p;
+	uint32_t j;
+
+	guard_offset = in_length - 2 * half_order;
+	for (i = 0; i < 2 * half_order; i++)
+	{
+		guard[i] = in[guard_offset + i];
+		guard[2 * half_order + i] = in[i];
+	}
+
+	j = 0;
+	// Outputs whose window begins before the start of the input buffer.
+	for (p = 0; p < half_order; p += ratio)
+	{
+		out[j++] = (uint16_t)firFoldedKernel(&(guard[p + half_order]), coefficients, half_order);
+	}
+	// Outputs whose window lies entirely within the input buffer.
+	for (; (p + half_order) < in_length; p += ratio)
+	{
+		out[j++] = (uint16_t)firFoldedKernel(&(in[p - half_order]), coefficients, half_order);
+	}
+	// Outputs whose window extends past the end of the input buffer.
+	for (; p < in_length; p += ratio)
+	{
+		out[j++] = (uint16_t)firFoldedKernel(&(guard[p - half_order - guard_offset]), coefficients, half_order);
+	}
+}
+
+#ifdef TEST_FIR
+
+/** Number of samples in each test input buffer. */
+#define TEST_LENGTH		1024
+
+/** Low-pass filter coefficients used by the PIC32 HWRNG. */
+static const int32_t pic32_coefficients[17] = {
+-123, 202, 711, 0, -2681, -2929, 5309, 19161,
+26236,
+19161, 5309, -2929, -2681, 0, 711, 202, -123};
+
+/** Reference implementation: evaluate the full filter at one output,
+  * using circular addressing on every tap.
+  * \param in See firDecimate().
+  * \param in_length See firDecimate().
+  * \param centre Index of the input sample that the output is centred on.
+  * \param coefficients See firDecimate().
+  * \param half_order See firDecimate().
+  * \return The output sample.
+  */
+static int32_t referenceFilter(const uint16_t *in, uint32_t in_length, uint32_t centre, const int32_t *coefficients, uint32_t half_order)
+{
+	int32_t sum;
+	uint32_t i;
+	uint32_t index;
+
+	sum = 0;
+	for (i = 0; i < (2 * half_order + 1); i++)
+	{
+		index = (centre + in_length - half_order + i) % in_length;
+		sum += ((int32_t)in[index]) * coefficients[i];
+	}
+	return (sum >> 16) + ((sum >> 15) & 1);
+}
+
+/** Filter a buffer with firDecimate() and compare every output against
+  * referenceFilter().
+  * \param in Input samples.
+  * \param in_length See firDecimate().
+  * \param ratio See firDecimate().
+  * \param coefficients See firDecimate().
+  * \param half_order See firDecimate().
+  */
+static void checkAgainstReference(const uint16_t *in, uint32_t in_length, uint32_t ratio, const int32_t *coefficients, uint32_t half_order)
+{
+	uint16_t out[TEST_LENGTH];
+	uint32_t j;
+	bool failed;
+
+	firDecimate(out, in, in_length, ratio, coefficients, half_order);
+	failed = false;
+	for (j = 0; j < (in_length / ratio); j++)
+	{
+		if (out[j] != (uint16_t)referenceFilter(in, in_length, j * ratio, coefficients, half_order))
+		{
+			printf("Mismatch at output %u, ratio = %u, half_order = %u\n", j, ratio, half_order);
+			failed = true;
+			break;
+		}
+	}
+	if (failed)
+	{
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+int main(void)
+{
+	uint16_t in[TEST_LENGTH];
+	int32_t coefficients[2 * FIR_MAX_HALF_ORDER + 1];
+	uint32_t half_order;
+	uint32_t ratio;
+	uint32_t i;
+	int iteration;
+
+	initTests(__FILE__);
+
+	// Use the PIC32 HWRNG parameters on random 10-bit ADC samples.
+	for (iteration = 0; iteration < 100; iteration++)
+	{
+		for (i = 0; i < TEST_LENGTH; i++)
+		{
+			in[i] = (uint16_t)(rand() & 0x3ff);
+		}
+		checkAgainstReference(in, TEST_LENGTH, 2, pic32_coefficients, 8);
+	}
+
+	// Try other ratios and filter sizes, with random symmetric coefficients.
+	for (half_order = 0; half_order <= FIR_MAX_HALF_ORDER; half_order++)
+	{
+		for (ratio = 1; ratio <= 4; ratio++)
+		{
+			for (i = 0; i <= half_order; i++)
+			{
+				coefficients[i] = (rand() & 0x1fff) - 0x1000;
+				coefficients[2 * half_order - i] = coefficients[i];
+			}
+			for (i = 0; i < TEST_LENGTH; i++)
+			{
+				in[i] = (uint16_t)(rand() & 0x3ff);
+			}
+			checkAgainstReference(in, TEST_LENGTH, ratio, coefficients, half_order);
+			// Smallest permitted input length.
+			checkAgainstReference(in, 4 * ratio * (half_order + 1), ratio, coefficients, half_order);
+		}
+	}
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_FIR
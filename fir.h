@@ -0,0 +1,21 @@
+/** \file fir.h
+  *
+  * \brief Describes functions and constants exported by fir.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef FIR_H_INCLUDED
+#define FIR_H_INCLUDED
+
+#include "common.h"
+
+/** Maximum supported value of the half_order parameter of firDecimate().
+  * This determines the size of the guard buffer that firDecimate() places
+  * on the stack.
+  */
+#define FIR_MAX_HALF_ORDER			16
+
+extern void firDecimate(volatile uint16_t *out, const volatile uint16_t *in, const uint32_t in_length, const uint32_t ratio, const int32_t *coefficients, const uint32_t half_order);
+
+#endif // #ifndef FIR_H_INCLUDED
@@ -13,6 +13,9 @@
   *   returning #fix16_overflow.
   * - Moved fix16_log2() into fix16.c.
   * - Changed fix16_log2() to avoid division.
+  * - Made rounding and overflow detection in the 64-bit fix16_mul()
+  *   branch-free.
+  * - Added a 64-bit squaring fast path to fix16_log2().
   *
   * The rest of the file was written mainly by the libfixmath contributors.
   * A list of contributors can be retrieved from
@@ -21,6 +24,13 @@
   * This file is licensed as described by the file LIBFIXMATH_LICENCE.
   */
 
+#ifdef TEST_FIX16
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_FIX16
+
 #include "common.h"
 #include "fix16.h"
 #ifndef FIXMATH_NO_64BIT
@@ -74,10 +84,12 @@ fix16_t fix16_sub(fix16_t a, fix16_t b)
 	return diff;
 }
 
-/* 64-bit implementation for fix16_mul. Fastest version for e.g. ARM Cortex M3.
- * Performs a 32*32 -> 64bit multiplication. The middle 32 bits are the result,
- * bottom 16 bits are used for rounding, and upper 16 bits are used for overflow
- * detection.
+/* 64-bit implementation for fix16_mul. Fastest version for e.g. ARM Cortex M3
+ * and PIC32, where a 32*32 -> 64bit multiplication is a single instruction.
+ * The middle 32 bits are the result, bottom 16 bits are used for rounding,
+ * and upper 16 bits are used for overflow detection. Rounding and overflow
+ * detection are done without branching on the sign of the product, since
+ * that sign is unpredictable in FFT butterflies.
  */
  
 #if !defined(FIXMATH_NO_64BIT) && !defined(FIXMATH_OPTIMIZE_8BIT)
@@ -86,43 +98,23 @@ fix16_t fix16_mul(fix16_t inArg0, fix16_t inArg1)
 	int64_t product = (int64_t)inArg0 * inArg1;
 	
 	#ifndef FIXMATH_NO_OVERFLOW
-	// The upper 17 bits should all be the same (the sign).
-	uint32_t upper = (product >> 47);
-	#endif
-	
-	if (product < 0)
-	{
-		#ifndef FIXMATH_NO_OVERFLOW
-		if (~upper)
-		{
-			fix16_error_occurred = true;
-			return fix16_overflow;
-		}
-		#endif
-		
-		#ifndef FIXMATH_NO_ROUNDING
-		// This adjustment is required in order to round -1/2 correctly
-		product--;
-		#endif
-	}
-	else
+	// The upper 17 bits should all be the same (the sign), so upper
+	// should be either 0 or 0xFFFFFFFF.
+	uint32_t upper = (uint32_t)(product >> 47);
+	if ((upper + 1) > 1)
 	{
-		#ifndef FIXMATH_NO_OVERFLOW
-		if (upper)
-		{
-			fix16_error_occurred = true;
-			return fix16_overflow;
-		}
-		#endif
+		fix16_error_occurred = true;
+		return fix16_overflow;
 	}
+	#endif
 	
 	#ifdef FIXMATH_NO_ROUNDING
-	return product >> 16;
+	return (fix16_t)(product >> 16);
 	#else
-	fix16_t result = product >> 16;
-	result += (product & 0x8000) >> 15;
-	
-	return result;
+	// Round half away from zero. Subtracting 1 from negative products
+	// is required in order to round -1/2 correctly.
+	product += 0x8000 - (product < 0);
+	return (fix16_t)(product >> 16);
 	#endif
 }
 #endif
@@ -130,9 +122,15 @@ fix16_t fix16_mul(fix16_t inArg0, fix16_t inArg1)
 /* 32-bit implementation of fix16_mul. Potentially fast on 16-bit processors,
  * and this is a relatively good compromise for compilers that do not support
  * uint64_t. Uses 16*16->32bit multiplications.
+ * When the 64-bit implementation is being tested, this is also built (as
+ * fix16_mul_32bit), so that the two can be compared.
  */
 #if defined(FIXMATH_NO_64BIT) && !defined(FIXMATH_OPTIMIZE_8BIT)
 fix16_t fix16_mul(fix16_t inArg0, fix16_t inArg1)
+#elif defined(TEST_FIX16) && !defined(FIXMATH_OPTIMIZE_8BIT)
+static fix16_t fix16_mul_32bit(fix16_t inArg0, fix16_t inArg1)
+#endif
+#if (defined(FIXMATH_NO_64BIT) || defined(TEST_FIX16)) && !defined(FIXMATH_OPTIMIZE_8BIT)
 {
 	uint32_t product_lo_tmp;
 	fix16_t result;
@@ -305,6 +303,23 @@ static fix16_t fix16_rs(fix16_t x)
 	#endif
 }
 
+/**
+ * Squares x, where 1 <= x < 2. The result is rounded in the same way as
+ * fix16_mul() rounds.
+ */
+#if !defined(FIXMATH_NO_64BIT) && !defined(FIXMATH_NO_ROUNDING)
+static inline fix16_t fix16_square_normalised(fix16_t x)
+{
+	uint64_t product = (uint64_t)x * (uint64_t)x;
+	return (fix16_t)((product + 0x8000) >> 16);
+}
+#else
+static inline fix16_t fix16_square_normalised(fix16_t x)
+{
+	return fix16_mul(x, x);
+}
+#endif
+
 /**
  * Calculates the log base 2 of input.
  * Note that negative inputs are invalid! (will set #fix16_error_occurred,
@@ -345,9 +360,13 @@ fix16_t fix16_log2(fix16_t x)
 
 	if (x == 0) return (result << 16);
 
+	// From here on, 1 <= x < 2, so x * x cannot overflow. Where 64-bit
+	// intermediates are available, the squaring is done directly instead
+	// of through fix16_mul(), skipping its sign and overflow handling.
+	// Both give the same (rounded) result.
 	for (i = 16; i > 0; i--)
 	{
-		x = fix16_mul(x, x);
+		x = fix16_square_normalised(x);
 		result <<= 1;
 		if (x >= fix16_from_int(2))
 		{
@@ -356,9 +375,287 @@ fix16_t fix16_log2(fix16_t x)
 		}
 	}
 	#ifndef FIXMATH_NO_ROUNDING
-	x = fix16_mul(x, x);
+	x = fix16_square_normalised(x);
 	if (x >= fix16_from_int(2)) result++;
 	#endif
 
 	return result;
 }
+
+#ifdef TEST_FIX16
+
+/** Number of random test cases for each function. */
+#define NUM_RANDOM_TESTS		1000000
+
+/** Get a random fix16_t, with a magnitude that is uniformly distributed on a
+  * logarithmic scale, so that small and large numbers are tested equally.
+  * \return The random number.
+  */
+static fix16_t randomFix16(void)
+{
+	uint32_t r;
+	int shift;
+
+	r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	shift = rand() % 32;
+	r >>= shift;
+	if (rand() & 1)
+	{
+		return -(fix16_t)(r >> 1);
+	}
+	else
+	{
+		return (fix16_t)(r >> 1);
+	}
+}
+
+/** Check the result of fix16_mul() against a reference computed
+  * with 64-bit integers.
+  * \param a First operand.
+  * \param b Second operand.
+  * \return false if the result matched, true if it didn't.
+  */
+static bool checkMul(fix16_t a, fix16_t b)
+{
+	long long product;
+	long long magnitude;
+	long long expected;
+	fix16_t result;
+
+	product = (long long)a * (long long)b;
+	magnitude = (product < 0) ? -product : product;
+	// Results very close to the overflow threshold depend on rounding, so
+	// don't test those.
+	if ((magnitude > (1LL << 47) - (1LL << 17)) && (magnitude < (1LL << 47) + (1LL << 17)))
+	{
+		return false;
+	}
+	fix16_error_occurred = false;
+	result = fix16_mul(a, b);
+	if (magnitude >= (1LL << 47))
+	{
+		return !fix16_error_occurred;
+	}
+	// Round half away from zero.
+	expected = (magnitude + 0x8000) >> 16;
+	if (product < 0)
+	{
+		expected = -expected;
+	}
+	return fix16_error_occurred || (result != expected);
+}
+
+#ifndef FIXMATH_NO_64BIT
+/** Check that the 64-bit fix16_mul() and the 32-bit fix16_mul_32bit() give
+  * the same result and set #fix16_error_occurred in the same way.
+  * \param a First operand.
+  * \param b Second operand.
+  * \return false if the results matched, true if they didn't.
+  */
+static bool compareMulImplementations(fix16_t a, fix16_t b)
+{
+	fix16_t result_64bit;
+	fix16_t result_32bit;
+	bool error_64bit;
+	bool error_32bit;
+
+	fix16_error_occurred = false;
+	result_64bit = fix16_mul(a, b);
+	error_64bit = fix16_error_occurred;
+	fix16_error_occurred = false;
+	result_32bit = fix16_mul_32bit(a, b);
+	error_32bit = fix16_error_occurred;
+	return (result_64bit != result_32bit) || (error_64bit != error_32bit);
+}
+#endif // #ifndef FIXMATH_NO_64BIT
+
+/** Check the result of fix16_log2() against a floating-point reference.
+  * \param x The operand. This must be positive.
+  * \return false if the result was accurate, true if it wasn't.
+  */
+static bool checkLog2(fix16_t x)
+{
+	double expected;
+	fix16_t result;
+
+	fix16_error_occurred = false;
+	result = fix16_log2(x);
+	expected = log2((double)x / 65536.0) * 65536.0;
+	return fix16_error_occurred || (fabs((double)result - expected) > 4.0);
+}
+
+int main(void)
+{
+	int i;
+	int failed;
+	fix16_t x;
+	// Results of calls which are only made to check the error flag.
+	fix16_t discard;
+
+	initTests(__FILE__);
+
+	// Some simple cases.
+	if ((fix16_mul(fix16_from_int(3), fix16_from_int(-7)) == fix16_from_int(-21))
+		&& (fix16_mul(F16(0.5), F16(0.5)) == F16(0.25))
+		&& (fix16_mul(1, 0x8000) == 1) // 0.5 LSB rounds away from zero
+		&& (fix16_mul(-1, 0x8000) == -1))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_mul() fails simple cases\n");
+		reportFailure();
+	}
+	fix16_error_occurred = false;
+	discard = fix16_mul(fix16_from_int(256), fix16_from_int(128));
+	if (fix16_error_occurred)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_mul() doesn't detect overflow\n");
+		reportFailure();
+	}
+
+	// Random multiplications.
+	failed = 0;
+	for (i = 0; i < NUM_RANDOM_TESTS; i++)
+	{
+		if (checkMul(randomFix16(), randomFix16()))
+		{
+			failed++;
+		}
+	}
+	if (failed == 0)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%d random fix16_mul() tests failed\n", failed);
+		reportFailure();
+	}
+
+#ifndef FIXMATH_NO_64BIT
+	// The 64-bit fix16_mul() must give exactly the same results (including
+	// overflow detection) as the 32-bit one, which some platforms use.
+	failed = 0;
+	for (i = 0; i < NUM_RANDOM_TESTS; i++)
+	{
+		if (compareMulImplementations(randomFix16(), randomFix16()))
+		{
+			failed++;
+		}
+	}
+	// Include rounding edge cases and the boundaries of overflow.
+	if (compareMulImplementations(1, 0x8000)
+		|| compareMulImplementations(-1, 0x8000)
+		|| compareMulImplementations(3, -0x8000)
+		|| compareMulImplementations(fix16_from_int(181), fix16_from_int(181))
+		|| compareMulImplementations(fix16_from_int(182), fix16_from_int(-181))
+		|| compareMulImplementations(fix16_maximum, fix16_one)
+		|| compareMulImplementations(fix16_minimum, fix16_one)
+		|| compareMulImplementations(fix16_minimum, -fix16_one))
+	{
+		failed++;
+	}
+	if (failed == 0)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%d fix16_mul() results differ between 64-bit and 32-bit paths\n", failed);
+		reportFailure();
+	}
+#endif // #ifndef FIXMATH_NO_64BIT
+
+	// The squaring used by fix16_log2() must match fix16_mul() for every
+	// possible operand.
+	failed = 0;
+	for (x = fix16_one; x < fix16_from_int(2); x++)
+	{
+		if (fix16_square_normalised(x) != fix16_mul(x, x))
+		{
+			failed++;
+		}
+	}
+	if (failed == 0)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_square_normalised() doesn't match fix16_mul()\n");
+		reportFailure();
+	}
+
+	// Simple logarithms and invalid input.
+	if ((fix16_log2(fix16_one) == 0)
+		&& (fix16_log2(fix16_from_int(2)) == fix16_one)
+		&& (fix16_log2(F16(0.5)) == -fix16_one)
+		&& (fix16_log2(fix16_from_int(1024)) == fix16_from_int(10)))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_log2() fails simple cases\n");
+		reportFailure();
+	}
+	fix16_error_occurred = false;
+	discard = fix16_log2(0);
+	if (fix16_error_occurred)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_log2(0) doesn't set error flag\n");
+		reportFailure();
+	}
+	fix16_error_occurred = false;
+	discard = fix16_log2(-fix16_one);
+	if (fix16_error_occurred)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("fix16_log2() of negative number doesn't set error flag\n");
+		reportFailure();
+	}
+
+	// Random logarithms.
+	failed = 0;
+	for (i = 0; i < NUM_RANDOM_TESTS; i++)
+	{
+		x = randomFix16();
+		if (x < 0)
+		{
+			x = -x;
+		}
+		if ((x != 0) && checkLog2(x))
+		{
+			failed++;
+		}
+	}
+	if (failed == 0)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%d random fix16_log2() tests failed\n", failed);
+		reportFailure();
+	}
+
+	(void)discard;
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_FIX16
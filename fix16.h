@@ -11,6 +11,9 @@
   * - Moved add/subtract to fix16_inline.h.
   * - Removed C++ boilerplate and reference to "fix16.hpp".
   * - Added this header and some comments.
+  * - Added target-based selection of the fix16_mul() implementation.
+  * - Removed the const attribute from functions which set
+  *   #fix16_error_occurred.
   *
   * The rest of the file was written mainly by the libfixmath contributors.
   * A list of contributors can be retrieved from
@@ -24,13 +27,16 @@
 
 /*! These options may let the optimizer to remove some calls to the functions.
  *  Refer to http://gcc.gnu.org/onlinedocs/gcc/Function-Attributes.html
+ *  The functions are not declared const, because they write to
+ *  #fix16_error_occurred; with const, the compiler may assume that the flag
+ *  is unchanged across a call.
  */
 #ifndef FIXMATH_FUNC_ATTRS
 # ifdef __GNUC__
 #   if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ > 6)
-#     define FIXMATH_FUNC_ATTRS __attribute__((leaf, nothrow, const))
+#     define FIXMATH_FUNC_ATTRS __attribute__((leaf, nothrow))
 #   else
-#     define FIXMATH_FUNC_ATTRS __attribute__((nothrow, const))
+#     define FIXMATH_FUNC_ATTRS __attribute__((nothrow))
 #   endif
 # else
 #   define FIXMATH_FUNC_ATTRS
@@ -47,6 +53,19 @@
 
 #include "common.h"
 
+/*! Select the fix16_mul() implementation to suit the target, unless the
+ *  build has already chosen one. 64-bit intermediates are fastest where the
+ *  CPU has a 32x32->64 bit multiply (eg. PIC32, x86). Cortex-M0 only has a
+ *  32x32->32 bit multiply and AVR only has an 8x8->16 bit multiply, so
+ *  64-bit arithmetic would be emulated, slowly, on those.
+ */
+#if defined(__ARM_ARCH_6M__) && !defined(FIXMATH_NO_64BIT)
+#define FIXMATH_NO_64BIT
+#endif
+#if defined(__AVR__) && !defined(FIXMATH_OPTIMIZE_8BIT)
+#define FIXMATH_OPTIMIZE_8BIT
+#endif
+
 /*! Represent real numbers using the signed Q16.16 fixed-point representation.
  *  Numbers are stored in a signed 32 bit integer, where the least significant
  *  16 bits represent the fractional part and the most significant 16 bits
@@ -0,0 +1,124 @@
+/** \file fix16_bench.c
+  *
+  * \brief Micro-benchmark for fix16 arithmetic.
+  *
+  * This times fix16_mul(), fix16_log2() and a complete fft(), using
+  * whichever fix16_mul() implementation the build selects. The Makefile
+  * builds it twice: once with 64-bit intermediates and once with
+  * FIXMATH_NO_64BIT, so that the two can be compared on the same machine.
+  * Each benchmark also prints a checksum of its results; the checksums
+  * should be the same for both builds.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "../fix16.h"
+#include "../fft.h"
+
+/** Number of operands in each operand array. */
+#define NUM_OPERANDS		4096
+/** Number of times each benchmark goes through the operand arrays. */
+#define NUM_PASSES			2000
+/** Number of FFTs to time. */
+#define NUM_FFTS			20000
+
+/** First operands for fix16_mul(). */
+static fix16_t operand_a[NUM_OPERANDS];
+/** Second operands for fix16_mul(). */
+static fix16_t operand_b[NUM_OPERANDS];
+/** Operands for fix16_log2(). These are all positive. */
+static fix16_t operand_log[NUM_OPERANDS];
+
+/** Get the current time, in nanoseconds.
+  * \return The current time.
+  */
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1.0e9 + (double)t.tv_nsec;
+}
+
+/** Get a random fix16_t whose magnitude is less than limit.
+  * \param limit Upper bound on the magnitude.
+  * \return The random number.
+  */
+static fix16_t randomFix16(int32_t limit)
+{
+	return (fix16_t)((((uint32_t)rand() << 16) ^ (uint32_t)rand()) % (uint32_t)(2 * limit)) - limit;
+}
+
+int main(void)
+{
+	int i;
+	int pass;
+	uint32_t checksum;
+	double start;
+	double elapsed;
+	ComplexFixed data[FFT_SIZE];
+
+#ifdef FIXMATH_NO_64BIT
+	printf("fix16_mul(): 32-bit implementation\n");
+#else
+	printf("fix16_mul(): 64-bit implementation\n");
+#endif // #ifdef FIXMATH_NO_64BIT
+
+	srand(42);
+	// Operands are in the range typically seen in fft() and statistics.c,
+	// so that products don't overflow.
+	for (i = 0; i < NUM_OPERANDS; i++)
+	{
+		operand_a[i] = randomFix16(fix16_from_int(128));
+		operand_b[i] = randomFix16(fix16_from_int(128));
+		operand_log[i] = randomFix16(fix16_from_int(16384)) + fix16_from_int(16384) + 1;
+	}
+
+	checksum = 0;
+	start = now();
+	for (pass = 0; pass < NUM_PASSES; pass++)
+	{
+		for (i = 0; i < NUM_OPERANDS; i++)
+		{
+			checksum += (uint32_t)fix16_mul(operand_a[i], operand_b[i]);
+		}
+	}
+	elapsed = now() - start;
+	printf("fix16_mul():  %8.2f ns/call, checksum %08x\n", elapsed / ((double)NUM_PASSES * NUM_OPERANDS), checksum);
+
+	checksum = 0;
+	start = now();
+	for (pass = 0; pass < (NUM_PASSES / 20); pass++)
+	{
+		for (i = 0; i < NUM_OPERANDS; i++)
+		{
+			checksum += (uint32_t)fix16_log2(operand_log[i]);
+		}
+	}
+	elapsed = now() - start;
+	printf("fix16_log2(): %8.2f ns/call, checksum %08x\n", elapsed / ((double)(NUM_PASSES / 20) * NUM_OPERANDS), checksum);
+
+	checksum = 0;
+	elapsed = 0.0;
+	for (pass = 0; pass < NUM_FFTS; pass++)
+	{
+		for (i = 0; i < FFT_SIZE; i++)
+		{
+			data[i].real = operand_a[(pass + i) % NUM_OPERANDS] >> 8;
+			data[i].imag = operand_b[(pass + i) % NUM_OPERANDS] >> 8;
+		}
+		start = now();
+		fft(data, false);
+		elapsed += now() - start;
+		for (i = 0; i < FFT_SIZE; i++)
+		{
+			checksum += (uint32_t)data[i].real + (uint32_t)data[i].imag;
+		}
+	}
+	printf("fft():        %8.2f us/call, checksum %08x\n", elapsed / (1000.0 * NUM_FFTS), checksum);
+
+	exit(0);
+}
@@ -1,12 +1,13 @@
 /** \file gen_twiddle.c
   *
-  * \brief Generates fixed-point twiddle factor lookup table.
+  * \brief Generates fixed-point twiddle factor lookup tables.
   *
-  * This generates the twiddle factor lookup table for use in fft.c. This
-  * outputs the table as C source, with integer constants representing
+  * This generates the twiddle factor lookup tables for use in fft.c. This
+  * outputs the tables as C source, with integer constants representing
   * sin(phi) in 16.16 fixed-point format.
   *
-  * There are a couple of space optimisations:
+  * The first table (twiddle_factor_lookup) is used by
+  * fftPostProcessReal(). There are a couple of space optimisations:
   * - Only sin(phi) values for the first quadrant; phi in [0, pi / 2); are
   *   generated, since various symmetries of sin(phi) can be exploited in
   *   order to get values for the other quadrants.
@@ -16,6 +17,13 @@
   * - Only the fractional part of sin(phi) is outputted, since sin(phi) is in
   *   [0, 1) when phi is in [0, pi / 2).
   *
+  * The second table (radix4_twiddle_lookup) is used by fft(). It covers
+  * an entire period of sin(phi) for the complex FFT, so that fft() can
+  * fetch both sin(phi) and cos(phi) = sin(phi + pi / 2) without checking
+  * which quadrant phi is in. Entries are signed and are rounded away
+  * from zero, so that they match the first table wherever both are
+  * defined.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -34,11 +42,13 @@ int main(int argc, char **argv)
 	int fft_size;
 	int table_size;
 	unsigned int out; // C spec guarantees unsigned int can hold [0, 65535]
+	long signed_out;
+	double phi;
 
 	if (argc != 2)
 	{
 		printf("Usage: %s <size>\n", argv[0]);
-		printf("  <size>: size of (complex) FFT\n");
+		printf("  <size>: size of real FFT (twice the size of complex FFT)\n");
 		printf("\n");
 		exit(1);
 	}
@@ -77,4 +87,34 @@ int main(int argc, char **argv)
 		}
 	}
 	printf("};\n");
+	printf("\n");
+
+	// The complex FFT is half the size of the real FFT. fft() needs one
+	// full period of sin(phi), sampled at the complex FFT's roots of unity.
+	table_size = (fft_size / 2);
+	printf("// Table generated using gen_twiddle.\n");
+	printf("// FFT size: %d.\n", fft_size);
+	printf("static const fix16_t radix4_twiddle_lookup[%d] = {\n", table_size);
+	for (i = 0; i < table_size; i++)
+	{
+		phi = i * (2.0 * PI / (double)table_size);
+		if (sin(phi) >= 0.0)
+		{
+			signed_out = (long)(sin(phi) * (double)0x00010000 + 0.5);
+		}
+		else
+		{
+			signed_out = -(long)(-sin(phi) * (double)0x00010000 + 0.5);
+		}
+		printf("%ld", signed_out);
+		if (i != (table_size - 1))
+		{
+			printf(", ");
+		}
+		if ((i % VALUES_PER_LINE) == (VALUES_PER_LINE - 1))
+		{
+			printf("\n");
+		}
+	}
+	printf("};\n");
 }
@@ -27,6 +27,7 @@
 #include "common.h"
 #include "endian.h"
 #include "hmac_sha512.h"
+#include "perf_counters.h"
 
 #if defined(AVR) && defined(__GNUC__)
 #define LOOKUP_QWORD(x)		(my_pgm_read_qword_near(&(x)))
@@ -168,7 +169,9 @@ static void sha512Block(HashState64 *hs64)
 	uint64_t t1, t2;
 	uint8_t t;
 	uint64_t w[80];
+	PERF_DECLARE_START;
 
+	PERF_START();
 	for (t = 0; t < 16; t++)
 	{
 		w[t] = hs64->m[t];
@@ -206,6 +209,7 @@ static void sha512Block(HashState64 *hs64)
 	hs64->h[5] += f;
 	hs64->h[6] += g;
 	hs64->h[7] += h;
+	PERF_STOP(PERF_SHA512_BLOCK, 1);
 }
 
 /** Clear the message buffer.
@@ -301,23 +305,22 @@ static void sha512Finish(uint8_t *out, HashState64 *hs64)
 	}
 }
 
-/** Calculate a 64 byte HMAC of an arbitrary message and key using SHA-512 as
-  * the hash function.
-  * The code in here is based on the description in section 5
-  * ("HMAC SPECIFICATION") of FIPS PUB 198.
-  * \param out A byte array where the HMAC-SHA512 hash value will be written.
-  *            This must have space for #SHA512_HASH_LENGTH bytes.
+/** Prepare an HMAC-SHA512 key for repeated use. Every HMAC-SHA512
+  * calculation begins by hashing one block derived from the key (for the
+  * inner hash) and another block derived from the key (for the outer hash).
+  * Those blocks depend only on the key, so if many messages are to be
+  * authenticated with the same key, the hash states after those blocks can
+  * be saved and reused by hmacSha512Prepared(). This halves the work for
+  * short messages.
+  * \param prepared The prepared key will be written here. This is as
+  *                 sensitive as the key itself.
   * \param key A byte array containing the key to use in the HMAC-SHA512
   *            calculation. The key can be of any length.
   * \param key_length The length, in bytes, of the key.
-  * \param text A byte array containing the message to use in the HMAC-SHA512
-  *             calculation. The message can be of any length.
-  * \param text_length The length, in bytes, of the message.
   */
-void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length)
+void hmacSha512Prepare(HmacSha512Key *prepared, const uint8_t *key, const unsigned int key_length)
 {
 	unsigned int i;
-	uint8_t hash[SHA512_HASH_LENGTH];
 	uint8_t padded_key[128];
 	HashState64 hs64;
 
@@ -336,23 +339,61 @@ void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length,
 		}
 		sha512Finish(padded_key, &hs64);
 	}
-	// Calculate hash = H((K_0 XOR ipad) || text).
+	// Hash state after K_0 XOR ipad.
 	sha512Begin(&hs64);
 	for (i = 0; i < sizeof(padded_key); i++)
 	{
 		sha512WriteByte(&hs64, (uint8_t)(padded_key[i] ^ 0x36));
 	}
+	memcpy(prepared->inner_h, hs64.h, sizeof(prepared->inner_h));
+	// Hash state after K_0 XOR opad.
+	sha512Begin(&hs64);
+	for (i = 0; i < sizeof(padded_key); i++)
+	{
+		sha512WriteByte(&hs64, (uint8_t)(padded_key[i] ^ 0x5c));
+	}
+	memcpy(prepared->outer_h, hs64.h, sizeof(prepared->outer_h));
+	memset(padded_key, 0, sizeof(padded_key));
+	memset(&hs64, 0, sizeof(hs64));
+}
+
+/** Resume a SHA-512 hash from a state saved by hmacSha512Prepare(). The
+  * saved state is always exactly one block (128 bytes) into the message.
+  * \param hs64 The 64 bit hash state to initialise.
+  * \param h The saved hash value.
+  */
+static void sha512Resume(HashState64 *hs64, const uint64_t *h)
+{
+	memcpy(hs64->h, h, sizeof(hs64->h));
+	hs64->message_length = 128;
+	clearM(hs64);
+}
+
+/** Calculate a 64 byte HMAC of an arbitrary message using SHA-512 as the hash
+  * function, with a key that was prepared by hmacSha512Prepare(). The
+  * result is the same as the result of hmacSha512() with the original key.
+  * \param out A byte array where the HMAC-SHA512 hash value will be written.
+  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param prepared The prepared key.
+  * \param text A byte array containing the message to use in the HMAC-SHA512
+  *             calculation. The message can be of any length.
+  * \param text_length The length, in bytes, of the message.
+  */
+void hmacSha512Prepared(uint8_t *out, const HmacSha512Key *prepared, const uint8_t *text, const unsigned int text_length)
+{
+	unsigned int i;
+	uint8_t hash[SHA512_HASH_LENGTH];
+	HashState64 hs64;
+
+	// Calculate hash = H((K_0 XOR ipad) || text).
+	sha512Resume(&hs64, prepared->inner_h);
 	for (i = 0; i < text_length; i++)
 	{
 		sha512WriteByte(&hs64, text[i]);
 	}
 	sha512Finish(hash, &hs64);
 	// Calculate H((K_0 XOR opad) || hash).
-	sha512Begin(&hs64);
-	for (i = 0; i < sizeof(padded_key); i++)
-	{
-		sha512WriteByte(&hs64, (uint8_t)(padded_key[i] ^ 0x5c));
-	}
+	sha512Resume(&hs64, prepared->outer_h);
 	for (i = 0; i < sizeof(hash); i++)
 	{
 		sha512WriteByte(&hs64, hash[i]);
@@ -360,6 +401,28 @@ void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length,
 	sha512Finish(out, &hs64);
 }
 
+/** Calculate a 64 byte HMAC of an arbitrary message and key using SHA-512 as
+  * the hash function.
+  * The code in here is based on the description in section 5
+  * ("HMAC SPECIFICATION") of FIPS PUB 198.
+  * \param out A byte array where the HMAC-SHA512 hash value will be written.
+  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param key A byte array containing the key to use in the HMAC-SHA512
+  *            calculation. The key can be of any length.
+  * \param key_length The length, in bytes, of the key.
+  * \param text A byte array containing the message to use in the HMAC-SHA512
+  *             calculation. The message can be of any length.
+  * \param text_length The length, in bytes, of the message.
+  */
+void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length)
+{
+	HmacSha512Key prepared;
+
+	hmacSha512Prepare(&prepared, key, key_length);
+	hmacSha512Prepared(out, &prepared, text, text_length);
+	memset(&prepared, 0, sizeof(prepared));
+}
+
 #ifdef TEST_HMAC_SHA512
 
 /** Run unit tests using test vectors from a file. The file is expected to be
@@ -483,9 +546,71 @@ http://csrc.nist.gov/groups/STM/cavp/index.html#07", filename);
 	fclose(f);
 }
 
+/** Check that one prepared key gives the right results for several
+  * messages. This uses test case 2 and the SHA-512 result of test case 6
+  * from RFC 4231, which doesn't need any test vector files. Test case 6 has
+  * a key which is longer than one block.
+  */
+static void checkPreparedKey(void)
+{
+	HmacSha512Key prepared;
+	uint8_t out[SHA512_HASH_LENGTH];
+	uint8_t long_key[131];
+	const char *text2 = "what do ya want for nothing?";
+	const char *text6 = "Test Using Larger Than Block-Size Key - Hash Key First";
+	const uint8_t expected2[SHA512_HASH_LENGTH] = {
+		0x16, 0x4b, 0x7a, 0x7b, 0xfc, 0xf8, 0x19, 0xe2,
+		0xe3, 0x95, 0xfb, 0xe7, 0x3b, 0x56, 0xe0, 0xa3,
+		0x87, 0xbd, 0x64, 0x22, 0x2e, 0x83, 0x1f, 0xd6,
+		0x10, 0x27, 0x0c, 0xd7, 0xea, 0x25, 0x05, 0x54,
+		0x97, 0x58, 0xbf, 0x75, 0xc0, 0x5a, 0x99, 0x4a,
+		0x6d, 0x03, 0x4f, 0x65, 0xf8, 0xf0, 0xe6, 0xfd,
+		0xca, 0xea, 0xb1, 0xa3, 0x4d, 0x4a, 0x6b, 0x4b,
+		0x63, 0x6e, 0x07, 0x0a, 0x38, 0xbc, 0xe7, 0x37};
+	const uint8_t expected6[SHA512_HASH_LENGTH] = {
+		0x80, 0xb2, 0x42, 0x63, 0xc7, 0xc1, 0xa3, 0xeb,
+		0xb7, 0x14, 0x93, 0xc1, 0xdd, 0x7b, 0xe8, 0xb4,
+		0x9b, 0x46, 0xd1, 0xf4, 0x1b, 0x4a, 0xee, 0xc1,
+		0x12, 0x1b, 0x01, 0x37, 0x83, 0xf8, 0xf3, 0x52,
+		0x6b, 0x56, 0xd0, 0x37, 0xe0, 0x5f, 0x25, 0x98,
+		0xbd, 0x0f, 0xd2, 0x21, 0x5d, 0x6a, 0x1e, 0x52,
+		0x95, 0xe6, 0x4f, 0x73, 0xf6, 0x3f, 0x0a, 0xec,
+		0x8b, 0x91, 0x5a, 0x98, 0x5d, 0x78, 0x65, 0x98};
+	int i;
+
+	// The same prepared key is used twice, to check that
+	// hmacSha512Prepared() doesn't modify it.
+	hmacSha512Prepare(&prepared, (const uint8_t *)"Jefe", 4);
+	for (i = 0; i < 2; i++)
+	{
+		hmacSha512Prepared(out, &prepared, (const uint8_t *)text2, (unsigned int)strlen(text2));
+		if (memcmp(out, expected2, sizeof(out)))
+		{
+			printf("Prepared key test %d failed\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	memset(long_key, 0xaa, sizeof(long_key));
+	hmacSha512(out, long_key, sizeof(long_key), (const uint8_t *)text6, (unsigned int)strlen(text6));
+	if (memcmp(out, expected6, sizeof(out)))
+	{
+		printf("Long key test failed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
 int main(void)
 {
 	initTests(__FILE__);
+	checkPreparedKey();
 	scanTestVectors("HMAC.rsp");
 	finishTests();
 	exit(0);
@@ -13,6 +13,19 @@
 /** Number of bytes a SHA-512 hash requires. */
 #define SHA512_HASH_LENGTH		64
 
+/** An HMAC-SHA512 key which has been prepared for repeated use by
+  * hmacSha512Prepare(). This holds the SHA-512 hash states after the
+  * key-derived block of the inner and outer hashes. */
+typedef struct HmacSha512KeyStruct
+{
+	/** Hash value after hashing (K_0 XOR ipad). */
+	uint64_t inner_h[8];
+	/** Hash value after hashing (K_0 XOR opad). */
+	uint64_t outer_h[8];
+} HmacSha512Key;
+
+extern void hmacSha512Prepare(HmacSha512Key *prepared, const uint8_t *key, const unsigned int key_length);
+extern void hmacSha512Prepared(uint8_t *out, const HmacSha512Key *prepared, const uint8_t *text, const unsigned int text_length);
 extern void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length);
 
 #endif // #ifndef HMAC_SHA512_H_INCLUDED
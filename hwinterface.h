@@ -63,7 +63,10 @@ typedef enum AskUserCommandEnum
 	/** Do you want to give the host access to the master public key? */
 	ASKUSER_GET_MASTER_KEY		=	9,
 	/** Do you want to delete an existing wallet? */
-	ASKUSER_DELETE_WALLET		=	10
+	ASKUSER_DELETE_WALLET		=	10,
+	/** Do you want to create several new addresses in this wallet? The
+	  * number of addresses is set by setNewAddressesCount(). */
+	ASKUSER_NEW_ADDRESSES		=	11
 } AskUserCommand;
 
 /** Values for getString() function which specify which set of strings
@@ -184,6 +187,17 @@ extern void setTransactionFee(char *text_amount);
 /** Notify the user interface that the list of Bitcoin amount/address pairs
   * should be cleared. */
 extern void clearOutputsSeen(void);
+/** Maximum length of the text passed to setNewAddressesCount(), including
+  * the null terminator. This is enough for any 32-bit number. */
+#define TEXT_COUNT_LENGTH	11
+/** Notify the user interface of how many addresses
+  * an #ASKUSER_NEW_ADDRESSES request is for.
+  * \param text_count The number of addresses, as a null-terminated text
+  *                   string such as "64". This will be at
+  *                   most #TEXT_COUNT_LENGTH bytes long, including the
+  *                   null terminator.
+  */
+extern void setNewAddressesCount(char *text_count);
 /** Inform the user that an address has been generated.
   * \param address The output address, as a null-terminated text string
   *                such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
@@ -223,6 +237,20 @@ extern void clearOTP(void);
   */
 extern int hardwareRandom32Bytes(uint8_t *buffer);
 
+#ifdef DEBUG_PERF
+/** Get the current value of a free-running counter which is used to time
+  * operations for the performance counters (see perf_counters.c). The
+  * counter should increment at a constant rate and wrap around from
+  * 0xffffffff to 0.
+  * \return The current value of the counter.
+  */
+extern uint32_t getCycleCounter(void);
+/** Get the rate at which the counter read by getCycleCounter() increments.
+  * \return The rate, in counts per second.
+  */
+extern uint32_t getCycleCounterFrequency(void);
+#endif // #ifdef DEBUG_PERF
+
 /** Get size of a partition.
   * \param out_size On success, the size of the partition (in number of bytes)
   *                 will be written here.
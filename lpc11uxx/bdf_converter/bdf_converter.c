@@ -25,6 +25,17 @@
   * column. If you get to the bottom of the last column, move to the top-left
   * pixel of the next glyph.
   *
+  * If the "-c" option is given, a page-aligned, column-major table
+  * (font_columns) is output instead. In this format, every column of every
+  * glyph is stored as #FONT_COLUMN_PAGES whole bytes, one for each SSD1306
+  * GDDRAM page (8 pixel high row) that the column touches, with the least
+  * significant bit of each byte being the topmost pixel. A renderer can then
+  * copy the bytes straight into GDDRAM, without any bit-level extraction.
+  * If the glyph height is not a multiple of 8, lines of text don't start on
+  * page boundaries, so the table contains a pre-shifted copy of every glyph
+  * for each possible offset of a line within a page (see
+  * outputColumnTable()).
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -54,6 +65,22 @@ static int *bitmaps[ENCODING_END];
 /** Number of bytes on current line of C source output. */
 static int values_on_output_line;
 
+/** Get the value of one pixel of a glyph.
+  * \param bitmap The horizontal bitmap of the glyph.
+  * \param x The column of the pixel (0 = leftmost).
+  * \param y The row of the pixel (0 = topmost).
+  * \return Non-zero if the pixel is set, 0 if it is clear or if x or y are
+  *         out of range.
+  */
+static int getPixel(int *bitmap, int x, int y)
+{
+	if ((x < 0) || (x >= width) || (y < 0) || (y >= height))
+	{
+		return 0;
+	}
+	return bitmap[y * bytes_per_row + (x >> 3)] & (0x80 >> (x & 7));
+}
+
 /** Parse the definition of one glyph. The parser looks at everything between
   * the next occurence of "STARTCHAR <char_name>" and "ENDCHAR".
   * \param bdf The BDF file to parse.
@@ -178,29 +205,167 @@ static void outputTableByte(int output_byte, int no_comma)
 	}
 }
 
+/** Get the horizontal bitmap of a glyph.
+  * \param encoding The encoding value of the glyph.
+  * \param null_bitmap A bitmap of all 00s, to return if the font doesn't
+  *                    define the glyph.
+  * \return The bitmap of the glyph.
+  */
+static int *getGlyphBitmap(int encoding, int *null_bitmap)
+{
+	if (bitmaps[encoding] != NULL)
+	{
+		return bitmaps[encoding];
+	}
+	else
+	{
+		// Font doesn't define the glyph with this encoding value. Just
+		// use a bitmap of all 00s.
+		return null_bitmap;
+	}
+}
+
+/** Convert horizontal bitmaps into packed vertical bitmaps and output them
+  * as the body of font_table.
+  * \param null_bitmap A bitmap of all 00s, to output when the font doesn't
+  *                    define a glyph.
+  */
+static void outputPackedTable(int *null_bitmap)
+{
+	int i, j, k;
+	int *current_bitmap;
+	int output_byte;
+	int bits_shifted;
+
+	output_byte = 0;
+	bits_shifted = 0;
+	for (i = ENCODING_START; i < ENCODING_END; i++)
+	{
+		current_bitmap = getGlyphBitmap(i, null_bitmap);
+		for (j = 0; j < width; j++)
+		{
+			for (k = 0; k < height; k++)
+			{
+				output_byte >>= 1;
+				// Inspect pixel of glyph with encoding value i, at column
+				// j and row k.
+				if (getPixel(current_bitmap, j, k))
+				{
+					output_byte |= 0x80;
+				}
+				bits_shifted++;
+				if (bits_shifted == 8)
+				{
+					outputTableByte(output_byte, 0);
+					output_byte = 0;
+					bits_shifted = 0;
+				}
+			}
+		} // end for (j = 0; j < width; j++)
+	} // end for (i = ENCODING_START; i < ENCODING_END; i++)
+
+	// Take care of incomplete byte (if there is one).
+	if (bits_shifted != 0)
+	{
+		output_byte >>= (8 - bits_shifted);
+		outputTableByte(output_byte, 0);
+	}
+	// Finish off table with extra 00, as needed by ssd1306.c.
+	outputTableByte(0, 1);
+}
+
+/** Convert horizontal bitmaps into page-aligned, column-major bitmaps and
+  * output them as the body of font_columns.
+  *
+  * A line of text starting at pixel row y begins (y mod 8) pixels into a
+  * GDDRAM page. If lines are stacked directly on top of each other, y is
+  * always a multiple of the glyph height, so the only offsets which can
+  * occur are multiples of #FONT_COLUMN_SHIFT_STEP (the greatest common
+  * divisor of the glyph height and 8). The table contains every glyph
+  * pre-shifted down by each of those offsets, in order of increasing offset.
+  * Within each copy, glyphs are in order of encoding value, columns are
+  * left to right and pages are top to bottom. So the bytes for glyph g
+  * (with #FONT_TABLE_START already subtracted), column x and offset s begin
+  * at index:
+  * ((s / FONT_COLUMN_SHIFT_STEP) * number_of_glyphs + g) * width * FONT_COLUMN_PAGES + x * FONT_COLUMN_PAGES
+  * \param null_bitmap A bitmap of all 00s, to output when the font doesn't
+  *                    define a glyph.
+  * \param shift_step The greatest common divisor of the glyph height and 8.
+  * \param pages Number of pages that each column occupies. This must be
+  *              large enough for the largest offset.
+  */
+static void outputColumnTable(int *null_bitmap, int shift_step, int pages)
+{
+	int shift;
+	int i, j, k, b;
+	int *current_bitmap;
+	int output_byte;
+	int total_bytes;
+	int bytes_output;
+
+	total_bytes = (8 / shift_step) * (ENCODING_END - ENCODING_START) * width * pages;
+	bytes_output = 0;
+	for (shift = 0; shift < 8; shift += shift_step)
+	{
+		for (i = ENCODING_START; i < ENCODING_END; i++)
+		{
+			current_bitmap = getGlyphBitmap(i, null_bitmap);
+			for (j = 0; j < width; j++)
+			{
+				for (k = 0; k < pages; k++)
+				{
+					output_byte = 0;
+					for (b = 0; b < 8; b++)
+					{
+						// Bit b of page k is pixel row (k * 8 + b) of the
+						// display, relative to the top of the page where the
+						// glyph starts.
+						if (getPixel(current_bitmap, j, k * 8 + b - shift))
+						{
+							output_byte |= 1 << b;
+						}
+					}
+					bytes_output++;
+					outputTableByte(output_byte, bytes_output == total_bytes);
+				}
+			} // end for (j = 0; j < width; j++)
+		} // end for (i = ENCODING_START; i < ENCODING_END; i++)
+	} // end for (shift = 0; shift < 8; shift += shift_step)
+}
+
 int main(int argc, char **argv)
 {
 	char current_line[256];
 	char font_name[256];
+	char *file_name;
 	int found_font_name;
-	int i, j, k;
+	int column_major;
+	int shift_step;
+	int pages;
 	int *null_bitmap; // bitmap of all 00s, to output when the font doesn't define a glyph
-	int *current_bitmap;
-	int output_byte;
-	int mask;
-	int bits_shifted;
 	FILE *bdf;
 
-	if (argc != 2)
+	column_major = 0;
+	if ((argc == 3) && !strcmp(argv[1], "-c"))
+	{
+		column_major = 1;
+		file_name = argv[2];
+	}
+	else if (argc == 2)
 	{
-		printf("Usage: %s <bdf_file_name>\n", argv[0]);
+		file_name = argv[1];
+	}
+	else
+	{
+		printf("Usage: %s [-c] <bdf_file_name>\n", argv[0]);
+		printf("Use -c to output a page-aligned, column-major table.\n");
 		exit(1);
 	}
 
-	bdf = fopen(argv[1], "r");
+	bdf = fopen(file_name, "r");
 	if (bdf == NULL)
 	{
-		printf("Error: couldn't open \"%s\" for reading\n", argv[1]);
+		printf("Error: couldn't open \"%s\" for reading\n", file_name);
 		exit(1);
 	}
 
@@ -212,15 +377,12 @@ int main(int argc, char **argv)
 		if (sscanf(current_line, "FONT %s", font_name) == 1)
 		{
 			found_font_name = 1;
-			printf("// Table generated from file \"%s\" using bdf_converter.\n", argv[1]);
-			printf("// Font name: \"%s\".\n", font_name);
-			printf("const uint8_t font_table[] = {\n");
 			break;
 		}
 	}
 	if (!found_font_name)
 	{
-		printf("Error: couldn't find \"FONT\" in \"%s\", is it a BDF file?\n", argv[1]);
+		printf("Error: couldn't find \"FONT\" in \"%s\", is it a BDF file?\n", file_name);
 		fclose(bdf);
 		exit(1);
 	}
@@ -235,54 +397,31 @@ int main(int argc, char **argv)
 	}
 	fclose(bdf);
 
-	// Convert horizontal bitmaps into packed vertical bitmaps.
-	output_byte = 0;
 	null_bitmap = calloc(bytes_per_row * height, sizeof(int));
-	bits_shifted = 0;
 	values_on_output_line = 0;
-	for (i = ENCODING_START; i < ENCODING_END; i++)
+	if (column_major)
 	{
-		if (bitmaps[i] != NULL)
-		{
-			current_bitmap = bitmaps[i];
-		}
-		else
+		// The largest offset of a line within a page is 8 - shift_step.
+		shift_step = 8;
+		while ((height % shift_step) != 0)
 		{
-			// Font doesn't define the glyph with encoding value i. Just
-			// use a bitmap of all 00s.
-			current_bitmap = null_bitmap;
+			shift_step >>= 1;
 		}
-		for (j = 0; j < width; j++)
-		{
-			for (k = 0; k < height; k++)
-			{
-				output_byte >>= 1;
-				mask = 0x80 >> (j & 7);
-				// Inspect pixel of glyph with encoding value i, at column
-				// j and row k.
-				if (current_bitmap[k * bytes_per_row + (j >> 3)] & mask)
-				{
-					output_byte |= 0x80;
-				}
-				bits_shifted++;
-				if (bits_shifted == 8)
-				{
-					outputTableByte(output_byte, 0);
-					output_byte = 0;
-					bits_shifted = 0;
-				}
-			}
-		} // end for (j = 0; j < width; j++)
-	} // end for (i = ENCODING_START; i < ENCODING_END; i++)
-
-	// Take care of incomplete byte (if there is one).
-	if (bits_shifted != 0)
+		pages = (height + (8 - shift_step) + 7) >> 3; // round up
+		printf("// Table generated from file \"%s\" using bdf_converter -c.\n", file_name);
+		printf("// Font name: \"%s\".\n", font_name);
+		printf("#define FONT_COLUMN_SHIFT_STEP\t%d\n", shift_step);
+		printf("#define FONT_COLUMN_PAGES\t\t%d\n", pages);
+		printf("const uint8_t font_columns[] = {\n");
+		outputColumnTable(null_bitmap, shift_step, pages);
+	}
+	else
 	{
-		output_byte >>= (8 - bits_shifted);
-		outputTableByte(output_byte, 0);
+		printf("// Table generated from file \"%s\" using bdf_converter.\n", file_name);
+		printf("// Font name: \"%s\".\n", font_name);
+		printf("const uint8_t font_table[] = {\n");
+		outputPackedTable(null_bitmap);
 	}
-	// Finish off table with extra 00, as needed by ssd1306.c.
-	outputTableByte(0, 1);
 	printf("};\n");
 
 	exit(0);
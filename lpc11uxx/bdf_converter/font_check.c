@@ -0,0 +1,112 @@
+/** \file font_check.c
+  *
+  * \brief Checks the column-major font table output by bdf_converter.
+  *
+  * This compares every byte of font_columns (the output of
+  * "bdf_converter -c") against what ssd1306.c's renderer obtains from
+  * font_table (the output of plain "bdf_converter") using bit-level
+  * extraction. The renderer's extraction is reproduced here by
+  * lookupFontTable(), which is identical to the function of the same name in
+  * ssd1306.c. See the "check" target in the Makefile.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "font_table.inc"
+#include "font_columns.inc"
+
+/** Width of a single character, in number of pixels. This must match the
+  * font passed to bdf_converter. */
+#ifndef CHARACTER_WIDTH
+#define CHARACTER_WIDTH		8
+#endif
+/** Height of a single character, in number of pixels. This must match the
+  * font passed to bdf_converter. */
+#ifndef CHARACTER_HEIGHT
+#define CHARACTER_HEIGHT	16
+#endif
+/** Number of bits in #font_table that each character occupies. */
+#define CHARACTER_BITS		(CHARACTER_WIDTH * CHARACTER_HEIGHT)
+/** Number of glyphs in each table. This is ENCODING_END - ENCODING_START
+  * from bdf_converter.c. */
+#define NUMBER_OF_GLYPHS	96
+
+/** Font table byte lookup function which has bit granularity. This is
+  * copied from ssd1306.c.
+  * \param bit_offset The font table offset, in bits, to grab a byte from.
+  * \return A byte from within the font table.
+  */
+static uint8_t lookupFontTable(uint32_t bit_offset)
+{
+	uint32_t index;
+	uint32_t data;
+
+	index = bit_offset >> 3;
+	if (index >= (sizeof(font_table) - 1))
+	{
+		return 0; // empty character
+	}
+	data = font_table[index] | (font_table[index + 1] << 8);
+	return (uint8_t)(data >> (bit_offset & 7));
+}
+
+int main(void)
+{
+	uint32_t shift;
+	uint32_t glyph;
+	uint32_t x;
+	uint32_t page;
+	uint32_t bit;
+	int32_t row;
+	uint32_t index;
+	uint32_t mismatches;
+	uint8_t expected;
+
+	if (sizeof(font_columns) != ((8 / FONT_COLUMN_SHIFT_STEP) * NUMBER_OF_GLYPHS * CHARACTER_WIDTH * FONT_COLUMN_PAGES))
+	{
+		printf("font_columns has the wrong size (%u bytes)\n", (unsigned int)sizeof(font_columns));
+		exit(1);
+	}
+	mismatches = 0;
+	index = 0;
+	for (shift = 0; shift < 8; shift += FONT_COLUMN_SHIFT_STEP)
+	{
+		for (glyph = 0; glyph < NUMBER_OF_GLYPHS; glyph++)
+		{
+			for (x = 0; x < CHARACTER_WIDTH; x++)
+			{
+				for (page = 0; page < FONT_COLUMN_PAGES; page++)
+				{
+					expected = 0;
+					for (bit = 0; bit < 8; bit++)
+					{
+						row = (int32_t)(page * 8 + bit) - (int32_t)shift;
+						if ((row >= 0) && (row < CHARACTER_HEIGHT)
+							&& (lookupFontTable(glyph * CHARACTER_BITS + x * CHARACTER_HEIGHT + (uint32_t)row) & 1))
+						{
+							expected |= (uint8_t)(1 << bit);
+						}
+					}
+					if (font_columns[index] != expected)
+					{
+						printf("Mismatch at shift %u, glyph %u, column %u, page %u: got 0x%02x, expected 0x%02x\n",
+							shift, glyph, x, page, font_columns[index], expected);
+						mismatches++;
+					}
+					index++;
+				}
+			}
+		}
+	}
+	if (mismatches != 0)
+	{
+		printf("%u bytes of font_columns didn't match font_table\n", mismatches);
+		exit(1);
+	}
+	printf("font_columns matches font_table (%u bytes checked)\n", index);
+	exit(0);
+}
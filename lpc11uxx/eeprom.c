@@ -6,12 +6,29 @@
   * LPC11Uxx's EEPROM. The in application programming (IAP) interface is
   * used to access the EEPROM.
   *
+  * Writes are collected in a write-combining buffer which holds one EEPROM
+  * page. Each IAP "Write EEPROM" call has a significant fixed overhead, so
+  * instead of issuing one call per nonVolatileWrite() (and
+  * encryptedNonVolatileWrite() does one for every 16 byte block), buffered
+  * bytes are committed using one call per contiguous run within a page.
+  * This happens when a write moves on to a different page, or when
+  * nonVolatileFlush() is called. A write which crosses a page boundary
+  * isn't buffered; it goes straight to EEPROM in one call, as it did
+  * before writes were buffered. So no write ever costs more than one IAP
+  * call.
+  *
+  * Only iapEEPROM() calls into the IAP interface. The host-side tester (see
+  * eeprom_tester/) defines EEPROM_HOST_MODEL and supplies its own version of
+  * iapEEPROM(), so that the buffering logic can be tested without hardware.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
 #include "../common.h"
 #include "../hwinterface.h"
 
+#ifndef EEPROM_HOST_MODEL
+
 /** In application programming entry point. The 0th bit is set to force
   * the instruction mode to Thumb mode. */
 #define IAP_LOCATION 0x1fff1ff1;
@@ -27,6 +44,34 @@ static uint32_t iap_command[5];
 /** Storage for in application programming result buffer. */
 static uint32_t iap_result[5];
 
+/** Call one of the EEPROM-related IAP commands.
+  * \param command_code The IAP command code. Use 61 for "Write EEPROM" or
+  *                     62 for "Read EEPROM".
+  * \param address EEPROM address to start writing to/reading from.
+  * \param data RAM address to read from (for writes) or write to (for reads).
+  * \param length The number of bytes to write/read.
+  * \return false on success, true if the IAP command failed.
+  */
+static bool iapEEPROM(uint32_t command_code, uint32_t address, uint8_t *data, uint32_t length)
+{
+	iap_command[0] = command_code;
+	iap_command[1] = address; // EEPROM address
+	iap_command[2] = (uint32_t)data; // RAM address
+	iap_command[3] = length; // number of bytes to be written/read
+	iap_command[4] = 48000; // system clock frequency in kHz
+	iapEntry(iap_command, iap_result);
+	if (iap_result[0] == 0)
+	{
+		return false;
+	}
+	else
+	{
+		return true;
+	}
+}
+
+#endif // #ifndef EEPROM_HOST_MODEL
+
 /** Size of EEPROM, in number of bytes. This isn't 4096 because, according to
   * the LPC11Uxx user manual, the last 64 bytes must not be written to.
   * \warning This is set for LPC11Uxx microcontrollers with 4K of
@@ -34,6 +79,60 @@ static uint32_t iap_result[5];
   */
 #define EEPROM_SIZE		4032
 
+/** Size of an EEPROM page, in number of bytes. The EEPROM is programmed a
+  * page at a time, so writing part of a page costs about as much time as
+  * writing all of it.
+  * \warning This must be 64, since #page_dirty_mask has one bit per byte.
+  */
+#define EEPROM_PAGE_SIZE	64
+
+/** Write-combining buffer. This holds bytes which have been written to the
+  * EEPROM page beginning at #page_address, but which haven't been
+  * committed to EEPROM yet. */
+static uint8_t page_buffer[EEPROM_PAGE_SIZE];
+/** EEPROM address of the start of the page which #page_buffer refers to.
+  * This is only meaningful if #page_dirty_mask is non-zero. */
+static uint32_t page_address;
+/** Bit i of this is set if byte i of #page_buffer is waiting to be
+  * committed. */
+static uint64_t page_dirty_mask;
+
+/** Commit the contents of the write-combining buffer to EEPROM. One IAP
+  * call is made for each contiguous run of dirty bytes, so adjacent writes
+  * are combined into one call. The buffer is emptied even if a write fails,
+  * since there is no sensible way to retry.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn commitPageBuffer(void)
+{
+	NonVolatileReturn r;
+	uint32_t start;
+	uint32_t end;
+
+	r = NV_NO_ERROR;
+	start = 0;
+	while (start < EEPROM_PAGE_SIZE)
+	{
+		if ((page_dirty_mask & ((uint64_t)1 << start)) == 0)
+		{
+			start++;
+			continue;
+		}
+		end = start + 1;
+		while ((end < EEPROM_PAGE_SIZE) && ((page_dirty_mask & ((uint64_t)1 << end)) != 0))
+		{
+			end++;
+		}
+		if (iapEEPROM(61, page_address + start, &(page_buffer[start]), end - start))
+		{
+			r = NV_IO_ERROR;
+		}
+		start = end;
+	}
+	page_dirty_mask = 0;
+	return r;
+}
+
 /** Write to non-volatile storage.
   * \param data A pointer to the data to be written.
   * \param address Byte offset specifying where in non-volatile storage to
@@ -45,6 +144,11 @@ static uint32_t iap_result[5];
   */
 NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t length)
 {
+	NonVolatileReturn r;
+	uint32_t page;
+	uint32_t offset;
+	uint32_t i;
+
 	// Since EEPROM_SIZE is much smaller than 2 ^ 32, address + length cannot
 	// overflow.
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
@@ -52,20 +156,54 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t len
 	{
 		return NV_INVALID_ADDRESS;
 	}
-	iap_command[0] = 61; // IAP command code for "Write EEPROM"
-	iap_command[1] = address; // EEPROM address
-	iap_command[2] = (uint32_t)data; // RAM address
-	iap_command[3] = length; // number of bytes to be written
-	iap_command[4] = 48000; // system clock frequency in kHz
-	iapEntry(iap_command, iap_result);
-	if (iap_result[0] == 0)
+	if (length == 0)
 	{
 		return NV_NO_ERROR;
 	}
+	page = address & ~(EEPROM_PAGE_SIZE - 1);
+	offset = address & (EEPROM_PAGE_SIZE - 1);
+	if ((offset + length) > EEPROM_PAGE_SIZE)
+	{
+		// Write crosses a page boundary. Buffering it would mean one IAP
+		// call per page, so write it directly instead. Any buffered bytes
+		// which it overwrites are now stale, so they are discarded.
+		if ((page_dirty_mask != 0) && (page_address >= page)
+			&& (page_address < (address + length)))
+		{
+			for (i = 0; i < EEPROM_PAGE_SIZE; i++)
+			{
+				if (((page_address + i) >= address) && ((page_address + i) < (address + length)))
+				{
+					page_dirty_mask &= ~((uint64_t)1 << i);
+				}
+			}
+		}
+		if (iapEEPROM(61, address, data, length))
+		{
+			return NV_IO_ERROR;
+		}
+		return NV_NO_ERROR;
+	}
+	if ((page_dirty_mask != 0) && (page != page_address))
+	{
+		// Write is to a different page; make room for it.
+		r = commitPageBuffer();
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+	}
+	page_address = page;
+	memcpy(&(page_buffer[offset]), data, length);
+	if (length == EEPROM_PAGE_SIZE)
+	{
+		page_dirty_mask = ~(uint64_t)0;
+	}
 	else
 	{
-		return NV_IO_ERROR;
+		page_dirty_mask |= (((uint64_t)1 << length) - 1) << offset;
 	}
+	return NV_NO_ERROR;
 }
 
 /** Read from non-volatile storage.
@@ -77,6 +215,9 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t len
   */
 NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t length)
 {
+	uint32_t i;
+	uint32_t offset;
+
 	// Since EEPROM_SIZE is much smaller than 2 ^ 32, address + length cannot
 	// overflow.
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
@@ -84,20 +225,27 @@ NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t leng
 	{
 		return NV_INVALID_ADDRESS;
 	}
-	iap_command[0] = 62; // IAP command code for "Read EEPROM"
-	iap_command[1] = address; // EEPROM address
-	iap_command[2] = (uint32_t)data; // RAM address
-	iap_command[3] = length; // number of bytes to be read
-	iap_command[4] = 48000; // system clock frequency in kHz
-	iapEntry(iap_command, iap_result);
-	if (iap_result[0] == 0)
+	if (iapEEPROM(62, address, data, length))
 	{
-		return NV_NO_ERROR;
+		return NV_IO_ERROR;
 	}
-	else
+	// Bytes which are still in the write-combining buffer are newer than
+	// what's in EEPROM.
+	if (page_dirty_mask != 0)
 	{
-		return NV_IO_ERROR;
+		for (i = 0; i < length; i++)
+		{
+			if (((address + i) & ~(EEPROM_PAGE_SIZE - 1)) == page_address)
+			{
+				offset = (address + i) & (EEPROM_PAGE_SIZE - 1);
+				if ((page_dirty_mask & ((uint64_t)1 << offset)) != 0)
+				{
+					data[i] = page_buffer[offset];
+				}
+			}
+		}
 	}
+	return NV_NO_ERROR;
 }
 
 /** Ensure that all buffered writes are committed to non-volatile storage.
@@ -105,6 +253,5 @@ NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t leng
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
-	// Nothing to do; writes are never buffered.
-	return NV_NO_ERROR;
+	return commitPageBuffer();
 }
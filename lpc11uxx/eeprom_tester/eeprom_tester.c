@@ -0,0 +1,337 @@
+// ***********************************************************************
+// eeprom_tester.c
+// ***********************************************************************
+//
+// Tests the write-combining buffer in lpc11uxx/eeprom.c on the host.
+//
+// This includes lpc11uxx/eeprom.c directly, with EEPROM_HOST_MODEL defined,
+// and supplies a version of iapEEPROM() which operates on a model of the
+// EEPROM instead of calling the IAP interface. The model checks that no
+// write goes beyond the end of the usable EEPROM, and counts IAP calls so
+// that the effect of write combining can be seen.
+//
+// lpc11uxx/eeprom.c still uses the old, partition-less non-volatile
+// storage interface. So that it can be compiled alongside the current
+// hwinterface.h, its functions are renamed here.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../common.h"
+#include "../../hwinterface.h"
+
+#define nonVolatileWrite	eepromWrite
+#define nonVolatileRead		eepromRead
+#define nonVolatileFlush	eepromFlush
+
+static bool iapEEPROM(uint32_t command_code, uint32_t address, uint8_t *data, uint32_t length);
+
+#define EEPROM_HOST_MODEL
+#include "../eeprom.c"
+
+// Size of the modelled EEPROM, in bytes. This includes the 64 bytes at the
+// end which must not be written to.
+#define MODEL_SIZE					4096
+// Number of random operations in the stress test.
+#define STRESS_OPERATIONS			200000
+
+// Contents of the modelled EEPROM.
+static uint8_t eeprom[MODEL_SIZE];
+// What the contents of the EEPROM should be, once everything is flushed.
+static uint8_t shadow[MODEL_SIZE];
+// Number of IAP "Write EEPROM" calls.
+static uint32_t write_calls;
+// Number of EEPROM page programming cycles caused by IAP "Write EEPROM"
+// calls.
+static uint32_t page_programs;
+// Number of EEPROM page programming cycles there would have been if every
+// write went straight to EEPROM, as it did before writes were buffered.
+static uint32_t unbuffered_page_programs;
+// Number of IAP "Read EEPROM" calls.
+static uint32_t read_calls;
+// Number of IAP calls which violated the rules (eg. writes to the reserved
+// area at the end of the EEPROM).
+static uint32_t violations;
+// If this is true, the next IAP call will fail.
+static bool fail_next_call;
+// Number of tests which failed.
+static uint32_t failures;
+
+// Number of EEPROM pages that a write of length bytes to address touches.
+static uint32_t pagesSpanned(uint32_t address, uint32_t length)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+	return (address + length - 1) / EEPROM_PAGE_SIZE - address / EEPROM_PAGE_SIZE + 1;
+}
+
+// Replacement for the function in lpc11uxx/eeprom.c which calls the IAP
+// interface.
+static bool iapEEPROM(uint32_t command_code, uint32_t address, uint8_t *data, uint32_t length)
+{
+	if (fail_next_call)
+	{
+		fail_next_call = false;
+		return true;
+	}
+	if ((address + length) > MODEL_SIZE)
+	{
+		printf("IAP call beyond end of EEPROM: address %u, length %u\n", address, length);
+		violations++;
+		return true;
+	}
+	if (command_code == 61)
+	{
+		write_calls++;
+		page_programs += pagesSpanned(address, length);
+		if (length == 0)
+		{
+			printf("Empty Write EEPROM call: address %u\n", address);
+			violations++;
+		}
+		if ((address + length) > EEPROM_SIZE)
+		{
+			printf("Write EEPROM call to reserved area: address %u, length %u\n", address, length);
+			violations++;
+		}
+		memcpy(&(eeprom[address]), data, length);
+	}
+	else if (command_code == 62)
+	{
+		read_calls++;
+		memcpy(data, &(eeprom[address]), length);
+	}
+	else
+	{
+		printf("Unknown IAP command %u\n", command_code);
+		violations++;
+		return true;
+	}
+	return false;
+}
+
+static void check(bool condition, const char *description)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", description);
+		failures++;
+	}
+}
+
+// Write to the EEPROM (through the buffer) and to the shadow copy.
+static NonVolatileReturn writeBoth(uint8_t *data, uint32_t address, uint32_t length)
+{
+	NonVolatileReturn r;
+
+	r = eepromWrite(data, address, length);
+	if (r == NV_NO_ERROR)
+	{
+		memcpy(&(shadow[address]), data, length);
+		unbuffered_page_programs += pagesSpanned(address, length);
+	}
+	return r;
+}
+
+// Update a wallet-record-sized region in 16 byte blocks, as
+// encryptedNonVolatileWrite() does, and report the number of IAP calls.
+static void testRecordUpdate(void)
+{
+	uint8_t block[16];
+	uint32_t i;
+	uint32_t calls_before;
+
+	calls_before = write_calls;
+	for (i = 0; i < 10; i++)
+	{
+		memset(block, (int)(0x10 + i), sizeof(block));
+		writeBoth(block, 96 + i * 16, sizeof(block));
+	}
+	check(write_calls == calls_before + 2, "record update commits a page as soon as writes move past it");
+	check(eepromFlush() == NV_NO_ERROR, "record update flush");
+	check(!memcmp(eeprom, shadow, sizeof(eeprom)), "record update contents");
+	printf("160 byte record update in 16 byte blocks: 10 writes became %u IAP calls\n", write_calls - calls_before);
+	check((write_calls - calls_before) == 3, "record update spans 3 pages, so should take 3 IAP calls");
+}
+
+// Reads must see bytes which haven't been flushed yet.
+static void testReadsSeeBuffer(void)
+{
+	uint8_t data[100];
+	uint8_t read_back[100];
+	uint32_t i;
+	uint32_t calls_before;
+
+	for (i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)(0xa0 + i);
+	}
+	calls_before = write_calls;
+	writeBoth(&(data[0]), 1030, 10);
+	writeBoth(&(data[20]), 1050, 10);
+	check(write_calls == calls_before, "writes within one page aren't committed straight away");
+	check(eepromRead(read_back, 1020, 50) == NV_NO_ERROR, "read of unflushed data");
+	check(!memcmp(read_back, &(shadow[1020]), 50), "read sees unflushed data");
+	check(eepromFlush() == NV_NO_ERROR, "flush of two runs");
+	check(write_calls == calls_before + 2, "two non-adjacent runs in one page take two IAP calls");
+	check(!memcmp(eeprom, shadow, sizeof(eeprom)), "contents after flush of two runs");
+	calls_before = write_calls;
+	check(eepromFlush() == NV_NO_ERROR, "flush of empty buffer");
+	check(write_calls == calls_before, "flushing an empty buffer doesn't make any IAP calls");
+}
+
+// A write which crosses a page boundary goes straight to EEPROM in one call,
+// and must replace anything buffered for the bytes it overwrites.
+static void testPageCrossing(void)
+{
+	uint8_t data[100];
+	uint32_t calls_before;
+
+	memset(data, 0x31, sizeof(data));
+	check(writeBoth(data, 1000, 20) == NV_NO_ERROR, "write before page crossing write");
+	memset(data, 0x32, sizeof(data));
+	calls_before = write_calls;
+	check(writeBoth(data, 1010, 100) == NV_NO_ERROR, "page crossing write");
+	check(write_calls == calls_before + 1, "a page crossing write takes one IAP call");
+	check(eepromRead(data, 990, 40) == NV_NO_ERROR, "read after page crossing write");
+	check(!memcmp(data, &(shadow[990]), 40), "read sees page crossing write");
+	check(eepromFlush() == NV_NO_ERROR, "flush after page crossing write");
+	check(write_calls == calls_before + 2, "bytes not overwritten by a page crossing write are still committed");
+	check(!memcmp(eeprom, shadow, sizeof(eeprom)), "contents after page crossing write");
+}
+
+// Invalid addresses must be rejected without buffering anything.
+static void testInvalidAddress(void)
+{
+	uint8_t data[128];
+	uint32_t calls_before;
+
+	memset(data, 0x55, sizeof(data));
+	calls_before = write_calls;
+	check(eepromWrite(data, EEPROM_SIZE - 10, 20) == NV_INVALID_ADDRESS, "write past end is rejected");
+	check(eepromWrite(data, EEPROM_SIZE + 1, 0) == NV_INVALID_ADDRESS, "write beyond end is rejected");
+	check(eepromRead(data, EEPROM_SIZE - 10, 20) == NV_INVALID_ADDRESS, "read past end is rejected");
+	check(writeBoth(data, EEPROM_SIZE - 64, 64) == NV_NO_ERROR, "write of last page");
+	check(eepromFlush() == NV_NO_ERROR, "flush of last page");
+	check(write_calls == calls_before + 1, "a whole page takes one IAP call");
+	check(!memcmp(eeprom, shadow, sizeof(eeprom)), "contents after invalid writes");
+}
+
+// IAP failures must be reported, and mustn't leave anything buffered.
+static void testFailure(void)
+{
+	uint8_t data[8];
+	uint32_t calls_before;
+
+	memset(data, 0x77, sizeof(data));
+	check(eepromWrite(data, 200, sizeof(data)) == NV_NO_ERROR, "write before failure");
+	fail_next_call = true;
+	check(eepromFlush() == NV_IO_ERROR, "failed flush is reported");
+	calls_before = write_calls;
+	check(eepromFlush() == NV_NO_ERROR, "flush after failure");
+	check(write_calls == calls_before, "failed data isn't retried");
+	// Make the model and shadow agree again.
+	memcpy(shadow, eeprom, sizeof(shadow));
+
+	check(eepromWrite(data, 300, sizeof(data)) == NV_NO_ERROR, "write before failed eviction");
+	fail_next_call = true;
+	check(eepromWrite(data, 400, sizeof(data)) == NV_IO_ERROR, "failed eviction is reported");
+	fail_next_call = true;
+	check(eepromRead(data, 0, sizeof(data)) == NV_IO_ERROR, "failed read is reported");
+	check(eepromFlush() == NV_NO_ERROR, "flush after failed eviction");
+	memcpy(shadow, eeprom, sizeof(shadow));
+}
+
+// Random writes, reads and flushes, checked against the shadow copy.
+static void testStress(void)
+{
+	uint8_t data[300];
+	uint8_t read_back[300];
+	uint32_t i;
+	uint32_t j;
+	uint32_t address;
+	uint32_t length;
+	uint32_t writes;
+	uint32_t calls_before;
+	uint32_t programs_before;
+	uint32_t unbuffered_before;
+	uint32_t mismatches;
+
+	srand(42);
+	writes = 0;
+	mismatches = 0;
+	calls_before = write_calls;
+	programs_before = page_programs;
+	unbuffered_before = unbuffered_page_programs;
+	for (i = 0; i < STRESS_OPERATIONS; i++)
+	{
+		// Bias lengths towards small, since that's the common case.
+		length = 1 + (uint32_t)(rand() % ((rand() & 1) ? 16 : (int)sizeof(data)));
+		address = (uint32_t)(rand() % (EEPROM_SIZE - length + 1));
+		switch (rand() % 8)
+		{
+		case 0:
+			if (eepromFlush() != NV_NO_ERROR)
+			{
+				mismatches++;
+			}
+			if (memcmp(eeprom, shadow, sizeof(eeprom)))
+			{
+				mismatches++;
+			}
+			break;
+		case 1:
+		case 2:
+			if ((eepromRead(read_back, address, length) != NV_NO_ERROR)
+				|| memcmp(read_back, &(shadow[address]), length))
+			{
+				mismatches++;
+			}
+			break;
+		default:
+			for (j = 0; j < length; j++)
+			{
+				data[j] = (uint8_t)rand();
+			}
+			if (writeBoth(data, address, length) != NV_NO_ERROR)
+			{
+				mismatches++;
+			}
+			writes++;
+			break;
+		}
+	}
+	check(eepromFlush() == NV_NO_ERROR, "final stress test flush");
+	check(!memcmp(eeprom, shadow, sizeof(eeprom)), "contents after stress test");
+	check(mismatches == 0, "stress test reads and flushes matched");
+	printf("Stress test: %u writes became %u IAP calls\n", writes, write_calls - calls_before);
+	printf("Stress test: %u page programming cycles, versus %u unbuffered\n",
+		page_programs - programs_before, unbuffered_page_programs - unbuffered_before);
+	check((page_programs - programs_before) <= (unbuffered_page_programs - unbuffered_before),
+		"buffering never programs more pages than not buffering");
+	check((write_calls - calls_before) < writes, "buffering makes fewer IAP calls than there are writes");
+}
+
+int main(void)
+{
+	testRecordUpdate();
+	testReadsSeeBuffer();
+	testPageCrossing();
+	testInvalidAddress();
+	testFailure();
+	testStress();
+	check(violations == 0, "no IAP calls broke the rules");
+	if (failures != 0)
+	{
+		printf("%u tests failed\n", failures);
+		exit(1);
+	}
+	printf("All tests passed\n");
+	exit(0);
+}
@@ -192,10 +192,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateCentralMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
@@ -212,7 +209,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	tests_failed = 0;
 	// STATTEST_MIN_MEAN and STATTEST_MAX_MEAN are in ADC output numbers.
 	// To be comparable to mean, they need to be scaled and offset, just
-	// as samples are in updateIteratorCache().
+	// as samples are in scaleSample().
 	if (mean <= F16((STATTEST_MIN_MEAN - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN))
 	{
 		tests_failed |= 1; // mean below minimum
@@ -375,10 +372,10 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #if ((SAMPLE_BUFFER_SIZE & 15) != 0)
 #error "SAMPLE_BUFFER_SIZE not a multiple of 16"
 #endif // #if ((SAMPLE_BUFFER_SIZE & 15) != 0)
+	incrementHistogramBatch(&(adc_sample_buffer[sample_buffer_consumed]), 16);
 	for (i = 0; i < 16; i++)
 	{
 		sample = adc_sample_buffer[sample_buffer_consumed];
-		incrementHistogram(sample);
 		// Fill entropy buffer with ADC sample data.
 		buffer[i * 2] = (uint8_t)sample;
 		buffer[i * 2 + 1] = (uint8_t)(sample >> 8);
@@ -756,10 +753,7 @@ void testStatistics(void)
 			SysTick->LOAD = 0x00FFFFFF; // set timer reload to max
 			SysTick->CTRL = 5; // enable system tick timer, frequency = CPU
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateCentralMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			cycles = SysTick->VAL; // read as soon as possible
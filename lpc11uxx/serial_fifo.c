@@ -12,6 +12,11 @@
   * since storage is implemented as a circular queue. Instead, when a buffer
   * overflow is detected, streamError() is called.
   *
+  * Each buffer has exactly one producer and one consumer, so no locking is
+  * needed: the producer only ever modifies CircularBuffer#head and the
+  * consumer only ever modifies CircularBuffer#tail. This allows bytes to be
+  * moved in and out of the buffers in blocks, without disabling interrupts.
+  *
   * The functions in this file don't actually interface with any
   * communications hardware. The interface of circular buffers to hardware
   * must be handled elsewhere.
@@ -83,13 +88,13 @@ void initSerialFIFO(void)
 	memset((void *)receive_buffer_storage, 0xff, RECEIVE_BUFFER_SIZE); // just to be sure
 	memset((void *)transmit_buffer_storage, 0, TRANSMIT_BUFFER_SIZE);
 	memset((void *)receive_buffer_storage, 0, RECEIVE_BUFFER_SIZE);
-	transmit_buffer.next = 0;
-	transmit_buffer.remaining = 0;
+	transmit_buffer.head = 0;
+	transmit_buffer.tail = 0;
 	transmit_buffer.size = TRANSMIT_BUFFER_SIZE;
 	transmit_buffer.error_occurred = 0;
 	transmit_buffer.storage = transmit_buffer_storage;
-	receive_buffer.next = 0;
-	receive_buffer.remaining = 0;
+	receive_buffer.head = 0;
+	receive_buffer.tail = 0;
 	receive_buffer.size = RECEIVE_BUFFER_SIZE;
 	receive_buffer.error_occurred = 0;
 	receive_buffer.storage = receive_buffer_storage;
@@ -105,13 +110,19 @@ static void enterSleepMode(void)
 	__asm("wfi"); // wait for interrupt
 }
 
+/** Prevent the compiler from moving memory accesses across this point.
+  * The LPC11Uxx has a single in-order core, so this is all that is needed to
+  * ensure that the other side of the buffer never sees an updated index
+  * before the storage contents it covers. */
+#define FIFO_MEMORY_BARRIER()	__asm volatile("" : : : "memory")
+
 /** Check whether a circular buffer is empty.
   * \param buffer The circular buffer to check.
   * \return true if it is empty, false if it is non-empty.
   */
 bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == 0)
+	if (buffer->head == buffer->tail)
 	{
 		return true;
 	}
@@ -129,21 +140,11 @@ void circularBufferSignalError(volatile CircularBuffer *buffer)
 	buffer->error_occurred = true;
 }
 
-/** Read a byte from a circular buffer. This will block until a byte is
-  * read.
-  * \param buffer The circular buffer to read from.
-  * \param is_irq Use true if calling this from an interrupt
-  *               request handler, otherwise use false.
-  * \return The byte that was read from the buffer.
+/** Halt if an error has been signalled in a circular buffer.
+  * \param buffer The circular buffer to check.
   */
-uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
+static void circularBufferCheckError(volatile CircularBuffer *buffer)
 {
-	uint8_t r;
-
-	while(isCircularBufferEmpty(buffer))
-	{
-		enterSleepMode();
-	}
 	if (buffer->error_occurred)
 	{
 		streamError();
@@ -153,74 +154,146 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 			// do nothing
 		}
 	}
-	if (!is_irq)
+}
+
+/** Read as many bytes as are available (up to a limit) from a circular
+  * buffer. This never blocks. The bytes are copied in at most two
+  * contiguous spans and the read index is only updated once.
+  * This must only be called by the consumer of the buffer.
+  * \param buffer The circular buffer to read from.
+  * \param data The array to copy the bytes into.
+  * \param length The maximum number of bytes to read.
+  * \return The number of bytes that were read, which may be 0 if the buffer
+  *         was empty.
+  */
+uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length)
+{
+	uint32_t tail;
+	uint32_t index;
+	uint32_t first_span;
+
+	tail = buffer->tail;
+	if (length > (buffer->head - tail))
 	{
-		__disable_irq();
+		length = buffer->head - tail;
 	}
-	r = buffer->storage[buffer->next];
-	buffer->remaining--;
-	buffer->next = (buffer->next + 1) & (buffer->size - 1);
-	if (!is_irq)
+	FIFO_MEMORY_BARRIER();
+	index = tail & (buffer->size - 1);
+	first_span = buffer->size - index;
+	if (first_span > length)
 	{
-		__enable_irq();
+		first_span = length;
 	}
-	return r;
+	memcpy(data, (const void *)&(buffer->storage[index]), first_span);
+	memcpy(&(data[first_span]), (const void *)buffer->storage, length - first_span);
+	FIFO_MEMORY_BARRIER();
+	buffer->tail = tail + length;
+	return length;
 }
 
-/** Write a byte to a circular buffer. If the buffer is full and is_irq is
-  * false, this will block until the buffer is not full. If the buffer is
-  * full and is_irq is true, this will give up and flag a buffer
-  * overflow.
+/** Write as many bytes as will fit (up to a limit) into a circular buffer.
+  * This never blocks. This must only be called by the producer of the buffer.
   * \param buffer The circular buffer to write to.
-  * \param data The byte to write to the buffer.
-  * \param is_irq Use true if calling this from an interrupt
-  *               request handler, otherwise use false.
+  * \param data The bytes to write.
+  * \param length The maximum number of bytes to write.
+  * \return The number of bytes that were written.
   */
-void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq)
+static uint32_t circularBufferWriteSome(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
 {
+	uint32_t head;
 	uint32_t index;
+	uint32_t first_span;
 
-	if (!is_irq)
+	head = buffer->head;
+	if (length > (buffer->size - (head - buffer->tail)))
 	{
-		if (buffer->error_occurred)
-		{
-			streamError();
-			__disable_irq();
-			while (true)
-			{
-				// do nothing
-			}
-		}
+		length = buffer->size - (head - buffer->tail);
 	}
-	if (buffer->remaining == buffer->size)
+	FIFO_MEMORY_BARRIER();
+	index = head & (buffer->size - 1);
+	first_span = buffer->size - index;
+	if (first_span > length)
+	{
+		first_span = length;
+	}
+	memcpy((void *)&(buffer->storage[index]), data, first_span);
+	memcpy((void *)buffer->storage, &(data[first_span]), length - first_span);
+	FIFO_MEMORY_BARRIER();
+	buffer->head = head + length;
+	return length;
+}
+
+/** Write a block of bytes to a circular buffer. If there isn't enough space
+  * and is_irq is false, this will block until all bytes have been written.
+  * If there isn't enough space and is_irq is true, this will give up
+  * (without writing anything) and flag a buffer overflow.
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write.
+  * \param length The number of bytes to write.
+  * \param is_irq Use true if calling this from an interrupt
+  *               request handler, otherwise use false.
+  */
+void circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length, bool is_irq)
+{
+	uint32_t written;
+
+	if (is_irq)
 	{
-		// Buffer is full.
-		if (is_irq)
+		if ((buffer->size - (buffer->head - buffer->tail)) < length)
 		{
 			// In interrupt handler; cannot block. This can only happen
 			// if the host does not honour flow control protocol when sending.
 			circularBufferSignalError(buffer);
 			return;
 		}
-		else
-		{
-			while (buffer->remaining == buffer->size)
-			{
-				enterSleepMode();
-			}
-		}
 	}
-	if (!is_irq)
+	else
 	{
-		__disable_irq();
+		circularBufferCheckError(buffer);
+	}
+	while (true)
+	{
+		written = circularBufferWriteSome(buffer, data, length);
+		data += written;
+		length -= written;
+		if (length == 0)
+		{
+			break;
+		}
+		enterSleepMode();
 	}
-	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
-	buffer->storage[index] = data;
-	buffer->remaining++;
-	if (!is_irq)
+}
+
+/** Read a byte from a circular buffer. This will block until a byte is
+  * read.
+  * \param buffer The circular buffer to read from.
+  * \return The byte that was read from the buffer.
+  */
+uint8_t circularBufferRead(volatile CircularBuffer *buffer)
+{
+	uint8_t r;
+
+	while(isCircularBufferEmpty(buffer))
 	{
-		__enable_irq();
+		enterSleepMode();
 	}
+	circularBufferCheckError(buffer);
+	circularBufferReadBlock(buffer, &r, 1);
+	return r;
+}
+
+/** Write a byte to a circular buffer. If the buffer is full and is_irq is
+  * false, this will block until the buffer is not full. If the buffer is
+  * full and is_irq is true, this will give up and flag a buffer
+  * overflow.
+  * \param buffer The circular buffer to write to.
+  * \param data The byte to write to the buffer.
+  * \param is_irq Use true if calling this from an interrupt
+  *               request handler, otherwise use false.
+  */
+void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq)
+{
+	circularBufferWriteBlock(buffer, &data, 1, is_irq);
 }
 
 /** Grab one byte from the communication stream. There is no way for this
@@ -249,21 +322,17 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 uint8_t streamGetOneByte(void)
 {
 	uint8_t one_byte;
-	uint8_t buffer[4];
-	uint32_t i;
+	uint8_t buffer[5];
 
-	one_byte = circularBufferRead(&receive_buffer, false);
+	one_byte = circularBufferRead(&receive_buffer);
 	receive_acknowledge--;
 	if (receive_acknowledge == 0)
 	{
 		// Send acknowledgement to other side.
 		receive_acknowledge = RECEIVE_BUFFER_SIZE;
-		writeU32LittleEndian(buffer, receive_acknowledge);
-		circularBufferWrite(&transmit_buffer, 0xff, false);
-		for (i = 0; i < 4; i++)
-		{
-			circularBufferWrite(&transmit_buffer, buffer[i], false);
-		}
+		buffer[0] = 0xff;
+		writeU32LittleEndian(&(buffer[1]), receive_acknowledge);
+		circularBufferWriteBlock(&transmit_buffer, buffer, sizeof(buffer), false);
 		serialSendNotify();
 	}
 	return one_byte;
@@ -293,10 +362,10 @@ void streamPutOneByte(uint8_t one_byte)
 		do
 		{
 			// do nothing
-		} while (circularBufferRead(&receive_buffer, false) != 0xff);
+		} while (circularBufferRead(&receive_buffer) != 0xff);
 		for (i = 0; i < 4; i++)
 		{
-			buffer[i] = circularBufferRead(&receive_buffer, false);
+			buffer[i] = circularBufferRead(&receive_buffer);
 		}
 		transmit_acknowledge = readU32LittleEndian(buffer);
 	}
@@ -354,6 +423,11 @@ void sanitiseRam(void)
 	// was called as a result of a "unload wallet" packet, since the host
 	// isn't supposed to send anything until it receives a response from
 	// here.
+	// The EEPROM write-combining buffer (see eeprom.c) is in RAM, so it
+	// would be cleared below. Commit it first, so that buffered writes
+	// aren't lost. There's nothing sensible to do if this fails; the
+	// buffer is emptied regardless.
+	nonVolatileFlush();
 	saved_receive_acknowledge = receive_acknowledge;
 	saved_transmit_acknowledge = transmit_acknowledge;
 	sanitiseRamInternal();
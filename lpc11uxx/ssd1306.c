@@ -25,6 +25,7 @@
 #define DISPLAY_WIDTH		128
 /** Height of the display, in number of pixels.
   * \warning This must be a multiple of 8.
+  * \warning This must be <= 64.
   */
 #define DISPLAY_HEIGHT		64
 /** Width of a single character, in number of pixels. */
@@ -32,6 +33,7 @@
 /** Height of a single character, in number of pixels. This does not need to
   * be a multiple of 8.
   * \warning This must be >= 8.
+  * \warning This must be < 32.
   */
 #define CHARACTER_HEIGHT	16
 /** Maximum number of characters which can be on a line. */
@@ -180,6 +182,11 @@ static uint32_t cursor_line;
   * writeStringToDisplay() will write to next.
   */
 static uint32_t cursor_pos;
+/** What #text_buffer contained when the display was last rendered. The
+  * display's GDDRAM always reflects this, so renderDisplay() only needs to
+  * re-render character cells where this differs from #text_buffer.
+  */
+static uint8_t displayed_text_buffer[CHARACTERS_PER_LINE * NUMBER_OF_LINES];
 
 /** Set up LPC11Uxx peripherals to communicate with the SSD1306-based display.
   * The SPI1 bus is set up at 1 Mhz to communicate with the SSD1306 controller
@@ -302,27 +309,40 @@ static void resetSSD1306(void)
 	writeSPI1Byte(false, 0x01); // memory addressing mode = vertical
 }
 
-/** Clear the display and all associated buffers. */
-void clearDisplay(void)
+/** Restrict subsequent data writes to a rectangular window of the SSD1306's
+  * GDDRAM, and move the GDDRAM pointer to the top-left of that window.
+  * Since the memory addressing mode is "vertical" (see resetSSD1306()),
+  * data bytes will fill the window one column at a time, starting from the
+  * left.
+  * \param first_x Leftmost column of the window, in pixels.
+  * \param last_x Rightmost column of the window, in pixels.
+  * \param first_page Topmost page of the window. Each page is 8 pixels high.
+  * \param last_page Bottommost page of the window.
+  */
+static void setDisplayWindow(uint32_t first_x, uint32_t last_x, uint32_t first_page, uint32_t last_page)
+{
+	writeSPI1Byte(false, 0x21); // set column address
+	writeSPI1Byte(false, (uint8_t)first_x);
+	writeSPI1Byte(false, (uint8_t)last_x);
+	writeSPI1Byte(false, 0x22); // set page address
+	writeSPI1Byte(false, (uint8_t)first_page);
+	writeSPI1Byte(false, (uint8_t)last_page);
+}
+
+/** Clear all of the SSD1306's GDDRAM, regardless of what's in
+  * #displayed_text_buffer. This is needed after reset, when the contents of
+  * GDDRAM are undefined.
+  */
+static void clearGDDRAM(void)
 {
 	uint32_t i;
 
-	for (i = 0; i < 1024; i++)
+	setDisplayWindow(0, DISPLAY_WIDTH - 1, 0, (DISPLAY_HEIGHT / 8) - 1);
+	for (i = 0; i < (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8); i++)
 	{
 		writeSPI1Byte(true, 0);
 	}
-	cursor_line = 0;
-	cursor_pos = 0;
-	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
-}
-
-/** Set up everything so that the display is ready to start having text
-  * rendered on it. */
-void initSSD1306(void)
-{
-	configurePeripheralsForSSD1306();
-	resetSSD1306();
-	clearDisplay();
+	memset(displayed_text_buffer, FONT_BLANK, sizeof(displayed_text_buffer));
 }
 
 /** Font table byte lookup function which has bit granularity. Alternatively,
@@ -376,94 +396,165 @@ static uint8_t lookupTextBuffer(uint32_t char_x, uint32_t char_y)
 	}
 }
 
+/** Obtain one column of a character's glyph from #font_table.
+  * \param character The character, with #FONT_TABLE_START subtracted off
+  *                  (as returned by lookupTextBuffer()).
+  * \param char_x_offset x offset within character (0 = leftmost column).
+  * \return The glyph column. The least significant bit is the topmost
+  *         pixel. Only the least significant #CHARACTER_HEIGHT bits are
+  *         used; the rest are zero.
+  */
+static uint32_t lookupGlyphColumn(uint8_t character, uint32_t char_x_offset)
+{
+	uint32_t bit_offset;
+	uint32_t column;
+	uint32_t i;
+
+	bit_offset = character * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT;
+	column = 0;
+	for (i = 0; i < CHARACTER_HEIGHT; i += 8)
+	{
+		column |= (uint32_t)lookupFontTable(bit_offset + i) << i;
+	}
+	return column & (((uint32_t)1 << CHARACTER_HEIGHT) - 1);
+}
+
+/** Rasterise one entire column of the display from the contents of the text
+  * buffer (#text_buffer).
+  * \param x The column to rasterise (0 = left edge).
+  * \return The pixels of the column. The least significant bit is the
+  *         topmost pixel, and each byte corresponds to one page of GDDRAM.
+  */
+static uint64_t rasteriseColumn(uint32_t x)
+{
+	uint32_t char_x; // 0 = leftmost character, 1 = the one to the right of that etc.
+	uint32_t char_y; // 0 = topmost character, 1 = the one below that etc.
+	uint32_t char_x_offset; // x offset within character
+	uint64_t column;
+
+	char_x = x / CHARACTER_WIDTH;
+	char_x_offset = x % CHARACTER_WIDTH;
+	column = 0;
+	for (char_y = 0; (char_y < NUMBER_OF_LINES) && ((char_y * CHARACTER_HEIGHT) < DISPLAY_HEIGHT); char_y++)
+	{
+		column |= (uint64_t)lookupGlyphColumn(lookupTextBuffer(char_x, char_y), char_x_offset) << (char_y * CHARACTER_HEIGHT);
+	}
+	return column;
+}
+
 /** Using the contents of the text buffer (#text_buffer) and the font
   * in #font_table, this outputs a series of data bytes to the SSD1306
-  * display.
+  * display, so that the display matches the text buffer.
   *
+  * Only character cells which have changed since the last render (i.e.
+  * where #text_buffer differs from #displayed_text_buffer) are re-rendered.
+  * For each column of characters, the changed lines determine a window of
+  * GDDRAM (see setDisplayWindow()), and only that window is written to.
   * Since the SSD1306 memory addressing mode is set to "vertical" by
-  * resetSSD1306(), this function renders in columns, 8 pixels at a time.
-  * The rendering loop starts at the top-left, moves downwards and when it
-  * hits the bottom of the current column, moves right to start at the top
-  * of the next column. Column-based rendering is done because the SSD1306's
-  * GDDRAM is column-based (each byte of data corresponds to an 8 pixel high
-  * column).
+  * resetSSD1306(), the window is filled in columns, 8 pixels at a time.
+  * Column-based rendering is done because the SSD1306's GDDRAM is
+  * column-based (each byte of data corresponds to an 8 pixel high column).
   *
   * In order for the renderer to work
   * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
   * and #CHARACTER_HEIGHT must be set correctly.
   * The renderer only supports monochrome, fixed-width fonts.
   * However, the renderer can deal with fonts with a height which is not a
-  * multiple of 8.
+  * multiple of 8. In that case, a window can include parts of lines which
+  * haven't changed; those are re-rendered from #text_buffer too.
   *
-  * This renderer isn't very fast. But it doesn't need to be. With the SPI bus
-  * running at a bit rate of 1 Mhz, the renderer only needs to be able to
-  * write one byte every 384 cycles, which is a long time.
+  * Typically, only a few characters change between renders (for example,
+  * when writeStringToDisplay() is called several times to build up one
+  * screen), so this writes far fewer than the 1024 bytes needed to
+  * re-render the entire display.
   */
 static void renderDisplay(void)
 {
-	uint32_t x; // 0 = left edge, positive = right
-	uint32_t y; // 0 = top edge, positive = down
 	uint32_t char_x; // 0 = leftmost character, 1 = the one to the right of that etc.
 	uint32_t char_y; // 0 = topmost character, 1 = the one below that etc.
-	uint32_t char_x_offset; // x offset within character
-	uint32_t char_y_offset; // y offset within character
-	uint32_t amount; // number of bits to use
-	uint8_t current_character;
-	uint8_t next_character;
-	uint8_t data;
-	uint8_t temp_data;
+	uint32_t first_line; // topmost changed line in this column of characters
+	uint32_t last_line; // bottommost changed line in this column of characters
+	uint32_t first_x;
+	uint32_t last_x;
+	uint32_t first_page;
+	uint32_t last_page;
+	uint32_t x;
+	uint32_t page;
+	uint32_t index;
+	uint64_t column;
 
-	char_x = 0;
-	char_x_offset = 0;
-	for (x = 0; x < DISPLAY_WIDTH; x++)
+	for (char_x = 0; (char_x < CHARACTERS_PER_LINE) && ((char_x * CHARACTER_WIDTH) < DISPLAY_WIDTH); char_x++)
 	{
-		// Render a column.
-		char_y = 0;
-		char_y_offset = 0;
-		// The next (i.e. one below) character needs to be fetched in advance
-		// because the next 8 pixels may go across the current's character
-		// height boundary.
-		current_character = lookupTextBuffer(char_x, char_y);
-		next_character = lookupTextBuffer(char_x, char_y + 1);
-		for (y = 0; y < DISPLAY_HEIGHT; y += 8)
+		// Find out which lines in this column of characters have changed.
+		first_line = NUMBER_OF_LINES;
+		last_line = 0;
+		for (char_y = 0; char_y < NUMBER_OF_LINES; char_y++)
 		{
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Byte goes across character height boundary.
-				amount = CHARACTER_HEIGHT - char_y_offset;
-			}
-			else
+			index = CHARACTERS_PER_LINE * char_y + char_x;
+			if (text_buffer[index] != displayed_text_buffer[index])
 			{
-				// Next byte resides entirely within current character.
-				amount = 8;
+				if (first_line == NUMBER_OF_LINES)
+				{
+					first_line = char_y;
+				}
+				last_line = char_y;
+				displayed_text_buffer[index] = text_buffer[index];
 			}
-			data = lookupFontTable(current_character * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
-			data &= (1 << amount) - 1;
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Need to fetch partial character column from next character.
-				temp_data = lookupFontTable(next_character * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
-				data |= temp_data << amount;
-			}
-			writeSPI1Byte(true, data);
-			// Prepare for next byte.
-			char_y_offset += 8;
-			if (char_y_offset >= CHARACTER_HEIGHT)
+		}
+		if (first_line == NUMBER_OF_LINES)
+		{
+			continue; // nothing changed
+		}
+
+		// Work out which part of GDDRAM the changed lines occupy.
+		first_page = (first_line * CHARACTER_HEIGHT) / 8;
+		last_page = ((last_line + 1) * CHARACTER_HEIGHT - 1) / 8;
+		if (first_page >= (DISPLAY_HEIGHT / 8))
+		{
+			continue; // changed lines are off the bottom of the display
+		}
+		if (last_page >= (DISPLAY_HEIGHT / 8))
+		{
+			last_page = (DISPLAY_HEIGHT / 8) - 1;
+		}
+		first_x = char_x * CHARACTER_WIDTH;
+		last_x = first_x + CHARACTER_WIDTH - 1;
+		if (last_x >= DISPLAY_WIDTH)
+		{
+			last_x = DISPLAY_WIDTH - 1;
+		}
+
+		setDisplayWindow(first_x, last_x, first_page, last_page);
+		for (x = first_x; x <= last_x; x++)
+		{
+			column = rasteriseColumn(x);
+			for (page = first_page; page <= last_page; page++)
 			{
-				char_y_offset -= CHARACTER_HEIGHT;
-				char_y++;
-				current_character = next_character;
-				next_character = lookupTextBuffer(char_x, char_y + 1);
+				writeSPI1Byte(true, (uint8_t)(column >> (page * 8)));
 			}
-		} // end for (y = 0; y < DISPLAY_HEIGHT; y += 8)
-		// Prepare for next column.
-		char_x_offset++;
-		if (char_x_offset >= CHARACTER_WIDTH)
-		{
-			char_x_offset = 0;
-			char_x++;
 		}
-	} // end for (x = 0; x < DISPLAY_WIDTH; x++)
+	}
+}
+
+/** Clear the display and all associated buffers. */
+void clearDisplay(void)
+{
+	cursor_line = 0;
+	cursor_pos = 0;
+	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
+	// This only needs to clear the character cells which aren't already
+	// blank.
+	renderDisplay();
+}
+
+/** Set up everything so that the display is ready to start having text
+  * rendered on it. */
+void initSSD1306(void)
+{
+	configurePeripheralsForSSD1306();
+	resetSSD1306();
+	clearGDDRAM();
+	clearDisplay();
 }
 
 /** Move cursor to the start of the next line, but only if the cursor is not
@@ -54,6 +54,27 @@ void initUsart(void)
 	NVIC_EnableIRQ(21); // 21 = USART interrupt
 }
 
+/** Size, in bytes, of the USART's hardware receive and transmit FIFOs. */
+#define USART_FIFO_SIZE		16
+
+/** Move as many bytes as the USART's transmit FIFO can hold from the
+  * transmit buffer into the transmit FIFO. This must only be called when
+  * the transmit FIFO is empty (i.e. THRE is set), and with the USART
+  * interrupt unable to run.
+  */
+static void fillTransmitFIFO(void)
+{
+	uint8_t block[USART_FIFO_SIZE];
+	uint32_t count;
+	uint32_t i;
+
+	count = circularBufferReadBlock(&transmit_buffer, block, sizeof(block));
+	for (i = 0; i < count; i++)
+	{
+		LPC_USART->THR = block[i];
+	}
+}
+
 /** Interrupt request handler for USART. This is invoked in 3 situations:
   * - whenever a byte is received,
   * - another byte can be shoved into the transmit FIFO,
@@ -62,24 +83,33 @@ void initUsart(void)
 void UART_IRQHandler(void)
 {
 	uint32_t source;
+	uint8_t block[USART_FIFO_SIZE];
+	uint32_t count;
 
 	source = ((uint32_t)LPC_USART->IIR >> 1) & 7;
 	if (source == 2)
 	{
 		// Receive data available interrupt.
-		// Move bytes from RBR into circular buffer until hardware FIFO is empty.
-		while (LPC_USART->LSR & 0x01)
+		// Move bytes from RBR into circular buffer until hardware FIFO is
+		// empty. They are moved in blocks, so that the circular buffer's
+		// write index is updated once per block instead of once per byte.
+		do
 		{
-			circularBufferWrite(&receive_buffer, (uint8_t)(LPC_USART->RBR), true);
-		}
+			count = 0;
+			while ((count < sizeof(block)) && (LPC_USART->LSR & 0x01))
+			{
+				block[count++] = (uint8_t)(LPC_USART->RBR);
+			}
+			circularBufferWriteBlock(&receive_buffer, block, count, true);
+		} while (count == sizeof(block));
 	}
 	else if (source == 1)
 	{
 		// THRE (Transmit Holding Register Empty) interrupt.
-		if (!isCircularBufferEmpty(&transmit_buffer) && (LPC_USART->LSR & 0x20))
+		if (LPC_USART->LSR & 0x20)
 		{
-			// There's data to send and THR is empty.
-			LPC_USART->THR = circularBufferRead(&transmit_buffer, true);
+			// THR and the transmit FIFO are empty.
+			fillTransmitFIFO();
 		}
 	}
 	else
@@ -93,19 +123,19 @@ void UART_IRQHandler(void)
 /** This must be called whenever the transmit buffer transitions from empty
   * to non-empty, in order to initiate the transmission of the contents of the
   * transmit buffer.
-  * This function may directly handle the transmission of the first byte (the
-  * interrupt handler UART_IRQHandler() will handle the rest).
+  * This function may directly handle the transmission of the first block of
+  * bytes (the interrupt handler UART_IRQHandler() will handle the rest).
   */
 void serialSendNotify(void)
 {
-	// Need to disable interrupts otherwise the transmit buffer might be
-	// emptied between the check and use.
+	// Need to disable interrupts, otherwise UART_IRQHandler() (the usual
+	// consumer of the transmit buffer) might run between the check and the
+	// read.
 	__disable_irq();
-	if (!isCircularBufferEmpty(&transmit_buffer) && (LPC_USART->LSR & 0x20))
+	if (LPC_USART->LSR & 0x20)
 	{
-		// There's data to send and THR is empty.
-		LPC_USART->THR = circularBufferRead(&transmit_buffer, false);
-		// Warning: circularBufferRead() enables interrupts.
+		// THR and the transmit FIFO are empty.
+		fillTransmitFIFO();
 	}
 	__enable_irq();
 }
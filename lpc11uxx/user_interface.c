@@ -13,6 +13,7 @@
 
 #include "../common.h"
 #include "../hwinterface.h"
+#include "../background.h"
 #include "../baseconv.h"
 #include "../prandom.h"
 #include "ssd1306.h"
@@ -43,6 +44,9 @@ static bool transaction_fee_set;
 /** Storage for transaction fee amount. This is only valid
   * if #transaction_fee_set is true. */
 static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
+/** Storage for the number of addresses in an #ASKUSER_NEW_ADDRESSES
+  * request. */
+static char new_addresses_count[TEXT_COUNT_LENGTH];
 
 /** Set up LPC11Uxx peripherals to get input from two pushbuttons. The
   * pushbuttons should be connected as follows:
@@ -123,40 +127,25 @@ static void waitForNoButtonPress(void)
 }
 
 /** Wait until accept or cancel button is pressed. This function does do
-  * debouncing.
+  * debouncing. While no button press is in progress, background tasks
+  * (see background.c) are run instead of idling.
   * \return false if the accept button was pressed, true if the cancel
   *         button was pressed. If both buttons were pressed simultaneously,
   *         true will be returned.
   */
 static bool waitForButtonPress(void)
 {
-	uint32_t counter;
-	bool accept_pressed;
-	bool cancel_pressed;
+	ButtonDebouncer debouncer;
 
-	counter = DEBOUNCE_COUNT;
-	while (counter > 0)
+	initButtonDebouncer(&debouncer, DEBOUNCE_COUNT);
+	do
 	{
-		wait1ms();
-		accept_pressed = isAcceptPressed();
-		cancel_pressed = isCancelPressed();
-		if (!accept_pressed && !cancel_pressed)
+		if (isButtonPressInProgress(&debouncer) || !runBackgroundTask())
 		{
-			counter = DEBOUNCE_COUNT; // reset debounce counter
+			wait1ms();
 		}
-		else
-		{
-			counter--;
-		}
-	}
-	if (cancel_pressed)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	} while (!sampleButtonDebouncer(&debouncer, isAcceptPressed(), isCancelPressed()));
+	return wasCancelPressed(&debouncer);
 }
 
 /** Notify the user interface that the transaction parser has seen a new
@@ -208,6 +197,17 @@ void clearOutputsSeen(void)
 	transaction_fee_set = false;
 }
 
+/** Notify the user interface of how many addresses
+  * an #ASKUSER_NEW_ADDRESSES request is for.
+  * \param text_count The number of addresses, as a null-terminated text
+  *                   string such as "64".
+  */
+void setNewAddressesCount(char *text_count)
+{
+	strncpy(new_addresses_count, text_count, TEXT_COUNT_LENGTH);
+	new_addresses_count[TEXT_COUNT_LENGTH - 1] = '\0';
+}
+
 /** Ask user if they want to allow some action.
   * \param command The action to ask the user about. See #AskUserCommandEnum.
   * \return false if the user accepted, true if the user denied.
@@ -233,6 +233,14 @@ bool userDenied(AskUserCommand command)
 		writeStringToDisplayWordWrap("Create new address?");
 		r = waitForButtonPress();
 	}
+	else if (command == ASKUSER_NEW_ADDRESSES)
+	{
+		waitForNoButtonPress();
+		writeStringToDisplay("Create ");
+		writeStringToDisplay(new_addresses_count);
+		writeStringToDisplay(" new addresses?");
+		r = waitForButtonPress();
+	}
 	else if (command == ASKUSER_SIGN_TRANSACTION)
 	{
 		// writeStringToDisplayWordWrap() isn't used here because word
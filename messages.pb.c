@@ -9,6 +9,7 @@ const bool NewWallet_is_hidden_default = false;
 const uint32_t LoadWallet_wallet_number_default = 0;
 const bool BackupWallet_is_encrypted_default = false;
 const uint32_t BackupWallet_device_default = 0;
+const bool GetPerfCounters_reset_default = false;
 
 
 const pb_field_t Initialize_fields[2] = {
@@ -215,13 +216,41 @@ const pb_field_t MasterPublicKey_fields[3] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t GetPerfCounters_fields[2] = {
+    PB_FIELD2(  1, BOOL    , OPTIONAL, STATIC, FIRST, GetPerfCounters, reset, reset, &GetPerfCounters_reset_default),
+    PB_LAST_FIELD
+};
+
+const pb_field_t PerfCounter_fields[4] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, PerfCounter, counter_id, counter_id, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, PerfCounter, count, counter_id, 0),
+    PB_FIELD2(  3, UINT64  , REQUIRED, STATIC, OTHER, PerfCounter, cycles, count, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t PerfCounters_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, PerfCounters, cycles_per_second, cycles_per_second, 0),
+    PB_FIELD2(  2, MESSAGE , REPEATED, CALLBACK, OTHER, PerfCounters, counter, cycles_per_second, &PerfCounter_fields),
+    PB_LAST_FIELD
+};
+
+const pb_field_t NewAddresses_fields[2] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, NewAddresses, count, count, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t Addresses_fields[2] = {
+    PB_FIELD2(  1, MESSAGE , REPEATED, CALLBACK, FIRST, Addresses, addresses, addresses, &Address_fields),
+    PB_LAST_FIELD
+};
+
 
 /* Check that field information fits in pb_field_t */
 #if !defined(PB_FIELD_16BIT) && !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256 && pb_membersize(PerfCounters, counter) < 256 && pb_membersize(Addresses, addresses) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey_GetPerfCounters_PerfCounter_PerfCounters_NewAddresses_Addresses)
 #endif
 
 #if !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536 && pb_membersize(PerfCounters, counter) < 65536 && pb_membersize(Addresses, addresses) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey_GetPerfCounters_PerfCounter_PerfCounters_NewAddresses_Addresses)
 #endif
 
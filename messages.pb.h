@@ -84,6 +84,10 @@ typedef struct _Address {
     Address_address_t address;
 } Address;
 
+typedef struct _Addresses {
+    pb_callback_t addresses;
+} Addresses;
+
 typedef struct _BackupWallet {
     bool has_is_encrypted;
     bool is_encrypted;
@@ -169,6 +173,11 @@ typedef struct _GetEntropy {
     uint32_t number_of_bytes;
 } GetEntropy;
 
+typedef struct _GetPerfCounters {
+    bool has_reset;
+    bool reset;
+} GetPerfCounters;
+
 typedef struct {
     size_t size;
     uint8_t bytes[64];
@@ -198,6 +207,10 @@ typedef struct _MasterPublicKey {
     MasterPublicKey_chain_code_t chain_code;
 } MasterPublicKey;
 
+typedef struct _NewAddresses {
+    uint32_t count;
+} NewAddresses;
+
 typedef struct {
     size_t size;
     uint8_t bytes[40];
@@ -221,6 +234,17 @@ typedef struct _OtpAck {
     char otp[16];
 } OtpAck;
 
+typedef struct _PerfCounter {
+    uint32_t counter_id;
+    uint32_t count;
+    uint64_t cycles;
+} PerfCounter;
+
+typedef struct _PerfCounters {
+    uint32_t cycles_per_second;
+    pb_callback_t counter;
+} PerfCounters;
+
 typedef struct _PinAck {
     pb_callback_t password;
 } PinAck;
@@ -292,11 +316,13 @@ extern const bool NewWallet_is_hidden_default;
 extern const uint32_t LoadWallet_wallet_number_default;
 extern const bool BackupWallet_is_encrypted_default;
 extern const uint32_t BackupWallet_device_default;
+extern const bool GetPerfCounters_reset_default;
 
 /* Field tags (for use in manual encoding/decoding) */
 #define Address_address_handle_tag               1
 #define Address_public_key_tag                   2
 #define Address_address_tag                      3
+#define Addresses_addresses_tag                  1
 #define BackupWallet_is_encrypted_tag            1
 #define BackupWallet_device_tag                  2
 #define ChangeEncryptionKey_password_tag         1
@@ -319,16 +345,23 @@ extern const uint32_t BackupWallet_device_default;
 #define FormatWalletArea_initial_entropy_pool_tag 1
 #define GetAddressAndPublicKey_address_handle_tag 1
 #define GetEntropy_number_of_bytes_tag           1
+#define GetPerfCounters_reset_tag                1
 #define Initialize_session_id_tag                1
 #define LoadWallet_wallet_number_tag             1
 #define MasterPublicKey_public_key_tag           1
 #define MasterPublicKey_chain_code_tag           2
+#define NewAddresses_count_tag                   1
 #define NewWallet_wallet_number_tag              1
 #define NewWallet_password_tag                   2
 #define NewWallet_wallet_name_tag                3
 #define NewWallet_is_hidden_tag                  4
 #define NumberOfAddresses_number_of_addresses_tag 1
 #define OtpAck_otp_tag                           1
+#define PerfCounter_counter_id_tag               1
+#define PerfCounter_count_tag                    2
+#define PerfCounter_cycles_tag                   3
+#define PerfCounters_cycles_per_second_tag       1
+#define PerfCounters_counter_tag                 2
 #define PinAck_password_tag                      1
 #define Ping_greeting_tag                        1
 #define PingResponse_echoed_greeting_tag         1
@@ -383,6 +416,11 @@ extern const pb_field_t GetEntropy_fields[2];
 extern const pb_field_t Entropy_fields[2];
 extern const pb_field_t GetMasterPublicKey_fields[1];
 extern const pb_field_t MasterPublicKey_fields[3];
+extern const pb_field_t GetPerfCounters_fields[2];
+extern const pb_field_t PerfCounter_fields[4];
+extern const pb_field_t PerfCounters_fields[3];
+extern const pb_field_t NewAddresses_fields[2];
+extern const pb_field_t Addresses_fields[2];
 
 /* Maximum encoded size of messages (where known) */
 #define Initialize_size                          66
@@ -415,6 +453,9 @@ extern const pb_field_t MasterPublicKey_fields[3];
 #define GetEntropy_size                          6
 #define GetMasterPublicKey_size                  0
 #define MasterPublicKey_size                     101
+#define GetPerfCounters_size                     2
+#define PerfCounter_size                         23
+#define NewAddresses_size                        6
 
 #ifdef __cplusplus
 } /* extern "C" */
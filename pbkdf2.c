@@ -29,16 +29,16 @@
 #include "hwinterface.h"
 #include "pbkdf2.h"
 
-/** Derive a key using the specified password and salt, using HMAC-SHA512 as
-  * the underlying pseudo-random function. The derived key length is fixed
-  * at #SHA512_HASH_LENGTH bytes.
+/** Begin a PBKDF2 calculation, using HMAC-SHA512 as the underlying
+  * pseudo-random function. No iterations are done here; use
+  * pbkdf2Continue() to do them.
   *
-  * This code here is based on section 5.3 ("PBKDF Specification") of
-  * NIST SP 800-132 (obtained from
-  * http://csrc.nist.gov/publications/nistpubs/800-132/nist-sp800-132.pdf on
-  * 30 March 2013).
-  * \param out A byte array where the resulting derived key will be written.
-  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * Since the output after n iterations is needed to calculate the output
+  * after more than n iterations, splitting the calculation up like this
+  * allows the derived key for many different iteration counts to be
+  * calculated for little more than the cost of the largest one. That's
+  * useful when the iteration count isn't known (see getPBKDF2Iterations()).
+  * \param state The state to initialise.
   * \param password Byte array specifying the password to use in PBKDF2.
   * \param password_length The length (in bytes) of the password.
   * \param salt Byte array specifying the salt to use in PBKDF2.
@@ -46,42 +46,75 @@
   * \warning salt cannot be too long; salt_length must be less than or equal
   *          to #SHA512_HASH_LENGTH - 4.
   */
-void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length)
+void pbkdf2Begin(PBKDF2State *state, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length)
 {
-	uint8_t u[SHA512_HASH_LENGTH];
-	uint8_t hmac_result[SHA512_HASH_LENGTH];
-	unsigned int u_length;
-	uint32_t num_iterations;
-	uint32_t i;
-	unsigned int j;
-
-	memset(out, 0, SHA512_HASH_LENGTH);
-	memset(u, 0, sizeof(u));
+	memset(state, 0, sizeof(*state));
 	if (salt_length > (SHA512_HASH_LENGTH - 4))
 	{
 		// Salt too long.
 		fatalError();
 		return;
 	}
-	else
-	{
-		u_length = salt_length;
-	}
-	memcpy(u, salt, u_length);
-	writeU32BigEndian(&(u[u_length]), 1);
-	u_length += 4;
+	// The password is the HMAC key for every iteration, so it only needs to
+	// be prepared once.
+	hmacSha512Prepare(&(state->prepared_password), password, password_length);
+	memcpy(state->u, salt, salt_length);
+	writeU32BigEndian(&(state->u[salt_length]), 1);
+	state->u_length = salt_length + 4;
+}
+
+/** Do more iterations of a PBKDF2 calculation which was started by
+  * pbkdf2Begin(). Afterwards, PBKDF2State#out contains the derived key for
+  * the total number of iterations done so far.
+  * \param state The state of the calculation.
+  * \param num_iterations The number of iterations to add.
+  */
+void pbkdf2Continue(PBKDF2State *state, uint32_t num_iterations)
+{
+	uint8_t hmac_result[SHA512_HASH_LENGTH];
+	uint32_t i;
+	unsigned int j;
 
-	num_iterations = getPBKDF2Iterations();
 	for (i = 0; i < num_iterations; i++)
 	{
-		hmacSha512(hmac_result, password, password_length, u, u_length);
-		memcpy(u, hmac_result, sizeof(u));
-		u_length = SHA512_HASH_LENGTH;
+		hmacSha512Prepared(hmac_result, &(state->prepared_password), state->u, state->u_length);
+		memcpy(state->u, hmac_result, sizeof(state->u));
+		state->u_length = SHA512_HASH_LENGTH;
 		for (j = 0; j < SHA512_HASH_LENGTH; j++)
 		{
-			out[j] ^= u[j];
+			state->out[j] ^= state->u[j];
 		}
 	}
+	state->iterations += num_iterations;
+	memset(hmac_result, 0, sizeof(hmac_result));
+}
+
+/** Derive a key using the specified password and salt, using HMAC-SHA512 as
+  * the underlying pseudo-random function. The derived key length is fixed
+  * at #SHA512_HASH_LENGTH bytes. The number of iterations is
+  * getPBKDF2Iterations().
+  *
+  * This code here is based on section 5.3 ("PBKDF Specification") of
+  * NIST SP 800-132 (obtained from
+  * http://csrc.nist.gov/publications/nistpubs/800-132/nist-sp800-132.pdf on
+  * 30 March 2013).
+  * \param out A byte array where the resulting derived key will be written.
+  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param password Byte array specifying the password to use in PBKDF2.
+  * \param password_length The length (in bytes) of the password.
+  * \param salt Byte array specifying the salt to use in PBKDF2.
+  * \param salt_length The length (in bytes) of the salt.
+  * \warning salt cannot be too long; salt_length must be less than or equal
+  *          to #SHA512_HASH_LENGTH - 4.
+  */
+void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length)
+{
+	PBKDF2State state;
+
+	pbkdf2Begin(&state, password, password_length, salt, salt_length);
+	pbkdf2Continue(&state, getPBKDF2Iterations());
+	memcpy(out, state.out, SHA512_HASH_LENGTH);
+	memset(&state, 0, sizeof(state));
 }
 
 #ifdef TEST
@@ -263,6 +296,7 @@ int main(void)
 	unsigned int num_test_vectors;
 	unsigned int i;
 	uint8_t out[SHA512_HASH_LENGTH];
+	PBKDF2State state;
 
 	initTests(__FILE__);
 
@@ -290,6 +324,33 @@ int main(void)
 		}
 	}
 
+	// Doing the iterations in successively larger chunks (as is done when
+	// the iteration count is unknown) should give the same result.
+	for (i = 0; i < num_test_vectors; i++)
+	{
+		pbkdf2Begin(
+			&state,
+			(const uint8_t *)pbkdf2_test_vectors[i].password,
+			(unsigned int)pbkdf2_test_vectors[i].password_length,
+			(const uint8_t *)pbkdf2_test_vectors[i].salt,
+			(unsigned int)pbkdf2_test_vectors[i].salt_length);
+		pbkdf2Continue(&state, 1);
+		while (state.iterations < getPBKDF2Iterations())
+		{
+			pbkdf2Continue(&state, state.iterations);
+		}
+		if ((state.iterations != getPBKDF2Iterations())
+			|| memcmp(state.out, pbkdf2_test_vectors[i].expected_result, SHA512_HASH_LENGTH))
+		{
+			printf("Test %u mismatch when continued in chunks\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
 	finishTests();
 	exit(0);
 }
@@ -9,7 +9,28 @@
 #define PBKDF2_H_INCLUDED
 
 #include "common.h"
+#include "hmac_sha512.h"
 
+/** State of a PBKDF2 calculation which can be continued for any number of
+  * iterations. See pbkdf2Begin() and pbkdf2Continue(). Everything in here is
+  * as sensitive as the password. */
+typedef struct PBKDF2StateStruct
+{
+	/** The password, prepared for use as an HMAC-SHA512 key. */
+	HmacSha512Key prepared_password;
+	/** Most recent output of the pseudo-random function (or the salt and
+	  * block index, before the first iteration). */
+	uint8_t u[SHA512_HASH_LENGTH];
+	/** Number of valid bytes in PBKDF2State#u. */
+	unsigned int u_length;
+	/** Derived key, after PBKDF2State#iterations iterations. */
+	uint8_t out[SHA512_HASH_LENGTH];
+	/** Number of iterations done so far. */
+	uint32_t iterations;
+} PBKDF2State;
+
+extern void pbkdf2Begin(PBKDF2State *state, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length);
+extern void pbkdf2Continue(PBKDF2State *state, uint32_t num_iterations);
 extern void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length);
 
 #endif // #ifndef PBKDF2_H_INCLUDED
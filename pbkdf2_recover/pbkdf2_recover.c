@@ -0,0 +1,580 @@
+/** \file pbkdf2_recover.c
+  *
+  * \brief Recover the password and PBKDF2 iteration count of a wallet.
+  *
+  * The number of PBKDF2 iterations used to derive wallet encryption keys is
+  * platform-dependent (see getPBKDF2Iterations()), and it isn't stored
+  * anywhere. It is always a power of 2, so that it can be found by trying
+  * successively greater powers of 2. This program does that for a list of
+  * candidate passwords, against an image of the accounts partition of
+  * non-volatile storage.
+  *
+  * For each candidate password, PBKDF2 is only calculated once, up to the
+  * largest iteration count. Along the way, the derived key after each power
+  * of 2 is checked by trying to load the wallet with it (which checks the
+  * wallet checksum). So a wrong password costs about half as much as it
+  * would if pbkdf2() were called for each iteration count. The candidate
+  * passwords are shared out between one worker process per core. Processes
+  * (not threads) are used because wallet.c keeps the loaded wallet in
+  * global variables.
+  *
+  * This can also generate a test image (see usage()).
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../pbkdf2.h"
+#include "../prandom.h"
+#include "../wallet.h"
+#include "../xex.h"
+
+/** Maximum size, in bytes, of the accounts partition image. */
+#define MAX_IMAGE_SIZE			(1024 * 1024)
+/** Size, in bytes, of the accounts partition of a generated image. This is
+  * the same as the PIC32 firmware (see pic32/sst25x.h). */
+#define GENERATED_IMAGE_SIZE	3072
+/** Size, in bytes, of the global partition. This is only used when
+  * generating an image; it just needs to be big enough for the persistent
+  * entropy pool. */
+#define GLOBAL_PARTITION_SIZE	256
+/** Maximum length, in bytes, of a candidate password (including the
+  * newline). */
+#define MAX_LINE_LENGTH			1024
+/** Default value for the largest power of 2 to try. Every port currently
+  * uses 128 (2 ^ 7) iterations, so this leaves lots of room. */
+#define DEFAULT_MAX_EXPONENT	16
+
+/** What a worker process sends back to the main process when it finds the
+  * password. */
+typedef struct RecoveryResultStruct
+{
+	/** Index (into #passwords) of the password. */
+	uint32_t password_index;
+	/** Number of PBKDF2 iterations. */
+	uint32_t iterations;
+} RecoveryResult;
+
+/** Contents of the accounts partition. */
+static uint8_t accounts_partition[MAX_IMAGE_SIZE];
+/** Size, in bytes, of the accounts partition. */
+static uint32_t accounts_partition_size;
+/** Contents of the global partition. */
+static uint8_t global_partition[GLOBAL_PARTITION_SIZE];
+/** What getPBKDF2Iterations() returns. This is only used when generating an
+  * image. */
+static uint32_t generate_iterations;
+/** Candidate passwords. */
+static char **passwords;
+/** Length, in bytes, of each candidate password. */
+static unsigned int *password_lengths;
+/** Number of candidate passwords. */
+static uint32_t num_passwords;
+
+/** Get the current time, in nanoseconds.
+  * \return The current time.
+  */
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1.0e9 + (double)t.tv_nsec;
+}
+
+/** Get a pointer to the in-memory contents of a partition.
+  * \param out_size The size of the partition will be written here.
+  * \param partition The partition. Must be one of #NVPartitions.
+  * \return A pointer to the partition contents, or NULL if partition is
+  *         invalid.
+  */
+static uint8_t *getPartition(uint32_t *out_size, NVPartitions partition)
+{
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_size = GLOBAL_PARTITION_SIZE;
+		return global_partition;
+	}
+	else if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_size = accounts_partition_size;
+		return accounts_partition;
+	}
+	else
+	{
+		return NULL;
+	}
+}
+
+/** Get size of a partition.
+  * \param out_size On success, the size of the partition (in number of bytes)
+  *                 will be written here.
+  * \param partition Partition to query. Must be one of #NVPartitions.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
+{
+	if (getPartition(out_size, partition) == NULL)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	return NV_NO_ERROR;
+}
+
+/** Write to the in-memory copy of non-volatile storage.
+  * \param data A pointer to the data to be written.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint8_t *contents;
+	uint32_t size;
+
+	contents = getPartition(&size, partition);
+	if ((contents == NULL) || (address > size) || (length > (size - address)))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(&(contents[address]), data, length);
+	return NV_NO_ERROR;
+}
+
+/** Read from the in-memory copy of non-volatile storage.
+  * \param data A pointer to the buffer which will receive the data.
+  * \param partition The partition to read from. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start reading from.
+  * \param length The number of bytes to read.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint8_t *contents;
+	uint32_t size;
+
+	contents = getPartition(&size, partition);
+	if ((contents == NULL) || (address > size) || (length > (size - address)))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(data, &(contents[address]), length);
+	return NV_NO_ERROR;
+}
+
+/** Nothing is buffered, so there is nothing to flush.
+  * \return Always #NV_NO_ERROR.
+  */
+NonVolatileReturn nonVolatileFlush(void)
+{
+	return NV_NO_ERROR;
+}
+
+/** Get random bytes from the operating system. This is only used when
+  * generating an image.
+  * \param buffer The random bytes will be written here. This must have space
+  *               for 32 bytes.
+  * \return The estimated entropy, in bits, or a negative number on failure.
+  */
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	FILE *f;
+	size_t got;
+
+	f = fopen("/dev/urandom", "rb");
+	if (f == NULL)
+	{
+		return -1;
+	}
+	got = fread(buffer, 1, 32, f);
+	fclose(f);
+	if (got != 32)
+	{
+		return -1;
+	}
+	return 256;
+}
+
+/** Number of PBKDF2 iterations to use when generating an image. Recovery
+  * doesn't use this, since it calls pbkdf2Continue() directly.
+  * \return Number of iterations.
+  */
+uint32_t getPBKDF2Iterations(void)
+{
+	return generate_iterations;
+}
+
+/** Backups aren't used.
+  * \param seed Ignored.
+  * \param is_encrypted Ignored.
+  * \param destination_device Ignored.
+  * \return Always true (failure).
+  */
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	(void)seed;
+	(void)is_encrypted;
+	(void)destination_device;
+	return true;
+}
+
+/** Something went badly wrong. */
+void fatalError(void)
+{
+	printf("fatalError() called\n");
+	exit(1);
+}
+
+/** Print command-line usage information.
+  * \param program_name The name of this program.
+  */
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-w <wallet>] [-k <max exponent>] [-j <jobs>] [-o <offset>] <image> <password list>\n", program_name);
+	printf("       %s -g <iterations> <password> <image>\n", program_name);
+	printf("The first form tries each password in <password list> (one per line)\n");
+	printf("against a wallet in <image>, which contains the accounts partition.\n");
+	printf("  -w   Wallet number (default: 0).\n");
+	printf("  -k   Try iteration counts up to 2 ^ <max exponent> (default: %d).\n", DEFAULT_MAX_EXPONENT);
+	printf("  -j   Number of worker processes (default: number of cores).\n");
+	printf("  -o   Offset of the accounts partition within <image> (default: 0).\n");
+	printf("The second form generates <image>, with one wallet encrypted using\n");
+	printf("<password> and <iterations> PBKDF2 iterations.\n");
+}
+
+/** Generate an image containing one encrypted wallet.
+  * \param iterations Number of PBKDF2 iterations to use.
+  * \param password The wallet password.
+  * \param filename The image will be written to this file.
+  * \return 0 on success, non-zero on failure.
+  */
+static int generateImage(uint32_t iterations, const char *password, const char *filename)
+{
+	uint8_t pool_state[ENTROPY_POOL_LENGTH];
+	uint8_t name[NAME_LENGTH];
+	FILE *f;
+
+	generate_iterations = iterations;
+	accounts_partition_size = GENERATED_IMAGE_SIZE;
+	if (hardwareRandom32Bytes(pool_state) < 0)
+	{
+		printf("Could not get random bytes\n");
+		return 1;
+	}
+	memset(name, ' ', sizeof(name));
+	memcpy(name, "Recovery test wallet", 20);
+	if (initialiseEntropyPool(pool_state)
+		|| (sanitiseEverything() != WALLET_NO_ERROR)
+		|| (newWallet(0, name, false, NULL, false, (const uint8_t *)password, (unsigned int)strlen(password)) != WALLET_NO_ERROR))
+	{
+		printf("Could not create wallet\n");
+		return 1;
+	}
+	f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		printf("Could not open \"%s\" for writing\n", filename);
+		return 1;
+	}
+	fwrite(accounts_partition, 1, accounts_partition_size, f);
+	fclose(f);
+	return 0;
+}
+
+/** Load the accounts partition image.
+  * \param filename The file to load it from.
+  * \param offset Offset of the accounts partition within the file.
+  * \return false on success, true on failure.
+  */
+static bool loadImage(const char *filename, long offset)
+{
+	FILE *f;
+	size_t got;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		printf("Could not open \"%s\"\n", filename);
+		return true;
+	}
+	if (fseek(f, offset, SEEK_SET) != 0)
+	{
+		printf("Could not seek to offset %ld in \"%s\"\n", offset, filename);
+		fclose(f);
+		return true;
+	}
+	got = fread(accounts_partition, 1, sizeof(accounts_partition), f);
+	fclose(f);
+	accounts_partition_size = (uint32_t)got;
+	return false;
+}
+
+/** Load the list of candidate passwords into #passwords and
+  * #password_lengths. Line endings are stripped.
+  * \param filename The file to load them from.
+  * \return false on success, true on failure.
+  */
+static bool loadPasswords(const char *filename)
+{
+	FILE *f;
+	char line[MAX_LINE_LENGTH];
+	size_t length;
+	uint32_t capacity;
+
+	f = fopen(filename, "r");
+	if (f == NULL)
+	{
+		printf("Could not open \"%s\"\n", filename);
+		return true;
+	}
+	capacity = 0;
+	num_passwords = 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		length = strlen(line);
+		while ((length > 0) && ((line[length - 1] == '\n') || (line[length - 1] == '\r')))
+		{
+			length--;
+		}
+		if (num_passwords == capacity)
+		{
+			capacity = (capacity == 0) ? 1024 : (capacity * 2);
+			passwords = realloc(passwords, capacity * sizeof(char *));
+			password_lengths = realloc(password_lengths, capacity * sizeof(unsigned int));
+			if ((passwords == NULL) || (password_lengths == NULL))
+			{
+				printf("Out of memory\n");
+				fclose(f);
+				return true;
+			}
+		}
+		passwords[num_passwords] = malloc(length + 1);
+		if (passwords[num_passwords] == NULL)
+		{
+			printf("Out of memory\n");
+			fclose(f);
+			return true;
+		}
+		memcpy(passwords[num_passwords], line, length);
+		passwords[num_passwords][length] = '\0';
+		password_lengths[num_passwords] = (unsigned int)length;
+		num_passwords++;
+	}
+	fclose(f);
+	return false;
+}
+
+/** Try one candidate password with every power of 2 iteration count up to
+  * 2 ^ max_exponent.
+  * \param out_iterations If the password is correct, the number of PBKDF2
+  *                       iterations will be written here.
+  * \param wallet_spec The wallet number of the wallet to try to load.
+  * \param uuid The wallet UUID, which is the PBKDF2 salt.
+  * \param password_index Index (into #passwords) of the candidate password.
+  * \param max_exponent The largest power of 2 to try.
+  * \return true if the password is correct, false otherwise.
+  */
+static bool tryPassword(uint32_t *out_iterations, uint32_t wallet_spec, const uint8_t *uuid, uint32_t password_index, unsigned int max_exponent)
+{
+	PBKDF2State state;
+	unsigned int k;
+
+	// Empty passwords aren't tried, since a wallet with no password isn't
+	// encrypted using PBKDF2 (see main()).
+	if (password_lengths[password_index] == 0)
+	{
+		return false;
+	}
+	pbkdf2Begin(&state, (const uint8_t *)passwords[password_index], password_lengths[password_index], uuid, UUID_LENGTH);
+	for (k = 0; k <= max_exponent; k++)
+	{
+		pbkdf2Continue(&state, ((uint32_t)1 << k) - state.iterations);
+		if (initWalletWithKey(wallet_spec, state.out) == WALLET_NO_ERROR)
+		{
+			*out_iterations = state.iterations;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Try every candidate password, in parallel.
+  * \param out_result If the password is found, it will be written here.
+  * \param wallet_spec The wallet number of the wallet to recover.
+  * \param uuid The wallet UUID, which is the PBKDF2 salt.
+  * \param max_exponent The largest power of 2 to try.
+  * \param num_jobs Number of worker processes.
+  * \return true if the password was found, false otherwise.
+  */
+static bool tryAllPasswords(RecoveryResult *out_result, uint32_t wallet_spec, const uint8_t *uuid, unsigned int max_exponent, unsigned int num_jobs)
+{
+	int pipe_fds[2];
+	pid_t *pids;
+	unsigned int job;
+	uint32_t i;
+	RecoveryResult result;
+	bool found;
+
+	if (pipe(pipe_fds) != 0)
+	{
+		printf("Could not create pipe\n");
+		exit(1);
+	}
+	pids = calloc(num_jobs, sizeof(pid_t));
+	if (pids == NULL)
+	{
+		printf("Out of memory\n");
+		exit(1);
+	}
+	fflush(stdout);
+	for (job = 0; job < num_jobs; job++)
+	{
+		pids[job] = fork();
+		if (pids[job] < 0)
+		{
+			printf("Could not start worker process\n");
+			exit(1);
+		}
+		if (pids[job] == 0)
+		{
+			// Worker process. Passwords are interleaved between workers, so
+			// that they all finish at about the same time.
+			close(pipe_fds[0]);
+			for (i = job; i < num_passwords; i += num_jobs)
+			{
+				if (tryPassword(&(result.iterations), wallet_spec, uuid, i, max_exponent))
+				{
+					result.password_index = i;
+					if (write(pipe_fds[1], &result, sizeof(result)) != sizeof(result))
+					{
+						_exit(1);
+					}
+					break;
+				}
+			}
+			_exit(0);
+		}
+	}
+
+	// The read below will return 0 when every worker has exited without
+	// finding the password.
+	close(pipe_fds[1]);
+	found = (read(pipe_fds[0], out_result, sizeof(*out_result)) == sizeof(*out_result));
+	close(pipe_fds[0]);
+	for (job = 0; job < num_jobs; job++)
+	{
+		if (found)
+		{
+			kill(pids[job], SIGTERM);
+		}
+		waitpid(pids[job], NULL, 0);
+	}
+	free(pids);
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t wallet_spec;
+	unsigned int max_exponent;
+	long num_jobs;
+	long offset;
+	int i;
+	uint32_t version;
+	uint8_t name[NAME_LENGTH];
+	uint8_t uuid[UUID_LENGTH];
+	uint8_t zero_key[WALLET_ENCRYPTION_KEY_LENGTH];
+	RecoveryResult result;
+	double start;
+	double elapsed;
+
+	if ((argc == 5) && !strcmp(argv[1], "-g"))
+	{
+		return generateImage((uint32_t)strtoul(argv[2], NULL, 0), argv[3], argv[4]);
+	}
+
+	wallet_spec = 0;
+	max_exponent = DEFAULT_MAX_EXPONENT;
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	offset = 0;
+	for (i = 1; (i + 1) < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			wallet_spec = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-k"))
+		{
+			max_exponent = (unsigned int)strtoul(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-j"))
+		{
+			num_jobs = strtol(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-o"))
+		{
+			offset = strtol(argv[i + 1], NULL, 0);
+		}
+		else
+		{
+			break;
+		}
+	}
+	if (((argc - i) != 2) || (max_exponent > 31))
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+	if (num_jobs < 1)
+	{
+		num_jobs = 1;
+	}
+	if (loadImage(argv[i], offset) || loadPasswords(argv[i + 1]))
+	{
+		exit(1);
+	}
+
+	if (getWalletInfo(&version, name, uuid, wallet_spec) != WALLET_NO_ERROR)
+	{
+		printf("Could not read wallet %u from image (error %d)\n", wallet_spec, (int)walletGetLastError());
+		exit(1);
+	}
+	// Wallets without a password use an all zero key.
+	memset(zero_key, 0, sizeof(zero_key));
+	if (initWalletWithKey(wallet_spec, zero_key) == WALLET_NO_ERROR)
+	{
+		printf("Wallet %u is not encrypted\n", wallet_spec);
+		exit(0);
+	}
+	if (version == VERSION_NOTHING_THERE)
+	{
+		printf("Wallet %u is hidden or doesn't exist\n", wallet_spec);
+	}
+	printf("Trying %u passwords with up to %u iterations, using %ld processes\n", num_passwords, 1u << max_exponent, num_jobs);
+
+	start = now();
+	if (tryAllPasswords(&result, wallet_spec, uuid, max_exponent, (unsigned int)num_jobs))
+	{
+		elapsed = (now() - start) / 1.0e9;
+		printf("Found password \"%s\" with %u PBKDF2 iterations in %.3f s\n", passwords[result.password_index], result.iterations, elapsed);
+		exit(0);
+	}
+	else
+	{
+		elapsed = (now() - start) / 1.0e9;
+		printf("Password not found (%.3f s, %.1f passwords/s)\n", elapsed, (double)num_passwords / elapsed);
+		exit(1);
+	}
+}
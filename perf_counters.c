@@ -0,0 +1,223 @@
+/** \file perf_counters.c
+  *
+  * \brief Accumulates counts and cycle times for frequently-used operations.
+  *
+  * When firmware is built with DEBUG_PERF defined, the hot paths listed
+  * in #PerfCounterIDEnum use PERF_START() and PERF_STOP() (see
+  * perf_counters.h) to time themselves, and the results are accumulated
+  * here. The host can read the counters using the GetPerfCounters message.
+  * This makes it possible to relate reports of slowness to the cost of
+  * actual operations. Without DEBUG_PERF, all the instrumentation compiles
+  * to nothing and this file is empty.
+  *
+  * Times are measured using getCycleCounter(). They include time spent in
+  * nested instrumented operations; for example, the time for
+  * #PERF_POINT_MULTIPLY includes all the time for #PERF_BIG_MULTIPLY in the
+  * same point multiplication. Operations which fail part-way through are
+  * not counted.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_PERF_COUNTERS
+// The instrumentation in other files isn't compiled in for unit tests, but
+// the accumulation code here still needs to be tested.
+#define DEBUG_PERF
+#endif // #ifdef TEST_PERF_COUNTERS
+
+#ifdef TEST_PERF_COUNTERS
+#include <stdlib.h>
+#include <stdio.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_PERF_COUNTERS
+
+#include "common.h"
+#include "perf_counters.h"
+
+#ifdef DEBUG_PERF
+
+/** Number of times each operation has been done (but see
+  * #PERF_PARSE_TRANSACTION). */
+static uint32_t perf_count[PERF_NUMBER_OF_COUNTERS];
+/** Total number of getCycleCounter() counts spent in each operation. These
+  * are 64 bits wide since the total can be much longer than the period of
+  * getCycleCounter(). */
+static uint64_t perf_cycles[PERF_NUMBER_OF_COUNTERS];
+
+/** Add one timed operation to a performance counter. Use PERF_STOP() instead
+  * of calling this directly.
+  * \param id The performance counter to add to. Must be one
+  *           of #PerfCounterIDEnum.
+  * \param count What to add to the counter's count.
+  * \param cycles Number of getCycleCounter() counts the operation took.
+  */
+void perfCounterAdd(PerfCounterID id, uint32_t count, uint32_t cycles)
+{
+	if ((uint32_t)id < PERF_NUMBER_OF_COUNTERS)
+	{
+		perf_count[id] += count;
+		perf_cycles[id] += cycles;
+	}
+}
+
+/** Read the current value of a performance counter.
+  * \param out_count The counter's count will be written here.
+  * \param out_cycles The total number of getCycleCounter() counts spent in
+  *                   the operation will be written here.
+  * \param id The performance counter to read. Must be one
+  *           of #PerfCounterIDEnum. Invalid values read as zero.
+  */
+void getPerfCounter(uint32_t *out_count, uint64_t *out_cycles, PerfCounterID id)
+{
+	if ((uint32_t)id < PERF_NUMBER_OF_COUNTERS)
+	{
+		*out_count = perf_count[id];
+		*out_cycles = perf_cycles[id];
+	}
+	else
+	{
+		*out_count = 0;
+		*out_cycles = 0;
+	}
+}
+
+/** Reset every performance counter to zero. */
+void clearPerfCounters(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < PERF_NUMBER_OF_COUNTERS; i++)
+	{
+		perf_count[i] = 0;
+		perf_cycles[i] = 0;
+	}
+}
+
+#endif // #ifdef DEBUG_PERF
+
+#ifdef TEST_PERF_COUNTERS
+
+/** Simulated value of the cycle counter. */
+static uint32_t sim_cycle_counter;
+
+/** Simulated cycle counter, for PERF_START() and PERF_STOP().
+  * \return The current value of #sim_cycle_counter.
+  */
+uint32_t getCycleCounter(void)
+{
+	return sim_cycle_counter;
+}
+
+/** Simulated cycle counter frequency. This isn't used by any test, but
+  * hwinterface.h says it must exist.
+  * \return An arbitrary frequency.
+  */
+uint32_t getCycleCounterFrequency(void)
+{
+	return 1000000;
+}
+
+/** Simulate an operation which takes cycles counts, timed in the same way as
+  * the instrumented operations in other files.
+  * \param id The performance counter to add to.
+  * \param count What to add to the counter's count.
+  * \param cycles How long the operation takes.
+  */
+static void simulateOperation(PerfCounterID id, uint32_t count, uint32_t cycles)
+{
+	PERF_DECLARE_START;
+
+	PERF_START();
+	sim_cycle_counter += cycles;
+	PERF_STOP(id, count);
+}
+
+/** Check that a performance counter has the expected value.
+  * \param id The performance counter to check.
+  * \param expected_count Expected value of the counter's count.
+  * \param expected_cycles Expected value of the counter's cycle total.
+  * \param description Printed if the check fails.
+  */
+static void checkCounter(PerfCounterID id, uint32_t expected_count, uint64_t expected_cycles, const char *description)
+{
+	uint32_t count;
+	uint64_t cycles;
+
+	getPerfCounter(&count, &cycles, id);
+	if ((count == expected_count) && (cycles == expected_cycles))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%s: got count = %u, cycles = %llu\n", description, count, (unsigned long long)cycles);
+		reportFailure();
+	}
+}
+
+int main(void)
+{
+	uint32_t i;
+	bool all_zero;
+	uint32_t count;
+	uint64_t cycles;
+
+	initTests(__FILE__);
+
+	// All counters should start at zero.
+	all_zero = true;
+	for (i = 0; i < PERF_NUMBER_OF_COUNTERS; i++)
+	{
+		getPerfCounter(&count, &cycles, (PerfCounterID)i);
+		if ((count != 0) || (cycles != 0))
+		{
+			all_zero = false;
+		}
+	}
+	if (all_zero)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Counters don't start at zero\n");
+		reportFailure();
+	}
+
+	// Simple accumulation.
+	simulateOperation(PERF_SHA256_BLOCK, 1, 100);
+	simulateOperation(PERF_SHA256_BLOCK, 1, 150);
+	checkCounter(PERF_SHA256_BLOCK, 2, 250, "Simple accumulation");
+	checkCounter(PERF_SHA512_BLOCK, 0, 0, "Other counters unaffected");
+
+	// Counts other than 1 (as used by parseTransaction()).
+	simulateOperation(PERF_PARSE_TRANSACTION, 300, 5000);
+	checkCounter(PERF_PARSE_TRANSACTION, 300, 5000, "Count other than 1");
+
+	// The cycle counter wrapping around in the middle of an operation.
+	sim_cycle_counter = 0xffffff00;
+	simulateOperation(PERF_AES_ENCRYPT, 1, 0x200);
+	checkCounter(PERF_AES_ENCRYPT, 1, 0x200, "Cycle counter wraparound");
+
+	// Totals beyond 32 bits.
+	for (i = 0; i < 5; i++)
+	{
+		simulateOperation(PERF_POINT_MULTIPLY, 1, 0xc0000000);
+	}
+	checkCounter(PERF_POINT_MULTIPLY, 5, 5ULL * 0xc0000000, "Total beyond 32 bits");
+
+	// Invalid IDs should be ignored, and should read as zero.
+	perfCounterAdd(PERF_NUMBER_OF_COUNTERS, 1, 1);
+	checkCounter(PERF_NUMBER_OF_COUNTERS, 0, 0, "Invalid ID");
+	checkCounter(PERF_SHA256_BLOCK, 2, 250, "Invalid ID doesn't affect others");
+
+	// Clearing.
+	clearPerfCounters();
+	checkCounter(PERF_SHA256_BLOCK, 0, 0, "Clear");
+	checkCounter(PERF_POINT_MULTIPLY, 0, 0, "Clear 64 bit total");
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_PERF_COUNTERS
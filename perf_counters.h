@@ -0,0 +1,72 @@
+/** \file perf_counters.h
+  *
+  * \brief Describes functions, types and macros exported by perf_counters.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef PERF_COUNTERS_H_INCLUDED
+#define PERF_COUNTERS_H_INCLUDED
+
+#include "common.h"
+#include "hwinterface.h"
+
+/** Identifiers for each performance counter. These are sent to the host as
+  * the counter_id field of PerfCounter messages (see messages.proto), so
+  * existing values must not be renumbered. */
+typedef enum PerfCounterIDEnum
+{
+	/** pointMultiply(). Each point of pointMultiplyBatch() also counts as
+	  * one, as does each multiplication done with pointMultiplyBegin(),
+	  * pointMultiplySlice() and pointMultiplyEnd(). */
+	PERF_POINT_MULTIPLY			= 0,
+	/** bigMultiply(). */
+	PERF_BIG_MULTIPLY			= 1,
+	/** SHA-256 compression function (one 64 byte block). */
+	PERF_SHA256_BLOCK			= 2,
+	/** SHA-512 compression function (one 128 byte block). */
+	PERF_SHA512_BLOCK			= 3,
+	/** aesEncrypt() (one 16 byte block). */
+	PERF_AES_ENCRYPT			= 4,
+	/** nonVolatileRead(). */
+	PERF_NV_READ				= 5,
+	/** nonVolatileWrite(). */
+	PERF_NV_WRITE				= 6,
+	/** nonVolatileFlush(). */
+	PERF_NV_FLUSH				= 7,
+	/** Acquisition and statistical testing of one batch of HWRNG
+	  * samples. */
+	PERF_HWRNG_BATCH			= 8,
+	/** parseTransaction(). For this counter, the count is the number of
+	  * transaction bytes parsed, not the number of calls. */
+	PERF_PARSE_TRANSACTION		= 9,
+	/** Total number of performance counters. This must be last. */
+	PERF_NUMBER_OF_COUNTERS		= 10
+} PerfCounterID;
+
+#ifdef DEBUG_PERF
+/** Declare the variable which PERF_START() and PERF_STOP() use. This should
+  * be the last local variable declaration in a function. */
+#define PERF_DECLARE_START			uint32_t perf_start
+/** Begin timing an operation. */
+#define PERF_START()				perf_start = getCycleCounter()
+/** Finish timing an operation which was started with PERF_START(), and add
+  * it to a performance counter.
+  * \param id The performance counter to add to. Must be one
+  *           of #PerfCounterIDEnum.
+  * \param count What to add to the counter's count. This is usually 1.
+  */
+#define PERF_STOP(id, count)		perfCounterAdd(id, count, getCycleCounter() - perf_start)
+#else
+#define PERF_DECLARE_START
+#define PERF_START()
+#define PERF_STOP(id, count)
+#endif // #ifdef DEBUG_PERF
+
+#ifdef DEBUG_PERF
+extern void perfCounterAdd(PerfCounterID id, uint32_t count, uint32_t cycles);
+extern void getPerfCounter(uint32_t *out_count, uint64_t *out_cycles, PerfCounterID id);
+extern void clearPerfCounters(void);
+#endif // #ifdef DEBUG_PERF
+
+#endif // #ifndef PERF_COUNTERS_H_INCLUDED
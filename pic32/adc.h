@@ -12,7 +12,7 @@
 #include "../fft.h" // for FFT_SIZE
 
 /** Size of #sample_buffer, in number of samples.
-  * \warning This must be a multiple of 16, or else hardwareRandom32Bytes()
+  * \warning This must be a multiple of 16, or else hwrngRandom32Bytes()
   *          will attempt to read past the end of the sample buffer.
   */
 #define ADC_SAMPLE_BUFFER_SIZE	(FFT_SIZE * 4)
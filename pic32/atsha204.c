@@ -466,17 +466,14 @@ void atsha204Sleep(void)
 	sendBytes(buffer, 1);
 }
 
-/** Get the output of the ATSHA204's internal hardware random number
-  * generator.
-  * \param random_bytes Byte array which, on success, will be written with
-  *                     32 random bytes.
-  * \return false on success, true on failure.
+/** Ask the ATSHA204's internal hardware random number generator for 32
+  * random bytes, without waiting for the response. Use
+  * atsha204PollRandom() to collect the response. This allows other work to
+  * be done while the ATSHA204 executes the command.
   */
-bool atsha204Random(uint8_t *random_bytes)
+void atsha204BeginRandom(void)
 {
-	uint32_t received_length;
-	uint8_t buffer[64];
-	unsigned int timeout_counter;
+	uint8_t buffer[8];
 
 	buffer[0] = COMMAND_FLAG;
 	buffer[1] = 7; // length
@@ -486,32 +483,63 @@ bool atsha204Random(uint8_t *random_bytes)
 	buffer[5] = 0; // reserved; must be 0
 	appendCRC16(&(buffer[1]), 5);
 	sendBytes(buffer, 8);
-	timeout_counter = 0;
-	do
-	{
-		// The token receive timeout (#TOKEN_TIMEOUT_ITERATIONS) equates to
-		// about 250 microsecond. The idea here is to delay enough to make
-		// each iteration of this do loop about 1 millisecond.
-		delayCycles(750 * CYCLES_PER_MICROSECOND); // 750 microsecond
-		buffer[0] = TRANSMIT_FLAG;
-		received_length = sendAndReceiveBytes(buffer, 1, sizeof(buffer));
-		timeout_counter++;
-		// From Table 8-4 of the ATSHA204 datasheet, the maximum execution
-		// time of the "Random" command is 50 millisecond. The timeout
-		// value of 75 below includes a safety factor of 1.5.
-	} while ((received_length == 0) && (timeout_counter < 75));
+}
+
+/** Check whether the ATSHA204 has finished executing the "Random" command
+  * sent by atsha204BeginRandom(). Each call takes about 250 microsecond
+  * if the response isn't ready yet.
+  * \param random_bytes Byte array which, if the response is ready and
+  *                     valid, will be written with 32 random bytes.
+  * \return See #ATSHA204PollResultEnum.
+  */
+ATSHA204PollResult atsha204PollRandom(uint8_t *random_bytes)
+{
+	uint32_t received_length;
+	uint8_t buffer[64];
+
+	buffer[0] = TRANSMIT_FLAG;
+	received_length = sendAndReceiveBytes(buffer, 1, sizeof(buffer));
 	if (received_length == 0)
 	{
-		return true; // timeout
+		return ATSHA204_POLL_BUSY;
 	}
 	if (!isBlockValid(buffer, received_length))
 	{
-		return true; // invalid block received
+		return ATSHA204_POLL_FAILED; // invalid block received
 	}
 	if (received_length != 35)
 	{
-		return true; // unexpected packet size
+		return ATSHA204_POLL_FAILED; // unexpected packet size
 	}
 	memcpy(random_bytes, &(buffer[1]), 32);
+	return ATSHA204_POLL_READY;
+}
+
+/** Get the output of the ATSHA204's internal hardware random number
+  * generator, waiting for the response.
+  * \param random_bytes Byte array which, on success, will be written with
+  *                     32 random bytes.
+  * \return false on success, true on failure.
+  */
+bool atsha204Random(uint8_t *random_bytes)
+{
+	ATSHA204PollResult r;
+	unsigned int timeout_counter;
+
+	atsha204BeginRandom();
+	timeout_counter = 0;
+	do
+	{
+		// The token receive timeout (#TOKEN_TIMEOUT_ITERATIONS) equates to
+		// about 250 microsecond. The idea here is to delay enough to make
+		// each iteration of this do loop about 1 millisecond.
+		delayCycles(750 * CYCLES_PER_MICROSECOND); // 750 microsecond
+		r = atsha204PollRandom(random_bytes);
+		timeout_counter++;
+	} while ((r == ATSHA204_POLL_BUSY) && (timeout_counter < ATSHA204_RANDOM_TIMEOUT_MS));
+	if (r != ATSHA204_POLL_READY)
+	{
+		return true; // timeout or invalid response
+	}
 	return false; // success
 }
@@ -11,10 +11,29 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/** Maximum time, in millisecond, to wait for the ATSHA204 to respond to a
+  * "Random" command. From Table 8-4 of the ATSHA204 datasheet, the maximum
+  * execution time of the "Random" command is 50 millisecond. This includes
+  * a safety factor of 1.5. */
+#define ATSHA204_RANDOM_TIMEOUT_MS		75
+
+/** Possible return values for atsha204PollRandom(). */
+typedef enum ATSHA204PollResultEnum
+{
+	/** The response was received and the random bytes are valid. */
+	ATSHA204_POLL_READY		= 0,
+	/** The ATSHA204 hasn't responded yet. */
+	ATSHA204_POLL_BUSY		= 1,
+	/** The ATSHA204 responded with something invalid. */
+	ATSHA204_POLL_FAILED	= 2
+} ATSHA204PollResult;
+
 extern void initATSHA204(void);
 extern bool atsha204Wake(void);
 extern void atsha204Sleep(void);
 extern bool atsha204Random(uint8_t *random_bytes);
+extern void atsha204BeginRandom(void);
+extern ATSHA204PollResult atsha204PollRandom(uint8_t *random_bytes);
 
 #endif	// #ifndef ATSHA204_H_INCLUDED
 
@@ -0,0 +1,179 @@
+/** \file entropy_sources.c
+  *
+  * \brief Implements hardwareRandom32Bytes() by mixing the PIC32's entropy
+  *        sources.
+  *
+  * There are two entropy sources: the ADC-based HWRNG (see hwrng.c) and the
+  * ATSHA204's internal random number generator (see atsha204.c). They are
+  * combined using the mixer in entropy_mixer.c. While the ADC-based HWRNG
+  * is busy acquiring and testing a batch of samples, the ATSHA204 executes
+  * its "Random" command on its own. The ATSHA204 is a supplementary source:
+  * its bytes are XORed into the next batch from the ADC-based HWRNG, so it
+  * never costs an extra call, and the ATSHA204's output comes almost for
+  * free.
+  *
+  * The ADC-based HWRNG is statistically tested, so its own entropy estimate
+  * is used and its failure is fatal. The ATSHA204's random number generator
+  * can't be tested from here, so it is credited conservatively (see
+  * #ATSHA204_ENTROPY_CREDIT), and if it fails, it is simply not used any
+  * more.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common.h"
+#include "../entropy_mixer.h"
+#include "../hwinterface.h"
+#include "atsha204.h"
+#include "hwrng.h"
+#include "hwrng_limits.h"
+#include "pic32_system.h"
+
+/** Number of bits of entropy credited for every 32 bytes obtained from the
+  * ADC-based HWRNG. This must match what hwrngRandom32Bytes() returns. */
+#define ADC_ENTROPY_CREDIT			((int)(16.0 * ENTROPY_BITS_PER_SAMPLE))
+
+/** Number of bits of entropy credited for every 32 bytes obtained from the
+  * ATSHA204. The ATSHA204's random number generator is a black box, so this
+  * is only 1/8 of the credit for the ADC batch which its bytes are mixed
+  * into. Even if the ATSHA204's output were completely predictable, at least
+  * 8/9 of the 256 * ENTROPY_SAFETY_FACTOR bits which getRandom256Internal()
+  * requires would still come from the ADC-based HWRNG. That is 455 bits,
+  * which is still well over the 256 bits of output, so the ATSHA204 cannot
+  * weaken getRandom256() by more than a small part of its safety factor. In
+  * return, 29 ADC batches are needed instead of 32. */
+#define ATSHA204_ENTROPY_CREDIT		(ADC_ENTROPY_CREDIT / 8)
+
+/** Number of core timer ticks in #ATSHA204_RANDOM_TIMEOUT_MS. The core timer
+  * ticks once every 2 CPU cycles. */
+#define ATSHA204_TIMEOUT_TICKS		(ATSHA204_RANDOM_TIMEOUT_MS * (CYCLES_PER_MILLISECOND / 2))
+
+/** Value of the core timer when the current ATSHA204 "Random" command was
+  * sent. */
+static uint32_t atsha204_begin_count;
+/** Value of the core timer when the ATSHA204 was last polled. */
+static uint32_t atsha204_last_poll_count;
+
+/** Read the CP0 Count (core timer) register.
+  * \return The current value of the core timer.
+  */
+static uint32_t __attribute__((nomips16)) readCoreTimer(void)
+{
+	uint32_t count;
+
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	return count;
+}
+
+/** Wake the ATSHA204 and ask it for random bytes. This is the begin function
+  * of the ATSHA204 entropy source.
+  * \return false on success, true on failure.
+  */
+static bool atsha204SourceBegin(void)
+{
+	if (atsha204Wake())
+	{
+		return true;
+	}
+	atsha204BeginRandom();
+	atsha204_begin_count = readCoreTimer();
+	atsha204_last_poll_count = atsha204_begin_count;
+	return false;
+}
+
+/** Check whether the ATSHA204 has responded to the request sent by
+  * atsha204SourceBegin(). This is the poll function of the ATSHA204 entropy
+  * source.
+  * \param buffer See EntropySource#poll.
+  * \return See EntropySource#poll.
+  */
+static int atsha204SourcePoll(uint8_t *buffer)
+{
+	ATSHA204PollResult r;
+	uint32_t now;
+	uint32_t since_last_poll;
+
+	now = readCoreTimer();
+	since_last_poll = now - atsha204_last_poll_count;
+	atsha204_last_poll_count = now;
+	r = atsha204PollRandom(buffer);
+	if (r == ATSHA204_POLL_READY)
+	{
+		atsha204Sleep();
+		return ATSHA204_ENTROPY_CREDIT;
+	}
+	else if (r == ATSHA204_POLL_FAILED)
+	{
+		atsha204Sleep();
+		return -1;
+	}
+
+	// No response yet.
+	if (since_last_poll > ATSHA204_TIMEOUT_TICKS)
+	{
+		// The request was left pending for a long time (eg. between calls
+		// to getRandom256()). The ATSHA204's watchdog timer may have put it
+		// to sleep, discarding the response, so this isn't a failure of the
+		// ATSHA204. Try again.
+		if (atsha204SourceBegin())
+		{
+			return -1;
+		}
+		return 0;
+	}
+	if ((now - atsha204_begin_count) > ATSHA204_TIMEOUT_TICKS)
+	{
+		atsha204Sleep();
+		return -1; // timeout
+	}
+	return 0;
+}
+
+/** The ADC-based HWRNG. It doesn't need to begin requests, since
+  * hwrngRandom32Bytes() does all its work when it is called. */
+static const EntropySource adc_source = {
+	NULL,
+	hwrngRandom32Bytes,
+	ADC_ENTROPY_CREDIT,
+	true,
+	false};
+
+/** The ATSHA204's internal random number generator. Its bytes are mixed
+  * into each batch from #adc_source. */
+static const EntropySource atsha204_source = {
+	atsha204SourceBegin,
+	atsha204SourcePoll,
+	ATSHA204_ENTROPY_CREDIT,
+	false,
+	true};
+
+/** Whether #adc_source and #atsha204_source have been registered with the
+  * mixer. */
+static bool sources_registered;
+
+/** Fill buffer with 32 random bytes from a hardware random number generator.
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return An estimate of the total number of bits (not bytes) of entropy in
+  *         the buffer on success, or a negative number if the hardware random
+  *         number generator failed in any way. This may also return 0 to tell
+  *         the caller that more samples are needed in order to do any
+  *         meaningful statistical testing. If this returns 0, the caller
+  *         should continue to call this until it returns a non-zero value.
+  */
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	if (!sources_registered)
+	{
+		// The ADC source is registered first so that it is polled first.
+		// The ATSHA204 can then work on its request while the ADC source
+		// acquires and tests samples.
+		clearEntropySources();
+		addEntropySource(&adc_source);
+		addEntropySource(&atsha204_source);
+		sources_registered = true;
+	}
+	return mixedRandom32Bytes(buffer);
+}
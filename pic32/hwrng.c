@@ -2,9 +2,10 @@
   *
   * \brief Collects and tests HWRNG samples.
   *
-  * The code in this file provides an implementation of
-  * hardwareRandom32Bytes() by offering hardware random number generator
-  * (HWRNG) samples from the ADC (see adc.c). However, the majority of code in
+  * The code in this file provides hwrngRandom32Bytes(), which offers hardware
+  * random number generator (HWRNG) samples from the ADC (see adc.c). This is
+  * one of the entropy sources which entropy_sources.c mixes together to
+  * implement hardwareRandom32Bytes(). However, the majority of code in
   * this file is dedicated to statistical testing of those samples.
   *
   * Why bother going to all the trouble to test the HWRNG? Many cryptographic
@@ -24,10 +25,13 @@
 #include <p32xxxx.h>
 #include "../fix16.h"
 #include "../fft.h"
+#include "../fir.h"
 #include "../statistics.h"
 #include "hwrng_limits.h"
+#include "hwrng.h"
 #include "adc.h"
 #include "pic32_system.h"
+#include "../perf_counters.h"
 
 #ifdef TEST_STATISTICS
 #include "ssd1306.h"
@@ -55,6 +59,23 @@ static fix16_t most_recent_entropy_estimate;
 static int report_to_stream;
 #endif // #ifdef TEST_STATISTICS
 
+#ifndef HWRNG_PROFILE_POINT
+/** Marks the end of a stage in the HWRNG sample processing pipeline. The
+  * host-side replay benchmark (see pic32/testers/hwrng_replay) defines this
+  * to timestamp each stage. On the device, this does nothing.
+  * \param stage Name of the stage which has just finished.
+  */
+#define HWRNG_PROFILE_POINT(stage)
+#endif // #ifndef HWRNG_PROFILE_POINT
+#ifndef HWRNG_REPORT_VERDICT
+/** Called with the result of the statistical tests in
+  * fillAndTestSamplesArray(). The host-side replay benchmark defines this
+  * to record which tests failed. On the device, this does nothing.
+  * \param tests_failed See reportStatistics().
+  */
+#define HWRNG_REPORT_VERDICT(tests_failed)
+#endif // #ifndef HWRNG_REPORT_VERDICT
+
 /** Number of ADC samples per HWRNG sample. The signal is oversampled and then
   * filtered in the digital domain to improve the robustness of the HWRNG to
   * high-frequency intereference. */
@@ -65,22 +86,26 @@ static int report_to_stream;
   * FIR filter. This influences #FILTER_ORDER. This must match the parameter
   * listed in calculate_fir_coefficients.m. */
 #define FILTER_HALF_ORDER				8
+#if (FILTER_HALF_ORDER > FIR_MAX_HALF_ORDER)
+#error "FILTER_HALF_ORDER too big for firDecimate()"
+#endif // #if (FILTER_HALF_ORDER > FIR_MAX_HALF_ORDER)
 /** The order (i.e. "number of points" or "size") of the FIR filter. Bigger
   * means higher quality and more computation time. To adjust this,
   * see #FILTER_HALF_ORDER. */
 #define FILTER_ORDER					(2 * FILTER_HALF_ORDER + 1)
 /** FIR filter coefficients, calculated using calculate_fir_coefficients.m
-  * and expressed in Q16.16 fixed-point representation. */
+  * and expressed in Q16.16 fixed-point representation. These must be
+  * symmetric, since firDecimate() folds the taps. */
 static const int32_t fir_lowpass_coefficients[FILTER_ORDER] = {
 -123, 202, 711, 0, -2681, -2929, 5309, 19161,
 26236,
 19161, 5309, -2929, -2681, 0, 711, 202, -123};
 
 /** Array of samples which have passed statistical tests. #SAMPLE_COUNT samples
-  * need to be stored because hardwareRandom32Bytes() cannot start returning
+  * need to be stored because hwrngRandom32Bytes() cannot start returning
   * samples from this array until all statistical tests have passed. */
 static volatile uint16_t samples[SAMPLE_COUNT];
-/** Number of samples in #samples that hardwareRandom32Bytes() has
+/** Number of samples in #samples that hwrngRandom32Bytes() has
   * used up. */
 static uint32_t samples_consumed;
 
@@ -211,14 +236,13 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateCentralMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
+	HWRNG_PROFILE_POINT(moments);
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
 	entropy_error_occurred = fix16_error_occurred;
+	HWRNG_PROFILE_POINT(entropy);
 
 #ifdef TEST_STATISTICS
 	most_recent_mean = mean;
@@ -231,7 +255,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	tests_failed = 0;
 	// STATTEST_MIN_MEAN and STATTEST_MAX_MEAN are in ADC output numbers.
 	// To be comparable to mean, they need to be scaled and offset, just
-	// as samples are in updateIteratorCache().
+	// as samples are in scaleSample().
 	if (mean <= F16((STATTEST_MIN_MEAN - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN))
 	{
 		tests_failed |= 1; // mean below minimum
@@ -307,9 +331,11 @@ static NOINLINE uint32_t fftTestsFailed(fix16_t variance)
 	ComplexFixed fft_buffer[FFT_SIZE + 1];
 
 	bandwidth = estimateBandwidth(&max_bin);
+	HWRNG_PROFILE_POINT(bandwidth);
 	fix16_error_occurred = false;
 	autocorrelation_error_occurred = calculateAutoCorrelation(fft_buffer);
 	max_autocorrelation = findMaximumAutoCorrelation(fft_buffer);
+	HWRNG_PROFILE_POINT(autocorrelation);
 
 #ifdef TEST_STATISTICS
 	if (report_to_stream == 4)
@@ -350,35 +376,6 @@ static NOINLINE uint32_t fftTestsFailed(fix16_t variance)
 	return tests_failed;
 }
 
-/** Apply FIR filter to samples.
-  * \param samples Array of input samples. It must
-  *                contain #ADC_SAMPLE_BUFFER_SIZE samples.
-  * \param base_index Index into samples array to begin applying filter.
-  * \param coefficients Array of FIR filter coefficients, in Q16.16
-  *                     fixed-point representation.
-  * \param order Order (number of coefficients) of the filter.
-  * \return The output sample.
-  * \warning All filter coefficients should have a magnitude of less than one.
-  */
-static int32_t firFilter(const volatile uint16_t *samples, const unsigned int base_index, const int32_t *coefficients, const unsigned int order)
-{
-	int32_t sum; // Q16.16 fixed-point representation
-	unsigned int i;
-	unsigned int index;
-
-	// Convolute samples with coefficients.
-	sum = 0;
-	for (i = 0; i < order; i++)
-	{
-		// The "& (ADC_SAMPLE_BUFFER_SIZE - 1)" makes this a circular
-		// convolution. Circular convolution treats every sample in the
-		// ADC buffer fairly.
-		index = (base_index + i) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-		sum += ((int32_t)samples[index]) * coefficients[i];
-	}
-	return (sum >> 16) + ((sum >> 15) & 1); // round result
-}
-
 /** Gather #SAMPLE_COUNT ADC samples into #samples and run statistical tests
   * on the sample array.
   * \return false on success, true if any statistical test failed.
@@ -386,12 +383,11 @@ static int32_t firFilter(const volatile uint16_t *samples, const unsigned int ba
 static bool fillAndTestSamplesArray(void)
 {
 	unsigned int i;
-	unsigned int j;
-	unsigned int base_index;
-	int32_t filtered_sample;
 	uint32_t tests_failed;
 	fix16_t variance;
+	PERF_DECLARE_START;
 
+	PERF_START();
 	clearHistogram();
 	clearPowerSpectralDensity();
 	samples_consumed = 0;
@@ -411,22 +407,17 @@ static bool fillAndTestSamplesArray(void)
 			// do nothing
 		}
 		suppressIdleMode(false); // stop suppressing CPU idle mode
-		// Filter ADC samples, placing result into samples array.
-		for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
-		{
-			// The "- FILTER_HALF_ORDER" is there to account for the
-			// delay of the low-pass filter.
-			base_index = ((j * OVERSAMPLE_RATIO) - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-			filtered_sample = firFilter(adc_sample_buffer, base_index, fir_lowpass_coefficients, FILTER_ORDER);
-			samples[i + j] = filtered_sample;
-		}
+		HWRNG_PROFILE_POINT(acquire);
+		// Filter and decimate ADC samples, placing result into samples
+		// array. Each output is centred on its input sample, which
+		// accounts for the delay of the low-pass filter.
+		firDecimate(&(samples[i]), adc_sample_buffer, ADC_SAMPLE_BUFFER_SIZE, OVERSAMPLE_RATIO, fir_lowpass_coefficients, FILTER_HALF_ORDER);
+		HWRNG_PROFILE_POINT(filter);
 	}
 
 	// Run statistical tests on samples array.
-	for (i = 0; i < SAMPLE_COUNT; i++)
-	{
-		incrementHistogram(samples[i]);
-	}
+	incrementHistogramBatch(samples, SAMPLE_COUNT);
+	HWRNG_PROFILE_POINT(histogram);
 	// The following loop assumes that #SAMPLE_COUNT is a multiple
 	// of #FFT_SIZE * 2.
 #if ((SAMPLE_COUNT % (FFT_SIZE * 2)) != 0)
@@ -436,8 +427,10 @@ static bool fillAndTestSamplesArray(void)
 	{
 		accumulatePowerSpectralDensity(&(samples[i]));
 	}
+	HWRNG_PROFILE_POINT(psd);
 	tests_failed = histogramTestsFailed(&variance);
 	tests_failed |= fftTestsFailed(variance);
+	HWRNG_REPORT_VERDICT(tests_failed);
 #ifdef TEST_STATISTICS
 	reportStatistics(tests_failed);
 #endif // #ifdef TEST_STATISTICS
@@ -451,10 +444,12 @@ static bool fillAndTestSamplesArray(void)
 		return true; // statistical tests indicate HWRNG failure
 #endif // #ifdef IGNORE_HWRNG_FAILURE
 	}
+	PERF_STOP(PERF_HWRNG_BATCH, 1);
 	return false;
 }
 
-/** Fill buffer with 32 random bytes from a hardware random number generator.
+/** Fill buffer with 32 random bytes from the ADC-based hardware random number
+  * generator. This has the same interface as hardwareRandom32Bytes().
   * \param buffer The buffer to fill. This should have enough space for 32
   *               bytes.
   * \return An estimate of the total number of bits (not bytes) of entropy in
@@ -464,7 +459,7 @@ static bool fillAndTestSamplesArray(void)
   *         meaningful statistical testing. If this returns 0, the caller
   *         should continue to call this until it returns a non-zero value.
   */
-int hardwareRandom32Bytes(uint8_t *buffer)
+int hwrngRandom32Bytes(uint8_t *buffer)
 {
 	unsigned int i;
 	uint32_t sample;
@@ -756,7 +751,7 @@ static void sendFix16(fix16_t value)
 
 /** Test statistical testing functions. The testing mode is set by the first
   * byte received from the stream.
-  * - 'R': Send what hardwareRandom32Bytes() returns.
+  * - 'R': Send what hwrngRandom32Bytes() returns.
   * - 'S': Send moment-based statistical properties of HWRNG to stream.
   * - 'P': Send power-spectral density estimate of HWRNG to stream.
   * - 'B': Send bandwidth estimate off HWRNG to stream.
@@ -812,10 +807,10 @@ void __attribute__ ((nomips16)) testStatistics(void)
 		}
 		while (true)
 		{
-			hardwareRandom32Bytes(random_bytes);
+			hwrngRandom32Bytes(random_bytes);
 			if (!report_to_stream)
 			{
-				// Spam hardwareRandom32Bytes() output to stream,
+				// Spam hwrngRandom32Bytes() output to stream,
 				// so that host can inspect the raw HWRNG samples
 				for (i = 0; i < sizeof(random_bytes); i++)
 				{
@@ -838,10 +833,7 @@ void __attribute__ ((nomips16)) testStatistics(void)
 
 			asm volatile("mfc0 %0, $9" : "=r"(start_count));
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateCentralMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			asm volatile("mfc0 %0, $9" : "=r"(end_count)); // read as soon as possible
@@ -8,6 +8,10 @@
 #ifndef PIC32_HWRNG_H_INCLUDED
 #define PIC32_HWRNG_H_INCLUDED
 
+#include <stdint.h>
+
+extern int hwrngRandom32Bytes(uint8_t *buffer);
+
 #ifdef TEST_STATISTICS
 extern void __attribute__ ((nomips16)) testStatistics(void);
 #endif // #ifdef TEST_STATISTICS
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "../hwinterface.h"
+#include "../perf_counters.h"
 #include "sst25x.h"
 
 /** Whether write cache is valid. */
@@ -120,7 +121,9 @@ extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition,
 	uint32_t end; // exclusive
 	uint32_t data_index;
 	NonVolatileReturn r;
+	PERF_DECLARE_START;
 
+	PERF_START();
     r = checkAndTweakAddress(&address, partition, length);
     if (r != NV_NO_ERROR)
     {
@@ -152,6 +155,7 @@ extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition,
 		address++;
 		data_index++;
 	}
+	PERF_STOP(PERF_NV_WRITE, 1);
 	return NV_NO_ERROR;
 }
 
@@ -170,7 +174,9 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
 	uint32_t nv_read_length; // length of contiguous non-volatile read
 	uint32_t data_index;
     NonVolatileReturn r;
+	PERF_DECLARE_START;
 
+	PERF_START();
 	r = checkAndTweakAddress(&address, partition, length);
     if (r != NV_NO_ERROR)
     {
@@ -216,17 +222,32 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
 		// End of contiguous non-volatile read.
 		sst25xRead(&(data[data_index]), address - nv_read_length, nv_read_length);
 	}
+	PERF_STOP(PERF_NV_READ, 1);
 	return NV_NO_ERROR;
 }
 
 /** Ensure that all buffered writes are committed to non-volatile storage.
+  *
+  * The SST25VF080B datasheet only specifies word programming for words which
+  * are in the erased state (0xffff); reprogramming a word which has already
+  * been programmed is outside the specification, even if it would only
+  * change bits from 1 to 0. So the rule is: a word which needs to change
+  * may only be programmed if it is currently 0xffff. If any word which
+  * needs to change isn't 0xffff, the sector is erased first. Otherwise,
+  * the changes can be made by programming alone, which is much faster and
+  * doesn't wear the flash. In both cases, only words which actually need to
+  * be programmed are programmed.
   * \return See #NonVolatileReturnEnum for return values.
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
 	unsigned int i;
+	unsigned int run_start;
+	bool needs_erase;
 	uint8_t read_buffer[SECTOR_SIZE];
+	PERF_DECLARE_START;
 
+	PERF_START();
 	if (write_cache_valid)
 	{
 		if (write_cache_tag >= NV_MEMORY_SIZE)
@@ -234,19 +255,72 @@ NonVolatileReturn nonVolatileFlush(void)
 			return NV_INVALID_ADDRESS;
 		}
 
-		// Erase sector and verify erase.
-		sst25xEraseSector(write_cache_tag);
+		// Compare cache with current flash contents. Only erased words may
+		// be programmed (see above), so any changed word which isn't
+		// erased forces a sector erase.
 		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
-		for (i = 0; i < SECTOR_SIZE; i++)
+		needs_erase = false;
+		for (i = 0; i < SECTOR_SIZE; i += 2)
+		{
+			if (((read_buffer[i] != write_cache[i]) || (read_buffer[i + 1] != write_cache[i + 1]))
+				&& ((read_buffer[i] != 0xff) || (read_buffer[i + 1] != 0xff)))
+			{
+				needs_erase = true;
+				break;
+			}
+		}
+
+		if (needs_erase)
+		{
+			// Erase sector and verify erase. This leaves read_buffer
+			// containing the (erased) flash contents, as required below.
+			sst25xEraseSector(write_cache_tag);
+			sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
+			for (i = 0; i < SECTOR_SIZE; i++)
+			{
+				if (read_buffer[i] != 0xff)
+				{
+					return NV_IO_ERROR; // erase did not complete properly
+				}
+			}
+		}
+
+		// Work out what needs to be programmed. Words which are already
+		// correct are set to 0xffff, to mark them as not needing
+		// programming. Every word which does need programming is
+		// currently 0xffff, so its new contents can't be 0xffff.
+		for (i = 0; i < SECTOR_SIZE; i += 2)
 		{
-			if (read_buffer[i] != 0xff)
+			if ((read_buffer[i] == write_cache[i]) && (read_buffer[i + 1] == write_cache[i + 1]))
+			{
+				read_buffer[i] = 0xff;
+				read_buffer[i + 1] = 0xff;
+			}
+			else
+			{
+				read_buffer[i] = write_cache[i];
+				read_buffer[i + 1] = write_cache[i + 1];
+			}
+		}
+
+		// Program each run of words which has something to program.
+		i = 0;
+		while (i < SECTOR_SIZE)
+		{
+			if ((read_buffer[i] == 0xff) && (read_buffer[i + 1] == 0xff))
+			{
+				i += 2;
+				continue;
+			}
+			run_start = i;
+			while ((i < SECTOR_SIZE) && ((read_buffer[i] != 0xff) || (read_buffer[i + 1] != 0xff)))
 			{
-				return NV_IO_ERROR; // erase did not complete properly
+				i += 2;
 			}
+			sst25xProgramWords(&(read_buffer[run_start]), write_cache_tag + run_start, i - run_start);
 		}
 
-		// Program sector and verify program.
-		sst25xProgramSector(write_cache, write_cache_tag);
+		// Verify program.
 		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
 		if (memcmp(read_buffer, write_cache, SECTOR_SIZE))
 		{
@@ -257,5 +331,6 @@ NonVolatileReturn nonVolatileFlush(void)
 		write_cache_tag = 0;
 		memset(write_cache, 0, sizeof(write_cache));
 	}
+	PERF_STOP(PERF_NV_FLUSH, 1);
 	return NV_NO_ERROR;
 }
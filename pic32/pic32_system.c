@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <p32xxxx.h>
 #include "pic32_system.h"
+#include "../hwinterface.h"
 
 // This series of #pragma declarations set the device configuration bits.
 // TODO: Implemented these in a less Microchip toolchain-specific way.
@@ -114,6 +115,29 @@ void __attribute__((nomips16)) delayCyclesAndIdle(uint32_t num_cycles)
 	} while ((current_count - start_count) < num_cycles);
 }
 
+#ifdef DEBUG_PERF
+/** Get the current value of the core timer, for the performance counters.
+  * This is an implementation of a function described in hwinterface.h.
+  * \return The current value of the CP0 Count register.
+  */
+uint32_t __attribute__((nomips16)) getCycleCounter(void)
+{
+	uint32_t count;
+
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	return count;
+}
+
+/** Get the rate at which getCycleCounter() increments.
+  * This is an implementation of a function described in hwinterface.h.
+  * \return Counts per second.
+  */
+uint32_t getCycleCounterFrequency(void)
+{
+	return CYCLES_PER_SECOND / 2; // Count is incremented every 2 CPU cycles
+}
+#endif // #ifdef DEBUG_PERF
+
 /** Initialise caching module and set up CPU for instruction caching. */
 static void __attribute__ ((nomips16)) prefetchInit(void)
 {
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <p32xxxx.h>
 #include "pic32_system.h"
+#include "../background.h"
 
 /** Number of consistent samples (each sample is 1 ms apart) required to
   * register a button press. */
@@ -90,38 +91,23 @@ void waitForNoButtonPress(void)
 }
 
 /** Wait until accept or cancel button is pressed. This function does do
-  * debouncing.
+  * debouncing. While no button press is in progress, background tasks
+  * (see background.c) are run instead of idling.
   * \return false if the accept button was pressed, true if the cancel
   *         button was pressed. If both buttons were pressed simultaneously,
   *         true will be returned.
   */
 bool waitForButtonPress(void)
 {
-	uint32_t counter;
-	bool accept_pressed;
-	bool cancel_pressed;
+	ButtonDebouncer debouncer;
 
-	counter = DEBOUNCE_COUNT;
-	while (counter > 0)
+	initButtonDebouncer(&debouncer, DEBOUNCE_COUNT);
+	do
 	{
-		wait1ms();
-		accept_pressed = isAcceptPressed();
-		cancel_pressed = isCancelPressed();
-		if (!accept_pressed && !cancel_pressed)
-		{
-			counter = DEBOUNCE_COUNT; // reset debounce counter
-		}
-		else
+		if (isButtonPressInProgress(&debouncer) || !runBackgroundTask())
 		{
-			counter--;
+			wait1ms();
 		}
-	}
-	if (cancel_pressed)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	} while (!sampleButtonDebouncer(&debouncer, isAcceptPressed(), isCancelPressed()));
+	return wasCancelPressed(&debouncer);
 }
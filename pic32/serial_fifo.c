@@ -4,8 +4,13 @@
   *
   * Each FIFO buffer is intended to be used in a producer-consumer process,
   * with the producer existing in a non-IRH (Interrupt Request Handler) context
-  * and the consumer existing in an IRH context, or vice versa. Synchronisation
-  * is handled using critical sections.
+  * and the consumer existing in an IRH context, or vice versa. There is
+  * exactly one producer and one consumer for each buffer, so no locking is
+  * needed: the producer only ever modifies CircularBuffer#head and the
+  * consumer only ever modifies CircularBuffer#tail. Because of this, bytes
+  * can be moved in and out of the buffers in blocks (see
+  * circularBufferReadBlock() and circularBufferWriteBlock()), without
+  * disabling interrupts.
   * The functions in this file don't actually interface with any
   * communications hardware. The interface of circular buffers to hardware
   * must be handled elsewhere.
@@ -22,29 +27,52 @@
 #include "../common.h"
 #include "../hwinterface.h"
 
+/** Prevent the compiler from moving memory accesses across this point.
+  * The PIC32 has a single in-order core, so this is all that is needed to
+  * ensure that the other side of the buffer never sees an updated index
+  * before the storage contents it covers. Host-side testers which run the
+  * producer and consumer on different threads can override this.
+  */
+#ifndef FIFO_MEMORY_BARRIER
+#define FIFO_MEMORY_BARRIER()	asm volatile("" : : : "memory")
+#endif // #ifndef FIFO_MEMORY_BARRIER
+
 /** Clear and initialise contents of circular buffer.
   * \param buffer The circular buffer to initialise and clear.
   * \param storage Storage array for buffer contents. This must be large enough
   *                to store the number of bytes specified by size.
-  * \param size Size, in bytes, of the storage array.
+  * \param size Size, in bytes, of the storage array. This must be a power
+  *             of 2.
   */
 void initCircularBuffer(volatile CircularBuffer *buffer, volatile uint8_t *storage, uint32_t size)
 {
 	memset((void *)storage, 0xff, size); // just to be sure
 	memset((void *)storage, 0, size);
-	buffer->next = 0;
-	buffer->remaining = 0;
+	buffer->head = 0;
+	buffer->tail = 0;
 	buffer->size = size;
 	buffer->storage = storage;
 }
 
+/** Obtain the number of bytes which are in a circular buffer, waiting to be
+  * read.
+  * \param buffer The circular buffer to check.
+  * \return The number of bytes in the circular buffer.
+  */
+static uint32_t circularBufferUsed(volatile CircularBuffer *buffer)
+{
+	// This works even if head has wrapped around but tail hasn't, because
+	// unsigned arithmetic is modulo 2 ^ 32 and size is a power of 2.
+	return buffer->head - buffer->tail;
+}
+
 /** Check whether a circular buffer is empty.
   * \param buffer The circular buffer to check.
   * \return true if it is empty, false if it is non-empty.
   */
 bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == 0)
+	if (circularBufferUsed(buffer) == 0)
 	{
 		return true;
 	}
@@ -60,7 +88,7 @@ bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
   */
 bool isCircularBufferFull(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == buffer->size)
+	if (circularBufferUsed(buffer) == buffer->size)
 	{
 		return true;
 	}
@@ -78,9 +106,115 @@ bool isCircularBufferFull(volatile CircularBuffer *buffer)
   */
 uint32_t circularBufferSpaceRemaining(volatile CircularBuffer *buffer)
 {
-	// No need to put this in a critical section since (outside of init),
-	// nothing else touches size.
-	return buffer->size - buffer->remaining;
+	return buffer->size - circularBufferUsed(buffer);
+}
+
+/** Read as many bytes as are available (up to a limit) from a circular
+  * buffer. This never blocks. The bytes are copied in at most two
+  * contiguous spans (one if the bytes don't wrap around the end of the
+  * storage array), and the read index is only updated once.
+  * This must only be called by the consumer of the buffer.
+  * \param buffer The circular buffer to read from.
+  * \param data The array to copy the bytes into.
+  * \param length The maximum number of bytes to read.
+  * \return The number of bytes that were read, which may be 0 if the buffer
+  *         was empty.
+  */
+uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length)
+{
+	uint32_t tail;
+	uint32_t index;
+	uint32_t first_span;
+
+	tail = buffer->tail;
+	if (length > (buffer->head - tail))
+	{
+		length = buffer->head - tail;
+	}
+	// Don't let reads of storage happen before the read of head.
+	FIFO_MEMORY_BARRIER();
+	index = tail & (buffer->size - 1);
+	first_span = buffer->size - index;
+	if (first_span > length)
+	{
+		first_span = length;
+	}
+	memcpy(data, (const void *)&(buffer->storage[index]), first_span);
+	memcpy(&(data[first_span]), (const void *)buffer->storage, length - first_span);
+	// Don't let the producer overwrite bytes before they've been copied.
+	FIFO_MEMORY_BARRIER();
+	buffer->tail = tail + length;
+	return length;
+}
+
+/** Write as many bytes as will fit (up to a limit) into a circular buffer.
+  * This never blocks. Like circularBufferReadBlock(), this copies at most
+  * two contiguous spans and updates the write index once.
+  * This must only be called by the producer of the buffer.
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write.
+  * \param length The maximum number of bytes to write.
+  * \return The number of bytes that were written.
+  */
+static uint32_t circularBufferWriteSome(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
+{
+	uint32_t head;
+	uint32_t index;
+	uint32_t first_span;
+
+	head = buffer->head;
+	if (length > (buffer->size - (head - buffer->tail)))
+	{
+		length = buffer->size - (head - buffer->tail);
+	}
+	// Don't overwrite storage before the consumer has finished with it.
+	FIFO_MEMORY_BARRIER();
+	index = head & (buffer->size - 1);
+	first_span = buffer->size - index;
+	if (first_span > length)
+	{
+		first_span = length;
+	}
+	memcpy((void *)&(buffer->storage[index]), data, first_span);
+	memcpy((void *)buffer->storage, &(data[first_span]), length - first_span);
+	// Don't let the consumer see the new head before the bytes it covers.
+	FIFO_MEMORY_BARRIER();
+	buffer->head = head + length;
+	return length;
+}
+
+/** Write a block of bytes to a circular buffer. If there isn't enough space
+  * in the buffer, this will block until all bytes have been written.
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write.
+  * \param length The number of bytes to write.
+  * \param is_irq Use true if calling this from an interrupt
+  *               request handler, otherwise use false.
+  * \warning If is_irq is true, there must be enough space for all length
+  *          bytes, otherwise usbFatalError() will be called.
+  */
+void circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length, bool is_irq)
+{
+	uint32_t written;
+
+	if (is_irq && (circularBufferSpaceRemaining(buffer) < length))
+	{
+		// In interrupt handler; cannot block, because that will block
+		// the consumer and cause a deadlock.
+		usbFatalError();
+		return;
+	}
+	while (true)
+	{
+		written = circularBufferWriteSome(buffer, data, length);
+		data += written;
+		length -= written;
+		if (length == 0)
+		{
+			break;
+		}
+		enterIdleMode();
+	}
 }
 
 /** Read a byte from a circular buffer. This will block until a byte is
@@ -92,7 +226,6 @@ uint32_t circularBufferSpaceRemaining(volatile CircularBuffer *buffer)
   */
 uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 {
-	uint32_t status;
 	uint8_t r;
 
 	while(isCircularBufferEmpty(buffer))
@@ -107,12 +240,7 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 		}
 		enterIdleMode();
 	}
-
-	status = disableInterrupts();
-	r = buffer->storage[buffer->next];
-	buffer->remaining--;
-	buffer->next = (buffer->next + 1) & (buffer->size - 1);
-	restoreInterrupts(status);
+	circularBufferReadBlock(buffer, &r, 1);
 	return r;
 }
 
@@ -125,25 +253,5 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
   */
 void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq)
 {
-	uint32_t status;
-	uint32_t index;
-
-	while (isCircularBufferFull(buffer))
-	{
-		// Buffer is full.
-		if (is_irq)
-		{
-			// In interrupt handler; cannot block, because that will block
-			// the consumer and cause a deadlock.
-			usbFatalError();
-			return;
-		}
-		enterIdleMode();
-	}
-
-	status = disableInterrupts();
-	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
-	buffer->storage[index] = data;
-	buffer->remaining++;
-	restoreInterrupts(status);
+	circularBufferWriteBlock(buffer, &data, 1, is_irq);
 }
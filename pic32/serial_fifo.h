@@ -13,12 +13,14 @@
 /** A circular buffer. */
 typedef struct CircularBufferStruct
 {
-	/** Index of the next element to remove. */
-	volatile uint32_t next;
-	/** Number of elements remaining in buffer. */
-	volatile uint32_t remaining;
+	/** Total number of elements ever written to the buffer, modulo 2 ^ 32.
+	  * This is only modified by the producer. */
+	volatile uint32_t head;
+	/** Total number of elements ever read from the buffer, modulo 2 ^ 32.
+	  * This is only modified by the consumer. */
+	volatile uint32_t tail;
 	/** The maximum number of elements the buffer can store.
-	  * \warning This must be a power of 2.
+	  * \warning This must be a power of 2, and no larger than 2 ^ 31.
 	  */
 	volatile uint32_t size;
 	/** Storage for the buffer. */
@@ -31,5 +33,7 @@ extern bool isCircularBufferFull(volatile CircularBuffer *buffer);
 extern uint32_t circularBufferSpaceRemaining(volatile CircularBuffer *buffer);
 extern uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq);
 extern void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq);
+extern uint32_t circularBufferReadBlock(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length);
+extern void circularBufferWriteBlock(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length, bool is_irq);
 
 #endif // #ifndef SERIAL_FIFO_H_INCLUDED
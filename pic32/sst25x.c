@@ -18,6 +18,11 @@
   * code can probably be adapted to other serial flash memory chips relatively
   * easily.
   *
+  * Only initSPI4() and spiCommand() access the SPI hardware. The host-side
+  * flash simulator (see pic32/testers/nvmem_sim) defines SST25X_HOST_MODEL
+  * and supplies its own versions of those two functions, so that the rest
+  * of this file runs unmodified against a model of the flash chip.
+  *
   * For hardware interfacing requirements, see initSST25x(). All references
   * to the "PIC32 family reference manual" refer to Section 23 (Serial
   * Peripheral Interface), revision G, obtained from
@@ -75,17 +80,16 @@ typedef enum SST25xOpCodesEnum
 	SST25X_DBSY					= 0x80
 } SST25xOpCodes;
 
-/** Initialise the PIC32's SPI4 module to interface with the SST25x serial
-  * flash. SCK4, SDI4 and SDO4 are expected to be directly connected to the
-  * serial flash. SS4 should be connected to the serial flash's chip enable
-  * pin and RB13 should be connected to the serial flash's write protect
-  * pin. */
-void initSST25x(void)
+#ifndef SST25X_HOST_MODEL
+
+/** Initialise the PIC32's SPI4 module and the pins used to interface with
+  * the SST25x serial flash. See initSST25x() for the expected connections.
+  */
+static void initSPI4(void)
 {
 	uint32_t status;
 	uint32_t junk;
 	int i;
-	uint8_t sst25x_status_register;
 
 	AD1PCFGbits.PCFG8 = 1; // set SS4 as digital I/O
 	AD1PCFGbits.PCFG13 = 1; // set RB13 as digital I/O
@@ -123,12 +127,6 @@ void initSST25x(void)
 	SPI4CONbits.MSSEN = 0; // disable slave select (that's controlled manually)
 	SPI4CONbits.ON = 1; // start SPI module
 	restoreInterrupts(status);
-
-	// Disable block level write protection. See Table 3 of the SST25VF080B
-	// datasheet.
- 	sst25x_status_register = sst25xReadStatusRegister();
-	sst25x_status_register &= 0xc3; // clear BP0, BP1, BP2 and BP3
-	sst25xWriteStatusRegister(sst25x_status_register);
 }
 
 /** Queue one byte of data for transmission via. SPI4. This will block until
@@ -205,6 +203,26 @@ static void spiCommand(const uint8_t *command_buffer, unsigned int command_lengt
 	PORTBbits.RB8 = 1; // set slave select high
 }
 
+#endif // #ifndef SST25X_HOST_MODEL
+
+/** Initialise the PIC32's SPI4 module to interface with the SST25x serial
+  * flash. SCK4, SDI4 and SDO4 are expected to be directly connected to the
+  * serial flash. SS4 should be connected to the serial flash's chip enable
+  * pin and RB13 should be connected to the serial flash's write protect
+  * pin. */
+void initSST25x(void)
+{
+	uint8_t sst25x_status_register;
+
+	initSPI4();
+
+	// Disable block level write protection. See Table 3 of the SST25VF080B
+	// datasheet.
+ 	sst25x_status_register = sst25xReadStatusRegister();
+	sst25x_status_register &= 0xc3; // clear BP0, BP1, BP2 and BP3
+	sst25xWriteStatusRegister(sst25x_status_register);
+}
+
 /** Read the SST25x status register (see page 7 of the SST25VF080B datasheet).
   * \return The current value of the status register.
   */
@@ -316,22 +334,23 @@ void sst25xEraseSector(uint32_t address)
 	sst25xWriteDisable(); // just to be safe
 }
 
-/** Program an entire sector (#SECTOR_SIZE bytes) of the SST25x serial flash.
-  * Programming allows the sector to be written with arbitrary data. Before
-  * calling this, the sector should be in an erased state (use
-  * sst25xEraseSector() to do that).
-  * \param data The data to program the sector with. This must be
-  *             exactly #SECTOR_SIZE bytes in size
-  * \param address The address of the sector to program. This must be aligned
-  *                to a multiple of #SECTOR_SIZE.
+/** Program a run of words in the SST25x serial flash, using auto-address
+  * increment mode. Every word in the run must be in the erased
+  * state (0xffff) beforehand; the SST25VF080B datasheet doesn't specify what
+  * happens when an already programmed word is programmed again.
+  * \param data The data to program. This must be length bytes in size.
+  * \param address The address to start programming at. This must be a
+  *                multiple of 2.
+  * \param length The number of bytes to program. This must be a non-zero
+  *               multiple of 2.
   */
-void sst25xProgramSector(uint8_t *data, uint32_t address)
+void sst25xProgramWords(const uint8_t *data, uint32_t address, uint32_t length)
 {
 	unsigned int i;
 	uint8_t command_buffer[6];
 	uint8_t read_buffer[1];
 
-	address &= (0xffffffff ^ (SECTOR_SIZE - 1)); // align to multiple of SECTOR_SIZE
+	address &= 0xfffffffe; // align to multiple of 2
 	// Use auto-address increment mode with software end-of-write detection.
 	// This follows Figure 11 of the SST25VF080B datasheet.
 	sst25xWriteEnable();
@@ -343,7 +362,7 @@ void sst25xProgramSector(uint8_t *data, uint32_t address)
 	command_buffer[5] = data[1];
 	spiCommand(command_buffer, 6, read_buffer, 0);
 	sst25xWaitUntilNotBusy();
-	for (i = 2; i < SECTOR_SIZE; i += 2)
+	for (i = 2; i < length; i += 2)
 	{
 		command_buffer[0] = SST25X_AAI_WORD_PROGRAM;
 		command_buffer[1] = data[i];
@@ -354,3 +373,18 @@ void sst25xProgramSector(uint8_t *data, uint32_t address)
 	sst25xWriteDisable(); // exit AAI mode
 	sst25xWaitUntilNotBusy(); // just to be safe
 }
+
+/** Program an entire sector (#SECTOR_SIZE bytes) of the SST25x serial flash.
+  * Programming allows the sector to be written with arbitrary data. Before
+  * calling this, the sector should be in an erased state (use
+  * sst25xEraseSector() to do that).
+  * \param data The data to program the sector with. This must be
+  *             exactly #SECTOR_SIZE bytes in size
+  * \param address The address of the sector to program. This must be aligned
+  *                to a multiple of #SECTOR_SIZE.
+  */
+void sst25xProgramSector(uint8_t *data, uint32_t address)
+{
+	address &= (0xffffffff ^ (SECTOR_SIZE - 1)); // align to multiple of SECTOR_SIZE
+	sst25xProgramWords(data, address, SECTOR_SIZE);
+}
@@ -37,6 +37,7 @@ extern uint8_t sst25xReadStatusRegister(void);
 extern void sst25xWriteStatusRegister(uint8_t sst25x_status_register);
 extern void sst25xRead(uint8_t *data, uint32_t address, uint32_t length);
 extern void sst25xEraseSector(uint32_t address);
+extern void sst25xProgramWords(const uint8_t *data, uint32_t address, uint32_t length);
 extern void sst25xProgramSector(uint8_t *data, uint32_t address);
 
 #endif	// #ifndef PIC32_SST25X_H
@@ -0,0 +1,319 @@
+// ***********************************************************************
+// fifo_stress.c
+// ***********************************************************************
+//
+// Stress test for the lock-free FIFO buffers in pic32/serial_fifo.c.
+//
+// This includes pic32/serial_fifo.c directly, so the code that is tested is
+// exactly the code that runs on the device. On the device, the producer and
+// consumer of a buffer are the main loop and an interrupt request handler.
+// Here, they are two threads, which is a harsher test, since either thread
+// can be preempted at any point. FIFO_MEMORY_BARRIER() is overridden with a
+// full memory barrier, because unlike the PIC32, the host may have more than
+// one core.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define FIFO_MEMORY_BARRIER()	__sync_synchronize()
+#include "../../serial_fifo.c"
+
+// Size of the buffer under test, in bytes. This is the same as the PIC32
+// transmit FIFO, and is small so that the indices wrap around often.
+#define BUFFER_SIZE				64
+// Maximum length of a block passed to circularBufferWriteBlock() or
+// circularBufferReadBlock(). This is larger than BUFFER_SIZE so that
+// blocking writes and partial reads get exercised.
+#define MAX_BLOCK_LENGTH		(BUFFER_SIZE * 2 + 3)
+// Seed for the sequence of bytes which is sent through the buffer.
+#define DATA_SEED				0x12345678
+// Number of bytes sent through the buffer in the wrap-around test.
+#define WRAP_TEST_LENGTH		100000
+
+// The ways in which the producer and consumer can access the buffer.
+typedef enum AccessModeEnum
+{
+	// Single-byte calls only.
+	MODE_BYTE,
+	// Block calls only.
+	MODE_BLOCK,
+	// Single-byte or block calls, chosen at random.
+	MODE_MIXED
+} AccessMode;
+
+// Parameters and results of one test.
+typedef struct TestStruct
+{
+	// Name of test, for reporting.
+	const char *name;
+	// How the producer and consumer access the buffer.
+	AccessMode mode;
+	// Number of bytes to send through the buffer.
+	uint64_t length;
+	// Number of bytes the consumer received which didn't match.
+	uint64_t mismatches;
+} Test;
+
+// The buffer under test.
+static volatile CircularBuffer fifo;
+// Storage for the buffer under test.
+static volatile uint8_t fifo_storage[BUFFER_SIZE];
+
+// Called by serial_fifo.c whenever a blocking call has to wait.
+void enterIdleMode(void)
+{
+	sched_yield();
+}
+
+// Called by serial_fifo.c if an interrupt request handler would deadlock.
+// Neither thread claims to be one, so this should never be called.
+void usbFatalError(void)
+{
+	printf("usbFatalError() called\n");
+	exit(1);
+}
+
+// Advance a xorshift32 generator.
+static uint32_t nextRandom(uint32_t *state)
+{
+	uint32_t x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// Pick a block length between 1 and MAX_BLOCK_LENGTH inclusive, or 1 if
+// single-byte calls should be used. Also limit it to remaining.
+static uint32_t pickLength(AccessMode mode, uint32_t *state, uint64_t remaining, bool *use_byte_call)
+{
+	uint32_t length;
+
+	if (mode == MODE_BYTE)
+	{
+		*use_byte_call = true;
+	}
+	else if (mode == MODE_BLOCK)
+	{
+		*use_byte_call = false;
+	}
+	else
+	{
+		*use_byte_call = (nextRandom(state) & 1) != 0;
+	}
+	if (*use_byte_call)
+	{
+		length = 1;
+	}
+	else
+	{
+		length = 1 + (nextRandom(state) % MAX_BLOCK_LENGTH);
+	}
+	if (length > remaining)
+	{
+		length = (uint32_t)remaining;
+	}
+	return length;
+}
+
+// Producer thread. Sends the test's sequence of bytes through the buffer.
+static void *producer(void *arg)
+{
+	Test *test;
+	uint8_t block[MAX_BLOCK_LENGTH];
+	uint32_t data_state;
+	uint32_t length_state;
+	uint32_t length;
+	uint32_t i;
+	uint64_t sent;
+	bool use_byte_call;
+
+	test = (Test *)arg;
+	data_state = DATA_SEED;
+	length_state = 1;
+	sent = 0;
+	while (sent < test->length)
+	{
+		length = pickLength(test->mode, &length_state, test->length - sent, &use_byte_call);
+		for (i = 0; i < length; i++)
+		{
+			block[i] = (uint8_t)nextRandom(&data_state);
+		}
+		if (use_byte_call)
+		{
+			circularBufferWrite(&fifo, block[0], false);
+		}
+		else
+		{
+			circularBufferWriteBlock(&fifo, block, length, false);
+		}
+		sent += length;
+	}
+	return NULL;
+}
+
+// Consumer thread. Checks that the bytes received from the buffer match
+// the test's sequence of bytes.
+static void *consumer(void *arg)
+{
+	Test *test;
+	uint8_t block[MAX_BLOCK_LENGTH];
+	uint32_t data_state;
+	uint32_t length_state;
+	uint32_t length;
+	uint32_t i;
+	uint64_t received;
+	bool use_byte_call;
+
+	test = (Test *)arg;
+	data_state = DATA_SEED;
+	length_state = 2;
+	received = 0;
+	while (received < test->length)
+	{
+		length = pickLength(test->mode, &length_state, test->length - received, &use_byte_call);
+		if (use_byte_call)
+		{
+			block[0] = circularBufferRead(&fifo, false);
+		}
+		else
+		{
+			// circularBufferReadBlock() never blocks, so it may return
+			// fewer bytes than asked for.
+			length = circularBufferReadBlock(&fifo, block, length);
+			if (length == 0)
+			{
+				sched_yield();
+			}
+		}
+		for (i = 0; i < length; i++)
+		{
+			if (block[i] != (uint8_t)nextRandom(&data_state))
+			{
+				test->mismatches++;
+			}
+		}
+		received += length;
+	}
+	return NULL;
+}
+
+// Obtain the current time, in seconds.
+static double getTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+// Run one test, starting the buffer's indices at initial_index. Returns
+// false on success, true on failure.
+static bool runTest(Test *test, uint32_t initial_index)
+{
+	pthread_t producer_thread;
+	pthread_t consumer_thread;
+	double start;
+	double elapsed;
+	bool failed;
+
+	initCircularBuffer(&fifo, fifo_storage, BUFFER_SIZE);
+	fifo.head = initial_index;
+	fifo.tail = initial_index;
+	test->mismatches = 0;
+	start = getTime();
+	if (pthread_create(&consumer_thread, NULL, consumer, test)
+		|| pthread_create(&producer_thread, NULL, producer, test))
+	{
+		printf("Could not create threads\n");
+		exit(1);
+	}
+	pthread_join(producer_thread, NULL);
+	pthread_join(consumer_thread, NULL);
+	elapsed = getTime() - start;
+
+	failed = false;
+	if (test->mismatches != 0)
+	{
+		failed = true;
+	}
+	if (!isCircularBufferEmpty(&fifo)
+		|| (fifo.head != (uint32_t)(initial_index + test->length)))
+	{
+		failed = true;
+	}
+	printf("%-8s %12llu bytes %8.3f s %10.2f MB/s  %s\n", test->name,
+		(unsigned long long)test->length, elapsed,
+		(double)test->length / elapsed / 1.0e6,
+		failed ? "FAILED" : "ok");
+	if (test->mismatches != 0)
+	{
+		printf("    %llu bytes didn't match\n", (unsigned long long)test->mismatches);
+	}
+	return failed;
+}
+
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-n <bytes per test>]\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+	Test wrap_test = {"wrap", MODE_MIXED, WRAP_TEST_LENGTH, 0};
+	Test tests[] = {
+		{"byte", MODE_BYTE, 0, 0},
+		{"block", MODE_BLOCK, 0, 0},
+		{"mixed", MODE_MIXED, 0, 0}};
+	uint64_t length;
+	unsigned int i;
+	unsigned int failures;
+
+	length = 10000000;
+	for (i = 1; i < (unsigned int)argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && ((i + 1) < (unsigned int)argc))
+		{
+			length = strtoull(argv[++i], NULL, 0);
+		}
+		else
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	failures = 0;
+	// Start the indices just below 2 ^ 32, so that they wrap around during
+	// the test.
+	if (runTest(&wrap_test, 0 - (uint32_t)(WRAP_TEST_LENGTH / 2)))
+	{
+		failures++;
+	}
+	for (i = 0; i < (sizeof(tests) / sizeof(tests[0])); i++)
+	{
+		tests[i].length = length;
+		if (runTest(&tests[i], 0))
+		{
+			failures++;
+		}
+	}
+	if (failures != 0)
+	{
+		printf("%u tests failed\n", failures);
+		exit(1);
+	}
+	printf("All tests passed\n");
+	exit(0);
+}
@@ -0,0 +1,9 @@
+// ***********************************************************************
+// p32xxxx.h
+// ***********************************************************************
+//
+// Empty stand-in for the PIC32 special function register header, so that
+// pic32/serial_fifo.c can be compiled on the host by fifo_stress.c. Nothing
+// in pic32/serial_fifo.c touches any registers.
+//
+// This file is licensed as described by the file LICENCE.
@@ -0,0 +1,359 @@
+// ***********************************************************************
+// hwrng_replay.c
+// ***********************************************************************
+//
+// Replay recorded or synthetic ADC samples through the PIC32 HWRNG
+// sample processing pipeline (filter -> histogram -> PSD -> moments ->
+// entropy -> bandwidth -> autocorrelation), on the host.
+//
+// This includes pic32/hwrng.c directly, so the code that is run is exactly
+// the code that runs on the device; only the ADC is replaced. The ADC
+// samples come from a trace file, which contains 16-bit little-endian
+// unsigned samples at the ADC sample rate (i.e. before filtering and
+// decimation), or from a deterministic synthetic noise generator.
+//
+// The trace is split into blocks of (SAMPLE_COUNT * OVERSAMPLE_RATIO) ADC
+// samples. Each block produces one set of statistical test results (a
+// "verdict"), just like one call to fillAndTestSamplesArray() on the
+// device. The verdicts can be recorded to a file and later compared
+// against, so that a change to the entropy path which alters any test
+// result is flagged.
+//
+// This also reports throughput and the time spent in each stage of the
+// pipeline. This is useful for benchmarking.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Stages of the pipeline, in the order that they are executed. These names
+// must match the ones passed to HWRNG_PROFILE_POINT() in pic32/hwrng.c.
+enum StageEnum
+{
+	STAGE_acquire,
+	STAGE_filter,
+	STAGE_histogram,
+	STAGE_psd,
+	STAGE_moments,
+	STAGE_entropy,
+	STAGE_bandwidth,
+	STAGE_autocorrelation,
+	NUMBER_OF_STAGES
+};
+
+// Human-readable names of each stage.
+static const char *stage_names[NUMBER_OF_STAGES] = {
+"acquire", "filter", "histogram", "psd",
+"moments", "entropy", "bandwidth", "autocorrelation"};
+
+static void profilePoint(int stage);
+static void reportVerdict(uint32_t tests_failed);
+
+#define HWRNG_PROFILE_POINT(stage)			profilePoint(STAGE_##stage)
+#define HWRNG_REPORT_VERDICT(tests_failed)	reportVerdict(tests_failed)
+
+#include "../../hwrng.c"
+
+// Total time spent in each stage, in nanoseconds.
+static double stage_time[NUMBER_OF_STAGES];
+// Time at which the most recent stage finished.
+static struct timespec last_point;
+
+// The entire trace, in ADC samples.
+static uint16_t *trace;
+// Number of ADC samples in the trace.
+static uint32_t trace_length;
+// Index into trace of the next ADC sample which beginFillingADCBuffer()
+// will use.
+static uint32_t trace_position;
+// Most recent verdict passed to reportVerdict().
+static uint32_t most_recent_verdict;
+
+// Stand-in for the ADC's DMA destination buffer.
+volatile uint16_t adc_sample_buffer[ADC_SAMPLE_BUFFER_SIZE];
+
+// Stand-in for the ADC: copy the next chunk of the trace into
+// adc_sample_buffer. The caller guarantees that there is enough trace left.
+void beginFillingADCBuffer(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < ADC_SAMPLE_BUFFER_SIZE; i++)
+	{
+		adc_sample_buffer[i] = trace[trace_position++];
+	}
+}
+
+// The buffer is always filled immediately by beginFillingADCBuffer().
+bool isADCBufferFull(void)
+{
+	return true;
+}
+
+// There is no idle mode on the host.
+void suppressIdleMode(bool do_suppress)
+{
+	(void)do_suppress;
+}
+
+// Convert a timespec into nanoseconds.
+static double timespecToNanoseconds(struct timespec *t)
+{
+	return (double)t->tv_sec * 1.0e9 + (double)t->tv_nsec;
+}
+
+// Attribute the time since the last profile point to the specified stage.
+static void profilePoint(int stage)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stage_time[stage] += timespecToNanoseconds(&now) - timespecToNanoseconds(&last_point);
+	last_point = now;
+}
+
+// Remember the result of statistical tests, so that it can be recorded or
+// compared.
+static void reportVerdict(uint32_t tests_failed)
+{
+	most_recent_verdict = tests_failed;
+}
+
+// Read an entire trace file into trace. Each sample is a 16-bit
+// little-endian unsigned integer.
+static void readTrace(const char *filename)
+{
+	FILE *f;
+	long size;
+	uint8_t buffer[2];
+	uint32_t i;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		printf("Could not open %s for reading\n", filename);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	trace_length = (uint32_t)(size / 2);
+	trace = malloc(trace_length * sizeof(uint16_t));
+	for (i = 0; i < trace_length; i++)
+	{
+		if (fread(buffer, 2, 1, f) != 1)
+		{
+			printf("Error while reading %s\n", filename);
+			exit(1);
+		}
+		trace[i] = (uint16_t)(buffer[0] | (buffer[1] << 8));
+	}
+	fclose(f);
+}
+
+// State of synthetic noise generator.
+static uint32_t xorshift_state = 2463534242u;
+
+// Get a pseudo-random 32-bit integer. This is xorshift32, which is used
+// (instead of rand()) so that synthetic traces are the same everywhere.
+static uint32_t xorshift32(void)
+{
+	xorshift_state ^= xorshift_state << 13;
+	xorshift_state ^= xorshift_state >> 17;
+	xorshift_state ^= xorshift_state << 5;
+	return xorshift_state;
+}
+
+// Generate a synthetic trace which resembles the output of the HWRNG: 10-bit
+// approximately Gaussian noise centred on mid-scale.
+static void generateTrace(uint32_t blocks)
+{
+	uint32_t i;
+	int j;
+	int32_t sum;
+	int32_t sample;
+
+	trace_length = blocks * SAMPLE_COUNT * OVERSAMPLE_RATIO;
+	trace = malloc(trace_length * sizeof(uint16_t));
+	for (i = 0; i < trace_length; i++)
+	{
+		// Sum of 12 uniform variables on [0, 4096) has mean 24576 and
+		// standard deviation 4096. Scale that to a standard deviation
+		// of 64 ADC units.
+		sum = 0;
+		for (j = 0; j < 12; j++)
+		{
+			sum += (int32_t)(xorshift32() & 0xfff);
+		}
+		sample = 512 + ((sum - 24576) / 64);
+		if (sample < 0)
+		{
+			sample = 0;
+		}
+		if (sample > 1023)
+		{
+			sample = 1023;
+		}
+		trace[i] = (uint16_t)sample;
+	}
+}
+
+// Print command-line usage information.
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-r <verdict file> | -c <verdict file>] <trace file>\n", program_name);
+	printf("   or: %s [-r <verdict file> | -c <verdict file>] -s <number of blocks>\n", program_name);
+	printf("  -r   Record the test results of each block to <verdict file>.\n");
+	printf("  -c   Compare the test results of each block against <verdict file>.\n");
+	printf("  -s   Use a synthetic trace instead of a trace file.\n");
+	printf("A trace file contains 16-bit little-endian unsigned ADC samples.\n");
+}
+
+int main(int argc, char **argv)
+{
+	FILE *verdict_file;
+	const char *record_filename;
+	const char *compare_filename;
+	const char *trace_filename;
+	uint32_t synthetic_blocks;
+	uint32_t blocks;
+	uint32_t block;
+	uint32_t expected_verdict;
+	uint32_t blocks_passed;
+	uint32_t verdicts_changed;
+	double total_time;
+	double processing_time;
+	int i;
+	int stage;
+
+	record_filename = NULL;
+	compare_filename = NULL;
+	trace_filename = NULL;
+	synthetic_blocks = 0;
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-r") && ((i + 1) < argc))
+		{
+			record_filename = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-c") && ((i + 1) < argc))
+		{
+			compare_filename = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-s") && ((i + 1) < argc))
+		{
+			synthetic_blocks = (uint32_t)strtoul(argv[++i], NULL, 0);
+		}
+		else if (argv[i][0] != '-')
+		{
+			trace_filename = argv[i];
+		}
+		else
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	if (((trace_filename == NULL) == (synthetic_blocks == 0))
+		|| ((record_filename != NULL) && (compare_filename != NULL)))
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (trace_filename != NULL)
+	{
+		readTrace(trace_filename);
+	}
+	else
+	{
+		generateTrace(synthetic_blocks);
+	}
+	blocks = trace_length / (SAMPLE_COUNT * OVERSAMPLE_RATIO);
+	if (blocks == 0)
+	{
+		printf("Trace is too short; it needs at least %u ADC samples\n", SAMPLE_COUNT * OVERSAMPLE_RATIO);
+		exit(1);
+	}
+
+	verdict_file = NULL;
+	if (record_filename != NULL)
+	{
+		verdict_file = fopen(record_filename, "w");
+	}
+	else if (compare_filename != NULL)
+	{
+		verdict_file = fopen(compare_filename, "r");
+	}
+	if (((record_filename != NULL) || (compare_filename != NULL)) && (verdict_file == NULL))
+	{
+		printf("Could not open verdict file\n");
+		exit(1);
+	}
+
+	blocks_passed = 0;
+	verdicts_changed = 0;
+	trace_position = 0;
+	for (block = 0; block < blocks; block++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &last_point);
+		fillAndTestSamplesArray();
+		if (most_recent_verdict == 0)
+		{
+			blocks_passed++;
+		}
+		if (record_filename != NULL)
+		{
+			fprintf(verdict_file, "%u %02x\n", block, most_recent_verdict);
+		}
+		else if (compare_filename != NULL)
+		{
+			if (fscanf(verdict_file, "%*u %x", &expected_verdict) != 1)
+			{
+				printf("Verdict file has fewer blocks than trace\n");
+				exit(1);
+			}
+			if (expected_verdict != most_recent_verdict)
+			{
+				printf("Block %u: verdict changed from %02x to %02x\n", block, expected_verdict, most_recent_verdict);
+				verdicts_changed++;
+			}
+		}
+	}
+	if (verdict_file != NULL)
+	{
+		fclose(verdict_file);
+	}
+
+	total_time = 0.0;
+	for (stage = 0; stage < NUMBER_OF_STAGES; stage++)
+	{
+		total_time += stage_time[stage];
+	}
+	// Time spent acquiring samples is time spent copying the trace, which
+	// has nothing to do with the device.
+	processing_time = total_time - stage_time[STAGE_acquire];
+	printf("Blocks: %u (%u passed all tests)\n", blocks, blocks_passed);
+	printf("ADC samples/s: %.0f\n", (double)blocks * SAMPLE_COUNT * OVERSAMPLE_RATIO * 1.0e9 / processing_time);
+	printf("HWRNG samples/s: %.0f\n", (double)blocks * SAMPLE_COUNT * 1.0e9 / processing_time);
+	printf("%-16s %12s %8s\n", "Stage", "us/block", "%");
+	for (stage = 0; stage < NUMBER_OF_STAGES; stage++)
+	{
+		printf("%-16s %12.1f %8.1f\n", stage_names[stage], stage_time[stage] / 1000.0 / blocks, 100.0 * stage_time[stage] / total_time);
+	}
+	if (compare_filename != NULL)
+	{
+		printf("Verdicts changed: %u\n", verdicts_changed);
+		if (verdicts_changed != 0)
+		{
+			exit(1);
+		}
+	}
+	free(trace);
+	exit(0);
+}
@@ -0,0 +1,9 @@
+// ***********************************************************************
+// p32xxxx.h
+// ***********************************************************************
+//
+// Empty stand-in for the PIC32 special function register header, so that
+// pic32/hwrng.c can be compiled on the host by hwrng_replay.c. None of the
+// code in pic32/hwrng.c that hwrng_replay.c uses touches any registers.
+//
+// This file is licensed as described by the file LICENCE.
@@ -0,0 +1,484 @@
+// ***********************************************************************
+// nvmem_sim.c
+// ***********************************************************************
+//
+// Run the PIC32 non-volatile memory stack (wallet.c -> nvmem_manager.c ->
+// sst25x.c) on the host, against a model of an SST25VF080B serial flash
+// chip.
+//
+// This includes pic32/sst25x.c directly, with SST25X_HOST_MODEL defined, so
+// the command sequences that are sent to the modelled chip are exactly the
+// ones that the device sends; only the SPI layer (spiCommand()) is
+// replaced. pic32/nvmem_manager.c and wallet.c are compiled unmodified.
+//
+// The model tracks the contents of the flash, the erase count of each
+// sector, bytes programmed, SPI commands and an approximate time for
+// everything, based on the SPI clock rate and the datasheet busy times.
+// Wallet operations (format, newWallet, makeNewAddress etc.) are run in
+// the same order as a typical session, and the flash activity of each is
+// reported. This allows changes to the write-caching policy to be measured
+// without hardware.
+//
+// All references to the "SST25VF080B datasheet" refer to revision A,
+// obtained from http://ww1.microchip.com/downloads/en/DeviceDoc/25045A.pdf
+// on 10 January 2013.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../../common.h"
+#include "../../../hwinterface.h"
+#include "../../../prandom.h"
+#include "../../../wallet.h"
+
+static void initSPI4(void);
+static void spiCommand(const uint8_t *command_buffer, unsigned int command_length, uint8_t *read_buffer, unsigned int read_length);
+
+#define SST25X_HOST_MODEL
+#include "../../sst25x.c"
+
+// Size of the modelled chip, in bytes. The SST25VF080B has 8 megabit.
+#define MODEL_SIZE					(1024 * 1024)
+// Number of sectors in the modelled chip.
+#define MODEL_SECTORS				(MODEL_SIZE / SECTOR_SIZE)
+// Time taken to transfer one byte over SPI, in nanoseconds. The SPI clock
+// is 9 MHz (see initSPI4() in pic32/sst25x.c).
+#define SPI_BYTE_TIME				(8.0 * 1000.0 / 9.0)
+// Maximum sector erase time (T_SE), in nanoseconds. From Table 18 of the
+// SST25VF080B datasheet.
+#define SECTOR_ERASE_TIME			25000000.0
+// Maximum byte program time (T_BP), in nanoseconds. This also applies to
+// each word in AAI mode. From Table 18 of the SST25VF080B datasheet.
+#define PROGRAM_TIME				10000.0
+
+// Counters which describe flash activity.
+typedef struct FlashStatisticsStruct
+{
+	// Number of SPI commands (i.e. chip select assertions).
+	uint32_t commands;
+	// Number of status register reads which found the chip busy.
+	uint32_t busy_polls;
+	// Number of bytes read from the flash array.
+	uint32_t bytes_read;
+	// Number of bytes programmed.
+	uint32_t bytes_programmed;
+	// Number of sector erases.
+	uint32_t erases;
+	// Number of commands which a real chip would have ignored or rejected.
+	uint32_t protocol_errors;
+	// Modelled time, in nanoseconds.
+	double time;
+} FlashStatistics;
+
+// Contents of the modelled flash.
+static uint8_t flash[MODEL_SIZE];
+// Number of times each sector has been erased.
+static uint32_t erase_count[MODEL_SECTORS];
+// Accumulated statistics.
+static FlashStatistics stats;
+// Status register block protection bits (BP0 to BP3 and BPL).
+static uint8_t block_protection;
+// Write-enable latch.
+static bool write_enabled;
+// Whether a write status register command has been enabled.
+static bool write_status_enabled;
+// Whether the chip is in auto-address increment (AAI) word program mode.
+static bool aai_mode;
+// Address of the next word to be programmed in AAI mode.
+static uint32_t aai_address;
+// Modelled time at which the current program or erase operation
+// completes, in nanoseconds.
+static double busy_until;
+
+// The modelled chip has no SPI module to initialise.
+static void initSPI4(void)
+{
+}
+
+// There is nothing to wait for on the host.
+void delayCycles(uint32_t num_cycles)
+{
+	(void)num_cycles;
+}
+
+// Extract the 24-bit address from a command.
+static uint32_t commandAddress(const uint8_t *command_buffer)
+{
+	return (((uint32_t)command_buffer[1] << 16) | ((uint32_t)command_buffer[2] << 8) | (uint32_t)command_buffer[3]) % MODEL_SIZE;
+}
+
+// Program one byte of the modelled flash. Like real flash, programming can
+// only clear bits. The SST25VF080B datasheet only specifies programming of
+// erased bytes, so programming a byte which isn't 0xff is counted as a
+// protocol error.
+static void programByte(uint32_t address, uint8_t data)
+{
+	if (flash[address % MODEL_SIZE] != 0xff)
+	{
+		stats.protocol_errors++;
+	}
+	flash[address % MODEL_SIZE] &= data;
+	stats.bytes_programmed++;
+}
+
+// Model of the SST25x serial flash's SPI interface. This decodes each
+// command which sst25x.c sends and updates the model accordingly.
+static void spiCommand(const uint8_t *command_buffer, unsigned int command_length, uint8_t *read_buffer, unsigned int read_length)
+{
+	bool busy;
+	uint32_t address;
+	unsigned int i;
+
+	stats.commands++;
+	stats.time += (double)(command_length + read_length) * SPI_BYTE_TIME;
+	busy = (stats.time < busy_until);
+	if (busy && (command_buffer[0] != SST25X_READ_STATUS))
+	{
+		// Only the status register can be read while the chip is busy.
+		stats.protocol_errors++;
+		return;
+	}
+
+	switch (command_buffer[0])
+	{
+	case SST25X_READ_STATUS:
+		for (i = 0; i < read_length; i++)
+		{
+			read_buffer[i] = (uint8_t)((busy ? 0x01 : 0) | (write_enabled ? 0x02 : 0)
+				| block_protection | (aai_mode ? 0x40 : 0));
+		}
+		if (busy)
+		{
+			stats.busy_polls++;
+		}
+		break;
+
+	case SST25X_ENABLE_WRITE_STATUS:
+		write_status_enabled = true;
+		break;
+
+	case SST25X_WRITE_STATUS:
+		if ((write_status_enabled || write_enabled) && (command_length >= 2))
+		{
+			block_protection = (uint8_t)(command_buffer[1] & 0xbc);
+		}
+		else
+		{
+			stats.protocol_errors++;
+		}
+		write_status_enabled = false;
+		write_enabled = false;
+		break;
+
+	case SST25X_WRITE_ENABLE:
+		write_enabled = true;
+		break;
+
+	case SST25X_WRITE_DISABLE:
+		write_enabled = false;
+		aai_mode = false;
+		break;
+
+	case SST25X_READ:
+		address = commandAddress(command_buffer);
+		for (i = 0; i < read_length; i++)
+		{
+			read_buffer[i] = flash[(address + i) % MODEL_SIZE];
+		}
+		stats.bytes_read += read_length;
+		break;
+
+	case SST25X_SECTOR_ERASE_4K:
+		if (!write_enabled || ((block_protection & 0x3c) != 0) || (command_length < 4))
+		{
+			stats.protocol_errors++;
+			break;
+		}
+		address = commandAddress(command_buffer) & ~(uint32_t)(SECTOR_SIZE - 1);
+		memset(&(flash[address]), 0xff, SECTOR_SIZE);
+		erase_count[address / SECTOR_SIZE]++;
+		stats.erases++;
+		busy_until = stats.time + SECTOR_ERASE_TIME;
+		write_enabled = false;
+		break;
+
+	case SST25X_BYTE_PROGRAM:
+		if (!write_enabled || ((block_protection & 0x3c) != 0) || (command_length < 5))
+		{
+			stats.protocol_errors++;
+			break;
+		}
+		programByte(commandAddress(command_buffer), command_buffer[4]);
+		busy_until = stats.time + PROGRAM_TIME;
+		write_enabled = false;
+		break;
+
+	case SST25X_AAI_WORD_PROGRAM:
+		if (!aai_mode)
+		{
+			// First command of AAI sequence includes the address.
+			if (!write_enabled || ((block_protection & 0x3c) != 0) || (command_length < 6))
+			{
+				stats.protocol_errors++;
+				break;
+			}
+			aai_mode = true;
+			aai_address = commandAddress(command_buffer) & ~(uint32_t)1;
+			programByte(aai_address, command_buffer[4]);
+			programByte(aai_address + 1, command_buffer[5]);
+		}
+		else
+		{
+			if (command_length < 3)
+			{
+				stats.protocol_errors++;
+				break;
+			}
+			programByte(aai_address, command_buffer[1]);
+			programByte(aai_address + 1, command_buffer[2]);
+		}
+		aai_address += 2;
+		busy_until = stats.time + PROGRAM_TIME;
+		break;
+
+	default:
+		stats.protocol_errors++;
+		break;
+	}
+}
+
+// State of the deterministic "random" number generator.
+static uint32_t xorshift_state = 2463534242u;
+
+// Get a pseudo-random 32-bit integer. This is xorshift32, which is used
+// (instead of rand()) so that results are the same everywhere.
+static uint32_t xorshift32(void)
+{
+	xorshift_state ^= xorshift_state << 13;
+	xorshift_state ^= xorshift_state >> 17;
+	xorshift_state ^= xorshift_state << 5;
+	return xorshift_state;
+}
+
+// Deterministic stand-in for the HWRNG. The entropy estimate is large so
+// that getRandom256() only needs a couple of calls.
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	int i;
+
+	for (i = 0; i < 32; i++)
+	{
+		buffer[i] = (uint8_t)xorshift32();
+	}
+	return 256;
+}
+
+// Same number of iterations as the PIC32 firmware (see pic32/main.c).
+uint32_t getPBKDF2Iterations(void)
+{
+	return 128;
+}
+
+// Backups aren't exercised.
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	(void)seed;
+	(void)is_encrypted;
+	(void)destination_device;
+	return true;
+}
+
+// Something went badly wrong.
+void fatalError(void)
+{
+	printf("fatalError() called\n");
+	exit(1);
+}
+
+// Statistics at the start of the current operation.
+static FlashStatistics operation_start;
+// Number of operations which didn't return the expected result.
+static int operations_failed;
+
+// Print the column headings of the table that endOperation() prints rows
+// of.
+static void printHeader(void)
+{
+	printf("%-24s %9s %10s %7s %11s %10s %11s\n", "Operation", "Commands", "Busy polls", "Erases", "Programmed", "Read", "Time (ms)");
+}
+
+// Mark the start of an operation.
+static void beginOperation(void)
+{
+	operation_start = stats;
+}
+
+// Mark the end of an operation and report its flash activity.
+static void endOperation(const char *name, bool failed)
+{
+	printf("%-24s %9u %10u %7u %11u %10u %11.3f%s\n", name,
+		stats.commands - operation_start.commands,
+		stats.busy_polls - operation_start.busy_polls,
+		stats.erases - operation_start.erases,
+		stats.bytes_programmed - operation_start.bytes_programmed,
+		stats.bytes_read - operation_start.bytes_read,
+		(stats.time - operation_start.time) / 1.0e6,
+		failed ? " FAILED" : "");
+	if (failed)
+	{
+		operations_failed++;
+	}
+}
+
+// Expected contents of the first few bytes of the global partition, for
+// flushTest().
+static uint8_t flush_test_expected[4];
+
+// Write one word to the global partition, flush it and check that the
+// flash contains what was written and that the sector was erased only if
+// expect_erase is true. Returns true if something went wrong.
+static bool flushTest(uint32_t address, uint8_t byte0, uint8_t byte1, bool expect_erase)
+{
+	uint8_t buffer[2];
+	uint8_t read_back[sizeof(flush_test_expected)];
+	uint32_t erases_before;
+
+	erases_before = stats.erases;
+	buffer[0] = byte0;
+	buffer[1] = byte1;
+	flush_test_expected[address] = byte0;
+	flush_test_expected[address + 1] = byte1;
+	if ((nonVolatileWrite(buffer, PARTITION_GLOBAL, address, 2) != NV_NO_ERROR)
+		|| (nonVolatileFlush() != NV_NO_ERROR)
+		|| (nonVolatileRead(read_back, PARTITION_GLOBAL, 0, sizeof(read_back)) != NV_NO_ERROR))
+	{
+		return true;
+	}
+	if (memcmp(read_back, flush_test_expected, sizeof(read_back))
+		|| memcmp(flash, flush_test_expected, sizeof(flush_test_expected)))
+	{
+		return true;
+	}
+	return (stats.erases != erases_before) != expect_erase;
+}
+
+// Print command-line usage information.
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-n <number of addresses>]\n", program_name);
+	printf("  -n   Number of addresses to generate (default: 10).\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t pool_state[ENTROPY_POOL_LENGTH];
+	uint8_t name[NAME_LENGTH];
+	uint8_t address[20];
+	uint8_t password[] = "password";
+	PointAffine public_key;
+	uint32_t num_addresses;
+	uint32_t i;
+	uint32_t max_erases;
+	uint32_t sectors_erased;
+	char operation_name[32];
+
+	num_addresses = 10;
+	for (i = 1; i < (uint32_t)argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && ((i + 1) < (uint32_t)argc))
+		{
+			num_addresses = (uint32_t)strtoul(argv[++i], NULL, 0);
+		}
+		else
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	// A new chip is fully erased.
+	memset(flash, 0xff, sizeof(flash));
+	initSST25x();
+	printHeader();
+
+	// Check nonVolatileFlush()'s erase decision. Only erased (0xffff) words
+	// can be programmed, so any change to a programmed word, even one which
+	// only clears bits, needs an erase. The protocol error check in
+	// programByte() catches any attempt to program a word which isn't erased.
+	memset(flush_test_expected, 0xff, sizeof(flush_test_expected));
+	beginOperation();
+	endOperation("flush: erased word", flushTest(0, 0x12, 0x34, false));
+	beginOperation();
+	endOperation("flush: clear bits", flushTest(0, 0x10, 0x30, true));
+	beginOperation();
+	endOperation("flush: set bits", flushTest(0, 0x7f, 0x30, true));
+	beginOperation();
+	endOperation("flush: second word", flushTest(2, 0x56, 0xff, false));
+	beginOperation();
+	endOperation("flush: unchanged", flushTest(2, 0x56, 0xff, false));
+
+	// This follows what the PACKET_TYPE_FORMAT handler in stream_comm.c
+	// does.
+	beginOperation();
+	memset(pool_state, 0x42, sizeof(pool_state));
+	endOperation("format", initialiseEntropyPool(pool_state)
+		|| (sanitiseEverything() != WALLET_NO_ERROR)
+		|| (uninitWallet() != WALLET_NO_ERROR));
+
+	beginOperation();
+	memset(name, ' ', sizeof(name));
+	memcpy(name, "Simulated wallet", 16);
+	endOperation("newWallet", newWallet(0, name, false, NULL, false, password, sizeof(password) - 1) != WALLET_NO_ERROR);
+
+	for (i = 0; i < num_addresses; i++)
+	{
+		beginOperation();
+		sprintf(operation_name, "makeNewAddress #%u", i + 1);
+		endOperation(operation_name, makeNewAddress(address, &public_key) == BAD_ADDRESS_HANDLE);
+	}
+
+	beginOperation();
+	endOperation("getAddressAndPublicKey", getAddressAndPublicKey(address, &public_key, 1) != WALLET_NO_ERROR);
+
+	beginOperation();
+	endOperation("initWallet", (uninitWallet() != WALLET_NO_ERROR)
+		|| (initWallet(0, password, sizeof(password) - 1) != WALLET_NO_ERROR));
+
+	beginOperation();
+	memcpy(name, "Renamed wallet  ", 16);
+	endOperation("changeWalletName", changeWalletName(name) != WALLET_NO_ERROR);
+
+	beginOperation();
+	endOperation("changeEncryptionKey", changeEncryptionKey(NULL, 0) != WALLET_NO_ERROR);
+
+	beginOperation();
+	endOperation("deleteWallet", deleteWallet(0) != WALLET_NO_ERROR);
+
+	memset(&operation_start, 0, sizeof(operation_start));
+	endOperation("Total", false);
+
+	max_erases = 0;
+	sectors_erased = 0;
+	for (i = 0; i < MODEL_SECTORS; i++)
+	{
+		if (erase_count[i] > 0)
+		{
+			sectors_erased++;
+		}
+		if (erase_count[i] > max_erases)
+		{
+			max_erases = erase_count[i];
+		}
+	}
+	printf("Sectors erased: %u, maximum erases of one sector: %u\n", sectors_erased, max_erases);
+	printf("Protocol errors: %u\n", stats.protocol_errors);
+	if ((operations_failed != 0) || (stats.protocol_errors != 0))
+	{
+		exit(1);
+	}
+	exit(0);
+}
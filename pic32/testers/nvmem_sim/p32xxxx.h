@@ -0,0 +1,9 @@
+// ***********************************************************************
+// p32xxxx.h
+// ***********************************************************************
+//
+// Empty stand-in for the PIC32 special function register header, so that
+// pic32/sst25x.c can be compiled on the host by nvmem_sim.c. The parts of
+// pic32/sst25x.c which touch registers are excluded by SST25X_HOST_MODEL.
+//
+// This file is licensed as described by the file LICENCE.
@@ -0,0 +1,629 @@
+// ***********************************************************************
+// protocol_bench.c
+// ***********************************************************************
+//
+// Replay the packet corpus in pic32/testers (the same files which
+// hwb_tester.c sends to real hardware) through processPacket() on the
+// host, and measure how long each message takes.
+//
+// The packet handler and wallet code are compiled unmodified, with
+// DEBUG_PERF defined, so that the performance counters in perf_counters.c
+// record time spent in each module (point multiplication, SHA-256, AES,
+// non-volatile storage etc.). Button, PIN and OTP interjections are
+// answered automatically: ButtonRequest with button_ack.bin, PinRequest
+// with pin_ack.bin and OtpRequest with the OTP that the device just
+// displayed. Non-volatile storage is a RAM image.
+//
+// A session (format, create a wallet, get addresses, sign a transaction,
+// etc.) is run several times. Some steps are generated instead of read from
+// the corpus, so that larger versions of the same requests can be measured
+// (see the -a and -e options). For each step, latency percentiles and the
+// average time spent in each instrumented module are reported.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/random.h>
+#include "../../../common.h"
+#include "../../../hwinterface.h"
+#include "../../../perf_counters.h"
+#include "../../../stream_comm.h"
+
+// Size, in bytes, of the global partition. This is the same as the PIC32
+// serial flash (see pic32/sst25x.h).
+#define GLOBAL_PARTITION_SIZE		1024
+// Size, in bytes, of the accounts partition.
+#define ACCOUNTS_PARTITION_SIZE		3072
+// Maximum size, in bytes, of any request packet.
+#define MAX_PACKET_SIZE				4096
+// Maximum number of steps in a session.
+#define MAX_STEPS					64
+// Maximum length of a step name.
+#define MAX_NAME_LENGTH				48
+// Default number of times to run the session.
+#define DEFAULT_REPETITIONS			10
+// Default number of addresses for the generated NewAddresses step.
+#define DEFAULT_NEW_ADDRESSES		64
+// Default number of bytes for the generated GetEntropy step. This is the
+// most that getBytesOfEntropy() in stream_comm.c will return.
+#define DEFAULT_ENTROPY_BYTES		1024
+
+// One request which is sent in every session.
+typedef struct BenchStepStruct
+{
+	// Name, for the report. Steps from the corpus are named after their
+	// file.
+	char name[MAX_NAME_LENGTH];
+	// The request packet, including its header.
+	uint8_t packet[MAX_PACKET_SIZE];
+	// Length of the request packet, in bytes.
+	uint32_t length;
+	// Latency of each run of this step, in nanoseconds.
+	double *latency;
+	// Total performance counter cycles (nanoseconds) in each module, over
+	// all runs of this step.
+	uint64_t module_cycles[PERF_NUMBER_OF_COUNTERS];
+	// Number of runs which ended with a Failure response.
+	uint32_t failures;
+} BenchStep;
+
+// Short names of each performance counter, in the order of
+// PerfCounterIDEnum. These are the column headings of the module report.
+static const char *counter_names[PERF_NUMBER_OF_COUNTERS] = {
+	"pt_mul", "big_mul", "sha256", "sha512", "aes", "nv_read", "nv_write", "nv_flush", "hwrng", "tx_parse"};
+
+// Every step of the session, in order.
+static BenchStep steps[MAX_STEPS];
+// Number of valid entries in steps.
+static uint32_t num_steps;
+// Directory containing the packet corpus.
+static const char *corpus_directory;
+
+// Contents of non-volatile storage. The global partition comes first.
+static uint8_t nv_image[GLOBAL_PARTITION_SIZE + ACCOUNTS_PARTITION_SIZE];
+
+// Bytes which streamGetOneByte() will return.
+static uint8_t in_buffer[MAX_PACKET_SIZE];
+// Number of valid bytes in in_buffer.
+static uint32_t in_length;
+// Index into in_buffer of the next byte to read.
+static uint32_t in_ptr;
+// Number of bytes of the current response packet which have been written
+// by streamPutOneByte(); 0 means a new packet is expected.
+static uint32_t out_position;
+// Payload length of the current response packet.
+static uint32_t out_payload_length;
+// Message ID of the current (or most recent) response packet.
+static uint16_t out_message_id;
+// Button acknowledgement packet, from the corpus.
+static uint8_t button_ack[MAX_PACKET_SIZE];
+// Length of button_ack, in bytes.
+static uint32_t button_ack_length;
+// PIN acknowledgement packet, from the corpus.
+static uint8_t pin_ack[MAX_PACKET_SIZE];
+// Length of pin_ack, in bytes.
+static uint32_t pin_ack_length;
+// The most recent OTP passed to displayOTP().
+static char current_otp[17];
+
+// Get the current time, in nanoseconds.
+static uint64_t now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+// Performance counter time base. This is in nanoseconds, so operations
+// which take longer than about 4 seconds will be mismeasured.
+uint32_t getCycleCounter(void)
+{
+	return (uint32_t)now();
+}
+
+// Frequency of getCycleCounter().
+uint32_t getCycleCounterFrequency(void)
+{
+	return 1000000000;
+}
+
+// Make the next request (or interjection response) available to
+// streamGetOneByte().
+static void setInput(const uint8_t *packet, uint32_t length)
+{
+	memcpy(in_buffer, packet, length);
+	in_length = length;
+	in_ptr = 0;
+}
+
+// Build an OtpAck packet containing the OTP which is being displayed.
+static void setOtpAckInput(void)
+{
+	uint8_t packet[32];
+	uint32_t otp_length;
+
+	otp_length = (uint32_t)strlen(current_otp);
+	packet[0] = '#';
+	packet[1] = '#';
+	packet[2] = 0x00;
+	packet[3] = PACKET_TYPE_OTP_ACK;
+	packet[4] = 0x00;
+	packet[5] = 0x00;
+	packet[6] = 0x00;
+	packet[7] = (uint8_t)(otp_length + 2);
+	packet[8] = 0x0a; // field 1, length-delimited
+	packet[9] = (uint8_t)otp_length;
+	memcpy(&(packet[10]), current_otp, otp_length);
+	setInput(packet, otp_length + 10);
+}
+
+// Get one byte of the current request. When the request has been completely
+// read, the device must be waiting for the response to an interjection,
+// which is supplied here.
+uint8_t streamGetOneByte(void)
+{
+	if (in_ptr >= in_length)
+	{
+		if (out_message_id == PACKET_TYPE_BUTTON_REQUEST)
+		{
+			setInput(button_ack, button_ack_length);
+		}
+		else if (out_message_id == PACKET_TYPE_PIN_REQUEST)
+		{
+			setInput(pin_ack, pin_ack_length);
+		}
+		else if (out_message_id == PACKET_TYPE_OTP_REQUEST)
+		{
+			setOtpAckInput();
+		}
+		else
+		{
+			printf("Device wants input after message 0x%02x\n", out_message_id);
+			exit(1);
+		}
+		// Don't answer the same interjection twice.
+		out_message_id = 0xffff;
+	}
+	return in_buffer[in_ptr++];
+}
+
+// Keep track of response packet boundaries, so that the message ID of the
+// most recent response is known. The responses themselves are discarded.
+void streamPutOneByte(uint8_t one_byte)
+{
+	if (out_position == 2)
+	{
+		out_message_id = (uint16_t)(one_byte << 8);
+	}
+	else if (out_position == 3)
+	{
+		out_message_id = (uint16_t)(out_message_id | one_byte);
+	}
+	else if ((out_position >= 4) && (out_position < 8))
+	{
+		out_payload_length = (out_payload_length << 8) | one_byte;
+	}
+	out_position++;
+	if ((out_position >= 8) && (out_position == (out_payload_length + 8)))
+	{
+		out_position = 0;
+		out_payload_length = 0;
+	}
+}
+
+// Transaction outputs aren't displayed.
+bool newOutputSeen(char *text_amount, char *text_address)
+{
+	return false;
+}
+
+// The transaction fee isn't displayed.
+void setTransactionFee(char *text_amount)
+{
+}
+
+// Transaction outputs aren't displayed.
+void clearOutputsSeen(void)
+{
+}
+
+// The number of new addresses isn't displayed.
+void setNewAddressesCount(char *text_count)
+{
+}
+
+// Every action is allowed.
+bool userDenied(AskUserCommand command)
+{
+	return false;
+}
+
+// Remember the OTP so that it can be sent back in an OtpAck.
+void displayOTP(AskUserCommand command, char *otp)
+{
+	strncpy(current_otp, otp, sizeof(current_otp) - 1);
+	current_otp[sizeof(current_otp) - 1] = '\0';
+}
+
+// Forget the OTP.
+void clearOTP(void)
+{
+	current_otp[0] = '\0';
+}
+
+// Random bytes come from the operating system.
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	PERF_DECLARE_START;
+
+	PERF_START();
+	if (getrandom(buffer, 32, 0) != 32)
+	{
+		return -1;
+	}
+	PERF_STOP(PERF_HWRNG_BATCH, 1);
+	return 256;
+}
+
+// Get size of a partition.
+NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
+{
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_size = GLOBAL_PARTITION_SIZE;
+	}
+	else if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_size = ACCOUNTS_PARTITION_SIZE;
+	}
+	else
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	return NV_NO_ERROR;
+}
+
+// Convert a partition and address into an offset into nv_image, checking
+// that the whole range is within the partition.
+static NonVolatileReturn imageOffset(uint32_t *out_offset, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t size;
+
+	if (nonVolatileGetSize(&size, partition) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	if ((address > size) || (length > (size - address)))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	*out_offset = address;
+	if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_offset += GLOBAL_PARTITION_SIZE;
+	}
+	return NV_NO_ERROR;
+}
+
+// Write to the RAM image of non-volatile storage.
+NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+	PERF_DECLARE_START;
+
+	PERF_START();
+	if (imageOffset(&offset, partition, address, length) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(&(nv_image[offset]), data, length);
+	PERF_STOP(PERF_NV_WRITE, 1);
+	return NV_NO_ERROR;
+}
+
+// Read from the RAM image of non-volatile storage.
+NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+	PERF_DECLARE_START;
+
+	PERF_START();
+	if (imageOffset(&offset, partition, address, length) != NV_NO_ERROR)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(data, &(nv_image[offset]), length);
+	PERF_STOP(PERF_NV_READ, 1);
+	return NV_NO_ERROR;
+}
+
+// Nothing is cached, so there is nothing to flush.
+NonVolatileReturn nonVolatileFlush(void)
+{
+	PERF_DECLARE_START;
+
+	PERF_START();
+	PERF_STOP(PERF_NV_FLUSH, 1);
+	return NV_NO_ERROR;
+}
+
+// Use the same number of PBKDF2 iterations as the PIC32 port.
+uint32_t getPBKDF2Iterations(void)
+{
+	return 128;
+}
+
+// Backups are discarded.
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	return destination_device != 0;
+}
+
+// Something went badly wrong.
+void fatalError(void)
+{
+	printf("fatalError() called\n");
+	exit(1);
+}
+
+// Read a packet from the corpus.
+static uint32_t readCorpusFile(uint8_t *out_packet, const char *filename)
+{
+	char path[512];
+	FILE *f;
+	size_t length;
+
+	snprintf(path, sizeof(path), "%s/%s", corpus_directory, filename);
+	f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		printf("Could not open \"%s\"\n", path);
+		exit(1);
+	}
+	length = fread(out_packet, 1, MAX_PACKET_SIZE, f);
+	fclose(f);
+	if (length < 8)
+	{
+		printf("\"%s\" is too short\n", path);
+		exit(1);
+	}
+	return (uint32_t)length;
+}
+
+// Add a step to the session, using a packet from the corpus. The step is
+// named after the file (without the extension).
+static void addCorpusStep(const char *filename)
+{
+	BenchStep *step;
+
+	step = &(steps[num_steps++]);
+	snprintf(step->name, sizeof(step->name), "%.*s", (int)(strlen(filename) - 4), filename);
+	step->length = readCorpusFile(step->packet, filename);
+}
+
+// Add a step to the session, using a generated packet whose payload is
+// a single uint32 field (field number 1). This is enough for GetEntropy,
+// NewAddresses and GetAddressAndPublicKey.
+static void addGeneratedStep(const char *name, uint16_t message_id, uint32_t value)
+{
+	BenchStep *step;
+	uint32_t length;
+
+	step = &(steps[num_steps++]);
+	snprintf(step->name, sizeof(step->name), "%s", name);
+	length = 8;
+	step->packet[length++] = 0x08; // field 1, varint
+	do
+	{
+		step->packet[length] = (uint8_t)(value & 0x7f);
+		value >>= 7;
+		if (value != 0)
+		{
+			step->packet[length] |= 0x80;
+		}
+		length++;
+	} while (value != 0);
+	step->packet[0] = '#';
+	step->packet[1] = '#';
+	step->packet[2] = (uint8_t)(message_id >> 8);
+	step->packet[3] = (uint8_t)message_id;
+	step->packet[4] = 0;
+	step->packet[5] = 0;
+	step->packet[6] = 0;
+	step->packet[7] = (uint8_t)(length - 8);
+	step->length = length;
+}
+
+// Comparison function for qsort().
+static int compareDoubles(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+// Get a percentile (nearest-rank) of a sorted array.
+static double percentile(const double *sorted, uint32_t n, uint32_t p)
+{
+	uint32_t rank;
+
+	rank = (p * n + 99) / 100;
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+	return sorted[rank - 1];
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t repetitions;
+	uint32_t new_addresses;
+	uint32_t entropy_bytes;
+	uint32_t rep;
+	uint32_t i;
+	uint32_t j;
+	uint32_t count;
+	uint32_t total_failures;
+	uint64_t cycles;
+	uint64_t start;
+	char name[MAX_NAME_LENGTH];
+	int arg;
+
+	repetitions = DEFAULT_REPETITIONS;
+	new_addresses = DEFAULT_NEW_ADDRESSES;
+	entropy_bytes = DEFAULT_ENTROPY_BYTES;
+	corpus_directory = "..";
+	for (arg = 1; (arg + 1) < argc; arg += 2)
+	{
+		if (!strcmp(argv[arg], "-r"))
+		{
+			repetitions = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[arg], "-a"))
+		{
+			new_addresses = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[arg], "-e"))
+		{
+			entropy_bytes = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[arg], "-c"))
+		{
+			corpus_directory = argv[arg + 1];
+		}
+		else
+		{
+			break;
+		}
+	}
+	if ((arg < argc) || (repetitions == 0) || (new_addresses == 0) || (entropy_bytes == 0))
+	{
+		printf("Usage: %s [-r <repetitions>] [-a <addresses>] [-e <entropy bytes>] [-c <corpus directory>]\n", argv[0]);
+		printf("Defaults: %d repetitions, %d addresses, %d entropy bytes, corpus in \"..\".\n",
+			DEFAULT_REPETITIONS, DEFAULT_NEW_ADDRESSES, DEFAULT_ENTROPY_BYTES);
+		exit(1);
+	}
+
+	button_ack_length = readCorpusFile(button_ack, "button_ack.bin");
+	pin_ack_length = readCorpusFile(pin_ack, "pin_ack.bin");
+
+	// The session. This is roughly the order which a host would use.
+	addCorpusStep("initialize.bin");
+	addCorpusStep("ping.bin");
+	addCorpusStep("format_storage.bin");
+	addCorpusStep("new_wallet.bin");
+	addCorpusStep("load_wallet.bin");
+	addCorpusStep("new_address.bin");
+	addCorpusStep("new_addresses.bin");
+	snprintf(name, sizeof(name), "new_addresses_%u (generated)", new_addresses);
+	addGeneratedStep(name, PACKET_TYPE_NEW_ADDRESSES, new_addresses);
+	addCorpusStep("get_number_of_addresses.bin");
+	addCorpusStep("get_address_1.bin");
+	addCorpusStep("get_address_2.bin");
+	addCorpusStep("get_address_3.bin");
+	snprintf(name, sizeof(name), "get_address_%u (generated)", new_addresses + 4);
+	addGeneratedStep(name, PACKET_TYPE_GET_ADDRESS_PUBKEY, new_addresses + 4);
+	addCorpusStep("get_master_public_key.bin");
+	addCorpusStep("list_wallets.bin");
+	addCorpusStep("get_device_uuid.bin");
+	addCorpusStep("get_entropy_32_bytes.bin");
+	addCorpusStep("get_entropy_4096_bytes.bin");
+	snprintf(name, sizeof(name), "get_entropy_%u_bytes (generated)", entropy_bytes);
+	addGeneratedStep(name, PACKET_TYPE_GET_ENTROPY, entropy_bytes);
+	addCorpusStep("sign_transaction.bin");
+	addCorpusStep("backup_wallet.bin");
+	addCorpusStep("delete_wallet.bin");
+
+	for (i = 0; i < num_steps; i++)
+	{
+		steps[i].latency = calloc(repetitions, sizeof(double));
+		if (steps[i].latency == NULL)
+		{
+			printf("Out of memory\n");
+			exit(1);
+		}
+	}
+
+	memset(nv_image, 0xff, sizeof(nv_image));
+	for (rep = 0; rep < repetitions; rep++)
+	{
+		for (i = 0; i < num_steps; i++)
+		{
+			setInput(steps[i].packet, steps[i].length);
+			out_message_id = 0xffff;
+			clearPerfCounters();
+			start = now();
+			processPacket();
+			steps[i].latency[rep] = (double)(now() - start);
+			if (in_ptr != in_length)
+			{
+				printf("%s: only %u of %u bytes were read\n", steps[i].name, in_ptr, in_length);
+				exit(1);
+			}
+			if (out_message_id == PACKET_TYPE_FAILURE)
+			{
+				steps[i].failures++;
+			}
+			for (j = 0; j < PERF_NUMBER_OF_COUNTERS; j++)
+			{
+				getPerfCounter(&count, &cycles, (PerfCounterID)j);
+				steps[i].module_cycles[j] += cycles;
+			}
+		}
+	}
+
+	printf("Latency (ms) over %u runs:\n", repetitions);
+	printf("%-36s %9s %9s %9s %9s %5s\n", "message", "p50", "p90", "p99", "max", "fail");
+	total_failures = 0;
+	for (i = 0; i < num_steps; i++)
+	{
+		qsort(steps[i].latency, repetitions, sizeof(double), compareDoubles);
+		printf("%-36s %9.3f %9.3f %9.3f %9.3f %5u\n", steps[i].name,
+			percentile(steps[i].latency, repetitions, 50) / 1.0e6,
+			percentile(steps[i].latency, repetitions, 90) / 1.0e6,
+			percentile(steps[i].latency, repetitions, 99) / 1.0e6,
+			steps[i].latency[repetitions - 1] / 1.0e6,
+			steps[i].failures);
+		total_failures += steps[i].failures;
+	}
+
+	// Modules nest (for example, pt_mul includes big_mul), so the columns
+	// don't add up to the latency.
+	printf("\nMean time per message (ms) in each module:\n");
+	printf("%-36s", "message");
+	for (j = 0; j < PERF_NUMBER_OF_COUNTERS; j++)
+	{
+		printf(" %8s", counter_names[j]);
+	}
+	printf("\n");
+	for (i = 0; i < num_steps; i++)
+	{
+		printf("%-36s", steps[i].name);
+		for (j = 0; j < PERF_NUMBER_OF_COUNTERS; j++)
+		{
+			printf(" %8.3f", (double)steps[i].module_cycles[j] / (double)repetitions / 1.0e6);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < num_steps; i++)
+	{
+		free(steps[i].latency);
+	}
+	if (total_failures != 0)
+	{
+		// Some requests in the corpus are meant to fail (for example,
+		// get_entropy_4096_bytes.bin asks for too many bytes), so this
+		// isn't treated as an error.
+		printf("\n%u responses were Failure messages\n", total_failures);
+	}
+	exit(0);
+}
@@ -0,0 +1,9 @@
+// ***********************************************************************
+// p32xxxx.h
+// ***********************************************************************
+//
+// Empty stand-in for the PIC32 special function register header, so that
+// pic32/ssd1306.c can be compiled on the host by ssd1306_sim.c. The parts of
+// pic32/ssd1306.c which touch registers are excluded by SSD1306_HOST_MODEL.
+//
+// This file is licensed as described by the file LICENCE.
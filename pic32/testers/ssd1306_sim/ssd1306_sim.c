@@ -0,0 +1,521 @@
+// ***********************************************************************
+// ssd1306_sim.c
+// ***********************************************************************
+//
+// Run the PIC32 SSD1306 text renderer on the host, against a model of the
+// SSD1306's GDDRAM and command interpreter.
+//
+// This includes pic32/ssd1306.c directly, with SSD1306_HOST_MODEL defined,
+// so the command and data bytes that are sent to the modelled controller
+// are exactly the ones that the device sends; only the GPIO layer
+// (writeSPIByte() etc.) is replaced.
+//
+// After every call into pic32/ssd1306.c, the modelled GDDRAM is compared
+// with a reference framebuffer, which is rasterised pixel-by-pixel straight
+// from the text buffer and font table. The renderer only redraws character
+// cells which have changed, so this catches any cell which it failed to
+// redraw, or redrew in the wrong place.
+//
+// All references to the "SSD1306 datasheet" refer to the document obtained
+// from http://www.adafruit.com/datasheets/SSD1306.pdf on 30-Apr-2012.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+static void configurePeripheralsForSSD1306(void);
+static void writeSPIByte(bool is_data, uint8_t value);
+static void pulseResetLine(void);
+
+#define SSD1306_HOST_MODEL
+#include "../../ssd1306.c"
+
+// Number of pages (8 pixel high rows) in GDDRAM.
+#define MODEL_PAGES					8
+// Number of columns in GDDRAM.
+#define MODEL_COLUMNS				128
+
+// Memory addressing modes. See section 10.1.3 of the SSD1306 datasheet.
+typedef enum AddressingModeEnum
+{
+	MODE_HORIZONTAL					= 0,
+	MODE_VERTICAL					= 1,
+	MODE_PAGE						= 2
+} AddressingMode;
+
+// Counters which describe display activity.
+typedef struct DisplayStatisticsStruct
+{
+	// Number of data bytes written to GDDRAM.
+	uint32_t data_bytes;
+	// Number of command bytes (including command arguments).
+	uint32_t command_bytes;
+	// Number of data bytes a renderer which redraws the entire display on
+	// every update would have written.
+	uint32_t full_redraw_bytes;
+} DisplayStatistics;
+
+// Contents of the modelled GDDRAM.
+static uint8_t gddram[MODEL_PAGES][MODEL_COLUMNS];
+// Current memory addressing mode.
+static AddressingMode addressing_mode;
+// Column address range, set by command 0x21.
+static uint32_t column_start;
+static uint32_t column_end;
+// Page address range, set by command 0x22.
+static uint32_t page_start;
+static uint32_t page_end;
+// GDDRAM pointer.
+static uint32_t column_pointer;
+static uint32_t page_pointer;
+// The command currently being received, and its arguments.
+static uint8_t command[3];
+// Number of bytes of command which have been received.
+static uint32_t command_received;
+// Number of bytes in command, including arguments.
+static uint32_t command_length;
+// Accumulated statistics.
+static DisplayStatistics stats;
+// Number of unknown commands received.
+static uint32_t unknown_commands;
+// Number of times the modelled GDDRAM didn't match the reference.
+static uint32_t mismatches;
+// Name of the operation currently being run, for error reporting.
+static const char *current_operation;
+
+// Reset the modelled controller. GDDRAM is left as it is, since the
+// SSD1306 datasheet doesn't say it is cleared by reset.
+static void resetModel(void)
+{
+	addressing_mode = MODE_PAGE;
+	column_start = 0;
+	column_end = MODEL_COLUMNS - 1;
+	page_start = 0;
+	page_end = MODEL_PAGES - 1;
+	column_pointer = 0;
+	page_pointer = 0;
+	command_received = 0;
+}
+
+// Get the total length (including arguments) of a command, from its first
+// byte. Returns 0 if the command is unknown.
+static uint32_t getCommandLength(uint8_t first_byte)
+{
+	switch (first_byte)
+	{
+	case 0x20: // set memory addressing mode
+	case 0x81: // set contrast
+	case 0x8d: // set charge pump
+	case 0xa8: // set multiplex ratio
+	case 0xd3: // set display offset
+	case 0xd5: // set oscillator frequency
+	case 0xd9: // set pre-charge period
+	case 0xda: // set COM pins hardware configuration
+	case 0xdb: // set VCOMH deselect level
+		return 2;
+	case 0x21: // set column address
+	case 0x22: // set page address
+		return 3;
+	case 0xa0: // set segment re-map
+	case 0xa1:
+	case 0xa4: // disable entire display on
+	case 0xa5:
+	case 0xa6: // set normal display
+	case 0xa7:
+	case 0xae: // display off
+	case 0xaf: // display on
+	case 0xc0: // set COM scan direction
+	case 0xc8:
+		return 1;
+	default:
+		if ((first_byte <= 0x1f) // set column start address for page mode
+			|| ((first_byte >= 0x40) && (first_byte <= 0x7f)) // set display start line
+			|| ((first_byte >= 0xb0) && (first_byte <= 0xb7))) // set page start for page mode
+		{
+			return 1;
+		}
+		return 0;
+	}
+}
+
+// Act on a completely received command.
+static void executeCommand(void)
+{
+	switch (command[0])
+	{
+	case 0x20:
+		addressing_mode = (AddressingMode)(command[1] & 3);
+		break;
+	case 0x21:
+		column_start = command[1] & 0x7f;
+		column_end = command[2] & 0x7f;
+		column_pointer = column_start;
+		break;
+	case 0x22:
+		page_start = command[1] & 7;
+		page_end = command[2] & 7;
+		page_pointer = page_start;
+		break;
+	default:
+		if (command[0] <= 0x0f)
+		{
+			column_pointer = (column_pointer & 0xf0) | command[0];
+		}
+		else if (command[0] <= 0x1f)
+		{
+			column_pointer = (column_pointer & 0x0f) | ((command[0] & 7) << 4);
+		}
+		else if ((command[0] >= 0xb0) && (command[0] <= 0xb7))
+		{
+			page_pointer = command[0] & 7;
+		}
+		// Everything else doesn't affect GDDRAM.
+		break;
+	}
+}
+
+// Write one byte to GDDRAM and advance the GDDRAM pointer, as described in
+// section 10.1.3 of the SSD1306 datasheet.
+static void writeData(uint8_t value)
+{
+	gddram[page_pointer][column_pointer] = value;
+	if (addressing_mode == MODE_VERTICAL)
+	{
+		page_pointer++;
+		if (page_pointer > page_end)
+		{
+			page_pointer = page_start;
+			column_pointer++;
+			if (column_pointer > column_end)
+			{
+				column_pointer = column_start;
+			}
+		}
+	}
+	else if (addressing_mode == MODE_HORIZONTAL)
+	{
+		column_pointer++;
+		if (column_pointer > column_end)
+		{
+			column_pointer = column_start;
+			page_pointer++;
+			if (page_pointer > page_end)
+			{
+				page_pointer = page_start;
+			}
+		}
+	}
+	else
+	{
+		if (column_pointer < (MODEL_COLUMNS - 1))
+		{
+			column_pointer++;
+		}
+	}
+}
+
+// Stand-in for the function in pic32/ssd1306.c which sets up GPIO.
+static void configurePeripheralsForSSD1306(void)
+{
+}
+
+// Stand-in for the function in pic32/ssd1306.c which asserts RES#.
+static void pulseResetLine(void)
+{
+	resetModel();
+}
+
+// Replacement for the bit-banged SPI write in pic32/ssd1306.c. This feeds
+// the modelled controller.
+static void writeSPIByte(bool is_data, uint8_t value)
+{
+	if (is_data)
+	{
+		if (command_received != 0)
+		{
+			printf("%s: data byte in the middle of command 0x%02x\n", current_operation, command[0]);
+			unknown_commands++;
+			command_received = 0;
+		}
+		writeData(value);
+		stats.data_bytes++;
+		return;
+	}
+
+	stats.command_bytes++;
+	if (command_received == 0)
+	{
+		command_length = getCommandLength(value);
+		if (command_length == 0)
+		{
+			printf("%s: unknown command 0x%02x\n", current_operation, value);
+			unknown_commands++;
+			return;
+		}
+	}
+	command[command_received++] = value;
+	if (command_received == command_length)
+	{
+		executeCommand();
+		command_received = 0;
+	}
+}
+
+// Get the colour of one pixel, straight from the text buffer and font
+// table. This deliberately doesn't use any of the renderer's functions.
+static bool referencePixel(uint32_t x, uint32_t y)
+{
+	uint32_t char_x;
+	uint32_t char_y;
+	uint32_t character;
+	uint32_t bit_offset;
+
+	char_x = x / CHARACTER_WIDTH;
+	char_y = y / CHARACTER_HEIGHT;
+	character = FONT_BLANK;
+	if ((char_x < CHARACTERS_PER_LINE) && (char_y < NUMBER_OF_LINES))
+	{
+		character = text_buffer[char_y * CHARACTERS_PER_LINE + char_x];
+	}
+	if (character < FONT_TABLE_START)
+	{
+		character = FONT_BLANK;
+	}
+	bit_offset = (character - FONT_TABLE_START) * CHARACTER_BITS
+		+ (x % CHARACTER_WIDTH) * CHARACTER_HEIGHT + (y % CHARACTER_HEIGHT);
+	if ((bit_offset >> 3) >= (sizeof(font_table) - 1))
+	{
+		return false;
+	}
+	return ((font_table[bit_offset >> 3] >> (bit_offset & 7)) & 1) != 0;
+}
+
+// Compare the modelled GDDRAM with the reference framebuffer.
+static void checkDisplay(void)
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t wrong_pixels;
+	bool actual;
+
+	wrong_pixels = 0;
+	for (x = 0; x < DISPLAY_WIDTH; x++)
+	{
+		for (y = 0; y < DISPLAY_HEIGHT; y++)
+		{
+			actual = ((gddram[y >> 3][x] >> (y & 7)) & 1) != 0;
+			if (actual != referencePixel(x, y))
+			{
+				wrong_pixels++;
+			}
+		}
+	}
+	if (wrong_pixels != 0)
+	{
+		printf("%s: %u pixels don't match reference\n", current_operation, wrong_pixels);
+		mismatches++;
+	}
+}
+
+// The following are wrappers around the functions exported by
+// pic32/ssd1306.c. They check the display after every call, and keep track
+// of what a full redraw would have cost. Every one of the wrapped functions
+// used to redraw the entire display.
+
+static void simClearDisplay(void)
+{
+	clearDisplay();
+	stats.full_redraw_bytes += DISPLAY_WIDTH * DISPLAY_HEIGHT / 8;
+	checkDisplay();
+}
+
+static void simWriteString(const char *str)
+{
+	writeStringToDisplay(str);
+	stats.full_redraw_bytes += DISPLAY_WIDTH * DISPLAY_HEIGHT / 8;
+	checkDisplay();
+}
+
+static void simWriteStringWordWrap(const char *str)
+{
+	writeStringToDisplayWordWrap(str);
+	stats.full_redraw_bytes += DISPLAY_WIDTH * DISPLAY_HEIGHT / 8;
+	checkDisplay();
+}
+
+static void printHeader(void)
+{
+	printf("%-12s %10s %10s %14s %8s\n", "operation", "data", "commands",
+		"full redraw", "ratio");
+}
+
+static void beginOperation(const char *name)
+{
+	current_operation = name;
+	memset(&stats, 0, sizeof(stats));
+}
+
+static void endOperation(void)
+{
+	double ratio;
+
+	ratio = 0.0;
+	if (stats.full_redraw_bytes != 0)
+	{
+		ratio = (double)(stats.data_bytes + stats.command_bytes) / (double)stats.full_redraw_bytes;
+	}
+	printf("%-12s %10u %10u %14u %8.3f\n", current_operation, stats.data_bytes,
+		stats.command_bytes, stats.full_redraw_bytes, ratio);
+}
+
+// Fill buffer with a random string of length characters, taken from
+// alphabet.
+static void randomString(char *buffer, uint32_t length, const char *alphabet)
+{
+	uint32_t i;
+	uint32_t alphabet_length;
+
+	alphabet_length = (uint32_t)strlen(alphabet);
+	for (i = 0; i < length; i++)
+	{
+		buffer[i] = alphabet[rand() % alphabet_length];
+	}
+	buffer[length] = '\0';
+}
+
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-n <number of transaction outputs>]\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+	// These are the prompts from pic32/user_interface.c.
+	static const char *prompts[] = {
+		"Create new wallet?",
+		"Create new address?",
+		"Format storage?",
+		"Change wallet name?",
+		"Backup wallet?",
+		"Restore wallet from backup?",
+		"Change wallet encryption key?",
+		"Reveal master public key?",
+		"Delete existing wallet?",
+		"Format storage? This will delete everything!",
+		"Are you sure you you want to nuke all wallets?",
+		"Are you really really sure?"};
+	char amount[32];
+	char address[40];
+	char random_text[64];
+	uint32_t num_outputs;
+	uint32_t i;
+	uint32_t x;
+	uint32_t page;
+
+	num_outputs = 2000;
+	for (i = 1; i < (uint32_t)argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && ((i + 1) < (uint32_t)argc))
+		{
+			num_outputs = (uint32_t)strtoul(argv[++i], NULL, 0);
+		}
+		else
+		{
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	srand(42);
+	// GDDRAM contents are undefined at power on.
+	for (page = 0; page < MODEL_PAGES; page++)
+	{
+		for (x = 0; x < MODEL_COLUMNS; x++)
+		{
+			gddram[page][x] = (uint8_t)rand();
+		}
+	}
+	resetModel();
+	printHeader();
+
+	beginOperation("init");
+	initSSD1306();
+	displayOn();
+	stats.full_redraw_bytes += DISPLAY_WIDTH * DISPLAY_HEIGHT / 8;
+	checkDisplay();
+	endOperation();
+
+	beginOperation("prompts");
+	for (i = 0; i < (sizeof(prompts) / sizeof(prompts[0])); i++)
+	{
+		simClearDisplay();
+		simWriteStringWordWrap(prompts[i]);
+	}
+	endOperation();
+
+	// This follows what userDenied() in pic32/user_interface.c does when
+	// asking the user to approve a transaction.
+	beginOperation("outputs");
+	for (i = 0; i < num_outputs; i++)
+	{
+		sprintf(amount, "%u.%08u", (unsigned int)(rand() % 100), (unsigned int)(rand() % 100000000));
+		address[0] = '1';
+		randomString(&(address[1]), 33, "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz");
+		simClearDisplay();
+		simWriteString("Send ");
+		simWriteString(amount);
+		simWriteString(" BTC to ");
+		simWriteString(address);
+		simWriteString("?");
+	}
+	simClearDisplay();
+	simWriteString("Transaction fee:");
+	nextLine();
+	simWriteString("0.0005");
+	simWriteString(" BTC.");
+	nextLine();
+	simWriteString("Is this okay?");
+	endOperation();
+
+	// Random strings, including unprintable characters, text which runs
+	// off the end of the display and long runs without clearing.
+	beginOperation("random");
+	for (i = 0; i < 10000; i++)
+	{
+		switch (rand() % 8)
+		{
+		case 0:
+			simClearDisplay();
+			break;
+		case 1:
+			nextLine();
+			break;
+		case 2:
+		case 3:
+			randomString(random_text, (uint32_t)(rand() % 24), "abc XYZ 0123 ~!");
+			simWriteStringWordWrap(random_text);
+			break;
+		default:
+			for (x = 0, page = (uint32_t)(rand() % 24); x < page; x++)
+			{
+				random_text[x] = (char)(1 + (rand() % 255));
+			}
+			random_text[page] = '\0';
+			simWriteString(random_text);
+			break;
+		}
+	}
+	endOperation();
+
+	if ((mismatches != 0) || (unknown_commands != 0))
+	{
+		printf("Display did not match reference %u times, %u unknown commands\n", mismatches, unknown_commands);
+		exit(1);
+	}
+	printf("Display matched reference after every operation\n");
+	exit(0);
+}
@@ -162,20 +162,11 @@ static void fillTransmitPacketBufferAndTransmit(void)
 {
 	uint32_t status;
 	uint32_t count;
-	uint32_t i;
 
 	// Put everything in a critical section so that bytes are either in
 	// the transmit FIFO or in interrupt_packet_buffer.
 	status = disableInterrupts();
-	i = 1;
-	while ((i < sizeof(interrupt_packet_buffer)) && !isCircularBufferEmpty(&transmit_fifo))
-	{
-		// Note that is_irq is set because interrupts are disabled; that's
-		// equivalent to an interrupt request handler context.
-		interrupt_packet_buffer[i] = circularBufferRead(&transmit_fifo, true);
-		i++;
-	}
-	count = i - 1;
+	count = circularBufferReadBlock(&transmit_fifo, &(interrupt_packet_buffer[1]), sizeof(interrupt_packet_buffer) - 1);
 	interrupt_packet_buffer[0] = (uint8_t)count;
 	if (count > 0)
 	{
@@ -199,17 +190,9 @@ static void fillTransmitPacketBufferAndTransmit(void)
   */
 static void transferIntoReceiveFIFO(uint8_t *buffer, uint32_t length)
 {
-	uint32_t i;
-
-	if (circularBufferSpaceRemaining(&receive_fifo) < length)
-	{
-		// This should never happen.
-		usbFatalError();
-	}
-	for (i = 0; i < length; i++)
-	{
-		circularBufferWrite(&receive_fifo, buffer[i], true);
-	}
+	// is_irq is set, so this will call usbFatalError() if there isn't enough
+	// space. This should never happen.
+	circularBufferWriteBlock(&receive_fifo, buffer, length, true);
 }
 
 /** Remove a byte from the existing queued packet which was intended to be
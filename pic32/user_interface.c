@@ -37,6 +37,9 @@ static bool transaction_fee_set;
 /** Storage for transaction fee amount. This is only valid
   * if #transaction_fee_set is true. */
 static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
+/** Storage for the number of addresses in an #ASKUSER_NEW_ADDRESSES
+  * request. */
+static char new_addresses_count[TEXT_COUNT_LENGTH];
 
 /** Notify the user interface that the transaction parser has seen a new
   * Bitcoin amount/address pair.
@@ -87,11 +90,24 @@ void clearOutputsSeen(void)
 	transaction_fee_set = false;
 }
 
+/** Notify the user interface of how many addresses
+  * an #ASKUSER_NEW_ADDRESSES request is for.
+  * \param text_count The number of addresses, as a null-terminated text
+  *                   string such as "64".
+  */
+void setNewAddressesCount(char *text_count)
+{
+	strncpy(new_addresses_count, text_count, TEXT_COUNT_LENGTH);
+	new_addresses_count[TEXT_COUNT_LENGTH - 1] = '\0';
+}
+
 /** Display a description of a command.
   * \command See #AskUserCommandEnum.
   */
 static void displayAction(AskUserCommand command)
 {
+	char prompt[TEXT_COUNT_LENGTH + 24];
+
 	if (command == ASKUSER_NEW_WALLET)
 	{
 		writeStringToDisplayWordWrap("Create new wallet?");
@@ -100,6 +116,13 @@ static void displayAction(AskUserCommand command)
 	{
 		writeStringToDisplayWordWrap("Create new address?");
 	}
+	else if (command == ASKUSER_NEW_ADDRESSES)
+	{
+		strcpy(prompt, "Create ");
+		strcat(prompt, new_addresses_count);
+		strcat(prompt, " new addresses?");
+		writeStringToDisplayWordWrap(prompt);
+	}
 	else if (command == ASKUSER_FORMAT)
 	{
 		writeStringToDisplayWordWrap("Format storage?");
@@ -151,6 +174,7 @@ bool userDenied(AskUserCommand command)
     {
     case ASKUSER_NEW_WALLET:
     case ASKUSER_NEW_ADDRESS:
+    case ASKUSER_NEW_ADDRESSES:
     case ASKUSER_CHANGE_NAME:
     case ASKUSER_BACKUP_WALLET:
     case ASKUSER_RESTORE_WALLET:
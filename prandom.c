@@ -33,6 +33,7 @@
 #include "prandom.h"
 #include "hwinterface.h"
 #include "storage_common.h"
+#include "background.h"
 
 #ifdef TEST_PRANDOM
 #include "test_helpers.h"
@@ -67,6 +68,24 @@ static bool cached_parent_public_key_valid;
 static uint8_t test_chain_code[32];
 #endif // #ifdef TEST_PRANDOM
 
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+/** Number of bits of the parent private key to process in each slice of
+  * background work. Each bit costs one point double and one point add, so
+  * this determines how long a button press can be held up for (see
+  * background.c). */
+#define PARENT_PUBLIC_KEY_SLICE_BITS	16
+
+/** State of the background calculation of the parent public key. This is
+  * only valid if #parent_public_key_pending is true. */
+static PointMultiplyState parent_public_key_state;
+/** Specifies whether the background calculation of the parent public key
+  * (see prepareParentPublicKey()) is in progress. */
+static bool parent_public_key_pending;
+/** Specifies whether parentPublicKeyTask() has been registered as a
+  * background task. */
+static bool parent_public_key_task_added;
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+
 /** Set the parent public key for the deterministic key generator (see
   * generateDeterministic256()). This function will speed up subsequent calls
   * to generateDeterministic256(), by allowing it to use a cached parent
@@ -91,6 +110,147 @@ void clearParentPublicKeyCache(void)
 	memset(&cached_parent_public_key, 0xff, sizeof(cached_parent_public_key)); // just to be sure
 	memset(&cached_parent_public_key, 0, sizeof(cached_parent_public_key));
 	cached_parent_public_key_valid = false;
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	memset(&parent_public_key_state, 0xff, sizeof(parent_public_key_state)); // just to be sure
+	memset(&parent_public_key_state, 0, sizeof(parent_public_key_state));
+	parent_public_key_pending = false;
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+}
+
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+/** Background task (see #BackgroundTask) which does one slice of the
+  * calculation of the parent public key.
+  * \return true if it did some work, false if there was nothing to do.
+  */
+static bool parentPublicKeyTask(void)
+{
+	if (!parent_public_key_pending)
+	{
+		return false;
+	}
+	if (pointMultiplySlice(&parent_public_key_state, PARENT_PUBLIC_KEY_SLICE_BITS) == 0)
+	{
+		pointMultiplyEnd(&cached_parent_public_key, &parent_public_key_state);
+		parent_public_key_pending = false;
+		cached_parent_public_key_valid = true;
+	}
+	return true;
+}
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+
+/** Extract the parent private key from a deterministic private key
+  * generator seed.
+  * \param k_par The parent private key will be written here, in
+  *              little-endian format. This must have space for 32 bytes.
+  * \param seed See generateDeterministic256().
+  * \return false upon success, true if the specified seed is not valid (will
+  *         produce degenerate private keys).
+  */
+static bool getParentPrivateKey(BigNum256 k_par, const uint8_t *seed)
+{
+	setFieldToN();
+	memcpy(k_par, seed, 32);
+	swapEndian256(k_par); // since seed is big-endian
+	bigModulo(k_par, k_par); // just in case
+	// k_par cannot be 0. If it is zero, then the output of this generator
+	// will always be 0.
+	if (bigIsZero(k_par))
+	{
+		return true; // invalid seed
+	}
+	return false;
+}
+
+/** Make sure the parent public key cache is valid, calculating the parent
+  * public key if necessary. If the calculation was started by
+  * prepareParentPublicKey() and hasn't been finished in the background
+  * yet, it is finished now.
+  * \param parent_private_key The parent private key, in little-endian
+  *                           format.
+  */
+static void ensureParentPublicKey(BigNum256 parent_private_key)
+{
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	if (parent_public_key_pending)
+	{
+		pointMultiplyEnd(&cached_parent_public_key, &parent_public_key_state);
+		parent_public_key_pending = false;
+		cached_parent_public_key_valid = true;
+	}
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	if (!cached_parent_public_key_valid)
+	{
+		setParentPublicKeyFromPrivateKey(parent_private_key);
+	}
+	setFieldToN();
+}
+
+/** Prepare the parent public key cache for the deterministic key generator
+  * (see generateDeterministic256()) for a new seed. This should be called
+  * whenever a wallet is loaded.
+  *
+  * This doesn't do the point multiplication, so that loading a wallet
+  * stays fast. If #BACKGROUND_PARENT_PUBLIC_KEY is defined, the calculation
+  * is begun here and done in slices by a background task (see background.c),
+  * so that the first address or signature is less likely to have to wait
+  * for it. Anything left over is finished when the parent public key is
+  * first needed. Otherwise, the whole calculation is left until the parent
+  * public key is first needed.
+  * \param seed See generateDeterministic256().
+  * \return false upon success, true if the specified seed is not valid (will
+  *         produce degenerate private keys).
+  */
+bool prepareParentPublicKey(const uint8_t *seed)
+{
+	uint8_t k_par[32];
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	PointAffine g;
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+
+	clearParentPublicKeyCache();
+	if (getParentPrivateKey(k_par, seed))
+	{
+		return true; // invalid seed
+	}
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	if (!parent_public_key_task_added)
+	{
+		// If there's no space, the calculation will just be finished when
+		// it's needed.
+		addBackgroundTask(parentPublicKeyTask);
+		parent_public_key_task_added = true;
+	}
+	setToG(&g);
+	pointMultiplyBegin(&parent_public_key_state, &g, k_par);
+	parent_public_key_pending = true;
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	memset(k_par, 0, sizeof(k_par));
+	return false;
+}
+
+/** Get the parent public key for the deterministic key generator (see
+  * generateDeterministic256()). This uses the cached parent public key, so
+  * it is fast if generateDeterministic256() or getParentPublicKey()
+  * has already been called for this seed, or if the background calculation
+  * begun by prepareParentPublicKey() has finished.
+  * \param out_public_key The parent public key will be written here. The
+  *                       x and y components are little-endian.
+  * \param seed See generateDeterministic256().
+  * \return false upon success, true if the specified seed is not valid (will
+  *         produce degenerate private keys).
+  */
+bool getParentPublicKey(PointAffine *out_public_key, const uint8_t *seed)
+{
+	uint8_t k_par[32];
+
+	if (getParentPrivateKey(k_par, seed))
+	{
+		return true; // invalid seed
+	}
+	ensureParentPublicKey(k_par);
+	memset(k_par, 0, sizeof(k_par));
+	memcpy(out_public_key, &cached_parent_public_key, sizeof(PointAffine));
+	return false;
 }
 
 /** Calculate the entropy pool checksum of an entropy pool state.
@@ -448,26 +608,39 @@ void generateInsecureOTP(char *otp)
   *         produce degenerate private keys).
   */
 bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t num)
+{
+	return generateDeterministic256Batch(out, seed, num, 1);
+}
+
+/** Deterministically generate several consecutive 256 bit numbers. The
+  * results are the same as calling generateDeterministic256() for each
+  * value of num from first_num to first_num + count - 1, but the parts of
+  * the calculation which only depend on the seed are done once per batch
+  * instead of once per number. Those are: extracting the parent private
+  * key, serialising the parent public key and preparing the HMAC-SHA512
+  * key (see hmacSha512Prepare()), which halves the cost of each HMAC.
+  * \param out The generated 256 bit numbers will be written here, one after
+  *            another. This must have space for count * 32 bytes.
+  * \param seed See generateDeterministic256().
+  * \param first_num The counter value for the first number.
+  * \param count The number of numbers to generate.
+  * \return false upon success, true if the specified seed is not valid (will
+  *         produce degenerate private keys).
+  */
+bool generateDeterministic256Batch(uint8_t *out, const uint8_t *seed, const uint32_t first_num, const uint32_t count)
 {
 	BigNum256 i_l;
 	uint8_t k_par[32];
 	uint8_t hash[SHA512_HASH_LENGTH];
 	uint8_t hmac_message[69]; // 04 (1 byte) + x (32 bytes) + y (32 bytes) + num (4 bytes)
+	HmacSha512Key chain_code_key;
+	uint32_t i;
 
-	setFieldToN();
-	memcpy(k_par, seed, 32);
-	swapEndian256(k_par); // since seed is big-endian
-	bigModulo(k_par, k_par); // just in case
-	// k_par cannot be 0. If it is zero, then the output of this generator
-	// will always be 0.
-	if (bigIsZero(k_par))
+	if (getParentPrivateKey(k_par, seed))
 	{
 		return true; // invalid seed
 	}
-	if (!cached_parent_public_key_valid)
-	{
-		setParentPublicKeyFromPrivateKey(k_par);
-	}
+	ensureParentPublicKey(k_par);
 	// BIP 0032 specifies that the public key should be represented in a way
 	// that is compatible with "SEC 1: Elliptic Curve Cryptography" by
 	// Certicom research, obtained 15-August-2011 from:
@@ -480,19 +653,26 @@ bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t
 	swapEndian256(&(hmac_message[1]));
 	memcpy(&(hmac_message[33]), cached_parent_public_key.y, 32);
 	swapEndian256(&(hmac_message[33]));
-	writeU32BigEndian(&(hmac_message[65]), num);
-	hmacSha512(hash, &(seed[32]), 32, hmac_message, sizeof(hmac_message));
+	hmacSha512Prepare(&chain_code_key, &(seed[32]), 32);
 
 	setFieldToN();
-	i_l = (BigNum256)hash;
-	swapEndian256(i_l); // since hash is big-endian
-	bigModulo(i_l, i_l); // just in case
-	bigMultiply(out, i_l, k_par);
+	for (i = 0; i < count; i++)
+	{
+		writeU32BigEndian(&(hmac_message[65]), first_num + i);
+		hmacSha512Prepared(hash, &chain_code_key, hmac_message, sizeof(hmac_message));
+		i_l = (BigNum256)hash;
+		swapEndian256(i_l); // since hash is big-endian
+		bigModulo(i_l, i_l); // just in case
+		bigMultiply(&(out[i * 32]), i_l, k_par);
+	}
 
 #ifdef TEST_PRANDOM
 	memcpy(test_chain_code, &(hash[32]), sizeof(test_chain_code));
 #endif // #ifdef TEST_PRANDOM
 
+	memset(k_par, 0, sizeof(k_par));
+	memset(hash, 0, sizeof(hash));
+	memset(&chain_code_key, 0, sizeof(chain_code_key));
 	return false; // success
 }
 
@@ -710,6 +890,7 @@ int main(int argc, char **argv)
 	uint8_t generated_using_ram[1024];
 	uint8_t public_key_binary[65];
 	PointAffine public_key;
+	PointAffine compare_public_key;
 	char otp[OTP_LENGTH];
 	char otp2[OTP_LENGTH];
 
@@ -788,6 +969,105 @@ int main(int argc, char **argv)
 		reportSuccess();
 	}
 
+	// Check that prepareParentPublicKey() leads to the right parent public
+	// key, and doesn't change what generateDeterministic256() outputs.
+	setToG(&compare_public_key);
+	memcpy(key2, seed, 32);
+	swapEndian256(key2);
+	setFieldToN();
+	bigModulo(key2, key2);
+	pointMultiply(&compare_public_key, key2);
+	assert(!prepareParentPublicKey(seed));
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	// Let the background task finish off some, but not all, of the work.
+	for (i = 0; i < 5; i++)
+	{
+		runBackgroundTask();
+	}
+	if (!parent_public_key_pending)
+	{
+		printf("Background calculation of parent public key finished too early\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+#else
+	// Loading a wallet shouldn't have to wait for a point multiplication.
+	if (cached_parent_public_key_valid)
+	{
+		printf("prepareParentPublicKey() calculates parent public key straight away\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	assert(!getParentPublicKey(&public_key, seed));
+	if (memcmp(&public_key, &compare_public_key, sizeof(PointAffine)))
+	{
+		printf("prepareParentPublicKey() calculates the wrong public key\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	assert(!prepareParentPublicKey(seed));
+#ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	while (runBackgroundTask())
+	{
+		// do nothing
+	}
+#endif // #ifdef BACKGROUND_PARENT_PUBLIC_KEY
+	assert(!generateDeterministic256(key2, seed, 0));
+	if (bigCompare(key2, keys[0]) != BIGCMP_EQUAL)
+	{
+		printf("prepareParentPublicKey() changes generateDeterministic256() output\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	memset(seed, 0, SEED_LENGTH);
+	if (!prepareParentPublicKey(seed) || !getParentPublicKey(&public_key, seed))
+	{
+		printf("prepareParentPublicKey() accepts invalid seed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Check that generateDeterministic256Batch() gives the same results as
+	// generateDeterministic256().
+	memset(seed, 42, SEED_LENGTH);
+	seed[1] = 7;
+	assert(!prepareParentPublicKey(seed));
+	assert(!generateDeterministic256Batch(&(keys[0][0]), seed, 0xfffffffe, 5));
+	abort = false;
+	for (i = 0; i < 5; i++)
+	{
+		assert(!generateDeterministic256(key2, seed, (uint32_t)(0xfffffffe + (unsigned int)i)));
+		if (bigCompare(key2, keys[i]) != BIGCMP_EQUAL)
+		{
+			abort = true;
+		}
+	}
+	if (abort)
+	{
+		printf("generateDeterministic256Batch() doesn't match generateDeterministic256()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// Check that generateDeterministic256() generates BIP 0032 private keys
 	// correctly.
 	memcpy(seed, sipa_test_master_seed, SEED_LENGTH);
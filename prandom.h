@@ -11,10 +11,7 @@
 #include "common.h"
 #include "bignum256.h"
 #include "storage_common.h"
-
-#ifdef TEST
 #include "ecdsa.h"
-#endif // #ifdef TEST
 
 /** Length, in bytes, of the seed that generateDeterministic256() requires.
   * \warning This must be a multiple of 16 in order for backupWallet() to work
@@ -46,6 +43,8 @@
 #endif
 
 extern void clearParentPublicKeyCache(void);
+extern bool prepareParentPublicKey(const uint8_t *seed);
+extern bool getParentPublicKey(PointAffine *out_public_key, const uint8_t *seed);
 extern bool setEntropyPool(uint8_t *in_pool_state);
 extern bool getEntropyPool(uint8_t *out_pool_state);
 extern bool initialiseEntropyPool(uint8_t *initial_pool_state);
@@ -53,6 +52,7 @@ extern bool getRandom256(BigNum256 n);
 extern bool getRandom256TemporaryPool(BigNum256 n, uint8_t *pool_state);
 extern void generateInsecureOTP(char *otp);
 extern bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t num);
+extern bool generateDeterministic256Batch(uint8_t *out, const uint8_t *seed, const uint32_t first_num, const uint32_t count);
 #ifdef TEST
 extern void initialiseDefaultEntropyPool(void);
 extern void corruptEntropyPool(void);
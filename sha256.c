@@ -17,6 +17,7 @@
 #include "common.h"
 #include "hash.h"
 #include "sha256.h"
+#include "perf_counters.h"
 
 /** Constants for SHA-256. See section 4.2.2 of FIPS PUB 180-3. */
 static const uint32_t k[64] PROGMEM = {
@@ -116,7 +117,9 @@ static void sha256Block(HashState *hs)
 	uint32_t t1, t2;
 	uint8_t t;
 	uint32_t w[64];
+	PERF_DECLARE_START;
 
+	PERF_START();
 	for (t = 0; t < 16; t++)
 	{
 		w[t] = hs->m[t];
@@ -154,6 +157,7 @@ static void sha256Block(HashState *hs)
 	hs->h[5] += f;
 	hs->h[6] += g;
 	hs->h[7] += h;
+	PERF_STOP(PERF_SHA256_BLOCK, 1);
 }
 
 /** Begin calculating hash for new message.
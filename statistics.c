@@ -15,19 +15,45 @@
   *   emulation).
   * - Some (RAM) space efficiency is achieved by storing samples in a
   *   histogram (see #packed_histogram_buffer), instead of storing them in a
-  *   FIFO buffer.
+  *   FIFO buffer. Platforms with RAM to spare can define UNPACKED_HISTOGRAM
+  *   to use a plain array of counts (see #histogram_buffer) instead.
+  * - Moments are calculated per histogram bin instead of per sample, so
+  *   the cost of calculateCentralMoments() depends on #HISTOGRAM_NUM_BINS
+  *   and not on #SAMPLE_COUNT.
   *
   * This file is licensed as described by the file LICENCE.
   */
 
+#ifdef TEST_STATISTICS
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "test_helpers.h"
+#endif // #ifdef TEST_STATISTICS
+
 #include "common.h"
 #include "fix16.h"
 #include "fft.h"
 #include "statistics.h"
 
-/** The maximum number of counts which can be held in one histogram bin. */
-#define MAX_HISTOGRAM_VALUE			((1 << BITS_PER_HISTOGRAM_BIN) - 1)
+/** The maximum number of counts which can be held in one histogram bin. This
+  * is the same for both storage layouts. */
+#define MAX_HISTOGRAM_VALUE			((1 << HISTOGRAM_COUNT_BITS) - 1)
 
+#ifdef UNPACKED_HISTOGRAM
+/** The buffer where histogram counts are stored. The buffer needs to be
+  * persistent, because counts are accumulated across many calls to
+  * hardwareRandom32Bytes(). Each bin has its own entry, which is faster
+  * to update than #packed_histogram_buffer but needs more RAM.
+  *
+  * A histogram is much more space-efficient than storing a buffer of
+  * individual samples, since (for the calculation of most statistical
+  * properties) the order of samples doesn't matter. Each bin represents a
+  * value, and each bin has an associated count, which represents how many
+  * times that value occurred.
+  */
+static uint16_t histogram_buffer[HISTOGRAM_NUM_BINS];
+#else
 /** The buffer where histogram counts are stored. The buffer needs to be
   * persistent, because counts are accumulated across many calls to
   * hardwareRandom32Bytes(). In order to conserve valuable RAM, the buffer is
@@ -40,6 +66,7 @@
   * times that value occurred.
   */
 static uint32_t packed_histogram_buffer[((HISTOGRAM_NUM_BINS * BITS_PER_HISTOGRAM_BIN) / 32) + 1];
+#endif // #ifdef UNPACKED_HISTOGRAM
 
 /** An estimate of the power spectral density of the HWRNG. As more samples
   * are collected, FFT results will be accumulated here. The more samples,
@@ -57,27 +84,65 @@ bool psd_accumulator_error_occurred;
 bool histogram_overflow_occurred;
 /** Number of samples that have been placed in the histogram. */
 uint32_t samples_in_histogram;
-/** The index (bin number) into the histogram buffer where the histogram
-  * iterator is currently at. */
-static uint32_t iterator_index;
-/** The count within a histogram bin where the histogram iterator is currently
-  * at. */
-static uint32_t iterator_count;
-/** Cached value of histogram counts in the bin specified by #iterator_index.
-  * This is used to speed up getTermFromIterator(). */
-static uint32_t cached_histogram_count;
-/** Cached value of scaled sample value for the bin specified
-  * by #iterator_index. This is used to speed up getTermFromIterator(). */
-static fix16_t cached_scaled_sample;
+/** Sum of (ADC sample number - #HISTOGRAM_NUM_BINS / 2) for every sample
+  * that has been placed in the histogram. This is maintained alongside the
+  * histogram so that the mean is known before calculateCentralMoments()
+  * does its sweep over the histogram bins. */
+static int32_t sum_of_samples;
 
 /** Reset all histogram counts to 0. */
 void clearHistogram(void)
 {
+#ifdef UNPACKED_HISTOGRAM
+	memset(histogram_buffer, 0, sizeof(histogram_buffer));
+#else
 	memset(packed_histogram_buffer, 0, sizeof(packed_histogram_buffer));
+#endif // #ifdef UNPACKED_HISTOGRAM
 	samples_in_histogram = 0;
+	sum_of_samples = 0;
 	histogram_overflow_occurred = false;
 }
 
+#ifdef UNPACKED_HISTOGRAM
+
+/** Gets an entry from the histogram counts buffer.
+  * \param index The histogram bin to query.
+  * \return The number of counts in the specified bin.
+  */
+static uint32_t getHistogram(uint32_t index)
+{
+	if (index >= HISTOGRAM_NUM_BINS)
+	{
+		// This should never happen.
+		fix16_error_occurred = true;
+		return 0;
+	}
+	return histogram_buffer[index];
+}
+
+/** Sets an entry in the histogram counts buffer.
+  * \param index The histogram bin to set.
+  * \param value The number of counts to set the bin to.
+  */
+static void putHistogram(uint32_t index, uint32_t value)
+{
+	if (index >= HISTOGRAM_NUM_BINS)
+	{
+		// This should never happen.
+		fix16_error_occurred = true;
+		return;
+	}
+	if (value > MAX_HISTOGRAM_VALUE)
+	{
+		// Overflow in one of the bins.
+		histogram_overflow_occurred = true;
+		return;
+	}
+	histogram_buffer[index] = (uint16_t)value;
+}
+
+#else
+
 /** Gets an entry from the histogram counts buffer.
   * \param index The histogram bin to query.
   * \return The number of counts in the specified bin.
@@ -151,6 +216,8 @@ static void putHistogram(uint32_t index, uint32_t value)
 	}
 }
 
+#endif // #ifdef UNPACKED_HISTOGRAM
+
 /** Increments the count of a histogram bin.
   * \param index The histogram bin to modify.
   */
@@ -158,6 +225,52 @@ void incrementHistogram(uint32_t index)
 {
 	putHistogram(index, getHistogram(index) + 1);
 	samples_in_histogram++;
+	sum_of_samples += (int32_t)index - (HISTOGRAM_NUM_BINS / 2);
+}
+
+/** Increments the count of a histogram bin for every sample in a buffer.
+  * This does the same thing as calling incrementHistogram() on each sample,
+  * but when UNPACKED_HISTOGRAM is defined, the whole buffer is binned in
+  * one tight loop.
+  * \param buffer The array of samples (ADC sample numbers) to place in the
+  *               histogram.
+  * \param length The number of samples in buffer.
+  */
+void incrementHistogramBatch(const volatile uint16_t *buffer, uint32_t length)
+{
+	uint32_t i;
+#ifdef UNPACKED_HISTOGRAM
+	uint32_t index;
+	int32_t sum;
+
+	sum = 0;
+	for (i = 0; i < length; i++)
+	{
+		index = buffer[i];
+		if (index >= HISTOGRAM_NUM_BINS)
+		{
+			// This should never happen.
+			fix16_error_occurred = true;
+		}
+		else if (histogram_buffer[index] == MAX_HISTOGRAM_VALUE)
+		{
+			// Overflow in one of the bins.
+			histogram_overflow_occurred = true;
+		}
+		else
+		{
+			histogram_buffer[index]++;
+		}
+		sum += (int32_t)index;
+	}
+	samples_in_histogram += length;
+	sum_of_samples += sum - (int32_t)(length * (HISTOGRAM_NUM_BINS / 2));
+#else
+	for (i = 0; i < length; i++)
+	{
+		incrementHistogram(buffer[i]);
+	}
+#endif // #ifdef UNPACKED_HISTOGRAM
 }
 
 /** Apply scaling and an offset to ADC sample values so that overflow will
@@ -175,101 +288,73 @@ fix16_t scaleSample(int sample_int)
 	return r;
 }
 
-/** This must be called whenever the iterator is active and #iterator_index
-  * changes. */
-static void updateIteratorCache(void)
-{
-	cached_histogram_count = getHistogram(iterator_index);
-	cached_scaled_sample = scaleSample((int)iterator_index);
-}
-
-/** Reset the histogram iterator back to the start. */
-static void resetIterator(void)
-{
-	iterator_index = 0;
-	iterator_count = 0;
-	updateIteratorCache();
-}
-
-/** Uses an iterator over the histogram to obtain one term in a central
-  * moment calculation. The iterator goes over each item (count) from each
-  * histogram bin (index).
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.). This must be positive and non-zero.
-  * \return One term for the calculation of the specified central moment.
+/** Examines the histogram and calculates the mean and the second, third and
+  * fourth central moments from it. All four values come from a single sweep
+  * over the histogram bins, in which each occupied bin contributes
+  * count * (x - mean) ^ power terms, where x is the (scaled) sample value
+  * that the bin represents. The mean is obtained from #sum_of_samples, so it
+  * is known before the sweep starts.
+  *
+  * Each bin's count is converted into a weight (count / #SAMPLE_COUNT)
+  * before it is multiplied into the terms. Since the weights sum to 1, each
+  * accumulator is bounded by the largest value of (x - mean) ^ power, just
+  * like the pairwise averaging which this replaces. Arithmetic errors
+  * (eg. overflow) will set #fix16_error_occurred.
+  * \param out_mean The mean will be written here.
+  * \param out_variance The variance (second central moment) will be written
+  *                     here.
+  * \param out_kappa3 The third central moment (non-standardised skewness)
+  *                   will be written here.
+  * \param out_kappa4 The fourth central moment (non-standardised kurtosis)
+  *                   will be written here.
   */
-static fix16_t getTermFromIterator(fix16_t mean, uint32_t power)
+void calculateCentralMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4)
 {
 	uint32_t i;
-	fix16_t scaled_sample;
-	fix16_t r;
-
-	// Search for the index (bin number) of the next count.
-	while (iterator_count >= cached_histogram_count)
-	{
-		iterator_count = 0;
-		iterator_index++;
-		if (iterator_index >= HISTOGRAM_NUM_BINS)
-		{
-			// Iterator ran past end of samples. This should never happen.
-			fix16_error_occurred = true;
-			return fix16_zero;
-		}
-		updateIteratorCache();
-	}
-
-	iterator_count++;
-	scaled_sample = fix16_sub(cached_scaled_sample, mean);
-	r = scaled_sample;
-	for (i = 1; i < power; i++)
-	{
-		r = fix16_mul(r, scaled_sample);
-	}
-	return r;
-}
-
-/** Recursive handler for calculateCentralMoment(). Recursion is used to do
-  * pairwise averaging. Pairwise averaging is just like pairwise summation,
-  * except there's a divide by 2 after each sum.
-  * Why do pairwise averaging? So that overflow is less likely to occur.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \param level The number of terms to use in the estimation of the central
-  *              moment.
-  * \return An estimate of the value of the specified central moment.
-  */
-static fix16_t calculateCentralMomentRecursive(fix16_t mean, uint32_t power, uint32_t level)
-{
-	fix16_t term1;
-	fix16_t term2;
+	uint32_t count;
+	fix16_t mean;
+	fix16_t weight;
+	fix16_t term;
+	fix16_t term_squared;
+	fix16_t variance;
+	fix16_t kappa3;
+	fix16_t kappa4;
 
-	if (level <= 2)
+	if (samples_in_histogram != SAMPLE_COUNT)
 	{
-		term1 = getTermFromIterator(mean, power);
-		term2 = getTermFromIterator(mean, power);
+		// The weights below assume a full histogram. This should never
+		// happen.
+		fix16_error_occurred = true;
 	}
-	else
+	// Each unit of #sum_of_samples is worth
+	// 1 / (#SAMPLE_COUNT * #SAMPLE_SCALE_DOWN) once it has been scaled
+	// (see scaleSample()) and averaged.
+#if (((SAMPLE_COUNT * SAMPLE_SCALE_DOWN) % 65536) != 0)
+#error "SAMPLE_COUNT * SAMPLE_SCALE_DOWN not a multiple of 65536"
+#endif // #if (((SAMPLE_COUNT * SAMPLE_SCALE_DOWN) % 65536) != 0)
+	mean = (fix16_t)(sum_of_samples / ((SAMPLE_COUNT * SAMPLE_SCALE_DOWN) / 65536));
+
+	variance = fix16_zero;
+	kappa3 = fix16_zero;
+	kappa4 = fix16_zero;
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
 	{
-		term1 = calculateCentralMomentRecursive(mean, power, level >> 1);
-		term2 = calculateCentralMomentRecursive(mean, power, level >> 1);
+		count = getHistogram(i);
+		if (count != 0)
+		{
+			weight = fix16_mul(fix16_from_int((int)count), FIX16_RECIPROCAL_OF(SAMPLE_COUNT));
+			term = fix16_sub(scaleSample((int)i), mean);
+			term_squared = fix16_mul(term, term);
+			variance = fix16_add(variance, fix16_mul(weight, term_squared));
+			kappa3 = fix16_add(kappa3, fix16_mul(weight, fix16_mul(term_squared, term)));
+			kappa4 = fix16_add(kappa4, fix16_mul(weight, fix16_mul(term_squared, term_squared)));
+		}
 	}
-	return fix16_mul(fix16_add(term1, term2), FIX16_RECIPROCAL_OF(2));
-}
 
-/** Examines the histogram and calculates a central moment from it. This does
-  * require the mean to be known. If the mean is not known, it can be
-  * calculated using this function by passing mean = 0.0 and power = 1.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \return The value of the specified central moment
-  */
-fix16_t calculateCentralMoment(fix16_t mean, uint32_t power)
-{
-	resetIterator();
-	return calculateCentralMomentRecursive(mean, power, SAMPLE_COUNT);
+	*out_mean = mean;
+	*out_variance = variance;
+	*out_kappa3 = kappa3;
+	*out_kappa4 = kappa4;
 }
 
 /** Obtains an estimate of the (Shannon) entropy per sample, based on the
@@ -332,6 +417,35 @@ void clearPowerSpectralDensity(void)
 	psd_accumulator_error_occurred = false;
 }
 
+/** Add the squared magnitude of one bin of a real FFT to the power spectral
+  * density estimate.
+  * \param index Index of the bin (and of #psd_accumulator entry).
+  * \param bin The FFT output for that bin.
+  */
+static void accumulatePsdBin(uint32_t index, ComplexFixed bin)
+{
+	fix16_t term1;
+	fix16_t term2;
+	fix16_t sum_of_squares;
+
+	// Rescale terms to make overflow less likely when squaring them.
+	term1 = fix16_mul(bin.real, FIX16_RECIPROCAL_OF(8));
+	term1 = fix16_mul(term1, term1);
+	term2 = fix16_mul(bin.imag, FIX16_RECIPROCAL_OF(8));
+	term2 = fix16_mul(term2, term2);
+	sum_of_squares = fix16_add(term1, term2);
+	// PSD is scaled down according to the number of samples. This
+	// will normalise the result, since total power scales as the
+	// number of samples.
+	// Since FIX16_RECIPROCAL_OF expects an integer, SAMPLE_COUNT must
+	// be >= 512.
+#if SAMPLE_COUNT < 512
+#error "SAMPLE_COUNT too small (it's < 512)"
+#endif // #if SAMPLE_COUNT < 512
+	sum_of_squares = fix16_mul(sum_of_squares, FIX16_RECIPROCAL_OF(SAMPLE_COUNT / 512));
+	psd_accumulator[index] = fix16_add(psd_accumulator[index], sum_of_squares);
+}
+
 /** Calculate (an estimate of) the power spectral density of a bunch of
   * time-domain samples. The result will be accumulated in #psd_accumulator.
   * \param source_buffer The array of time-domain samples to calculate the
@@ -341,28 +455,17 @@ void clearPowerSpectralDensity(void)
 void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 {
 	uint32_t i;
-	uint32_t index;
-	fix16_t scaled_sample;
-	fix16_t term1;
-	fix16_t term2;
-	fix16_t sum_of_squares;
-	ComplexFixed fft_buffer[FFT_SIZE + 1];
+	ComplexFixed bin_low;
+	ComplexFixed bin_high;
+	ComplexFixed fft_buffer[FFT_SIZE];
 
 	// Fill FFT buffer with entire contents of ADC sample data.
 	// Real/imaginary interleaving is done to allow a double-size real
 	// FFT to be performed; see fftPostProcessReal() for more details.
-	for (i = 0; i < (FFT_SIZE * 2); i++)
+	for (i = 0; i < FFT_SIZE; i++)
 	{
-		index = i >> 1;
-		scaled_sample = scaleSample((int)source_buffer[i]);
-		if ((i & 1) == 0)
-		{
-			fft_buffer[index].real = scaled_sample;
-		}
-		else
-		{
-			fft_buffer[index].imag = scaled_sample;
-		}
+		fft_buffer[i].real = scaleSample((int)source_buffer[2 * i]);
+		fft_buffer[i].imag = scaleSample((int)source_buffer[2 * i + 1]);
 	}
 
 	// Before computing the FFT, the mean of the FFT buffer is subtracted
@@ -376,30 +479,21 @@ void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 	{
 		psd_accumulator_error_occurred = true;
 	}
-	if (fftPostProcessReal(fft_buffer, false))
-	{
-		psd_accumulator_error_occurred = true;
-	}
+	// Rather than post-processing the whole buffer with
+	// fftPostProcessReal() and then making another pass to accumulate the
+	// squared magnitudes, each pair of real FFT bins is accumulated as soon
+	// as it is computed. This also means fft_buffer doesn't need an extra
+	// entry for the Nyquist bin.
 	fix16_error_occurred = false;
-	for (i = 0; i < (FFT_SIZE + 1); i++)
-	{
-		// Rescale terms to make overflow less likely when squaring them.
-		term1 = fix16_mul(fft_buffer[i].real, FIX16_RECIPROCAL_OF(8));
-		term1 = fix16_mul(term1, term1);
-		term2 = fix16_mul(fft_buffer[i].imag, FIX16_RECIPROCAL_OF(8));
-		term2 = fix16_mul(term2, term2);
-		sum_of_squares = fix16_add(term1, term2);
-		// PSD is scaled down according to the number of samples. This
-		// will normalise the result, since total power scales as the
-		// number of samples.
-		// Since FIX16_RECIPROCAL_OF expects an integer, SAMPLE_COUNT must
-		// be >= 512.
-#if SAMPLE_COUNT < 512
-#error "SAMPLE_COUNT too small (it's < 512)"
-#endif // #if SAMPLE_COUNT < 512
-		sum_of_squares = fix16_mul(sum_of_squares, FIX16_RECIPROCAL_OF(SAMPLE_COUNT / 512));
-		psd_accumulator[i] = fix16_add(psd_accumulator[i], sum_of_squares);
+	for (i = 0; i < (FFT_SIZE / 2); i++)
+	{
+		fftRealBinPair(fft_buffer, i, false, &bin_low, &bin_high);
+		accumulatePsdBin(i, bin_low);
+		accumulatePsdBin(FFT_SIZE - i, bin_high);
 	}
+	// Bin FFT_SIZE / 2 pairs with itself.
+	fftRealBinPair(fft_buffer, FFT_SIZE / 2, false, &bin_low, &bin_high);
+	accumulatePsdBin(FFT_SIZE / 2, bin_high);
 	if (fix16_error_occurred)
 	{
 		psd_accumulator_error_occurred = true;
@@ -453,3 +547,327 @@ bool calculateAutoCorrelation(ComplexFixed *fft_buffer)
 	}
 	return false;
 }
+
+#ifdef TEST_STATISTICS
+
+/** The most counts a histogram bin may hold. This is written out instead of
+  * using #MAX_HISTOGRAM_VALUE, so that the test catches any change to the
+  * limit. It is the limit of the original 11-bit packed layout. */
+#define TEST_BIN_LIMIT			2047
+
+/** Check that a moment calculated by calculateCentralMoments() is close to
+  * its expected value.
+  * \param actual The calculated value.
+  * \param expected The expected value.
+  * \param description Printed if the check fails.
+  */
+static void checkMoment(fix16_t actual, double expected, const char *description)
+{
+	double actual_double;
+
+	actual_double = (double)actual / 65536.0;
+	// Every bin's weight is rounded to 16 fractional bits, and so is every
+	// term, so allow for a small absolute error.
+	if (fabs(actual_double - expected) < 0.002)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%s: got %f, expected %f\n", description, actual_double, expected);
+		reportFailure();
+	}
+}
+
+/** Fill the histogram with #SAMPLE_COUNT samples which have a known
+  * distribution, then check calculateCentralMoments() against moments
+  * calculated directly (in floating-point) from the same samples.
+  * \param samples The samples. This must have #SAMPLE_COUNT entries.
+  * \param description Printed if a check fails.
+  */
+static void checkMomentsOf(const uint16_t *samples, const char *description)
+{
+	uint32_t i;
+	double x;
+	double mean;
+	double variance;
+	double kappa3;
+	double kappa4;
+	fix16_t out_mean;
+	fix16_t out_variance;
+	fix16_t out_kappa3;
+	fix16_t out_kappa4;
+
+	clearHistogram();
+	mean = 0.0;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		incrementHistogram(samples[i]);
+		mean += ((double)samples[i] - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN;
+	}
+	mean /= SAMPLE_COUNT;
+	variance = 0.0;
+	kappa3 = 0.0;
+	kappa4 = 0.0;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		x = ((double)samples[i] - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN - mean;
+		variance += x * x;
+		kappa3 += x * x * x;
+		kappa4 += x * x * x * x;
+	}
+	variance /= SAMPLE_COUNT;
+	kappa3 /= SAMPLE_COUNT;
+	kappa4 /= SAMPLE_COUNT;
+
+	fix16_error_occurred = false;
+	calculateCentralMoments(&out_mean, &out_variance, &out_kappa3, &out_kappa4);
+	if (fix16_error_occurred)
+	{
+		printf("%s: arithmetic error\n", description);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	printf("%s:\n", description);
+	checkMoment(out_mean, mean, "  Mean");
+	checkMoment(out_variance, variance, "  Variance");
+	checkMoment(out_kappa3, kappa3, "  Kappa3");
+	checkMoment(out_kappa4, kappa4, "  Kappa4");
+}
+
+/** Accumulate the power spectral density of some samples, and compare it
+  * to the squared magnitudes of a full complex DFT of size 2 * #FFT_SIZE,
+  * computed in floating-point. This checks that accumulating straight from
+  * the half-size FFT (see accumulatePowerSpectralDensity()) gives the same
+  * result.
+  * \param samples The samples (ADC sample numbers). This must have
+  *                2 * #FFT_SIZE entries.
+  * \param description Printed if the check fails.
+  */
+static void checkPsd(uint16_t *samples, const char *description)
+{
+	uint32_t k;
+	uint32_t n;
+	uint32_t bad_bins;
+	double mean;
+	double x[FFT_SIZE * 2];
+	double angle;
+	double real;
+	double imag;
+	double expected;
+	double actual;
+
+	mean = 0.0;
+	for (n = 0; n < (FFT_SIZE * 2); n++)
+	{
+		x[n] = ((double)samples[n] - (HISTOGRAM_NUM_BINS / 2)) / SAMPLE_SCALE_DOWN;
+		mean += x[n];
+	}
+	mean /= (FFT_SIZE * 2);
+
+	clearPowerSpectralDensity();
+	accumulatePowerSpectralDensity(samples);
+	if (psd_accumulator_error_occurred)
+	{
+		printf("%s: arithmetic error\n", description);
+		reportFailure();
+		return;
+	}
+	bad_bins = 0;
+	for (k = 0; k <= FFT_SIZE; k++)
+	{
+		real = 0.0;
+		imag = 0.0;
+		for (n = 0; n < (FFT_SIZE * 2); n++)
+		{
+			angle = -2.0 * M_PI * (double)((k * n) % (FFT_SIZE * 2)) / (FFT_SIZE * 2);
+			real += (x[n] - mean) * cos(angle);
+			imag += (x[n] - mean) * sin(angle);
+		}
+		// Same scaling as accumulatePsdBin().
+		expected = ((real / 8.0) * (real / 8.0) + (imag / 8.0) * (imag / 8.0)) / (SAMPLE_COUNT / 512);
+		actual = (double)psd_accumulator[k] / 65536.0;
+		if (fabs(actual - expected) > (0.001 + 0.01 * expected))
+		{
+			if (bad_bins == 0)
+			{
+				printf("%s: bin %u is %f, expected %f\n", description, k, actual, expected);
+			}
+			bad_bins++;
+		}
+	}
+	if (bad_bins != 0)
+	{
+		printf("%s: %u bins differ from the full DFT\n", description, bad_bins);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Check whether #histogram_overflow_occurred has the expected value.
+  * \param expected The expected value of #histogram_overflow_occurred.
+  * \param description Printed if the check fails.
+  */
+static void checkOverflow(bool expected, const char *description)
+{
+	if (histogram_overflow_occurred == expected)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("%s: histogram_overflow_occurred = %d\n", description, (int)histogram_overflow_occurred);
+		reportFailure();
+	}
+}
+
+int main(void)
+{
+	uint32_t i;
+	uint32_t j;
+	uint16_t samples[TEST_BIN_LIMIT + 1];
+	uint16_t moment_samples[SAMPLE_COUNT];
+	uint16_t psd_samples[FFT_SIZE * 2];
+	uint32_t lfsr;
+	fix16_t mean;
+	fix16_t variance;
+	fix16_t kappa3;
+	fix16_t kappa4;
+	bool bins_ok;
+
+	initTests(__FILE__);
+
+	// This is built twice, with and without UNPACKED_HISTOGRAM, so that
+	// both layouts are tested.
+#ifdef UNPACKED_HISTOGRAM
+	printf("Testing unpacked histogram\n");
+#else
+	printf("Testing packed histogram\n");
+#endif // #ifdef UNPACKED_HISTOGRAM
+
+	// Every bin should hold its own count, without disturbing its
+	// neighbours. In the packed layout, some bins straddle a word
+	// boundary.
+	clearHistogram();
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
+	{
+		for (j = 0; j < (i % 5); j++)
+		{
+			incrementHistogram(i);
+		}
+	}
+	putHistogram(37, TEST_BIN_LIMIT);
+	bins_ok = true;
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
+	{
+		j = (i == 37) ? TEST_BIN_LIMIT : (i % 5);
+		if (getHistogram(i) != j)
+		{
+			printf("Bin %u has %u counts, expected %u\n", i, getHistogram(i), j);
+			bins_ok = false;
+		}
+	}
+	if (bins_ok)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		reportFailure();
+	}
+
+	// One bin can hold exactly TEST_BIN_LIMIT counts, even though the
+	// unpacked layout has room for more.
+	clearHistogram();
+	for (i = 0; i < TEST_BIN_LIMIT; i++)
+	{
+		incrementHistogram(5);
+	}
+	checkOverflow(false, "Full bin");
+	incrementHistogram(5);
+	checkOverflow(true, "Overflowing bin");
+	clearHistogram();
+	checkOverflow(false, "Clear resets overflow");
+
+	// The batched path must overflow at the same count. A stuck ADC
+	// produces a buffer like this.
+	for (i = 0; i < TEST_BIN_LIMIT; i++)
+	{
+		samples[i] = 7;
+	}
+	incrementHistogramBatch(samples, TEST_BIN_LIMIT);
+	checkOverflow(false, "Full bin (batched)");
+	clearHistogram();
+	samples[TEST_BIN_LIMIT] = 7;
+	incrementHistogramBatch(samples, TEST_BIN_LIMIT + 1);
+	checkOverflow(true, "Overflowing bin (batched)");
+
+	// Samples spread over many bins shouldn't overflow.
+	clearHistogram();
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		incrementHistogram(i & (HISTOGRAM_NUM_BINS - 1));
+	}
+	checkOverflow(false, "Spread samples");
+
+	// Samples split evenly between -1.0 and +1.0 (after scaling) have
+	// exactly known moments.
+	clearHistogram();
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		if ((i & 1) == 0)
+		{
+			incrementHistogram((HISTOGRAM_NUM_BINS / 2) - SAMPLE_SCALE_DOWN);
+		}
+		else
+		{
+			incrementHistogram((HISTOGRAM_NUM_BINS / 2) + SAMPLE_SCALE_DOWN);
+		}
+	}
+	calculateCentralMoments(&mean, &variance, &kappa3, &kappa4);
+	checkMoment(mean, 0.0, "Two-valued mean");
+	checkMoment(variance, 1.0, "Two-valued variance");
+	checkMoment(kappa3, 0.0, "Two-valued kappa3");
+	checkMoment(kappa4, 1.0, "Two-valued kappa4");
+
+	// A skewed distribution, which exercises every term.
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		j = (i * i) % 301;
+		moment_samples[i] = (uint16_t)(400 + (j * j) / 301);
+	}
+	checkMomentsOf(moment_samples, "Skewed distribution");
+
+	// Pseudo-random samples, spread around the middle of the ADC range
+	// like the HWRNG's are.
+	lfsr = 0x12345678;
+	for (i = 0; i < SAMPLE_COUNT; i++)
+	{
+		lfsr = lfsr * 1103515245 + 12345;
+		moment_samples[i] = (uint16_t)(((lfsr >> 16) & 127) + ((lfsr >> 8) & 127) + 384);
+	}
+	checkMomentsOf(moment_samples, "Pseudo-random samples");
+
+	// Power spectral density of a tone and of pseudo-random samples.
+	for (i = 0; i < (FFT_SIZE * 2); i++)
+	{
+		psd_samples[i] = (uint16_t)(512.0 + 100.0 * sin(2.0 * M_PI * 51.0 * (double)i / (FFT_SIZE * 2)));
+	}
+	checkPsd(psd_samples, "Tone PSD");
+	for (i = 0; i < (FFT_SIZE * 2); i++)
+	{
+		psd_samples[i] = moment_samples[i];
+	}
+	checkPsd(psd_samples, "Pseudo-random PSD");
+
+	finishTests();
+	exit(0);
+}
+
+#endif // #ifdef TEST_STATISTICS
@@ -17,11 +17,27 @@
   * microcontrollers have a 10-bit ADC, this is 2 ^ 10.
   */
 #define HISTOGRAM_NUM_BINS			1024
+/** Number of bits needed to hold the maximum count of a histogram bin. This
+  * should be large enough to store the maximum expected histogram count.
+  * A bin which would exceed this sets #histogram_overflow_occurred, which is
+  * what catches a stuck ADC, so this must be the same whatever the storage
+  * layout.
+  */
+#define HISTOGRAM_COUNT_BITS		11
+#ifdef UNPACKED_HISTOGRAM
+/** Number of bits of storage space allocated to each histogram bin. When
+  * UNPACKED_HISTOGRAM is defined, each bin gets its own uint16_t. This
+  * uses more RAM than the bit-packed representation, but updating a bin
+  * doesn't involve any shifting or masking. Counts are still limited
+  * to #HISTOGRAM_COUNT_BITS bits.
+  */
+#define	BITS_PER_HISTOGRAM_BIN		16
+#else
 /** Number of bits of storage space allocated to each histogram bin. The
-  * maximum value of each bin is limited by this, so this should be
-  * large enough to store the maximum expected histogram count.
+  * bit-packed representation uses exactly #HISTOGRAM_COUNT_BITS bits.
   */
-#define	BITS_PER_HISTOGRAM_BIN		11
+#define	BITS_PER_HISTOGRAM_BIN		HISTOGRAM_COUNT_BITS
+#endif // #ifdef UNPACKED_HISTOGRAM
 
 /** Number of samples to take before running statistical tests.
   * \warning This must be a multiple of #FFT_SIZE * 2, so that a FFT can be
@@ -45,8 +61,9 @@ extern bool psd_accumulator_error_occurred;
 
 extern void clearHistogram(void);
 extern void incrementHistogram(uint32_t index);
+extern void incrementHistogramBatch(const volatile uint16_t *buffer, uint32_t length);
 extern fix16_t scaleSample(int sample_int);
-extern fix16_t calculateCentralMoment(fix16_t mean, uint32_t power);
+extern void calculateCentralMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4);
 extern fix16_t estimateEntropy(void);
 extern void subtractMeanFromFftBuffer(ComplexFixed *fft_buffer);
 extern void clearPowerSpectralDensity(void);
@@ -41,6 +41,7 @@
 #include "messages.pb.h"
 #include "sha256.h"
 #include "transaction.h"
+#include "perf_counters.h"
 
 #ifdef TEST_STREAM_COMM
 #include "test_helpers.h"
@@ -55,6 +56,10 @@ bool hashFieldCallback(pb_istream_t *stream, const pb_field_t *field, void **arg
 /** Maximum size (in bytes) of any protocol buffer message sent by functions
   * in this file. */
 #define MAX_SEND_SIZE			255
+/** Maximum number of addresses which can be created by one NewAddresses
+  * message. This limits how long the device can be kept busy by one
+  * request. */
+#define MAX_NEW_ADDRESSES		1024
 
 /** Union of field buffers for all protocol buffer messages. They're placed
   * in a union to make memory access more efficient, since the functions in
@@ -68,6 +73,7 @@ union MessageBufferUnion
 	DeleteWallet delete_wallet;
 	NewWallet new_wallet;
 	NewAddress new_address;
+	NewAddresses new_addresses;
 	GetNumberOfAddresses get_number_of_addresses;
 	NumberOfAddresses number_of_addresses;
 	GetAddressAndPublicKey get_address_and_public_key;
@@ -84,6 +90,10 @@ union MessageBufferUnion
 	GetEntropy get_entropy;
 	GetMasterPublicKey get_master_public_key;
 	MasterPublicKey master_public_key;
+#ifdef DEBUG_PERF
+	GetPerfCounters get_perf_counters;
+	PerfCounters perf_counters;
+#endif // #ifdef DEBUG_PERF
 };
 
 /** Determines the string that writeStringCallback() will write. */
@@ -117,6 +127,12 @@ static struct StringSetAndSpec string_arg_alt;
 /** Current number of wallets; used for the listWalletsCallback() callback
   * function. */
 static uint32_t number_of_wallets;
+/** Address handle of the first address to send to the host; used for
+  * the newAddressesCallback() callback function. */
+static AddressHandle new_addresses_first_ah;
+/** Number of addresses to send to the host; used for
+  * the newAddressesCallback() callback function. */
+static uint32_t new_addresses_count;
 /** Pointer to bytes of entropy to send to the host; used for
   * the getEntropyCallback() callback function. */
 static uint8_t *entropy_buffer;
@@ -725,6 +741,127 @@ static NOINLINE void getAndSendAddressAndPublicKey(bool generate_new, AddressHan
 	} // end if (r == WALLET_NO_ERROR)
 }
 
+/** nanopb field callback which will write repeated Address messages; one
+  * for each of the #new_addresses_count addresses starting
+  * at #new_addresses_first_ah. The addresses are generated in batches
+  * using getAddressesAndPublicKeys().
+  * \param stream Output stream to write to.
+  * \param field Field which contains the Address submessages.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool newAddressesCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	Address message_buffer;
+	PointAffine public_keys[POINT_MULTIPLY_BATCH_SIZE];
+	uint8_t addresses[POINT_MULTIPLY_BATCH_SIZE * 20];
+	uint32_t done;
+	uint32_t chunk_size;
+	uint32_t i;
+	bool generation_failed;
+
+	memset(&message_buffer, 0, sizeof(message_buffer));
+	generation_failed = false;
+	for (done = 0; done < new_addresses_count; done += chunk_size)
+	{
+		chunk_size = new_addresses_count - done;
+		if (chunk_size > POINT_MULTIPLY_BATCH_SIZE)
+		{
+			chunk_size = POINT_MULTIPLY_BATCH_SIZE;
+		}
+		// sendPacket() encodes every message twice; the first time is only
+		// to measure its length. The length of each Address doesn't depend
+		// on its contents (compressed public keys are always 33 bytes), so
+		// there's no need to generate the addresses for the first pass.
+		if ((stream->callback != NULL) && !generation_failed)
+		{
+			if (getAddressesAndPublicKeys(addresses, public_keys, new_addresses_first_ah + done, chunk_size) != WALLET_NO_ERROR)
+			{
+				// It's too late to send a Failure message, since the
+				// length of this one has already been sent. Returning false
+				// would make sendPacket() call fatalError(). Instead,
+				// finish the message with Address messages which are all
+				// zeroes. They have the length that was promised, and the
+				// host can recognise them because a valid public key never
+				// starts with 0x00.
+				generation_failed = true;
+			}
+		}
+		for (i = 0; i < chunk_size; i++)
+		{
+			message_buffer.address_handle = new_addresses_first_ah + done + i;
+			message_buffer.address.size = 20;
+			message_buffer.public_key.size = 33;
+			if (generation_failed)
+			{
+				memset(message_buffer.address.bytes, 0, 20);
+				memset(message_buffer.public_key.bytes, 0, 33);
+			}
+			else if (stream->callback != NULL)
+			{
+				memcpy(message_buffer.address.bytes, &(addresses[i * 20]), 20);
+				message_buffer.public_key.size = ecdsaSerialise(message_buffer.public_key.bytes, &(public_keys[i]), true);
+			}
+			if (!pb_encode_tag_for_field(stream, field))
+			{
+				return false;
+			}
+			if (!pb_encode_submessage(stream, Address_fields, &message_buffer))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/** Tell the user interface how many addresses an #ASKUSER_NEW_ADDRESSES
+  * request is for (see setNewAddressesCount()).
+  * \param count The number of addresses.
+  */
+static void notifyNewAddressesCount(uint32_t count)
+{
+	char text_count[TEXT_COUNT_LENGTH];
+	char digits[TEXT_COUNT_LENGTH];
+	uint8_t num_digits;
+	uint8_t i;
+
+	num_digits = 0;
+	do
+	{
+		digits[num_digits++] = (char)('0' + (count % 10));
+		count /= 10;
+	} while (count != 0);
+	for (i = 0; i < num_digits; i++)
+	{
+		text_count[i] = digits[num_digits - i - 1];
+	}
+	text_count[num_digits] = '\0';
+	setNewAddressesCount(text_count);
+}
+
+/** Create several new addresses and send them all to the host in one
+  * packet. The wallet record is only updated once (see makeNewAddresses()).
+  * \param count The number of new addresses to create.
+  */
+static NOINLINE void getAndSendNewAddresses(uint32_t count)
+{
+	Addresses message_buffer;
+
+	new_addresses_first_ah = makeNewAddresses(count);
+	if (new_addresses_first_ah == BAD_ADDRESS_HANDLE)
+	{
+		translateWalletError(walletGetLastError());
+	}
+	else
+	{
+		new_addresses_count = count;
+		message_buffer.addresses.funcs.encode = &newAddressesCallback;
+		message_buffer.addresses.arg = NULL;
+		sendPacket(PACKET_TYPE_ADDRESSES, Addresses_fields, &message_buffer);
+	}
+}
+
 /** nanopb field callback which will write repeated WalletInfo messages; one
   * for each wallet on the device.
   * \param stream Output stream to write to.
@@ -768,6 +905,38 @@ bool listWalletsCallback(pb_ostream_t *stream, const pb_field_t *field, void * c
 	return true;
 }
 
+#ifdef DEBUG_PERF
+/** nanopb field callback which will write out every performance counter
+  * (see perf_counters.c) as a PerfCounter message. With the current number
+  * of counters, the PerfCounters message is always smaller
+  * than #MAX_SEND_SIZE.
+  * \param stream Output stream to write to.
+  * \param field Field which contains the PerfCounter submessages.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool perfCountersCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	uint32_t i;
+	PerfCounter message_buffer;
+
+	for (i = 0; i < PERF_NUMBER_OF_COUNTERS; i++)
+	{
+		message_buffer.counter_id = i;
+		getPerfCounter(&(message_buffer.count), &(message_buffer.cycles), (PerfCounterID)i);
+		if (!pb_encode_tag_for_field(stream, field))
+		{
+			return false;
+		}
+		if (!pb_encode_submessage(stream, PerfCounter_fields, &message_buffer))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+#endif // #ifdef DEBUG_PERF
+
 /** nanopb field callback which will write out the contents
   * of #entropy_buffer.
   * \param stream Output stream to write to.
@@ -884,6 +1053,9 @@ void processPacket(void)
 	WalletErrors wallet_return;
 	char ping_greeting[sizeof(message_buffer.ping.greeting)];
 	bool has_ping_greeting;
+#ifdef DEBUG_PERF
+	bool reset_perf_counters;
+#endif // #ifdef DEBUG_PERF
 
 	message_id = receivePacketHeader();
 
@@ -1056,6 +1228,31 @@ void processPacket(void)
 		}
 		break;
 
+	case PACKET_TYPE_NEW_ADDRESSES:
+		// Create several new addresses in wallet.
+		receive_failure = receiveMessage(NewAddresses_fields, &(message_buffer.new_addresses));
+		if (!receive_failure)
+		{
+			if (message_buffer.new_addresses.count == 0)
+			{
+				writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+			}
+			else if (message_buffer.new_addresses.count > MAX_NEW_ADDRESSES)
+			{
+				writeFailureString(STRINGSET_MISC, MISCSTR_PARAM_TOO_LARGE);
+			}
+			else
+			{
+				notifyNewAddressesCount(message_buffer.new_addresses.count);
+				permission_denied = buttonInterjection(ASKUSER_NEW_ADDRESSES);
+				if (!permission_denied)
+				{
+					getAndSendNewAddresses(message_buffer.new_addresses.count);
+				}
+			}
+		}
+		break;
+
 	case PACKET_TYPE_GET_NUM_ADDRESSES:
 		// Get number of addresses in wallet.
 		receive_failure = receiveMessage(GetNumberOfAddresses_fields, &(message_buffer.get_number_of_addresses));
@@ -1319,6 +1516,25 @@ void processPacket(void)
 		}
 		break;
 
+#ifdef DEBUG_PERF
+	case PACKET_TYPE_GET_PERF_COUNTERS:
+		// Read (and optionally reset) performance counters.
+		receive_failure = receiveMessage(GetPerfCounters_fields, &(message_buffer.get_perf_counters));
+		if (!receive_failure)
+		{
+			reset_perf_counters = message_buffer.get_perf_counters.reset;
+			memset(&message_buffer, 0, sizeof(message_buffer));
+			message_buffer.perf_counters.cycles_per_second = getCycleCounterFrequency();
+			message_buffer.perf_counters.counter.funcs.encode = &perfCountersCallback;
+			sendPacket(PACKET_TYPE_PERF_COUNTERS, PerfCounters_fields, &(message_buffer.perf_counters));
+			if (reset_perf_counters)
+			{
+				clearPerfCounters();
+			}
+		}
+		break;
+#endif // #ifdef DEBUG_PERF
+
 	default:
 		// Unknown message ID.
 		readAndIgnoreInput();
@@ -1338,6 +1554,13 @@ static uint32_t stream_ptr;
 static uint32_t stream_length;
 /** Whether to use a test stream consisting of an infinite stream of zeroes. */
 static bool is_infinite_zero_stream;
+/** Bytes sent by streamPutOneByte() while #capture_output is true. */
+static uint8_t test_output[1024];
+/** Number of bytes in #test_output. */
+static uint32_t test_output_length;
+/** Whether streamPutOneByte() should store bytes in #test_output (as well as
+  * displaying them). */
+static bool capture_output;
 
 /** Sets input stream (what will be read by streamGetOneByte()) to the
   * contents of a buffer.
@@ -1396,6 +1619,10 @@ uint8_t streamGetOneByte(void)
 void streamPutOneByte(uint8_t one_byte)
 {
 	printf(" %02x", (int)one_byte);
+	if (capture_output && (test_output_length < sizeof(test_output)))
+	{
+		test_output[test_output_length++] = one_byte;
+	}
 }
 
 /** Helper for getString().
@@ -1554,6 +1781,21 @@ char getString(StringSet set, uint8_t spec, uint16_t pos)
 	return getStringInternal(set, spec)[pos];
 }
 
+/** Number of addresses in an #ASKUSER_NEW_ADDRESSES request, as set by
+  * setNewAddressesCount(). */
+static char new_addresses_text_count[TEXT_COUNT_LENGTH];
+
+/** Notify the user interface of how many addresses
+  * an #ASKUSER_NEW_ADDRESSES request is for.
+  * \param text_count The number of addresses, as a null-terminated text
+  *                   string such as "64".
+  */
+void setNewAddressesCount(char *text_count)
+{
+	strncpy(new_addresses_text_count, text_count, TEXT_COUNT_LENGTH);
+	new_addresses_text_count[TEXT_COUNT_LENGTH - 1] = '\0';
+}
+
 /** Display human-readable description of an action on stdout.
   * \param command The action to display. See #AskUserCommandEnum.
   */
@@ -1568,6 +1810,9 @@ static void printAction(AskUserCommand command)
 	case ASKUSER_NEW_ADDRESS:
 		printf("Create new address? ");
 		break;
+	case ASKUSER_NEW_ADDRESSES:
+		printf("Create %s new addresses? ", new_addresses_text_count);
+		break;
 	case ASKUSER_SIGN_TRANSACTION:
 		printf("Sign transaction? ");
 		break;
@@ -1676,6 +1921,25 @@ static const uint8_t test_stream_new_address[] = {
 
 0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00};
 
+/** Test stream data for: create 3 new addresses at once. */
+static const uint8_t test_stream_new_addresses[] = {
+0x23, 0x23, 0x00, 0x19, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x03,
+
+0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00};
+
+/** Test stream data for: create 1025 new addresses at once (which is too
+  * many). */
+static const uint8_t test_stream_new_addresses_too_many[] = {
+0x23, 0x23, 0x00, 0x19, 0x00, 0x00, 0x00, 0x03,
+0x08, 0x81, 0x08};
+
+/** Test stream data for: create 0 new addresses at once (which is
+  * invalid). */
+static const uint8_t test_stream_new_addresses_none[] = {
+0x23, 0x23, 0x00, 0x19, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x00};
+
 /** Test stream data for: get number of addresses. */
 static const uint8_t test_stream_get_num_addresses[] = {
 0x23, 0x23, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00};
@@ -1960,6 +2224,15 @@ static const uint8_t test_stream_load_no_key[] = {
 
 0x23, 0x23, 0x00, 0x55, 0x00, 0x00, 0x00, 0x00};
 
+/** Test stream data for: get performance counters and reset them. */
+static const uint8_t test_stream_get_perf_counters_reset[] = {
+0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x01};
+
+/** Test stream data for: get performance counters. */
+static const uint8_t test_stream_get_perf_counters[] = {
+0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00};
+
 /** Test response of processPacket() for a given test stream.
   * \param test_stream The test stream data to use.
   * \param size The length of the test stream, in bytes.
@@ -1975,6 +2248,198 @@ static void sendOneTestStream(const uint8_t *test_stream, uint32_t size)
   * case (use of a constant byte array). */
 #define SEND_ONE_TEST_STREAM(x)	sendOneTestStream(x, (uint32_t)sizeof(x));
 
+#ifdef DEBUG_PERF
+/** Number of PerfCounter messages seen by decodePerfCounterCallback(). */
+static uint32_t perf_counters_seen;
+/** Count of #PERF_POINT_MULTIPLY, as seen by decodePerfCounterCallback(). */
+static uint32_t perf_point_multiply_count;
+
+/** nanopb field callback which decodes one PerfCounter message from a
+  * PerfCounters message.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the PerfCounter submessage.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+static bool decodePerfCounterCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	PerfCounter counter;
+
+	if (!pb_decode(stream, PerfCounter_fields, &counter))
+	{
+		return false;
+	}
+	if (counter.counter_id == PERF_POINT_MULTIPLY)
+	{
+		perf_point_multiply_count = counter.count;
+	}
+	perf_counters_seen++;
+	return true;
+}
+#endif // #ifdef DEBUG_PERF
+
+/** Number of Address messages seen by decodeAddressCallback(). */
+static uint32_t addresses_seen;
+/** Number of Address messages seen by decodeAddressCallback() which are
+  * all zeroes. */
+static uint32_t zero_addresses_seen;
+
+/** nanopb field callback which decodes one Address message from an
+  * Addresses message.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the Address submessage.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+static bool decodeAddressCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	Address address;
+	uint8_t zeroes[33];
+
+	if (!pb_decode(stream, Address_fields, &address))
+	{
+		return false;
+	}
+	memset(zeroes, 0, sizeof(zeroes));
+	if ((address.public_key.size == 33) && !memcmp(address.public_key.bytes, zeroes, 33)
+		&& (address.address.size == 20) && !memcmp(address.address.bytes, zeroes, 20))
+	{
+		zero_addresses_seen++;
+	}
+	addresses_seen++;
+	return true;
+}
+
+/** Check that if addresses can't be generated while the response to
+  * NewAddresses is being sent, newAddressesCallback() finishes the message
+  * with all-zero Address messages, so that the message is well-formed and
+  * has the length which was measured. Failing would make sendPacket() call
+  * fatalError(). The wallet is unloaded to make generation fail.
+  */
+static void testNewAddressesFailure(void)
+{
+	Addresses message;
+	pb_ostream_t sizing_stream = PB_OSTREAM_SIZING;
+	pb_ostream_t stream;
+	pb_istream_t in_stream;
+	uint8_t buffer[512];
+
+	uninitWallet();
+	new_addresses_first_ah = 1;
+	new_addresses_count = 3;
+	message.addresses.funcs.encode = &newAddressesCallback;
+	message.addresses.arg = NULL;
+	stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+	if (!pb_encode(&sizing_stream, Addresses_fields, &message)
+		|| !pb_encode(&stream, Addresses_fields, &message))
+	{
+		printf("newAddressesCallback() fails when addresses can't be generated\n");
+		reportFailure();
+		return;
+	}
+	if (sizing_stream.bytes_written != stream.bytes_written)
+	{
+		printf("Length of Addresses changes when addresses can't be generated\n");
+		reportFailure();
+		return;
+	}
+	addresses_seen = 0;
+	zero_addresses_seen = 0;
+	memset(&message, 0, sizeof(message));
+	message.addresses.funcs.decode = &decodeAddressCallback;
+	in_stream = pb_istream_from_buffer(buffer, stream.bytes_written);
+	if (!pb_decode(&in_stream, Addresses_fields, &message)
+		|| (addresses_seen != 3) || (zero_addresses_seen != 3))
+	{
+		printf("Addresses isn't all zeroes when addresses can't be generated\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
+/** Send a GetPerfCounters packet and check the response. Firmware built
+  * with DEBUG_PERF should respond with every performance counter, other
+  * firmware should respond with Failure.
+  * \param test_stream The test stream data to use.
+  * \param size The length of the test stream, in bytes.
+  * \param expect_point_multiply Whether #PERF_POINT_MULTIPLY should have a
+  *                              non-zero count.
+  */
+static void checkPerfCounters(const uint8_t *test_stream, uint32_t size, bool expect_point_multiply)
+{
+	uint32_t message_id;
+	uint32_t length;
+	bool failed;
+#ifdef DEBUG_PERF
+	pb_istream_t stream;
+	PerfCounters message;
+#endif // #ifdef DEBUG_PERF
+
+	test_output_length = 0;
+	capture_output = true;
+	sendOneTestStream(test_stream, size);
+	capture_output = false;
+	failed = false;
+	if ((test_output_length < 8) || (test_output[0] != '#') || (test_output[1] != '#'))
+	{
+		printf("Response to GetPerfCounters has bad header\n");
+		reportFailure();
+		return;
+	}
+	message_id = ((uint32_t)test_output[2] << 8) | test_output[3];
+	length = readU32BigEndian(&(test_output[4]));
+	if (length != (test_output_length - 8))
+	{
+		printf("Response to GetPerfCounters has wrong length\n");
+		failed = true;
+	}
+#ifdef DEBUG_PERF
+	if (message_id != PACKET_TYPE_PERF_COUNTERS)
+	{
+		printf("Response to GetPerfCounters isn't PerfCounters\n");
+		failed = true;
+	}
+	memset(&message, 0, sizeof(message));
+	message.counter.funcs.decode = &decodePerfCounterCallback;
+	perf_counters_seen = 0;
+	perf_point_multiply_count = 0;
+	stream = pb_istream_from_buffer(&(test_output[8]), test_output_length - 8);
+	if (!pb_decode(&stream, PerfCounters_fields, &message))
+	{
+		printf("Couldn't decode PerfCounters\n");
+		failed = true;
+	}
+	if ((perf_counters_seen != PERF_NUMBER_OF_COUNTERS) || (message.cycles_per_second == 0))
+	{
+		printf("PerfCounters doesn't contain every counter\n");
+		failed = true;
+	}
+	if ((perf_point_multiply_count != 0) != expect_point_multiply)
+	{
+		printf("Wrong count for point multiplication: %u\n", perf_point_multiply_count);
+		failed = true;
+	}
+#else
+	(void)expect_point_multiply;
+	if (message_id != PACKET_TYPE_FAILURE)
+	{
+		printf("Response to GetPerfCounters without DEBUG_PERF isn't Failure\n");
+		failed = true;
+	}
+#endif // #ifdef DEBUG_PERF
+	if (failed)
+	{
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
 int main(void)
 {
 	int i;
@@ -1999,6 +2464,21 @@ int main(void)
 		printf("Creating new address...\n");
 		SEND_ONE_TEST_STREAM(test_stream_new_address);
 	}
+	printf("Creating 3 new addresses at once...\n");
+	SEND_ONE_TEST_STREAM(test_stream_new_addresses);
+	if (strcmp(new_addresses_text_count, "3"))
+	{
+		printf("Number of new addresses wasn't shown to user\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	printf("Creating too many new addresses at once...\n");
+	SEND_ONE_TEST_STREAM(test_stream_new_addresses_too_many);
+	printf("Creating no new addresses at once...\n");
+	SEND_ONE_TEST_STREAM(test_stream_new_addresses_none);
 	printf("Getting number of addresses...\n");
 	SEND_ONE_TEST_STREAM(test_stream_get_num_addresses);
 	printf("Getting address 1...\n");
@@ -2047,6 +2527,12 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_get_master_public_key_no_press);
 	printf("Loading wallet but not allowing password to be sent...\n");
 	SEND_ONE_TEST_STREAM(test_stream_load_no_key);
+	printf("Getting and resetting performance counters...\n");
+	checkPerfCounters(test_stream_get_perf_counters_reset, (uint32_t)sizeof(test_stream_get_perf_counters_reset), true);
+	printf("Getting performance counters after reset...\n");
+	checkPerfCounters(test_stream_get_perf_counters, (uint32_t)sizeof(test_stream_get_perf_counters), false);
+	printf("Creating new addresses when they can't be generated...\n");
+	testNewAddressesFailure();
 
 	finishTests();
 	exit(0);
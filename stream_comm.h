@@ -60,6 +60,11 @@
 #define PACKET_TYPE_DELETE_WALLET		0x16
 /** Initialise device's state. */
 #define PACKET_TYPE_INITIALIZE			0x17
+/** Read performance counters. This is only handled by firmware built
+  * with DEBUG_PERF defined. */
+#define PACKET_TYPE_GET_PERF_COUNTERS	0x18
+/** Create several new addresses in a wallet at once. */
+#define PACKET_TYPE_NEW_ADDRESSES		0x19
 /** An address from a wallet (response to #PACKET_TYPE_GET_ADDRESS_PUBKEY
   * or #PACKET_TYPE_NEW_ADDRESS). */
 #define PACKET_TYPE_ADDRESS_PUBKEY		0x30
@@ -85,6 +90,11 @@
 #define PACKET_TYPE_SIGNATURE			0x39
 /** Version information and list of features. */
 #define PACKET_TYPE_FEATURES			0x3a
+/** Performance counters (response to #PACKET_TYPE_GET_PERF_COUNTERS). */
+#define PACKET_TYPE_PERF_COUNTERS		0x3b
+/** Several addresses from a wallet (response
+  * to #PACKET_TYPE_NEW_ADDRESSES). */
+#define PACKET_TYPE_ADDRESSES			0x3c
 /** Device wants to wait for button press (beginning of ButtonRequest
   * interjection). */
 #define PACKET_TYPE_BUTTON_REQUEST		0x50
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <time.h>
 #include "test_helpers.h"
+#include "hwinterface.h"
 
 /** Number of test cases which succeeded. */
 static int succeeded;
@@ -148,5 +149,27 @@ void finishTests(void)
 	printf("Tests which failed: %d\n", failed);
 }
 
+#if defined(DEBUG_PERF) && !defined(TEST_PERF_COUNTERS)
+/** Host version of the cycle counter used by the performance counters (see
+  * perf_counters.c), for unit tests which are built with DEBUG_PERF. This
+  * uses processor time, since that is what the firmware's cycle counter
+  * measures. (perf_counters.c has its own simulated version for its unit
+  * test.)
+  * \return The current value of the counter.
+  */
+uint32_t getCycleCounter(void)
+{
+	return (uint32_t)clock();
+}
+
+/** Get the rate at which the counter read by getCycleCounter() increments.
+  * \return The rate, in counts per second.
+  */
+uint32_t getCycleCounterFrequency(void)
+{
+	return (uint32_t)CLOCKS_PER_SEC;
+}
+#endif // #if defined(DEBUG_PERF) && !defined(TEST_PERF_COUNTERS)
+
 #endif // #ifdef TEST
 
@@ -35,6 +35,7 @@
 #include "prandom.h"
 #include "hwinterface.h"
 #include "transaction.h"
+#include "perf_counters.h"
 
 /** The maximum size of a transaction (in bytes) which parseTransaction()
   * is prepared to handle. */
@@ -620,7 +621,9 @@ TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_has
 	HashState sig_hash_hs;
 	HashState transaction_hash_hs;
 	HashState ref_compare_hs;
+	PERF_DECLARE_START;
 
+	PERF_START();
 	hs_ptr_valid = false;
 	transaction_data_index = 0;
 	transaction_length = length;
@@ -644,6 +647,7 @@ TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_has
 			break;
 		}
 	}
+	PERF_STOP(PERF_PARSE_TRANSACTION, length);
 	return r;
 }
 
@@ -51,14 +51,28 @@
   * is used to calculate the checksum and the output of SHA-256 is 32 bytes
   * long. */
 #define CHECKSUM_LENGTH			32
+/** Length, in bytes, of the address tally (see
+  * WalletRecordUnencryptedStruct#address_tally). */
+#define ADDRESS_TALLY_LENGTH	4
 
 /** Structure of the unencrypted portion of a wallet record. */
 struct WalletRecordUnencryptedStruct
 {
 	/** Wallet version. Should be one of #WalletVersion. */
 	uint32_t version;
-	/** Reserved for future use. Set to all zeroes. */
-	uint8_t reserved[4];
+	/** Addresses made since the wallet record was last written in full, in
+	  * unary: each one clears a bit which is set in
+	  * WalletRecordEncryptedStruct#address_tally_mask. This is kept out of
+	  * the encrypted portion so that it can be updated by only clearing bits.
+	  * See makeNewAddresses().
+	  * \warning The bits which are in the mask aren't covered by the
+	  *          checksum (see calculateWalletChecksum()), so anyone who can
+	  *          write to non-volatile storage can change the number of
+	  *          addresses by up to #ADDRESS_TALLY_BITS without being
+	  *          detected. The seed is still checked, so this can only hide
+	  *          or reveal addresses which belong to the wallet anyway.
+	  */
+	uint8_t address_tally[ADDRESS_TALLY_LENGTH];
 	/** Name of the wallet. This is purely for the sake of the host; the
 	  * name isn't ever used or parsed by the functions in this file. */
 	uint8_t name[NAME_LENGTH];
@@ -75,8 +89,11 @@ struct WalletRecordEncryptedStruct
 	/** Random padding. This is random to try and thwart known-plaintext
 	  * attacks. */
 	uint8_t padding[8];
-	/** Reserved for future use. Set to all zeroes. */
-	uint8_t reserved[4];
+	/** Which bits of WalletRecordUnencryptedStruct#address_tally were set
+	  * when the wallet record was last written in full. This is all zeroes
+	  * for hidden wallets (and wallets written by older firmware), which
+	  * don't use the address tally. */
+	uint8_t address_tally_mask[ADDRESS_TALLY_LENGTH];
 	/** Seed for deterministic private key generator. */
 	uint8_t seed[SEED_LENGTH];
 	/** SHA-256 of everything except this. */
@@ -114,6 +131,15 @@ static WalletRecord current_wallet;
   * record is. If #wallet_loaded is false (i.e. no wallet is loaded), then the
   * contents of this variable are undefined. */
 static uint32_t wallet_nv_address;
+/** Hash state of the wallet checksum calculation after the unencrypted
+  * portion of #current_wallet has been written. This is only valid if
+  * #unencrypted_checksum_state_valid is true. */
+static HashState unencrypted_checksum_state;
+/** Whether #unencrypted_checksum_state is valid. Anything which changes the
+  * unencrypted portion of #current_wallet (other than clearing address tally
+  * bits which are in the mask, which the checksum ignores) must set this to
+  * false. */
+static bool unencrypted_checksum_state_valid;
 /** Cache of number of wallets that can fit in non-volatile storage. This will
   * be 0 if a value hasn't been calculated yet. This is set by
   * getNumberOfWallets(). */
@@ -149,10 +175,25 @@ void initWalletTest(void)
 #endif // #ifdef TEST
 
 #ifdef TEST_WALLET
+#ifdef FULL_ADDRESS_TALLY
+/** Number of bits of the address tally which are used - for testing only.
+  * With FULL_ADDRESS_TALLY defined, this is the same as in real firmware. */
+#define ADDRESS_TALLY_BITS		(ADDRESS_TALLY_LENGTH * 8)
+/** Maximum of addresses which can be stored in storage area - for testing
+  * only. This should actually be the capacity of the wallet, since one
+  * of the tests is to see what happens when the wallet is full. This must
+  * be big enough for the tests to use up the address tally. */
+#define MAX_TESTING_ADDRESSES	(ADDRESS_TALLY_BITS + 3)
+#else
 /** Maximum of addresses which can be stored in storage area - for testing
   * only. This should actually be the capacity of the wallet, since one
   * of the tests is to see what happens when the wallet is full. */
 #define MAX_TESTING_ADDRESSES	7
+/** Number of bits of the address tally which are used - for testing only.
+  * This is less than #MAX_TESTING_ADDRESSES so that the tests can use up
+  * the address tally. */
+#define ADDRESS_TALLY_BITS		3
+#endif // #ifdef FULL_ADDRESS_TALLY
 
 /** Set this to true to stop sanitiseNonVolatileStorage() from
   * updating the persistent entropy pool. This is necessary for some test
@@ -160,9 +201,39 @@ void initWalletTest(void)
   * of the entropy pool would appear as spurious writes to those test cases.
   */
 static bool suppress_set_entropy_pool;
+#else
+/** Number of bits of the address tally which are used. */
+#define ADDRESS_TALLY_BITS		(ADDRESS_TALLY_LENGTH * 8)
 #endif // #ifdef TEST_WALLET
 
+/** Get what the address tally of #current_wallet was when the wallet record
+  * was last written in full, by setting all the bits which are in the mask.
+  * This is what the wallet checksum covers, so that clearing those bits
+  * doesn't invalidate the checksum. For wallet records written by older
+  * firmware and for hidden wallets, the mask is all zeroes, so this is just
+  * the address tally, and the checksum is the same as it always was.
+  * \param out_tally The address tally will be written here. This must be a
+  *                  byte array with space for #ADDRESS_TALLY_LENGTH bytes.
+  */
+static void getWrittenAddressTally(uint8_t *out_tally)
+{
+	unsigned int i;
+
+	for (i = 0; i < ADDRESS_TALLY_LENGTH; i++)
+	{
+		out_tally[i] = (uint8_t)(current_wallet.unencrypted.address_tally[i] | current_wallet.encrypted.address_tally_mask[i]);
+	}
+}
+
 /** Calculate the checksum (SHA-256 hash) of the current wallet's contents.
+  *
+  * The unencrypted portion of the wallet record comes first and rarely
+  * changes (only the name and version are ever updated), so the hash state
+  * after it is cached in #unencrypted_checksum_state. Most updates then only
+  * need to hash the encrypted portion.
+  *
+  * The address tally is hashed as it was when the wallet record was last
+  * written in full (see getWrittenAddressTally()).
   * \param hash The resulting SHA-256 hash will be written here. This must
   *             be a byte array with space for #CHECKSUM_LENGTH bytes.
   * \return See #NonVolatileReturnEnum.
@@ -172,11 +243,27 @@ static void calculateWalletChecksum(uint8_t *hash)
 	uint8_t *ptr;
 	unsigned int i;
 	HashState hs;
+	uint8_t written_tally[ADDRESS_TALLY_LENGTH];
 
-	sha256Begin(&hs);
 	ptr = (uint8_t *)&current_wallet;
-	for (i = 0; i < sizeof(WalletRecord); i++)
+	getWrittenAddressTally(written_tally);
+	if (unencrypted_checksum_state_valid)
+	{
+		memcpy(&hs, &unencrypted_checksum_state, sizeof(hs));
+		i = offsetof(WalletRecord, encrypted);
+	}
+	else
 	{
+		sha256Begin(&hs);
+		i = 0;
+	}
+	for (; i < sizeof(WalletRecord); i++)
+	{
+		if (!unencrypted_checksum_state_valid && (i == offsetof(WalletRecord, encrypted)))
+		{
+			memcpy(&unencrypted_checksum_state, &hs, sizeof(hs));
+			unencrypted_checksum_state_valid = true;
+		}
 		// Skip checksum when calculating the checksum.
 		if (i == offsetof(WalletRecord, encrypted.checksum))
 		{
@@ -184,13 +271,56 @@ static void calculateWalletChecksum(uint8_t *hash)
 		}
 		if (i < sizeof(WalletRecord))
 		{
-			sha256WriteByte(&hs, ptr[i]);
+			if ((i >= offsetof(WalletRecord, unencrypted.address_tally))
+				&& (i < (offsetof(WalletRecord, unencrypted.address_tally) + ADDRESS_TALLY_LENGTH)))
+			{
+				sha256WriteByte(&hs, written_tally[i - offsetof(WalletRecord, unencrypted.address_tally)]);
+			}
+			else
+			{
+				sha256WriteByte(&hs, ptr[i]);
+			}
 		}
 	}
 	sha256Finish(&hs);
 	writeHashToByteArray(hash, &hs, true);
 }
 
+/** Count bits in the address tally of #current_wallet. Only bits which are
+  * set in the address tally mask are considered.
+  * \param count_used If this is true, bits which have been cleared (i.e.
+  *                   addresses which have been tallied) will be counted. If
+  *                   this is false, bits which are still set (i.e. space for
+  *                   more addresses) will be counted.
+  * \return The number of bits.
+  */
+static uint32_t countAddressTallyBits(bool count_used)
+{
+	unsigned int i;
+	unsigned int j;
+	uint8_t bits;
+	uint32_t count;
+
+	count = 0;
+	for (i = 0; i < ADDRESS_TALLY_LENGTH; i++)
+	{
+		bits = current_wallet.unencrypted.address_tally[i];
+		if (count_used)
+		{
+			bits = (uint8_t)~bits;
+		}
+		bits &= current_wallet.encrypted.address_tally_mask[i];
+		for (j = 0; j < 8; j++)
+		{
+			if ((bits & (1 << j)) != 0)
+			{
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
 /** Load contents of non-volatile memory into a #WalletRecord structure. This
   * doesn't care if there is or isn't actually a wallet at the specified
   * address.
@@ -234,11 +364,38 @@ static WalletErrors readWalletRecord(WalletRecord *wallet_record, uint32_t addre
 
 /** Store contents of #current_wallet into non-volatile memory. This will also
   * call nonVolatileFlush(), since that's usually what's wanted anyway.
+  *
+  * Since the whole record is being written, the address tally is restarted
+  * and the checksum is recalculated here, so callers don't need to do
+  * either.
   * \param address The address in non-volatile memory to write to.
   * \return See #WalletErrors.
   */
 static WalletErrors writeCurrentWalletRecord(uint32_t address)
 {
+	unsigned int i;
+	uint8_t old_written_tally[ADDRESS_TALLY_LENGTH];
+	uint8_t new_written_tally[ADDRESS_TALLY_LENGTH];
+
+	getWrittenAddressTally(old_written_tally);
+	// Hidden wallets don't use the address tally, because they must never
+	// change any unencrypted fields.
+	memset(current_wallet.encrypted.address_tally_mask, 0, ADDRESS_TALLY_LENGTH);
+	if (current_wallet.unencrypted.version != VERSION_NOTHING_THERE)
+	{
+		memset(current_wallet.unencrypted.address_tally, 0xff, ADDRESS_TALLY_LENGTH);
+		for (i = 0; i < ADDRESS_TALLY_BITS; i++)
+		{
+			current_wallet.encrypted.address_tally_mask[i >> 3] |= (uint8_t)(1 << (i & 7));
+		}
+	}
+	getWrittenAddressTally(new_written_tally);
+	if (memcmp(old_written_tally, new_written_tally, ADDRESS_TALLY_LENGTH))
+	{
+		unencrypted_checksum_state_valid = false;
+	}
+	calculateWalletChecksum(current_wallet.encrypted.checksum);
+
 	if (nonVolatileWrite(
 		(uint8_t *)&(current_wallet.unencrypted),
 		PARTITION_ACCOUNTS,
@@ -295,20 +452,14 @@ static void deriveAndSetEncryptionKey(const uint8_t *uuid, const uint8_t *passwo
 	}
 }
 
-/** Initialise a wallet (load it if it's there).
-  * \param wallet_spec The wallet number of the wallet to load.
-  * \param password Password to use to derive wallet encryption key.
-  * \param password_length Length of password, in bytes. Use 0 to specify no
-  *                        password (i.e. wallet is unencrypted).
+/** Unload the current wallet and select another one, so that its wallet
+  * record can be read or written.
+  * \param wallet_spec The wallet number of the wallet to select.
   * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
-  *         error occurred.
+  *         error occurred. In both cases, #last_error is also set.
   */
-WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const unsigned int password_length)
+static WalletErrors selectWallet(uint32_t wallet_spec)
 {
-	WalletErrors r;
-	uint8_t hash[CHECKSUM_LENGTH];
-	uint8_t uuid[UUID_LENGTH];
-
 	if (uninitWallet() != WALLET_NO_ERROR)
 	{
 		return last_error; // propagate error code
@@ -324,19 +475,24 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 		return last_error;
 	}
 	wallet_nv_address = wallet_spec * sizeof(WalletRecord);
+	return WALLET_NO_ERROR;
+}
 
-	if (nonVolatileRead(uuid, PARTITION_ACCOUNTS, wallet_nv_address + offsetof(WalletRecord, unencrypted.uuid), UUID_LENGTH) != NV_NO_ERROR)
-	{
-		last_error = WALLET_READ_ERROR;
-		return last_error;
-	}
-	deriveAndSetEncryptionKey(uuid, password, password_length);
+/** Load the wallet record of the wallet selected by selectWallet(), using
+  * the current encryption key, and check that it is valid.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+static WalletErrors loadSelectedWallet(void)
+{
+	WalletErrors r;
+	uint8_t hash[CHECKSUM_LENGTH];
+	uint32_t tallied;
 
 	r = readWalletRecord(&current_wallet, wallet_nv_address);
 	if (r != WALLET_NO_ERROR)
 	{
-		last_error = r;
-		return last_error;
+		return r;
 	}
 
 	if (current_wallet.unencrypted.version == VERSION_NOTHING_THERE)
@@ -350,22 +506,94 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 	}
 	else
 	{
-		last_error = WALLET_NOT_THERE;
-		return last_error;
+		return WALLET_NOT_THERE;
 	}
 
 	// Calculate checksum and check that it matches.
 	calculateWalletChecksum(hash);
 	if (bigCompareVariableSize(current_wallet.encrypted.checksum, hash, CHECKSUM_LENGTH) != BIGCMP_EQUAL)
 	{
-		last_error = WALLET_NOT_THERE;
-		return last_error;
+		return WALLET_NOT_THERE;
 	}
 
+	// Addresses made since the wallet record was last written in full are
+	// only recorded in the address tally. Those bits aren't covered by the
+	// checksum, so be careful not to let them overflow the number of
+	// addresses.
+	tallied = countAddressTallyBits(true);
+	if ((current_wallet.encrypted.num_addresses > MAX_ADDRESSES)
+		|| (tallied > (MAX_ADDRESSES - current_wallet.encrypted.num_addresses)))
+	{
+		return WALLET_NOT_THERE;
+	}
+	current_wallet.encrypted.num_addresses += tallied;
+
+	// The parent public key is calculated when it's first needed (or in the
+	// background), so that loading a wallet doesn't have to wait for a point
+	// multiplication.
+	prepareParentPublicKey(current_wallet.encrypted.seed);
+
 	wallet_loaded = true;
-	last_error = WALLET_NO_ERROR;
+	return WALLET_NO_ERROR;
+}
+
+/** Initialise a wallet (load it if it's there).
+  * \param wallet_spec The wallet number of the wallet to load.
+  * \param password Password to use to derive wallet encryption key.
+  * \param password_length Length of password, in bytes. Use 0 to specify no
+  *                        password (i.e. wallet is unencrypted).
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const unsigned int password_length)
+{
+	uint8_t uuid[UUID_LENGTH];
+
+	if (selectWallet(wallet_spec) != WALLET_NO_ERROR)
+	{
+		return last_error; // propagate error code
+	}
+
+	if (nonVolatileRead(uuid, PARTITION_ACCOUNTS, wallet_nv_address + offsetof(WalletRecord, unencrypted.uuid), UUID_LENGTH) != NV_NO_ERROR)
+	{
+		last_error = WALLET_READ_ERROR;
+		return last_error;
+	}
+	deriveAndSetEncryptionKey(uuid, password, password_length);
+
+	last_error = loadSelectedWallet();
+	return last_error;
+}
+
+#if defined(TEST_WALLET) || defined(KEY_RECOVERY)
+/** Initialise a wallet using an encryption key which has already been
+  * derived (instead of deriving it from a password). This allows a key
+  * recovery tool to try the keys for many candidate passwords and PBKDF2
+  * iteration counts without calling pbkdf2() for each one; see
+  * pbkdf2Continue().
+  *
+  * This isn't needed by firmware, so it is only compiled in if
+  * KEY_RECOVERY is defined.
+  * \param wallet_spec The wallet number of the wallet to load.
+  * \param derived_key The wallet encryption key. This must be
+  *                    #WALLET_ENCRYPTION_KEY_LENGTH bytes long. For
+  *                    encrypted wallets, this is the start of the output of
+  *                    pbkdf2(), using the password and the wallet's UUID.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred. #WALLET_NOT_THERE probably means that the key is
+  *         wrong.
+  */
+WalletErrors initWalletWithKey(uint32_t wallet_spec, const uint8_t *derived_key)
+{
+	if (selectWallet(wallet_spec) != WALLET_NO_ERROR)
+	{
+		return last_error; // propagate error code
+	}
+	setEncryptionKey(derived_key);
+	last_error = loadSelectedWallet();
 	return last_error;
 }
+#endif // #if defined(TEST_WALLET) || defined(KEY_RECOVERY)
 
 /** Unload wallet, so that it cannot be used until initWallet() is called.
   * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
@@ -378,6 +606,8 @@ WalletErrors uninitWallet(void)
 	is_hidden_wallet = false;
 	wallet_nv_address = 0;
 	memset(&current_wallet, 0, sizeof(WalletRecord));
+	unencrypted_checksum_state_valid = false;
+	memset(&unencrypted_checksum_state, 0, sizeof(unencrypted_checksum_state));
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -606,6 +836,7 @@ static WalletErrors updateWalletVersion(void)
 		// that would give away their presence.
 		return WALLET_INVALID_OPERATION;
 	}
+	unencrypted_checksum_state_valid = false;
 	if (isEncryptionKeyNonZero())
 	{
 		current_wallet.unencrypted.version = VERSION_IS_ENCRYPTED;
@@ -736,9 +967,9 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 			last_error = r;
 			return last_error;
 		}
-		memset(current_wallet.unencrypted.reserved, 0, sizeof(current_wallet.unencrypted.reserved));
 		memcpy(current_wallet.unencrypted.name, name, NAME_LENGTH);
 		memcpy(current_wallet.unencrypted.uuid, uuid, UUID_LENGTH);
+		unencrypted_checksum_state_valid = false;
 	}
 
 	// Update encrypted fields of current_wallet.
@@ -749,7 +980,6 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		return last_error;
 	}
 	memcpy(current_wallet.encrypted.padding, random_buffer, sizeof(current_wallet.encrypted.padding));
-	memset(current_wallet.encrypted.reserved, 0, sizeof(current_wallet.encrypted.reserved));
 	if (use_seed)
 	{
 		memcpy(current_wallet.encrypted.seed, seed, SEED_LENGTH);
@@ -769,8 +999,6 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		}
 		memcpy(&(current_wallet.encrypted.seed[32]), random_buffer, 32);
 	}
-	calculateWalletChecksum(current_wallet.encrypted.checksum);
-
 	r = writeCurrentWalletRecord(wallet_nv_address);
 	if (r != WALLET_NO_ERROR)
 	{
@@ -782,51 +1010,175 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 	return last_error;
 }
 
-/** Generate a new address using the deterministic private key generator.
-  * \param out_address The new address will be written here (if everything
-  *                    goes well). This must be a byte array with space for
-  *                    20 bytes.
-  * \param out_public_key The public key corresponding to the new address will
-  *                       be written here (if everything goes well).
-  * \return The address handle of the new address on success,
-  *         or #BAD_ADDRESS_HANDLE if an error occurred.
+/** Reserve a range of new addresses in the current wallet. The number of
+  * addresses in the wallet is increased by count, and the wallet record is
+  * written and checksummed only once, no matter how big count is. This is
+  * much faster than calling makeNewAddress() count times, and it also wears
+  * non-volatile storage much less. Use getAddressesAndPublicKeys() (or
+  * getAddressAndPublicKey()) to obtain the new addresses.
+  *
+  * Non-volatile storage is assumed to act like NOR flash (see
+  * nonVolatileWrite()), so where possible, the new addresses are recorded
+  * by clearing bits in the unencrypted address tally instead of rewriting
+  * the whole (encrypted) wallet record. That needs no erase. The whole
+  * record is only rewritten when the address tally runs out of bits. The
+  * cost is that the number of addresses made since the last full rewrite
+  * is visible to anyone who can read non-volatile storage, and isn't
+  * authenticated (see WalletRecordUnencryptedStruct#address_tally). Hidden
+  * wallets don't use the address tally, since it would give away their
+  * presence.
+  * \param count The number of new addresses to reserve. This must be
+  *              non-zero.
+  * \return The address handle of the first new address on success,
+  *         or #BAD_ADDRESS_HANDLE if an error occurred. The new addresses
+  *         have consecutive address handles.
   *         Use walletGetLastError() to get more detail about an error.
   */
-AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
+AddressHandle makeNewAddresses(uint32_t count)
 {
 	WalletErrors r;
+	AddressHandle first_ah;
+	uint32_t max_addresses;
+	uint32_t remaining;
+	unsigned int i;
+	uint8_t bit;
+	uint8_t new_tally[ADDRESS_TALLY_LENGTH];
 
 	if (!wallet_loaded)
 	{
 		last_error = WALLET_NOT_LOADED;
 		return BAD_ADDRESS_HANDLE;
 	}
+	if (count == 0)
+	{
+		last_error = WALLET_INVALID_OPERATION;
+		return BAD_ADDRESS_HANDLE;
+	}
 #ifdef TEST_WALLET
-	if (current_wallet.encrypted.num_addresses >= MAX_TESTING_ADDRESSES)
+	max_addresses = MAX_TESTING_ADDRESSES;
 #else
-	if (current_wallet.encrypted.num_addresses >= MAX_ADDRESSES)
+	max_addresses = MAX_ADDRESSES;
 #endif // #ifdef TEST_WALLET
+	// This is written so that it can't overflow.
+	if ((current_wallet.encrypted.num_addresses > max_addresses)
+		|| (count > (max_addresses - current_wallet.encrypted.num_addresses)))
 	{
 		last_error = WALLET_FULL;
 		return BAD_ADDRESS_HANDLE;
 	}
-	(current_wallet.encrypted.num_addresses)++;
-	calculateWalletChecksum(current_wallet.encrypted.checksum);
-	r = writeCurrentWalletRecord(wallet_nv_address);
-	if (r != WALLET_NO_ERROR)
+	first_ah = current_wallet.encrypted.num_addresses + 1;
+	if (count <= countAddressTallyBits(false))
+	{
+		// There's enough space in the address tally, so the new addresses
+		// can be recorded by only clearing bits. Bits are cleared starting
+		// from the least significant end.
+		memcpy(new_tally, current_wallet.unencrypted.address_tally, ADDRESS_TALLY_LENGTH);
+		remaining = count;
+		for (i = 0; (i < (ADDRESS_TALLY_LENGTH * 8)) && (remaining > 0); i++)
+		{
+			bit = (uint8_t)(1 << (i & 7));
+			if ((current_wallet.encrypted.address_tally_mask[i >> 3] & new_tally[i >> 3] & bit) != 0)
+			{
+				new_tally[i >> 3] &= (uint8_t)~bit;
+				remaining--;
+			}
+		}
+		if ((nonVolatileWrite(
+			new_tally,
+			PARTITION_ACCOUNTS,
+			wallet_nv_address + offsetof(WalletRecord, unencrypted.address_tally),
+			ADDRESS_TALLY_LENGTH) != NV_NO_ERROR)
+			|| (nonVolatileFlush() != NV_NO_ERROR))
+		{
+			last_error = WALLET_WRITE_ERROR;
+			return BAD_ADDRESS_HANDLE;
+		}
+		memcpy(current_wallet.unencrypted.address_tally, new_tally, ADDRESS_TALLY_LENGTH);
+		current_wallet.encrypted.num_addresses += count;
+	}
+	else
+	{
+		// The address tally is full (or not used), so the number of
+		// addresses has to go into the encrypted portion of the wallet
+		// record. This also restarts the address tally.
+		current_wallet.encrypted.num_addresses += count;
+		r = writeCurrentWalletRecord(wallet_nv_address);
+		if (r != WALLET_NO_ERROR)
+		{
+			last_error = r;
+			return BAD_ADDRESS_HANDLE;
+		}
+	}
+	last_error = WALLET_NO_ERROR;
+	return first_ah;
+}
+
+/** Generate a new address using the deterministic private key generator.
+  * \param out_address The new address will be written here (if everything
+  *                    goes well). This must be a byte array with space for
+  *                    20 bytes.
+  * \param out_public_key The public key corresponding to the new address will
+  *                       be written here (if everything goes well).
+  * \return The address handle of the new address on success,
+  *         or #BAD_ADDRESS_HANDLE if an error occurred.
+  *         Use walletGetLastError() to get more detail about an error.
+  */
+AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
+{
+	AddressHandle ah;
+
+	ah = makeNewAddresses(1);
+	if (ah == BAD_ADDRESS_HANDLE)
 	{
-		last_error = r;
 		return BAD_ADDRESS_HANDLE;
 	}
-	last_error = getAddressAndPublicKey(out_address, out_public_key, current_wallet.encrypted.num_addresses);
+	last_error = getAddressAndPublicKey(out_address, out_public_key, ah);
 	if (last_error != WALLET_NO_ERROR)
 	{
 		return BAD_ADDRESS_HANDLE;
 	}
 	else
 	{
-		return current_wallet.encrypted.num_addresses;
+		return ah;
+	}
+}
+
+/** Calculate the address of a public key.
+  * \param out_address The address will be written here. This must be a byte
+  *                    array with space for 20 bytes.
+  * \param public_key The public key.
+  * \return false on success, true if the public key is the point at
+  *         infinity (which has no address).
+  */
+static bool publicKeyToAddress(uint8_t *out_address, PointAffine *public_key)
+{
+	uint8_t buffer[32];
+	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE];
+	uint8_t serialised_size;
+	HashState hs;
+	uint8_t i;
+
+	serialised_size = ecdsaSerialise(serialised, public_key, true);
+	if (serialised_size < 2)
+	{
+		return true;
+	}
+	sha256Begin(&hs);
+	for (i = 0; i < serialised_size; i++)
+	{
+		sha256WriteByte(&hs, serialised[i]);
 	}
+	sha256Finish(&hs);
+	writeHashToByteArray(buffer, &hs, true);
+	ripemd160Begin(&hs);
+	for (i = 0; i < 32; i++)
+	{
+		ripemd160WriteByte(&hs, buffer[i]);
+	}
+	ripemd160Finish(&hs);
+	writeHashToByteArray(buffer, &hs, true);
+	memcpy(out_address, buffer, 20);
+	return false;
 }
 
 /** Given an address handle, use the deterministic private key
@@ -844,11 +1196,7 @@ AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
 WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_public_key, AddressHandle ah)
 {
 	uint8_t buffer[32];
-	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE];
-	uint8_t serialised_size;
-	HashState hs;
 	WalletErrors r;
-	uint8_t i;
 
 	if (!wallet_loaded)
 	{
@@ -877,28 +1225,95 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
 	setToG(out_public_key);
 	pointMultiply(out_public_key, buffer);
 	// Calculate address.
-	serialised_size = ecdsaSerialise(serialised, out_public_key, true);
-	if (serialised_size < 2)
+	if (publicKeyToAddress(out_address, out_public_key))
 	{
 		// Somehow, the public ended up as the point at infinity.
 		last_error = WALLET_INVALID_HANDLE;
 		return last_error;
 	}
-	sha256Begin(&hs);
-	for (i = 0; i < serialised_size; i++)
+
+	last_error = WALLET_NO_ERROR;
+	return last_error;
+}
+
+/** Generate the addresses and public keys associated with a range of
+  * consecutive address handles. The results are the same as calling
+  * getAddressAndPublicKey() for each address handle, but this is much
+  * faster for more than a few addresses, since private keys are generated
+  * using generateDeterministic256Batch() and public keys are calculated
+  * using pointMultiplyBatch().
+  * \param out_addresses The addresses will be written here (if everything
+  *                      goes well), one after another. This must be a byte
+  *                      array with space for count * 20 bytes.
+  * \param out_public_keys The public keys corresponding to the addresses
+  *                        will be written here (if everything goes well).
+  *                        This must have space for count public keys.
+  * \param first_ah The address handle of the first address.
+  * \param count The number of addresses to generate.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors getAddressesAndPublicKeys(uint8_t *out_addresses, PointAffine *out_public_keys, AddressHandle first_ah, uint32_t count)
+{
+	uint8_t private_keys[POINT_MULTIPLY_BATCH_SIZE * 32];
+	uint32_t chunk_size;
+	uint32_t i;
+
+	if (!wallet_loaded)
 	{
-		sha256WriteByte(&hs, serialised[i]);
+		last_error = WALLET_NOT_LOADED;
+		return last_error;
 	}
-	sha256Finish(&hs);
-	writeHashToByteArray(buffer, &hs, true);
-	ripemd160Begin(&hs);
-	for (i = 0; i < 32; i++)
+	if (current_wallet.encrypted.num_addresses == 0)
 	{
-		ripemd160WriteByte(&hs, buffer[i]);
+		last_error = WALLET_EMPTY;
+		return last_error;
+	}
+	// Since num_addresses < BAD_ADDRESS_HANDLE, checking that the last
+	// handle is in range also checks that first_ah + count doesn't
+	// overflow.
+	if ((first_ah == 0) || (count == 0) || (first_ah == BAD_ADDRESS_HANDLE)
+		|| (count > current_wallet.encrypted.num_addresses)
+		|| (first_ah > (current_wallet.encrypted.num_addresses - count + 1)))
+	{
+		last_error = WALLET_INVALID_HANDLE;
+		return last_error;
+	}
+
+	while (count > 0)
+	{
+		chunk_size = count;
+		if (chunk_size > POINT_MULTIPLY_BATCH_SIZE)
+		{
+			chunk_size = POINT_MULTIPLY_BATCH_SIZE;
+		}
+		if (generateDeterministic256Batch(private_keys, current_wallet.encrypted.seed, first_ah, chunk_size))
+		{
+			// This should never happen.
+			memset(private_keys, 0, sizeof(private_keys));
+			last_error = WALLET_RNG_FAILURE;
+			return last_error;
+		}
+		for (i = 0; i < chunk_size; i++)
+		{
+			setToG(&(out_public_keys[i]));
+		}
+		pointMultiplyBatch(out_public_keys, private_keys, chunk_size);
+		memset(private_keys, 0, sizeof(private_keys));
+		for (i = 0; i < chunk_size; i++)
+		{
+			if (publicKeyToAddress(&(out_addresses[i * 20]), &(out_public_keys[i])))
+			{
+				// Somehow, the public ended up as the point at infinity.
+				last_error = WALLET_INVALID_HANDLE;
+				return last_error;
+			}
+		}
+		out_addresses += chunk_size * 20;
+		out_public_keys += chunk_size;
+		first_ah += chunk_size;
+		count -= chunk_size;
 	}
-	ripemd160Finish(&hs);
-	writeHashToByteArray(buffer, &hs, true);
-	memcpy(out_address, buffer, 20);
 
 	last_error = WALLET_NO_ERROR;
 	return last_error;
@@ -916,22 +1331,21 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
   */
 WalletErrors getMasterPublicKey(PointAffine *out_public_key, uint8_t *out_chain_code)
 {
-	uint8_t local_seed[SEED_LENGTH]; // need a local copy to modify
-	BigNum256 k_par;
-
 	if (!wallet_loaded)
 	{
 		last_error = WALLET_NOT_LOADED;
 		return last_error;
 	}
-	memcpy(local_seed, current_wallet.encrypted.seed, SEED_LENGTH);
-	memcpy(out_chain_code, &(local_seed[32]), 32);
-	k_par = (BigNum256)local_seed;
-	swapEndian256(k_par); // since seed is big-endian
-	setFieldToN();
-	bigModulo(k_par, k_par); // just in case
-	setToG(out_public_key);
-	pointMultiply(out_public_key, k_par);
+	memcpy(out_chain_code, &(current_wallet.encrypted.seed[32]), 32);
+	// This reuses the parent public key which the deterministic private key
+	// generator has cached.
+	if (getParentPublicKey(out_public_key, current_wallet.encrypted.seed))
+	{
+		// The parent private key is 0, so the master public key is the
+		// point at infinity.
+		memset(out_public_key, 0, sizeof(PointAffine));
+		out_public_key->is_point_at_infinity = 1;
+	}
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -1025,7 +1439,6 @@ WalletErrors changeEncryptionKey(const uint8_t *password, const unsigned int pas
 		}
 	}
 
-	calculateWalletChecksum(current_wallet.encrypted.checksum);
 	last_error = writeCurrentWalletRecord(wallet_nv_address);
 	return last_error;
 }
@@ -1053,7 +1466,7 @@ WalletErrors changeWalletName(uint8_t *new_name)
 	}
 
 	memcpy(current_wallet.unencrypted.name, new_name, NAME_LENGTH);
-	calculateWalletChecksum(current_wallet.encrypted.checksum);
+	unencrypted_checksum_state_valid = false;
 	last_error = writeCurrentWalletRecord(wallet_nv_address);
 	return last_error;
 }
@@ -1207,6 +1620,8 @@ static uint32_t maximum_address_written[2];
 /** Lowest non-volatile address that nonVolatileWrite() has written to.
   * Index to this array = partition number. */
 static uint32_t minimum_address_written[2];
+/** Number of times nonVolatileFlush() has been called. */
+static uint32_t flush_count;
 #endif // #ifdef TEST_WALLET
 
 /** Get size of a partition.
@@ -1359,6 +1774,9 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
+#ifdef TEST_WALLET
+	flush_count++;
+#endif // #ifdef TEST_WALLET
 	fflush(wallet_test_file);
 	return NV_NO_ERROR;
 }
@@ -1612,6 +2030,32 @@ static void checkWalletSpecFunctions(uint32_t wallet_spec, bool should_succeed)
 	}
 }
 
+/** Calculate the checksum of #current_wallet in the way that firmware which
+  * doesn't know about the address tally does, by hashing everything except
+  * the checksum as it is.
+  * \param hash The resulting SHA-256 hash will be written here. This must
+  *             be a byte array with space for #CHECKSUM_LENGTH bytes.
+  */
+static void calculateOriginalWalletChecksum(uint8_t *hash)
+{
+	HashState hs;
+	uint8_t *ptr;
+	unsigned int i;
+
+	sha256Begin(&hs);
+	ptr = (uint8_t *)&current_wallet;
+	for (i = 0; i < sizeof(WalletRecord); i++)
+	{
+		if ((i < offsetof(WalletRecord, encrypted.checksum))
+			|| (i >= (offsetof(WalletRecord, encrypted.checksum) + CHECKSUM_LENGTH)))
+		{
+			sha256WriteByte(&hs, ptr[i]);
+		}
+	}
+	sha256Finish(&hs);
+	writeHashToByteArray(hash, &hs, true);
+}
+
 const uint8_t test_password0[] = "1234";
 const uint8_t test_password1[] = "ABCDEFGHJ!!!!";
 const uint8_t new_test_password[] = "new password";
@@ -1647,6 +2091,13 @@ int main(void)
 	PointAffine public_key;
 	PointAffine compare_public_key;
 	PointAffine *public_key_buffer;
+	PointAffine batch_public_keys[MAX_TESTING_ADDRESSES * 2];
+	uint8_t batch_addresses[MAX_TESTING_ADDRESSES * 2 * 20];
+	uint32_t flushes_before;
+	uint8_t checksum1[CHECKSUM_LENGTH];
+	uint8_t derived_key[SHA512_HASH_LENGTH];
+	uint8_t derived_key_uuid[UUID_LENGTH];
+	uint8_t checksum2[CHECKSUM_LENGTH];
 	bool abort;
 	bool is_zero;
 	bool abort_duplicate;
@@ -2002,6 +2453,13 @@ int main(void)
 	abort = false;
 	for (i = 0; i < sizeof(WalletRecord); i++)
 	{
+		// Address tally bits which are in the mask aren't covered by the
+		// checksum; the address tally is tested separately below.
+		if ((i >= (int)offsetof(WalletRecord, unencrypted.address_tally))
+			&& (i < ((int)offsetof(WalletRecord, unencrypted.address_tally) + ADDRESS_TALLY_LENGTH)))
+		{
+			continue;
+		}
 		if (nonVolatileRead(&one_byte, PARTITION_ACCOUNTS, (uint32_t)i, 1) != NV_NO_ERROR)
 		{
 			printf("NV read fail\n");
@@ -2176,6 +2634,274 @@ int main(void)
 		reportFailure();
 	}
 
+	// Check that makeNewAddresses() recognises a full wallet too, including
+	// when count is big enough to overflow the number of addresses.
+	if ((makeNewAddresses(1) == BAD_ADDRESS_HANDLE) && (walletGetLastError() == WALLET_FULL)
+		&& (makeNewAddresses(0xffffffff) == BAD_ADDRESS_HANDLE) && (walletGetLastError() == WALLET_FULL))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("makeNewAddresses() doesn't recognise a full wallet\n");
+		reportFailure();
+	}
+
+	// Reserving addresses in one go should give the same addresses as
+	// making them one at a time, and should only commit the wallet record
+	// once. A restored wallet is used, so that the seed is the same both
+	// times.
+	memset(seed1, 0x5a, sizeof(seed1));
+	deleteWallet(0);
+	newWallet(0, name, true, seed1, false, NULL, 0);
+	// Enough addresses are made to use up the address tally, for the address
+	// tally tests below.
+	for (i = 0; i < (ADDRESS_TALLY_BITS + 2); i++)
+	{
+		makeNewAddress(&(batch_addresses[i * 20]), &(batch_public_keys[i]));
+	}
+	deleteWallet(0);
+	newWallet(0, name, true, seed1, false, NULL, 0);
+	if ((makeNewAddresses(0) == BAD_ADDRESS_HANDLE) && (walletGetLastError() == WALLET_INVALID_OPERATION))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("makeNewAddresses() accepts a count of 0\n");
+		reportFailure();
+	}
+	if ((makeNewAddresses(MAX_TESTING_ADDRESSES + 1) == BAD_ADDRESS_HANDLE) && (walletGetLastError() == WALLET_FULL))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("makeNewAddresses() can reserve more addresses than will fit\n");
+		reportFailure();
+	}
+	flushes_before = flush_count;
+	ah = makeNewAddresses(4);
+	if ((ah == 1) && (flush_count == (flushes_before + 1)) && (getNumAddresses() == 4))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("makeNewAddresses() doesn't reserve addresses in one commit\n");
+		reportFailure();
+	}
+	if (makeNewAddress(&(batch_addresses[MAX_TESTING_ADDRESSES * 20 + 4 * 20]), &(batch_public_keys[MAX_TESTING_ADDRESSES + 4])) == 5)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("makeNewAddress() doesn't follow on from makeNewAddresses()\n");
+		reportFailure();
+	}
+	// The reserved addresses should still be there after reloading.
+	uninitWallet();
+	initWallet(0, NULL, 0);
+	if ((getNumAddresses() == 5)
+		&& (getAddressesAndPublicKeys(&(batch_addresses[MAX_TESTING_ADDRESSES * 20]), &(batch_public_keys[MAX_TESTING_ADDRESSES]), 1, 4) == WALLET_NO_ERROR))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Addresses reserved by makeNewAddresses() don't persist\n");
+		reportFailure();
+	}
+	abort = false;
+	for (i = 0; i < 5; i++)
+	{
+		if (memcmp(&(batch_addresses[i * 20]), &(batch_addresses[MAX_TESTING_ADDRESSES * 20 + i * 20]), 20)
+			|| (bigCompare(batch_public_keys[i].x, batch_public_keys[MAX_TESTING_ADDRESSES + i].x) != BIGCMP_EQUAL)
+			|| (bigCompare(batch_public_keys[i].y, batch_public_keys[MAX_TESTING_ADDRESSES + i].y) != BIGCMP_EQUAL))
+		{
+			printf("makeNewAddresses() gives different addresses to makeNewAddress(), ah = %d\n", i + 1);
+			abort = true;
+			reportFailure();
+			break;
+		}
+	}
+	if (!abort)
+	{
+		reportSuccess();
+	}
+
+	// New addresses should be recorded by only writing to the address tally,
+	// until it runs out of bits. Then the whole wallet record should be
+	// rewritten, which restarts the address tally.
+	deleteWallet(0);
+	newWallet(0, name, true, seed1, false, NULL, 0);
+	abort = false;
+	for (i = 0; i < (ADDRESS_TALLY_BITS + 2); i++)
+	{
+		minimum_address_written[PARTITION_ACCOUNTS] = 0xffffffff;
+		maximum_address_written[PARTITION_ACCOUNTS] = 0;
+		if (makeNewAddress(address1, &public_key) == BAD_ADDRESS_HANDLE)
+		{
+			printf("makeNewAddress() fails when using address tally, i = %d\n", i);
+			abort = true;
+			break;
+		}
+		if (i == ADDRESS_TALLY_BITS)
+		{
+			start_address = 0;
+			end_address = sizeof(WalletRecord);
+		}
+		else
+		{
+			start_address = offsetof(WalletRecord, unencrypted.address_tally);
+			end_address = start_address + ADDRESS_TALLY_LENGTH;
+		}
+		if ((minimum_address_written[PARTITION_ACCOUNTS] != start_address)
+			|| (maximum_address_written[PARTITION_ACCOUNTS] != (end_address - 1)))
+		{
+			printf("makeNewAddress() doesn't use address tally properly, i = %d\n", i);
+			abort = true;
+			break;
+		}
+		if (memcmp(address1, &(batch_addresses[i * 20]), 20))
+		{
+			printf("Address tally changes addresses, i = %d\n", i);
+			abort = true;
+			break;
+		}
+	}
+	if (!abort)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		reportFailure();
+	}
+	// Tallied addresses should still be there after reloading.
+	uninitWallet();
+	initWallet(0, NULL, 0);
+	if ((getNumAddresses() == (ADDRESS_TALLY_BITS + 2))
+		&& (getAddressAndPublicKey(address1, &public_key, ADDRESS_TALLY_BITS + 2) == WALLET_NO_ERROR)
+		&& !memcmp(address1, &(batch_addresses[(ADDRESS_TALLY_BITS + 1) * 20]), 20))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Tallied addresses don't persist\n");
+		reportFailure();
+	}
+	// Address tally bits which aren't in the mask are covered by the
+	// checksum, so clearing one should stop the wallet from loading. With
+	// the full address tally, every bit is in the mask.
+#if ADDRESS_TALLY_BITS < (ADDRESS_TALLY_LENGTH * 8)
+	uninitWallet();
+	nonVolatileRead(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally) + ADDRESS_TALLY_LENGTH - 1, 1);
+	one_byte &= 0x7f;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally) + ADDRESS_TALLY_LENGTH - 1, 1);
+	if (initWallet(0, NULL, 0) == WALLET_NOT_THERE)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Address tally bits outside mask aren't covered by checksum\n");
+		reportFailure();
+	}
+	one_byte |= 0x80;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally) + ADDRESS_TALLY_LENGTH - 1, 1);
+#endif // #if ADDRESS_TALLY_BITS < (ADDRESS_TALLY_LENGTH * 8)
+	// Clearing bits which are in the mask should count as new addresses.
+	uninitWallet();
+	nonVolatileRead(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally), 1);
+	one_byte &= 0xfd;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally), 1);
+	initWallet(0, NULL, 0);
+	if (getNumAddresses() == (ADDRESS_TALLY_BITS + 3))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Address tally bits inside mask aren't counted\n");
+		reportFailure();
+	}
+
+	// Until the address tally is used, the checksum should be the same as
+	// the one older firmware calculates, so that older firmware can still
+	// load the wallet.
+	deleteWallet(0);
+	newWallet(0, name, true, seed1, false, NULL, 0);
+	calculateOriginalWalletChecksum(checksum1);
+	if (!memcmp(checksum1, current_wallet.encrypted.checksum, sizeof(checksum1)))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Checksum of new wallet record differs from older firmware\n");
+		reportFailure();
+	}
+	// Wallet records written by older firmware have an all zero mask. Their
+	// address tally bytes could be anything (eg. for hidden wallets, they're
+	// left as random data) and are covered by the checksum. They should
+	// still load, without counting anything from the address tally.
+	memset(current_wallet.unencrypted.address_tally, 0x5a, ADDRESS_TALLY_LENGTH);
+	memset(current_wallet.encrypted.address_tally_mask, 0, ADDRESS_TALLY_LENGTH);
+	current_wallet.encrypted.num_addresses = 2;
+	calculateOriginalWalletChecksum(current_wallet.encrypted.checksum);
+	nonVolatileWrite((uint8_t *)&(current_wallet.unencrypted), PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted), sizeof(current_wallet.unencrypted));
+	encryptedNonVolatileWrite((uint8_t *)&(current_wallet.encrypted), PARTITION_ACCOUNTS, offsetof(WalletRecord, encrypted), sizeof(current_wallet.encrypted));
+	nonVolatileFlush();
+	uninitWallet();
+	if ((initWallet(0, NULL, 0) == WALLET_NO_ERROR) && (getNumAddresses() == 2))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet record written by older firmware doesn't load\n");
+		reportFailure();
+	}
+	// Changing those address tally bytes should be caught by the checksum.
+	uninitWallet();
+	one_byte = 0x5b;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally), 1);
+	if (initWallet(0, NULL, 0) == WALLET_NOT_THERE)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Address tally of older wallet record isn't covered by checksum\n");
+		reportFailure();
+	}
+	one_byte = 0x5a;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.address_tally), 1);
+	initWallet(0, NULL, 0);
+
+	// Using the cached hash state of the unencrypted portion shouldn't
+	// change the wallet checksum, even after the unencrypted portion is
+	// updated.
+	memcpy(name2, "Name which invalidates the hash state   ", NAME_LENGTH);
+	changeWalletName(name2);
+	makeNewAddresses(ADDRESS_TALLY_BITS + 1);
+	calculateWalletChecksum(checksum1);
+	unencrypted_checksum_state_valid = false;
+	calculateWalletChecksum(checksum2);
+	if (unencrypted_checksum_state_valid && !memcmp(checksum1, checksum2, sizeof(checksum1))
+		&& !memcmp(checksum1, current_wallet.encrypted.checksum, sizeof(checksum1)))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Cached hash state gives wrong wallet checksum\n");
+		reportFailure();
+	}
+
 	// Check that getNumAddresses() fails when the wallet is empty.
 	deleteWallet(0);
 	newWallet(0, name, false, NULL, false, NULL, 0);
@@ -2328,6 +3054,58 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Check that getAddressesAndPublicKeys() obtains the same addresses and
+	// public keys as makeNewAddress(), for the whole wallet and for part of
+	// it.
+	abort = false;
+	if ((getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 1, MAX_TESTING_ADDRESSES) != WALLET_NO_ERROR)
+		|| (getAddressesAndPublicKeys(&(batch_addresses[MAX_TESTING_ADDRESSES * 20]), &(batch_public_keys[MAX_TESTING_ADDRESSES]), 3, MAX_TESTING_ADDRESSES - 2) != WALLET_NO_ERROR))
+	{
+		printf("getAddressesAndPublicKeys() fails on valid range\n");
+		abort = true;
+	}
+	for (i = 0; !abort && (i < (2 * MAX_TESTING_ADDRESSES - 2)); i++)
+	{
+		if (i < MAX_TESTING_ADDRESSES)
+		{
+			j = i;
+		}
+		else
+		{
+			j = i - MAX_TESTING_ADDRESSES + 2;
+		}
+		if ((handles_buffer[j] != (AddressHandle)(j + 1))
+			|| memcmp(&(batch_addresses[i * 20]), &(address_buffer[j * 20]), 20)
+			|| (bigCompare(batch_public_keys[i].x, public_key_buffer[j].x) != BIGCMP_EQUAL)
+			|| (bigCompare(batch_public_keys[i].y, public_key_buffer[j].y) != BIGCMP_EQUAL))
+		{
+			printf("getAddressesAndPublicKeys() returned mismatching address or public key, i = %d\n", i);
+			abort = true;
+		}
+	}
+	if (abort)
+	{
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	if ((getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 0, 1) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 1, 0) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 2, MAX_TESTING_ADDRESSES) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, MAX_TESTING_ADDRESSES + 1, 1) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, BAD_ADDRESS_HANDLE, 1) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 2, BAD_ADDRESS_HANDLE) == WALLET_INVALID_HANDLE))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("getAddressesAndPublicKeys() doesn't recognise invalid ranges\n");
+		reportFailure();
+	}
+
 	// Test getAddressAndPublicKey() and getPrivateKey() functions using
 	// invalid and then valid address handles.
 	if (getAddressAndPublicKey(temp, &public_key, 0) == WALLET_INVALID_HANDLE)
@@ -3051,6 +3829,31 @@ int main(void)
 	}
 	uninitWallet();
 
+	// initWalletWithKey() should accept the key which initWallet() derives,
+	// and nothing else.
+	getWalletInfo(&version, compare_name, derived_key_uuid, 1);
+	pbkdf2(derived_key, test_password1, sizeof(test_password1), derived_key_uuid, UUID_LENGTH);
+	if (initWalletWithKey(1, derived_key) == WALLET_NO_ERROR)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Cannot load wallet 1 with derived key\n");
+		reportFailure();
+	}
+	derived_key[WALLET_ENCRYPTION_KEY_LENGTH - 1] ^= 1;
+	if (initWalletWithKey(1, derived_key) == WALLET_NOT_THERE)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet 1 loads with wrong derived key\n");
+		reportFailure();
+	}
+	uninitWallet();
+
 	// Change wallet 1's key and check that it doesn't change wallet 0.
 	initWallet(1, test_password1, sizeof(test_password1));
 	changeEncryptionKey(new_test_password, sizeof(new_test_password));
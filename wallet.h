@@ -85,11 +85,16 @@ typedef enum WalletErrorsEnum
 extern WalletErrors walletGetLastError(void);
 extern WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const unsigned int password_length);
 extern WalletErrors uninitWallet(void);
+#if defined(TEST_WALLET) || defined(KEY_RECOVERY)
+extern WalletErrors initWalletWithKey(uint32_t wallet_spec, const uint8_t *derived_key);
+#endif // #if defined(TEST_WALLET) || defined(KEY_RECOVERY)
 extern WalletErrors sanitiseEverything(void);
 extern WalletErrors deleteWallet(uint32_t wallet_spec);
 extern WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8_t *seed, bool make_hidden, const uint8_t *password, const unsigned int password_length);
+extern AddressHandle makeNewAddresses(uint32_t count);
 extern AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key);
 extern WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_public_key, AddressHandle ah);
+extern WalletErrors getAddressesAndPublicKeys(uint8_t *out_addresses, PointAffine *out_public_keys, AddressHandle first_ah, uint32_t count);
 extern WalletErrors getMasterPublicKey(PointAffine *out_public_key, uint8_t *out_chain_code);
 extern uint32_t getNumAddresses(void);
 extern WalletErrors getPrivateKey(uint8_t *out, AddressHandle ah);
@@ -0,0 +1,720 @@
+/** \file wallet_audit.c
+  *
+  * \brief Verify the wallets in many non-volatile storage images.
+  *
+  * This takes a list of images of the accounts partition of non-volatile
+  * storage (for example, dumps from many devices) and a password. For every
+  * wallet record in every image, it tries to load the wallet using wallet.c,
+  * which decrypts the record and checks its checksum. For each wallet which
+  * loads, the HASH160 of the first few addresses is calculated. The results
+  * are written to stdout as a machine-readable report, with one line (a JSON
+  * object) per wallet record.
+  *
+  * The work is split into items, each of which is one range of addresses
+  * of one wallet. Items are handed out to a pool of worker processes (one per
+  * core, by default) through a counter in shared memory, so a worker which
+  * finishes early just takes the next item. Each worker keeps a wallet
+  * loaded for as long as its items come from that wallet, so a wallet is
+  * loaded at most once per worker. Processes are used instead of
+  * threads because wallet.c, xex.c and bignum256.c all keep state in global
+  * variables. Results are also written to shared memory, and the main
+  * process prints them in order once a batch of images is finished.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../ecdsa.h"
+#include "../storage_common.h"
+#include "../wallet.h"
+
+/** Maximum size, in bytes, of the accounts partition. */
+#define MAX_PARTITION_SIZE		(1024 * 1024)
+/** Number of addresses in each work item. Workers don't reload the wallet
+  * for each item (see worker()), so this only needs to be big enough that
+  * handing out items is cheap. */
+#define ADDRESSES_PER_ITEM		64
+/** Number of images whose results are held in shared memory at once. */
+#define IMAGES_PER_BATCH		64
+/** Default number of addresses to calculate for each wallet. */
+#define DEFAULT_NUM_ADDRESSES	20
+/** Default number of PBKDF2 iterations. This is what every port currently
+  * uses (see getPBKDF2Iterations() in pic32/main.c, for example). */
+#define DEFAULT_ITERATIONS		128
+
+/** Outcome of auditing one wallet record. These are in order of increasing
+  * severity. If the work items of one wallet record have different
+  * outcomes, the most severe one is reported (see mergeStatus()). */
+typedef enum AuditStatusEnum
+{
+	/** The wallet loaded, so its checksum is correct. */
+	AUDIT_OK					= 0,
+	/** The version field says there's no wallet, and it doesn't load as a
+	  * hidden wallet with the given password. */
+	AUDIT_EMPTY					= 1,
+	/** The version field says there's a wallet, but it doesn't load. Either
+	  * the password is wrong or the record is corrupted. */
+	AUDIT_WRONG_KEY				= 2,
+	/** The version field has an unknown value. */
+	AUDIT_INVALID_VERSION		= 3,
+	/** The image couldn't be read, or is too short. */
+	AUDIT_READ_ERROR			= 4,
+	/** Some other wallet error occurred. */
+	AUDIT_ERROR					= 5
+} AuditStatus;
+
+/** Names of each #AuditStatus, as they appear in the report. */
+static const char *status_names[] = {"ok", "empty", "wrong_key", "invalid_version", "read_error", "error"};
+
+/** Results for one wallet record. */
+typedef struct WalletReportStruct
+{
+	/** See #AuditStatusEnum. */
+	uint32_t status;
+	/** Contents of the version field. */
+	uint32_t version;
+	/** Number of addresses in the wallet (only valid if status
+	  * is #AUDIT_OK). */
+	uint32_t num_addresses;
+	/** Wallet name. */
+	uint8_t name[NAME_LENGTH];
+	/** Wallet UUID. */
+	uint8_t uuid[UUID_LENGTH];
+} WalletReport;
+
+/** Everything which the worker processes share with the main process. */
+typedef struct SharedStateStruct
+{
+	/** Index of the next work item to hand out. */
+	uint32_t next_item;
+	/** Results for each wallet record in the current batch. The wallet
+	  * records of each image are consecutive. These must be cleared before
+	  * each batch, so that WalletReport#status starts as #AUDIT_OK. */
+	WalletReport *reports;
+	/** HASH160 of the first addresses of each wallet record, in the same
+	  * order as SharedState#reports. Each wallet record has space for
+	  * #num_addresses_wanted addresses. */
+	uint8_t *hash160s;
+} SharedState;
+
+/** Contents of the accounts partition. */
+static uint8_t accounts_partition[MAX_PARTITION_SIZE];
+/** Size, in bytes, of the accounts partition. Every image must have the
+  * same size, since wallet.c caches the number of wallets. */
+static uint32_t accounts_partition_size;
+/** What getPBKDF2Iterations() returns. */
+static uint32_t pbkdf2_iterations;
+/** Number of addresses to calculate for each wallet. */
+static uint32_t num_addresses_wanted;
+/** Number of work items for each wallet record. */
+static uint32_t items_per_wallet;
+/** Number of wallet records in each image. */
+static uint32_t wallets_per_image;
+
+/** Get the current time, in nanoseconds.
+  * \return The current time.
+  */
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1.0e9 + (double)t.tv_nsec;
+}
+
+/** Get size of a partition. Only the accounts partition exists.
+  * \param out_size On success, the size of the partition (in number of bytes)
+  *                 will be written here.
+  * \param partition Partition to query. Must be one of #NVPartitions.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
+{
+	if (partition != PARTITION_ACCOUNTS)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	*out_size = accounts_partition_size;
+	return NV_NO_ERROR;
+}
+
+/** Images are never modified, so writes always fail.
+  * \param data Ignored.
+  * \param partition Ignored.
+  * \param address Ignored.
+  * \param length Ignored.
+  * \return Always #NV_INVALID_ADDRESS.
+  */
+NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	(void)data;
+	(void)partition;
+	(void)address;
+	(void)length;
+	return NV_INVALID_ADDRESS;
+}
+
+/** Read from the currently loaded image.
+  * \param data A pointer to the buffer which will receive the data.
+  * \param partition The partition to read from. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start reading from.
+  * \param length The number of bytes to read.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	if ((partition != PARTITION_ACCOUNTS) || (address > accounts_partition_size)
+		|| (length > (accounts_partition_size - address)))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	memcpy(data, &(accounts_partition[address]), length);
+	return NV_NO_ERROR;
+}
+
+/** Nothing is buffered, so there is nothing to flush.
+  * \return Always #NV_NO_ERROR.
+  */
+NonVolatileReturn nonVolatileFlush(void)
+{
+	return NV_NO_ERROR;
+}
+
+/** Random numbers are never needed to load a wallet.
+  * \param buffer Ignored.
+  * \return Always -1 (failure).
+  */
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	(void)buffer;
+	return -1;
+}
+
+/** Number of PBKDF2 iterations to use when deriving wallet encryption keys.
+  * \return Number of iterations.
+  */
+uint32_t getPBKDF2Iterations(void)
+{
+	return pbkdf2_iterations;
+}
+
+/** Backups aren't used.
+  * \param seed Ignored.
+  * \param is_encrypted Ignored.
+  * \param destination_device Ignored.
+  * \return Always true (failure).
+  */
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	(void)seed;
+	(void)is_encrypted;
+	(void)destination_device;
+	return true;
+}
+
+/** Something went badly wrong. */
+void fatalError(void)
+{
+	printf("fatalError() called\n");
+	exit(1);
+}
+
+/** Print command-line usage information.
+  * \param program_name The name of this program.
+  */
+static void usage(const char *program_name)
+{
+	printf("Usage: %s [-p <password>] [-n <addresses>] [-i <iterations>] [-j <jobs>]\n", program_name);
+	printf("       [-o <offset>] [-s <size>] <image> [<image> ...]\n");
+	printf("Each <image> contains the accounts partition of one device.\n");
+	printf("  -p   Password for encrypted wallets (default: none).\n");
+	printf("  -n   Number of addresses to calculate for each wallet (default: %d).\n", DEFAULT_NUM_ADDRESSES);
+	printf("  -i   Number of PBKDF2 iterations (default: %d).\n", DEFAULT_ITERATIONS);
+	printf("  -j   Number of worker processes (default: number of cores).\n");
+	printf("  -o   Offset of the accounts partition within each image (default: 0).\n");
+	printf("  -s   Size of the accounts partition (default: rest of first image).\n");
+}
+
+/** Load the accounts partition from an image into #accounts_partition.
+  * \param filename The image file.
+  * \param offset Offset of the accounts partition within the file.
+  * \param size Expected size of the accounts partition. If this is 0, the
+  *             rest of the file (up to #MAX_PARTITION_SIZE) is used.
+  * \return The number of bytes read, or 0 if the file couldn't be read or
+  *         was too short.
+  */
+static uint32_t loadImage(const char *filename, long offset, uint32_t size)
+{
+	FILE *f;
+	size_t got;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		return 0;
+	}
+	if (fseek(f, offset, SEEK_SET) != 0)
+	{
+		fclose(f);
+		return 0;
+	}
+	if (size == 0)
+	{
+		size = MAX_PARTITION_SIZE;
+	}
+	got = fread(accounts_partition, 1, size, f);
+	fclose(f);
+	if ((got == 0) || ((size != MAX_PARTITION_SIZE) && (got != size)))
+	{
+		return 0;
+	}
+	return (uint32_t)got;
+}
+
+/** Load a wallet from the currently loaded image.
+  * \param report Where to write the results for the wallet record.
+  * \param wallet_spec The wallet number of the wallet.
+  * \param password Password for encrypted wallets.
+  * \param image_ok Whether the image was loaded successfully.
+  */
+static void loadWallet(WalletReport *report, uint32_t wallet_spec, const char *password, bool image_ok)
+{
+	WalletErrors r;
+
+	memset(report, 0, sizeof(*report));
+	if (!image_ok)
+	{
+		report->status = AUDIT_READ_ERROR;
+	}
+	else if (getWalletInfo(&(report->version), report->name, report->uuid, wallet_spec) != WALLET_NO_ERROR)
+	{
+		report->status = AUDIT_ERROR;
+	}
+	else if ((report->version != VERSION_NOTHING_THERE)
+		&& (report->version != VERSION_UNENCRYPTED)
+		&& (report->version != VERSION_IS_ENCRYPTED))
+	{
+		report->status = AUDIT_INVALID_VERSION;
+	}
+	else
+	{
+		if (report->version == VERSION_UNENCRYPTED)
+		{
+			r = initWallet(wallet_spec, NULL, 0);
+		}
+		else
+		{
+			// Hidden wallets have no version, so they are always tried with
+			// the password.
+			r = initWallet(wallet_spec, (const uint8_t *)password, (unsigned int)strlen(password));
+		}
+		if (r == WALLET_NO_ERROR)
+		{
+			report->status = AUDIT_OK;
+			report->num_addresses = getNumAddresses();
+		}
+		else if (r == WALLET_NOT_THERE)
+		{
+			if (report->version == VERSION_NOTHING_THERE)
+			{
+				report->status = AUDIT_EMPTY;
+			}
+			else
+			{
+				report->status = AUDIT_WRONG_KEY;
+			}
+		}
+		else
+		{
+			report->status = AUDIT_ERROR;
+		}
+	}
+}
+
+/** Do one work item: calculate a range of the addresses of the currently
+  * loaded wallet.
+  * \param hash160s Where to write the HASH160 of the wallet's addresses.
+  *                 This must have space for #num_addresses_wanted of them.
+  * \param num_addresses Number of addresses in the wallet.
+  * \param item_in_wallet Which range of addresses to calculate.
+  * \return #AUDIT_OK on success, or #AUDIT_ERROR if an error occurred.
+  */
+static AuditStatus auditAddresses(uint8_t *hash160s, uint32_t num_addresses, uint32_t item_in_wallet)
+{
+	PointAffine public_keys[ADDRESSES_PER_ITEM];
+	uint32_t first;
+	uint32_t count;
+
+	// Addresses beyond the number of addresses in the wallet have never
+	// been given out, so they aren't calculated.
+	first = item_in_wallet * ADDRESSES_PER_ITEM;
+	count = num_addresses_wanted;
+	if (num_addresses < count)
+	{
+		count = num_addresses;
+	}
+	if (first < count)
+	{
+		count -= first;
+		if (count > ADDRESSES_PER_ITEM)
+		{
+			count = ADDRESSES_PER_ITEM;
+		}
+		if (getAddressesAndPublicKeys(&(hash160s[first * 20]), public_keys, first + 1, count) != WALLET_NO_ERROR)
+		{
+			return AUDIT_ERROR;
+		}
+	}
+	return AUDIT_OK;
+}
+
+/** Combine the outcome of one work item with the status of its wallet
+  * record, keeping whichever is more severe. The work items of a wallet
+  * record can be done by different workers at the same time, so this is
+  * atomic.
+  * \param status The status of the wallet record, in shared memory.
+  * \param item_status The outcome of the work item. See #AuditStatusEnum.
+  */
+static void mergeStatus(uint32_t *status, uint32_t item_status)
+{
+	uint32_t old_status;
+
+	do
+	{
+		old_status = *status;
+		if (item_status <= old_status)
+		{
+			return;
+		}
+	} while (__sync_val_compare_and_swap(status, old_status, item_status) != old_status);
+}
+
+/** Worker process: take work items from the shared counter until there
+  * are none left. Each work item is one range of addresses, but loading a
+  * wallet (mainly PBKDF2 and one point multiplication) costs much more than
+  * calculating a range of addresses, so the most recently loaded wallet is
+  * kept loaded until an item from another wallet comes along.
+  * \param shared The shared state.
+  * \param filenames The images in this batch.
+  * \param num_images The number of images in this batch.
+  * \param offset Offset of the accounts partition within each image.
+  * \param password Password for encrypted wallets.
+  */
+static void worker(SharedState *shared, char **filenames, uint32_t num_images, long offset, const char *password)
+{
+	uint32_t item;
+	uint32_t total_wallets;
+	uint32_t image;
+	uint32_t loaded_image;
+	uint32_t wallet_index;
+	uint32_t loaded_wallet;
+	uint32_t item_in_wallet;
+	uint32_t item_status;
+	bool image_ok;
+	WalletReport *report;
+	WalletReport loaded_report;
+
+	total_wallets = num_images * wallets_per_image;
+	loaded_image = num_images; // i.e. none
+	loaded_wallet = total_wallets; // i.e. none
+	image_ok = false;
+	memset(&loaded_report, 0, sizeof(loaded_report));
+	while ((item = __sync_fetch_and_add(&(shared->next_item), 1)) < (total_wallets * items_per_wallet))
+	{
+		wallet_index = item / items_per_wallet;
+		item_in_wallet = item % items_per_wallet;
+		if (wallet_index != loaded_wallet)
+		{
+			uninitWallet();
+			image = wallet_index / wallets_per_image;
+			if (image != loaded_image)
+			{
+				image_ok = (loadImage(filenames[image], offset, accounts_partition_size) != 0);
+				loaded_image = image;
+			}
+			loadWallet(&loaded_report, wallet_index % wallets_per_image, password, image_ok);
+			loaded_wallet = wallet_index;
+		}
+
+		item_status = loaded_report.status;
+		if (item_status == AUDIT_OK)
+		{
+			item_status = auditAddresses(
+				&(shared->hash160s[wallet_index * num_addresses_wanted * 20]),
+				loaded_report.num_addresses,
+				item_in_wallet);
+		}
+		// Only the first item of each wallet record writes the rest of the
+		// report, since every item sees the same wallet record.
+		report = &(shared->reports[wallet_index]);
+		if (item_in_wallet == 0)
+		{
+			report->version = loaded_report.version;
+			report->num_addresses = loaded_report.num_addresses;
+			memcpy(report->name, loaded_report.name, NAME_LENGTH);
+			memcpy(report->uuid, loaded_report.uuid, UUID_LENGTH);
+		}
+		mergeStatus(&(report->status), item_status);
+	}
+	uninitWallet();
+}
+
+/** Write a byte array as a JSON string of hexadecimal digits.
+  * \param data The byte array.
+  * \param length Length of the byte array, in bytes.
+  */
+static void printHex(const uint8_t *data, uint32_t length)
+{
+	uint32_t i;
+
+	putchar('"');
+	for (i = 0; i < length; i++)
+	{
+		printf("%02x", data[i]);
+	}
+	putchar('"');
+}
+
+/** Write a byte array as a JSON string, escaping anything which isn't
+  * printable ASCII.
+  * \param data The byte array.
+  * \param length Length of the byte array, in bytes.
+  */
+static void printJSONString(const uint8_t *data, uint32_t length)
+{
+	uint32_t i;
+
+	putchar('"');
+	for (i = 0; i < length; i++)
+	{
+		if ((data[i] < 0x20) || (data[i] >= 0x7f) || (data[i] == '"') || (data[i] == '\\'))
+		{
+			printf("\\u%04x", data[i]);
+		}
+		else
+		{
+			putchar(data[i]);
+		}
+	}
+	putchar('"');
+}
+
+/** Write the report line for one wallet record.
+  * \param filename The image the wallet record came from.
+  * \param wallet_spec The wallet number of the wallet record.
+  * \param report Results for the wallet record.
+  * \param hash160s HASH160 of the wallet's addresses.
+  * \return The number of addresses written.
+  */
+static uint32_t printReport(const char *filename, uint32_t wallet_spec, const WalletReport *report, const uint8_t *hash160s)
+{
+	uint32_t i;
+	uint32_t count;
+
+	printf("{\"image\":");
+	printJSONString((const uint8_t *)filename, (uint32_t)strlen(filename));
+	printf(",\"wallet\":%u,\"status\":\"%s\"", wallet_spec, status_names[report->status]);
+	count = 0;
+	if ((report->status == AUDIT_EMPTY) || (report->status == AUDIT_INVALID_VERSION))
+	{
+		printf(",\"version\":%u", report->version);
+	}
+	else if ((report->status == AUDIT_OK) || (report->status == AUDIT_WRONG_KEY))
+	{
+		// The name and UUID of empty records are random junk, so they are
+		// only written for records which contain a wallet.
+		printf(",\"version\":%u,\"name\":", report->version);
+		printJSONString(report->name, NAME_LENGTH);
+		printf(",\"uuid\":");
+		printHex(report->uuid, UUID_LENGTH);
+	}
+	if (report->status == AUDIT_OK)
+	{
+		printf(",\"hidden\":%s,\"num_addresses\":%u,\"hash160\":[",
+			(report->version == VERSION_NOTHING_THERE) ? "true" : "false", report->num_addresses);
+		count = num_addresses_wanted;
+		if (report->num_addresses < count)
+		{
+			count = report->num_addresses;
+		}
+		for (i = 0; i < count; i++)
+		{
+			if (i != 0)
+			{
+				putchar(',');
+			}
+			printHex(&(hash160s[i * 20]), 20);
+		}
+		putchar(']');
+	}
+	printf("}\n");
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	const char *password;
+	long num_jobs;
+	long offset;
+	int i;
+	int first_image;
+	uint32_t num_images;
+	uint32_t batch_start;
+	uint32_t batch_size;
+	uint32_t j;
+	uint32_t k;
+	uint32_t wallets_ok;
+	uint32_t addresses_calculated;
+	long job;
+	pid_t pid;
+	SharedState *shared;
+	size_t reports_size;
+	size_t hash160s_size;
+	double start;
+
+	password = "";
+	num_addresses_wanted = DEFAULT_NUM_ADDRESSES;
+	pbkdf2_iterations = DEFAULT_ITERATIONS;
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	offset = 0;
+	accounts_partition_size = 0;
+	for (i = 1; (i + 1) < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-p"))
+		{
+			password = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			num_addresses_wanted = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-i"))
+		{
+			pbkdf2_iterations = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-j"))
+		{
+			num_jobs = strtol(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-o"))
+		{
+			offset = strtol(argv[i + 1], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-s"))
+		{
+			accounts_partition_size = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+		else
+		{
+			break;
+		}
+	}
+	first_image = i;
+	if ((first_image >= argc) || (accounts_partition_size > MAX_PARTITION_SIZE) || (num_addresses_wanted > 0x100000))
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+	if (num_jobs < 1)
+	{
+		num_jobs = 1;
+	}
+	num_images = (uint32_t)(argc - first_image);
+
+	// The first image determines the partition size, if it wasn't
+	// specified.
+	if (accounts_partition_size == 0)
+	{
+		accounts_partition_size = loadImage(argv[first_image], offset, 0);
+		if (accounts_partition_size == 0)
+		{
+			fprintf(stderr, "Could not read \"%s\"\n", argv[first_image]);
+			exit(1);
+		}
+	}
+	wallets_per_image = getNumberOfWallets();
+	if (wallets_per_image == 0)
+	{
+		fprintf(stderr, "Accounts partition is too small to contain a wallet\n");
+		exit(1);
+	}
+	items_per_wallet = (num_addresses_wanted + ADDRESSES_PER_ITEM - 1) / ADDRESSES_PER_ITEM;
+	if (items_per_wallet == 0)
+	{
+		items_per_wallet = 1;
+	}
+
+	reports_size = (size_t)IMAGES_PER_BATCH * wallets_per_image * sizeof(WalletReport);
+	hash160s_size = (size_t)IMAGES_PER_BATCH * wallets_per_image * num_addresses_wanted * 20;
+	shared = mmap(NULL, sizeof(SharedState) + reports_size + hash160s_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+	{
+		fprintf(stderr, "Could not allocate shared memory\n");
+		exit(1);
+	}
+	shared->reports = (WalletReport *)&(shared[1]);
+	shared->hash160s = (uint8_t *)&(shared->reports[IMAGES_PER_BATCH * wallets_per_image]);
+
+	start = now();
+	wallets_ok = 0;
+	addresses_calculated = 0;
+	for (batch_start = 0; batch_start < num_images; batch_start += batch_size)
+	{
+		batch_size = num_images - batch_start;
+		if (batch_size > IMAGES_PER_BATCH)
+		{
+			batch_size = IMAGES_PER_BATCH;
+		}
+		shared->next_item = 0;
+		memset(shared->reports, 0, reports_size);
+		fflush(stdout);
+		for (job = 0; job < num_jobs; job++)
+		{
+			pid = fork();
+			if (pid < 0)
+			{
+				fprintf(stderr, "Could not start worker process\n");
+				exit(1);
+			}
+			if (pid == 0)
+			{
+				worker(shared, &(argv[first_image + batch_start]), batch_size, offset, password);
+				_exit(0);
+			}
+		}
+		while (wait(NULL) > 0)
+		{
+			// Wait for every worker.
+		}
+
+		for (j = 0; j < batch_size; j++)
+		{
+			for (k = 0; k < wallets_per_image; k++)
+			{
+				if (shared->reports[j * wallets_per_image + k].status == AUDIT_OK)
+				{
+					wallets_ok++;
+				}
+				addresses_calculated += printReport(
+					argv[first_image + batch_start + j],
+					k,
+					&(shared->reports[j * wallets_per_image + k]),
+					&(shared->hash160s[(j * wallets_per_image + k) * num_addresses_wanted * 20]));
+			}
+		}
+	}
+	fflush(stdout);
+	fprintf(stderr, "Audited %u images (%u wallets loaded, %u addresses) in %.3f s using %ld processes\n",
+		num_images, wallets_ok, addresses_calculated, (now() - start) / 1.0e9, num_jobs);
+	exit(0);
+}